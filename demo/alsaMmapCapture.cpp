@@ -0,0 +1,354 @@
+#include <string.h>
+#include <unistd.h>
+#include <algorithm>
+#include <chrono>
+
+#include "alsaMmapCapture.hpp"
+
+#define CAPTURE_DEFAULT_BUFFER_COUNT 8
+#define CAPTURE_WAIT_TIMEOUT_MS 100
+#define CAPTURE_MIN_SLEEP_US 1000
+
+static int64_t steadyClockUs()
+{
+    return std::chrono::duration_cast<std::chrono::microseconds>(
+               std::chrono::steady_clock::now().time_since_epoch())
+        .count();
+}
+
+ModuleAlsaMmapCapture::ModuleAlsaMmapCapture(const std::string& dev, const SampleInfo& info)
+    : ModuleMedia("AlsaMmapCapture"), device(dev), sample_info(info), pcm(nullptr), format(SND_PCM_FORMAT_UNKNOWN),
+      frame_bytes(0), period_size(0), ring_size(0), zero_copy(true), held_frames(0), clock_base(0), clock_frames(0),
+      stats(), published()
+{
+    media_type = BUFFER_TYPE_AUDIO;
+}
+
+ModuleAlsaMmapCapture::~ModuleAlsaMmapCapture()
+{
+    if (pcm)
+        snd_pcm_close(pcm);
+}
+
+int ModuleAlsaMmapCapture::init()
+{
+    switch (sample_info.fmt) {
+        case SAMPLE_FMT_U8: format = SND_PCM_FORMAT_U8; break;
+        case SAMPLE_FMT_S16: format = SND_PCM_FORMAT_S16_LE; break;
+        case SAMPLE_FMT_S32: format = SND_PCM_FORMAT_S32_LE; break;
+        case SAMPLE_FMT_FLT: format = SND_PCM_FORMAT_FLOAT_LE; break;
+        default:
+            ff_error("Alsa mmap capture only supports interleaved U8, S16, S32 and FLT samples\n");
+            return -1;
+    }
+    if (sample_info.nb_samples <= 0 || sample_info.channels <= 0 || sample_info.sample_rate <= 0) {
+        ff_error("Alsa mmap capture: invalid sample info\n");
+        return -1;
+    }
+    frame_bytes = snd_pcm_format_physical_width(format) / 8 * sample_info.channels;
+
+    if (buffer_count == 0)
+        buffer_count = CAPTURE_DEFAULT_BUFFER_COUNT;
+    if (configure() < 0) {
+        if (pcm)
+            snd_pcm_close(pcm);
+        pcm = nullptr;
+        return -1;
+    }
+
+    int ret = initBuffer();
+    if (ret < 0) {
+        ff_error("Alsa mmap capture buffer init failed\n");
+        return ret;
+    }
+
+    initialize = true;
+    return 0;
+}
+
+int ModuleAlsaMmapCapture::configure()
+{
+    int ret = snd_pcm_open(&pcm, device.c_str(), SND_PCM_STREAM_CAPTURE, 0);
+    if (ret < 0) {
+        ff_error("Failed to open capture device %s: %s\n", device.c_str(), snd_strerror(ret));
+        return -1;
+    }
+
+    snd_pcm_hw_params_t* hw;
+    snd_pcm_hw_params_alloca(&hw);
+    snd_pcm_hw_params_any(pcm, hw);
+    ret = snd_pcm_hw_params_set_access(pcm, hw, SND_PCM_ACCESS_MMAP_INTERLEAVED);
+    if (ret < 0) {
+        ff_error("Capture device %s has no interleaved mmap access (%s), try it through plughw: or plug:\n",
+                 device.c_str(), snd_strerror(ret));
+        return -1;
+    }
+    ret = snd_pcm_hw_params_set_format(pcm, hw, format);
+    if (ret < 0) {
+        ff_error("Capture device %s: format %s: %s\n", device.c_str(), snd_pcm_format_name(format), snd_strerror(ret));
+        return -1;
+    }
+    ret = snd_pcm_hw_params_set_channels(pcm, hw, sample_info.channels);
+    if (ret < 0) {
+        ff_error("Capture device %s: %d channels: %s\n", device.c_str(), sample_info.channels, snd_strerror(ret));
+        return -1;
+    }
+    // The timestamps and the encoders count on the exact rate.
+    unsigned rate = sample_info.sample_rate;
+    ret = snd_pcm_hw_params_set_rate_near(pcm, hw, &rate, nullptr);
+    if (ret < 0 || rate != (unsigned)sample_info.sample_rate) {
+        ff_error("Capture device %s does not support %d Hz\n", device.c_str(), sample_info.sample_rate);
+        return -1;
+    }
+
+    snd_pcm_uframes_t buffer_frames = sample_info.nb_samples;
+    if (period_size == 0)
+        period_size = buffer_frames;
+    if (ring_size == 0)
+        ring_size = buffer_frames * (buffer_count + 2);
+    int dir = 0;
+    snd_pcm_hw_params_set_period_size_near(pcm, hw, &period_size, &dir);
+    snd_pcm_hw_params_set_buffer_size_near(pcm, hw, &ring_size);
+    ret = snd_pcm_hw_params(pcm, hw);
+    if (ret < 0) {
+        ff_error("Capture device %s: hw params: %s\n", device.c_str(), snd_strerror(ret));
+        return -1;
+    }
+    snd_pcm_hw_params_get_period_size(hw, &period_size, &dir);
+    snd_pcm_hw_params_get_buffer_size(hw, &ring_size);
+    if (ring_size < buffer_frames * 2) {
+        ff_error("Capture device %s: a ring of %lu frames can not hold two buffers of %lu\n", device.c_str(),
+                 ring_size, buffer_frames);
+        return -1;
+    }
+
+    // Woken once per buffer, however many periods it takes.
+    snd_pcm_sw_params_t* sw;
+    snd_pcm_sw_params_alloca(&sw);
+    snd_pcm_sw_params_current(pcm, sw);
+    snd_pcm_sw_params_set_avail_min(pcm, sw, buffer_frames);
+    ret = snd_pcm_sw_params(pcm, sw);
+    if (ret < 0) {
+        ff_error("Capture device %s: sw params: %s\n", device.c_str(), snd_strerror(ret));
+        return -1;
+    }
+
+    ff_info("Alsa mmap capture %s: %d Hz, %d channels, period %lu, ring %lu, %lu frames per buffer\n",
+            device.c_str(), sample_info.sample_rate, sample_info.channels, period_size, ring_size, buffer_frames);
+    return 0;
+}
+
+/// @brief Each buffer owns room for nb_samples frames, used when it can not point into the ring
+int ModuleAlsaMmapCapture::initBuffer()
+{
+    buffer_pool.clear();
+    buffer_ptr_queue.clear();
+    for (uint16_t i = 0; i < buffer_count; i++) {
+        shared_ptr<MediaBuffer> buffer = make_shared<MediaBuffer>(0);
+        buffer->allocBuffer(sample_info.nb_samples * frame_bytes);
+        if (buffer->getData() == nullptr)
+            return -1;
+        buffer->setIndex(i);
+        buffer->setMediaBufferType(BUFFER_TYPE_AUDIO);
+        buffer_pool.push_back(buffer);
+        buffer_ptr_queue.push_back(buffer);
+    }
+    released.assign(buffer_count, false);
+    return 0;
+}
+
+bool ModuleAlsaMmapCapture::setup()
+{
+    return startDevice() == 0;
+}
+
+bool ModuleAlsaMmapCapture::teardown()
+{
+    snd_pcm_drop(pcm);
+    regions.clear();
+    held_frames = 0;
+    return true;
+}
+
+/// @brief (Re)starts capturing into an empty ring, the regions still held are forgotten
+int ModuleAlsaMmapCapture::startDevice()
+{
+    regions.clear();
+    held_frames = 0;
+
+    snd_pcm_drop(pcm);
+    int ret = snd_pcm_prepare(pcm);
+    if (ret == 0)
+        ret = snd_pcm_start(pcm);
+    if (ret < 0) {
+        ff_error("Failed to start capture device %s: %s\n", device.c_str(), snd_strerror(ret));
+        return -1;
+    }
+    clock_base = steadyClockUs();
+    clock_frames = stats.frames;
+    return 0;
+}
+
+int ModuleAlsaMmapCapture::recover(int err)
+{
+    if (err == -EPIPE) {
+        stats.xruns++;
+        ff_warn("Alsa mmap capture %s: overrun with %lu frames held\n", device.c_str(), held_frames);
+    } else if (err == -ESTRPIPE) {
+        stats.suspends++;
+        ff_warn("Alsa mmap capture %s: suspended\n", device.c_str());
+    }
+
+    int ret = snd_pcm_recover(pcm, err, 1);
+    if (ret < 0) {
+        ff_error("Alsa mmap capture %s: %s\n", device.c_str(), snd_strerror(err));
+        return -1;
+    }
+    stats.recoveries++;
+    return startDevice();
+}
+
+/// @brief Gives the device back the frames of the released buffers at the head of the ring
+int ModuleAlsaMmapCapture::commitReleased()
+{
+    snd_pcm_uframes_t frames = 0;
+    {
+        std::lock_guard<std::mutex> lk(release_mtx);
+        while (!regions.empty() && (regions.front().index < 0 || released[regions.front().index])) {
+            frames += regions.front().frames;
+            regions.pop_front();
+        }
+    }
+    held_frames -= frames;
+
+    while (frames > 0) {
+        const snd_pcm_channel_area_t* areas;
+        snd_pcm_uframes_t offset, n = frames;
+        int ret = snd_pcm_mmap_begin(pcm, &areas, &offset, &n);
+        if (ret < 0)
+            return ret;
+        snd_pcm_sframes_t done = snd_pcm_mmap_commit(pcm, offset, n);
+        if (done < 0)
+            return done;
+        if (n == 0 || (snd_pcm_uframes_t)done != n)
+            return -EPIPE;
+        frames -= n;
+    }
+    return 0;
+}
+
+uint8_t* ModuleAlsaMmapCapture::ringAddress(const snd_pcm_channel_area_t* areas, snd_pcm_uframes_t offset)
+{
+    return (uint8_t*)areas[0].addr + areas[0].first / 8 + offset * (areas[0].step / 8);
+}
+
+ModuleMedia::ProduceResult ModuleAlsaMmapCapture::doProduce(shared_ptr<MediaBuffer> buffer)
+{
+    if (buffer == nullptr)
+        return PRODUCE_FAILED;
+
+    // The buffer is back from the pipeline, whatever it pointed to can be committed.
+    uint16_t index = buffer->getIndex();
+    {
+        std::lock_guard<std::mutex> lk(release_mtx);
+        released[index] = true;
+    }
+
+    snd_pcm_uframes_t want = sample_info.nb_samples;
+    const snd_pcm_channel_area_t* areas;
+    snd_pcm_uframes_t offset;
+    int err = 0;
+    while (true) {
+        if (getModuleStatus() == STATUS_STOPED || (err < 0 && recover(err) < 0)) {
+            buffer->setActiveData(nullptr);
+            buffer->setActiveSize(0);
+            buffer->setEos(true);
+            return PRODUCE_EOS;
+        }
+
+        err = commitReleased();
+        if (err < 0)
+            continue;
+        snd_pcm_sframes_t avail = snd_pcm_avail_update(pcm);
+        if (avail < 0) {
+            err = avail;
+            continue;
+        }
+        stats.max_fill = std::max(stats.max_fill, (uint32_t)avail);
+
+        // The held frames are still in the ring, before the new ones.
+        if ((snd_pcm_uframes_t)avail >= held_frames + want) {
+            snd_pcm_uframes_t frames = ring_size;
+            err = snd_pcm_mmap_begin(pcm, &areas, &offset, &frames);
+            if (err < 0)
+                continue;
+            break;
+        }
+
+        stats.waits++;
+        if (held_frames == 0) {
+            err = std::min(snd_pcm_wait(pcm, CAPTURE_WAIT_TIMEOUT_MS), 0);
+        } else {
+            // avail_min is met by the held frames already, sleep for the missing ones.
+            int64_t missing = held_frames + want - avail;
+            usleep(std::max<int64_t>(missing * 1000000 / sample_info.sample_rate, CAPTURE_MIN_SLEEP_US));
+        }
+    }
+
+    offset = (offset + held_frames) % ring_size;
+    Region region = {index, want};
+    if (zero_copy && offset + want <= ring_size && held_frames + 2 * want <= ring_size) {
+        buffer->setActiveData(ringAddress(areas, offset));
+        std::lock_guard<std::mutex> lk(release_mtx);
+        released[index] = false;
+    } else {
+        uint8_t* data = (uint8_t*)buffer->getData();
+        snd_pcm_uframes_t first = std::min(want, ring_size - offset);
+        memcpy(data, ringAddress(areas, offset), first * frame_bytes);
+        if (first < want)
+            memcpy(data + first * frame_bytes, ringAddress(areas, 0), (want - first) * frame_bytes);
+        buffer->setActiveData(data);
+        region.index = -1;
+        stats.copied++;
+    }
+    regions.push_back(region);
+    held_frames += want;
+
+    buffer->setActiveSize(want * frame_bytes);
+    buffer->setPUstimestamp(clock_base + (int64_t)((stats.frames - clock_frames) * 1000000 / sample_info.sample_rate));
+    stats.buffers++;
+    stats.frames += want;
+
+    // A copied buffer frees its frames now if nothing is held before it; errors show up on the next call.
+    if (region.index < 0)
+        commitReleased();
+
+    std::lock_guard<std::mutex> lk(stats_mtx);
+    published = stats;
+    return PRODUCE_SUCCESS;
+}
+
+void ModuleAlsaMmapCapture::bufferReleaseCallBack(shared_ptr<MediaBuffer> buffer)
+{
+    {
+        std::lock_guard<std::mutex> lk(release_mtx);
+        if (buffer->getIndex() < released.size())
+            released[buffer->getIndex()] = true;
+    }
+    ModuleMedia::bufferReleaseCallBack(buffer);
+}
+
+ModuleAlsaMmapCapture::Stats ModuleAlsaMmapCapture::getStats()
+{
+    std::lock_guard<std::mutex> lk(stats_mtx);
+    return published;
+}
+
+void ModuleAlsaMmapCapture::dumpStats()
+{
+    Stats s = getStats();
+    ff_info("alsa mmap capture %s: %" PRIu64 " buffers of %d frames in periods of %lu, %" PRIu64 " copied, %" PRIu64
+            " waits, %u xruns, %u suspends, %u recoveries, ring fill up to %u of %lu frames\n",
+            device.c_str(), s.buffers, sample_info.nb_samples, period_size, s.copied, s.waits, s.xruns, s.suspends,
+            s.recoveries, s.max_fill, ring_size);
+}
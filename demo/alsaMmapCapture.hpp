@@ -0,0 +1,102 @@
+#pragma once
+#include <alsa/asoundlib.h>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "module/module_media.hpp"
+
+/*
+ * ALSA capture source reading the ring buffer of the device through mmap,
+ * interleaved, as a replacement of ModuleAlsaCapture with the same
+ * SampleInfo (normal layout only).
+ *
+ * Each output buffer holds nb_samples frames. The hardware period can be
+ * smaller, then several periods are batched into one buffer: the module
+ * wakes once per buffer and the pipeline sees one buffer, while the device
+ * still works in short periods.
+ *
+ * The buffers point straight into the ring area and the frames are only
+ * given back to the device (committed) when the pipeline has released
+ * the buffer, the way ModuleCam hands out V4L2 buffers, so the samples are
+ * never copied. The ring must then hold the buffers in flight, by default
+ * it is sized for buffer_count + 2 buffers; a buffer that would wrap the
+ * end of the ring or leave less than one buffer free is copied out and
+ * committed at once instead.
+ *
+ * An overrun (the pipeline held the ring too long) or a suspend is
+ * recovered in place and counted; the frames in the ring are lost, and so
+ * are the samples of the buffers still held, which the device writes over.
+ */
+class ModuleAlsaMmapCapture : public ModuleMedia
+{
+public:
+    struct Stats {
+        uint64_t buffers;
+        uint64_t frames;
+        uint64_t copied;        // buffers copied out of the ring instead of pointing into it
+        uint64_t waits;         // times the ring had less than a buffer ready
+        uint32_t xruns;
+        uint32_t suspends;
+        uint32_t recoveries;
+        uint32_t max_fill;      // most frames waiting in the ring, held ones included
+    };
+
+public:
+    ModuleAlsaMmapCapture(const std::string& dev, const SampleInfo& sample_info);
+    ~ModuleAlsaMmapCapture();
+
+    // Hardware period in frames, nb_samples by default.
+    void setPeriodSize(int frames) { period_size = frames; }
+    // Ring size in frames, 0 sizes it for the buffers in flight.
+    void setRingSize(int frames) { ring_size = frames; }
+    // Copy every buffer out of the ring, for consumers holding buffers a long time.
+    void setZeroCopy(bool enable) { zero_copy = enable; }
+
+    int init() override;
+    Stats getStats();
+    void dumpStats();
+
+protected:
+    virtual ProduceResult doProduce(shared_ptr<MediaBuffer> buffer) override;
+    virtual int initBuffer() override;
+    virtual bool setup() override;
+    virtual bool teardown() override;
+    virtual void bufferReleaseCallBack(shared_ptr<MediaBuffer> buffer) override;
+
+private:
+    struct Region {
+        int index;              // buffer pointing into it, -1 when copied out
+        snd_pcm_uframes_t frames;
+    };
+
+    int configure();
+    int startDevice();
+    int recover(int err);
+    int commitReleased();
+    uint8_t* ringAddress(const snd_pcm_channel_area_t* areas, snd_pcm_uframes_t offset);
+
+private:
+    std::string device;
+    SampleInfo sample_info;
+    snd_pcm_t* pcm;
+    snd_pcm_format_t format;
+    size_t frame_bytes;
+    snd_pcm_uframes_t period_size;
+    snd_pcm_uframes_t ring_size;
+    bool zero_copy;
+
+    // Frames handed out and not committed yet, in ring order.
+    std::deque<Region> regions;
+    snd_pcm_uframes_t held_frames;
+    std::mutex release_mtx;
+    std::vector<bool> released;     // by buffer index
+
+    int64_t clock_base;
+    uint64_t clock_frames;          // frames handed out when clock_base was taken
+
+    Stats stats;                    // owned by the module thread
+    std::mutex stats_mtx;
+    Stats published;
+};
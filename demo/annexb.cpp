@@ -0,0 +1,256 @@
+#include <string.h>
+#if defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
+
+#include "annexb.hpp"
+
+/// @brief Whether any of the 16 bytes at p is zero
+static inline bool hasZero16(const uint8_t* p)
+{
+#if defined(__ARM_NEON)
+    return vmaxvq_u8(vceqzq_u8(vld1q_u8(p))) != 0;
+#else
+    uint64_t a, b;
+    memcpy(&a, p, 8);
+    memcpy(&b, p + 8, 8);
+    const uint64_t lo = 0x0101010101010101ULL, hi = 0x8080808080808080ULL;
+    return (((a - lo) & ~a) | ((b - lo) & ~b)) & hi;
+#endif
+}
+
+/// @brief Find the next 00 00 01 start code
+/// @return pointer to its first zero byte, or end if there is none
+const uint8_t* AnnexB::findStartCode(const uint8_t* p, const uint8_t* end)
+{
+    // A start code begins with a zero byte, 16 bytes without one are skipped at once.
+    while (p + 18 <= end) {
+        if (!hasZero16(p)) {
+            p += 16;
+            continue;
+        }
+        for (const uint8_t* block = p + 16; p < block; p++) {
+            if (p[0] == 0 && p[1] == 0 && p[2] == 1)
+                return p;
+        }
+    }
+
+    for (; p + 2 < end; p++) {
+        if (p[2] > 1) {
+            p += 2;
+        } else if (p[0] == 0 && p[1] == 0 && p[2] == 1) {
+            return p;
+        }
+    }
+    return end;
+}
+
+/// @brief Split an Annex-B buffer into NAL units
+/// @return number of NAL units found
+size_t AnnexB::split(const uint8_t* data, size_t size, Codec codec, std::vector<Nal>& nals)
+{
+    const uint8_t* end = data + size;
+    const uint8_t* sc = findStartCode(data, end);
+
+    nals.clear();
+    while (sc + 3 < end) {
+        const uint8_t* payload = sc + 3;
+        const uint8_t* next = findStartCode(payload, end);
+        const uint8_t* payload_end = next;
+
+        // The leading zero of a four byte start code belongs to the next NAL.
+        if (next < end && next > payload && next[-1] == 0)
+            payload_end = next - 1;
+
+        Nal nal;
+        nal.data = payload;
+        nal.size = payload_end - payload;
+        nal.begin = (sc > data && sc[-1] == 0) ? sc - 1 : sc;
+        if (codec == CODEC_H264) {
+            nal.type = payload[0] & 0x1f;
+            nal.temporal_id = 0;
+            nal.reference = (payload[0] >> 5) & 0x3;
+            // Prefix (14) and slice extension (20) NALs carry nal_unit_header_svc_extension.
+            if ((nal.type == 14 || nal.type == 20) && nal.size > 3 && (payload[1] & 0x80))
+                nal.temporal_id = payload[3] >> 5;
+        } else {
+            // nuh_temporal_id_plus1 must not be 0, a NAL without a full header is malformed and left out.
+            if (nal.size < 2 || (payload[1] & 0x7) == 0) {
+                sc = next;
+                continue;
+            }
+            nal.type = (payload[0] >> 1) & 0x3f;
+            nal.temporal_id = (payload[1] & 0x7) - 1;
+            // TRAIL_N, TSA_N, STSA_N, RADL_N, RASL_N and the reserved _N types are even numbered below 16.
+            nal.reference = !(nal.type <= 14 && (nal.type & 1) == 0);
+        }
+        nals.push_back(nal);
+        sc = next;
+    }
+    return nals.size();
+}
+
+bool AnnexB::isVcl(Codec codec, uint8_t type)
+{
+    if (codec == CODEC_H264)
+        return type >= 1 && type <= 5;
+    return type < 32;
+}
+
+bool AnnexB::isParameterSet(Codec codec, uint8_t type)
+{
+    if (codec == CODEC_H264)
+        return type == 7 || type == 8;
+    return type >= 32 && type <= 34;
+}
+
+bool AnnexB::isKeyframe(Codec codec, uint8_t type)
+{
+    if (codec == CODEC_H264)
+        return type == 5;
+    return type >= 16 && type <= 21;
+}
+
+bool AnnexB::isLayerSwitch(Codec codec, uint8_t type)
+{
+    if (codec == CODEC_H264)
+        return false;
+    // TSA_N, TSA_R, STSA_N, STSA_R
+    return type >= 2 && type <= 5;
+}
+
+/// @brief Whether the NAL at data begins a new access unit, given a VCL NAL came before it
+/// @param data first byte of the NAL header, with at least 3 bytes
+bool AnnexB::startsAccessUnit(Codec codec, const uint8_t* data, size_t size)
+{
+    if (size < 3)
+        return false;
+
+    if (codec == CODEC_H264) {
+        uint8_t type = data[0] & 0x1f;
+        // SEI, SPS, PPS, AUD, prefix and the reserved 15..18
+        if (type == 6 || type == 7 || type == 8 || type == 9 || (type >= 14 && type <= 18))
+            return true;
+        // first_mb_in_slice is ue(v), 0 is coded as a single 1 bit.
+        return isVcl(codec, type) && (data[1] & 0x80);
+    }
+
+    uint8_t type = (data[0] >> 1) & 0x3f;
+    // VPS, SPS, PPS, AUD, prefix SEI and the reserved 41..44, 48..55
+    if ((type >= 32 && type <= 35) || type == 39 || (type >= 41 && type <= 44) || (type >= 48 && type <= 55))
+        return true;
+    // first_slice_segment_in_pic_flag
+    return isVcl(codec, type) && (data[2] & 0x80);
+}
+
+/// @brief Read slice_type from the start of a H.264 slice header
+/// @return slice_type % 5, or -1 if the header can not be read
+int AnnexB::h264SliceType(const Nal& nal)
+{
+    uint8_t rbsp[16];
+    size_t len = 0;
+    int zeros = 0;
+
+    // Unescape just enough of the header for two exp-golomb codes.
+    for (size_t i = 1; i < nal.size && len < sizeof(rbsp); i++) {
+        if (zeros >= 2 && nal.data[i] == 3) {
+            zeros = 0;
+            continue;
+        }
+        zeros = nal.data[i] == 0 ? zeros + 1 : 0;
+        rbsp[len++] = nal.data[i];
+    }
+
+    size_t bit = 0;
+    uint32_t value[2];
+    for (int n = 0; n < 2; n++) {
+        int leading = 0;
+        while (bit < len * 8 && !((rbsp[bit / 8] >> (7 - bit % 8)) & 1)) {
+            leading++;
+            bit++;
+        }
+        if (leading > 31 || bit + leading >= len * 8)
+            return -1;
+        bit++;
+        uint32_t v = 0;
+        for (int i = 0; i < leading; i++, bit++)
+            v = (v << 1) | ((rbsp[bit / 8] >> (7 - bit % 8)) & 1);
+        value[n] = (1u << leading) - 1 + v;
+    }
+    return value[1] % 5;
+}
+
+/// @brief Classify the access unit in an Annex-B buffer
+AnnexB::FrameInfo AnnexB::parseFrame(const uint8_t* data, size_t size, Codec codec)
+{
+    FrameInfo info = {FRAME_UNKNOWN, false, 0, false, 0, false};
+    std::vector<Nal> nals;
+    bool key = false, intra = true;
+    uint8_t prefix_temporal_id = 0;
+
+    split(data, size, codec, nals);
+    for (auto& nal : nals) {
+        if (isParameterSet(codec, nal.type))
+            info.has_parameter_sets = true;
+        // A H.264 base layer slice takes its temporal_id from the prefix NAL in front of it.
+        if (codec == CODEC_H264 && nal.type == 14)
+            prefix_temporal_id = nal.temporal_id;
+        if (!isVcl(codec, nal.type) || nal.size == 0)
+            continue;
+
+        if (info.vcl_count == 0) {
+            info.temporal_id = codec == CODEC_H264 ? prefix_temporal_id : nal.temporal_id;
+            info.layer_switch = isLayerSwitch(codec, nal.type);
+        }
+        info.vcl_count++;
+        info.reference |= nal.reference;
+
+        if (isKeyframe(codec, nal.type)) {
+            key = true;
+        } else if (codec == CODEC_H264) {
+            int slice_type = h264SliceType(nal);
+            // 2: I, 4: SI
+            if (slice_type != 2 && slice_type != 4)
+                intra = false;
+        } else {
+            // Telling I from P in a H.265 slice header needs the PPS, count it as inter.
+            intra = false;
+        }
+    }
+
+    if (info.vcl_count == 0)
+        info.type = FRAME_UNKNOWN;
+    else if (key)
+        info.type = FRAME_KEY;
+    else if (intra)
+        info.type = FRAME_INTRA;
+    else
+        info.type = FRAME_INTER;
+    return info;
+}
+
+/// @brief Find the run of parameter set NALs at the start of a keyframe
+/// @param begin set to the first byte of the run, including its start code
+/// @return length of the run in bytes, 0 if there are no parameter sets
+size_t AnnexB::parameterSets(const uint8_t* data, size_t size, Codec codec, const uint8_t** begin)
+{
+    std::vector<Nal> nals;
+    const uint8_t* first = nullptr;
+    const uint8_t* last = nullptr;
+
+    split(data, size, codec, nals);
+    for (auto& nal : nals) {
+        if (isParameterSet(codec, nal.type)) {
+            if (first == nullptr)
+                first = nal.begin;
+            last = nal.data + nal.size;
+        } else if (first != nullptr) {
+            break;
+        }
+    }
+
+    if (first == nullptr)
+        return 0;
+    *begin = first;
+    return last - first;
+}
@@ -0,0 +1,58 @@
+#pragma once
+#include <stdint.h>
+#include <stddef.h>
+#include <vector>
+
+/*
+ * Minimal H.264/H.265 Annex-B parsing: NAL unit splitting and the few
+ * header fields needed to classify a frame without decoding it.
+ */
+class AnnexB
+{
+public:
+    enum Codec {
+        CODEC_H264 = 0,
+        CODEC_H265,
+    };
+
+    enum FrameType {
+        FRAME_UNKNOWN = 0,
+        FRAME_KEY,        // IDR, or an IRAP picture for H.265
+        FRAME_INTRA,      // non-IDR frame with only I slices
+        FRAME_INTER,
+    };
+
+    struct Nal {
+        const uint8_t* data;    // first byte of the NAL header, after the start code
+        size_t size;
+        const uint8_t* begin;   // first byte of the start code
+        uint8_t type;
+        uint8_t temporal_id;    // H.265 TemporalId, H.264 temporal_id of a SVC prefix or extension NAL, else 0
+        bool reference;         // H.264 nal_ref_idc != 0, H.265 not a sub-layer non-reference picture
+    };
+
+    struct FrameInfo {
+        FrameType type;
+        bool reference;
+        uint8_t temporal_id;
+        bool has_parameter_sets;
+        size_t vcl_count;
+        bool layer_switch;      // H.265 TSA/STSA, decoding may switch up to this sub-layer here
+    };
+
+public:
+    static const uint8_t* findStartCode(const uint8_t* p, const uint8_t* end);
+    static size_t split(const uint8_t* data, size_t size, Codec codec, std::vector<Nal>& nals);
+
+    static bool isVcl(Codec codec, uint8_t type);
+    static bool isParameterSet(Codec codec, uint8_t type);
+    static bool isKeyframe(Codec codec, uint8_t type);
+    static bool isLayerSwitch(Codec codec, uint8_t type);
+    static bool startsAccessUnit(Codec codec, const uint8_t* data, size_t size);
+
+    static FrameInfo parseFrame(const uint8_t* data, size_t size, Codec codec);
+    static size_t parameterSets(const uint8_t* data, size_t size, Codec codec, const uint8_t** begin);
+
+private:
+    static int h264SliceType(const Nal& nal);
+};
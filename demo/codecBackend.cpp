@@ -0,0 +1,254 @@
+#include <algorithm>
+#include "codecBackend.hpp"
+#include "module/vp/module_mppdec.hpp"
+#include "module/vp/module_mppenc.hpp"
+#if SOFT_CODEC
+#include "softCodec.hpp"
+#endif
+
+CodecFactory::CodecFactory()
+    : mpp_decode_budget(0)
+{
+}
+
+CodecFactory::~CodecFactory()
+{
+}
+
+CodecFactory& CodecFactory::getDefault()
+{
+    static CodecFactory factory;
+    return factory;
+}
+
+bool CodecFactory::backendAvailable(CodecBackendType type)
+{
+    switch (type) {
+        case CODEC_BACKEND_AUTO:
+        case CODEC_BACKEND_MPP:
+            return true;
+        case CODEC_BACKEND_SOFT:
+#if SOFT_CODEC
+            return true;
+#else
+            return false;
+#endif
+        default:
+            return false;
+    }
+}
+
+const char* CodecFactory::backendName(CodecBackendType type)
+{
+    switch (type) {
+        case CODEC_BACKEND_AUTO:
+            return "auto";
+        case CODEC_BACKEND_MPP:
+            return "mpp";
+        case CODEC_BACKEND_SOFT:
+            return "soft";
+        default:
+            return "unknown";
+    }
+}
+
+CodecBackendType CodecFactory::backendByName(const char* name)
+{
+    if (strcmp(name, "mpp") == 0)
+        return CODEC_BACKEND_MPP;
+    if (strcmp(name, "soft") == 0)
+        return CODEC_BACKEND_SOFT;
+    return CODEC_BACKEND_AUTO;
+}
+
+void CodecFactory::setMppDecodeBudget(uint64_t pixels)
+{
+    std::lock_guard<std::mutex> lk(mtx);
+    mpp_decode_budget = pixels;
+}
+
+uint64_t CodecFactory::mppDecodeLoadNoLock()
+{
+    uint64_t load = 0;
+
+    // Destroyed modules give their share back without an explicit release.
+    instances.erase(std::remove_if(instances.begin(), instances.end(), [](const Instance& i) {
+                        return i.module.expired();
+                    }),
+                    instances.end());
+
+    for (auto& i : instances) {
+        if (i.decoder && i.type == CODEC_BACKEND_MPP)
+            load += i.pixels;
+    }
+    return load;
+}
+
+uint64_t CodecFactory::getMppDecodeLoad()
+{
+    std::lock_guard<std::mutex> lk(mtx);
+    return mppDecodeLoadNoLock();
+}
+
+void CodecFactory::track(shared_ptr<ModuleMedia> module, CodecBackendType type, bool decoder, uint64_t pixels)
+{
+    std::lock_guard<std::mutex> lk(mtx);
+    Instance i;
+    i.module = module;
+    i.type = type;
+    i.decoder = decoder;
+    i.pixels = pixels;
+    instances.push_back(i);
+}
+
+CodecBackendType CodecFactory::getBackend(const shared_ptr<ModuleMedia>& module)
+{
+    std::lock_guard<std::mutex> lk(mtx);
+    for (auto& i : instances) {
+        if (i.module.lock() == module)
+            return i.type;
+    }
+    return CODEC_BACKEND_AUTO;
+}
+
+shared_ptr<ModuleMedia> CodecFactory::createMppDecoder(shared_ptr<ModuleMedia> productor, uint16_t buffer_count)
+{
+    shared_ptr<ModuleMppDec> dec = make_shared<ModuleMppDec>();
+    dec->setProductor(productor);
+    dec->setBufferCount(buffer_count);
+    if (dec->init() < 0) {
+        productor->removeConsumer(dec);
+        return nullptr;
+    }
+    return dec;
+}
+
+shared_ptr<ModuleMedia> CodecFactory::createSoftDecoder(shared_ptr<ModuleMedia> productor, uint16_t buffer_count)
+{
+#if SOFT_CODEC
+    shared_ptr<ModuleSoftDec> dec = make_shared<ModuleSoftDec>();
+    dec->setProductor(productor);
+    dec->setBufferCount(buffer_count);
+    if (dec->init() < 0) {
+        productor->removeConsumer(dec);
+        return nullptr;
+    }
+    return dec;
+#else
+    (void)productor;
+    (void)buffer_count;
+    ff_error("Soft codec backend is not built, rebuild with -DSOFT_CODEC=ON\n");
+    return nullptr;
+#endif
+}
+
+/// @brief Create and init a decoder for the productor's encoded output
+/// @return the decoder module, or nullptr if no backend could be initialized
+shared_ptr<ModuleMedia> CodecFactory::createDecoder(shared_ptr<ModuleMedia> productor, uint16_t buffer_count,
+                                                    CodecBackendType type)
+{
+    shared_ptr<ModuleMedia> dec = nullptr;
+
+    if (productor == nullptr)
+        return nullptr;
+
+    ImagePara para = productor->getOutputImagePara();
+    uint64_t pixels = (uint64_t)para.width * para.height;
+
+    if (type == CODEC_BACKEND_AUTO) {
+        bool over_budget;
+        {
+            std::lock_guard<std::mutex> lk(mtx);
+            over_budget = mpp_decode_budget > 0 && mppDecodeLoadNoLock() + pixels > mpp_decode_budget;
+        }
+
+        type = CODEC_BACKEND_MPP;
+        if (over_budget && backendAvailable(CODEC_BACKEND_SOFT)) {
+            ff_info("mpp decode budget used up, decoding %dx%d on the cpu\n", para.width, para.height);
+            type = CODEC_BACKEND_SOFT;
+            dec = createSoftDecoder(productor, buffer_count);
+        } else {
+            dec = createMppDecoder(productor, buffer_count);
+            if (dec == nullptr && backendAvailable(CODEC_BACKEND_SOFT)) {
+                ff_warn("mpp decoder init failed, falling back to the soft decoder\n");
+                type = CODEC_BACKEND_SOFT;
+                dec = createSoftDecoder(productor, buffer_count);
+            }
+        }
+    } else if (type == CODEC_BACKEND_SOFT) {
+        dec = createSoftDecoder(productor, buffer_count);
+    } else {
+        dec = createMppDecoder(productor, buffer_count);
+    }
+
+    if (dec != nullptr)
+        track(dec, type, true, pixels);
+    return dec;
+}
+
+shared_ptr<ModuleMedia> CodecFactory::createMppEncoder(shared_ptr<ModuleMedia> productor, const EncodeConfig& config,
+                                                       uint16_t buffer_count)
+{
+    shared_ptr<ModuleMppEnc> enc = make_shared<ModuleMppEnc>(config.type, config.fps, config.gop, config.bps);
+    enc->setProductor(productor);
+    enc->setBufferCount(buffer_count);
+    enc->setDuration(config.duration);
+    if (enc->init() < 0) {
+        productor->removeConsumer(enc);
+        return nullptr;
+    }
+    return enc;
+}
+
+shared_ptr<ModuleMedia> CodecFactory::createSoftEncoder(shared_ptr<ModuleMedia> productor, const EncodeConfig& config,
+                                                        uint16_t buffer_count)
+{
+#if SOFT_CODEC
+    shared_ptr<ModuleSoftEnc> enc = make_shared<ModuleSoftEnc>(config.type, config.fps, config.gop, config.bps);
+    enc->setProductor(productor);
+    enc->setBufferCount(buffer_count);
+    enc->setDuration(config.duration);
+    if (enc->init() < 0) {
+        productor->removeConsumer(enc);
+        return nullptr;
+    }
+    return enc;
+#else
+    (void)productor;
+    (void)config;
+    (void)buffer_count;
+    ff_error("Soft codec backend is not built, rebuild with -DSOFT_CODEC=ON\n");
+    return nullptr;
+#endif
+}
+
+/// @brief Create and init an encoder for the productor's raw output
+/// @return the encoder module, or nullptr if no backend could be initialized
+shared_ptr<ModuleMedia> CodecFactory::createEncoder(shared_ptr<ModuleMedia> productor, const EncodeConfig& config,
+                                                    uint16_t buffer_count, CodecBackendType type)
+{
+    shared_ptr<ModuleMedia> enc = nullptr;
+
+    if (productor == nullptr)
+        return nullptr;
+
+    if (type == CODEC_BACKEND_AUTO) {
+        type = CODEC_BACKEND_MPP;
+        enc = createMppEncoder(productor, config, buffer_count);
+        if (enc == nullptr && backendAvailable(CODEC_BACKEND_SOFT)) {
+            ff_warn("mpp encoder init failed, falling back to the soft encoder\n");
+            type = CODEC_BACKEND_SOFT;
+            enc = createSoftEncoder(productor, config, buffer_count);
+        }
+    } else if (type == CODEC_BACKEND_SOFT) {
+        enc = createSoftEncoder(productor, config, buffer_count);
+    } else {
+        enc = createMppEncoder(productor, config, buffer_count);
+    }
+
+    if (enc != nullptr) {
+        ImagePara para = productor->getOutputImagePara();
+        track(enc, type, false, (uint64_t)para.width * para.height);
+    }
+    return enc;
+}
@@ -0,0 +1,73 @@
+#pragma once
+#include <vector>
+#include <mutex>
+
+#include "module/module_media.hpp"
+#include "base/ff_type.hpp"
+
+enum CodecBackendType {
+    CODEC_BACKEND_AUTO = 0,
+    CODEC_BACKEND_MPP,
+    CODEC_BACKEND_SOFT,
+};
+
+struct EncodeConfig {
+    EncodeType type = ENCODE_TYPE_H264;
+    int fps = 30;
+    int gop = 60;
+    int bps = 2048;          // kbps
+    int64_t duration = 0;    // frame interval for the output pts in us, 0 keeps the input pts
+};
+
+/*
+ * Codec backend selection for the decode and encode stage of a pipeline.
+ *
+ * The MPP modules are the production backend. The software backend
+ * (softCodec.hpp, built with -DSOFT_CODEC=ON) takes the same encoded
+ * buffers and produces the same NV12 VideoBuffer/ImagePara/pts output, so
+ * the rest of the pipeline does not care which one it gets. With
+ * CODEC_BACKEND_AUTO a decoder goes to MPP unless MPP fails to init or the
+ * MPP decode budget is used up, then it overflows to the CPU.
+ */
+class CodecFactory
+{
+public:
+    CodecFactory();
+    ~CodecFactory();
+
+    static CodecFactory& getDefault();
+    static bool backendAvailable(CodecBackendType type);
+    static const char* backendName(CodecBackendType type);
+    static CodecBackendType backendByName(const char* name);
+
+    // Frame pixels of all live MPP decoders before AUTO overflows to the soft backend, 0 is unlimited.
+    void setMppDecodeBudget(uint64_t pixels);
+    uint64_t getMppDecodeLoad();
+
+    shared_ptr<ModuleMedia> createDecoder(shared_ptr<ModuleMedia> productor, uint16_t buffer_count,
+                                          CodecBackendType type = CODEC_BACKEND_AUTO);
+    shared_ptr<ModuleMedia> createEncoder(shared_ptr<ModuleMedia> productor, const EncodeConfig& config,
+                                          uint16_t buffer_count, CodecBackendType type = CODEC_BACKEND_AUTO);
+
+    CodecBackendType getBackend(const shared_ptr<ModuleMedia>& module);
+
+private:
+    struct Instance {
+        weak_ptr<ModuleMedia> module;
+        CodecBackendType type;
+        bool decoder;
+        uint64_t pixels;
+    };
+
+    shared_ptr<ModuleMedia> createMppDecoder(shared_ptr<ModuleMedia> productor, uint16_t buffer_count);
+    shared_ptr<ModuleMedia> createSoftDecoder(shared_ptr<ModuleMedia> productor, uint16_t buffer_count);
+    shared_ptr<ModuleMedia> createMppEncoder(shared_ptr<ModuleMedia> productor, const EncodeConfig& config, uint16_t buffer_count);
+    shared_ptr<ModuleMedia> createSoftEncoder(shared_ptr<ModuleMedia> productor, const EncodeConfig& config, uint16_t buffer_count);
+    void track(shared_ptr<ModuleMedia> module, CodecBackendType type, bool decoder, uint64_t pixels);
+    uint64_t mppDecodeLoadNoLock();
+
+private:
+    std::mutex mtx;
+    vector<Instance> instances;
+    uint64_t mpp_decode_budget;
+};
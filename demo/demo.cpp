@@ -5,9 +5,21 @@
 #include <getopt.h>
 #include <queue>
 #include <math.h>
+#include <inttypes.h>
+#include <algorithm>
 #include <termios.h>
 
 #include "utils.hpp"
+#include "rgaBalancer.hpp"
+#include "codecBackend.hpp"
+#include "frameSkip.hpp"
+#include "fmp4Writer.hpp"
+#include "trickPlay.hpp"
+#include "mmapReader.hpp"
+#include "esReader.hpp"
+#include "rtspFanout.hpp"
+#include "rtspReceiver.hpp"
+#include "llHls.hpp"
 #include "module/vi/module_cam.hpp"
 #include "module/vi/module_rtspClient.hpp"
 #include "module/vi/module_rtmpClient.hpp"
@@ -58,7 +70,9 @@ typedef struct _demo_config {
 
     bool cam_enabled = false;
     bool file_r_enabled = false;
+    bool es_r_enabled = false;
     bool loop = false;
+    bool mmap_read = false;
     bool dec_enabled = false;
     bool rga_enabled = false;
     bool drmdisplay_enabled = false;
@@ -66,10 +80,26 @@ typedef struct _demo_config {
     bool enc_enabled = false;
     bool file_w_enabled = false;
     bool rtsp_c_enabled = false;
+    bool rtsp_receiver = false;
     bool rtmp_c_enabled = false;
     bool push_enabled = false;
     bool savetofile_enabled = false;
     bool aplay_enable = false;
+    bool rga_balance = false;
+    CodecBackendType codec_backend = CODEC_BACKEND_AUTO;
+    ModuleFrameSkip::SkipMode skip_mode = ModuleFrameSkip::SKIP_NONE;
+    int skip_value = 0;
+    int fragment_ms = -1;
+    int zerocopy_bytes = 0;
+    int gop_cache_bytes = -1;
+    int gop_cache_speed = 0;
+    char multicast_group[32] = "";
+    int multicast_port = 0;
+    int multicast_ttl = 1;
+    char multicast_iface[32] = "";
+    int hls_part_ms = 0;
+    int hls_segment_ms = 0;
+    char hls_dir[256] = "";
 } DemoConfig;
 
 typedef struct _demo_data {
@@ -77,6 +107,10 @@ typedef struct _demo_data {
     shared_ptr<Synchronize> sync = nullptr;
     shared_ptr<ModuleMedia> last_module = nullptr;
     shared_ptr<ModuleMedia> source_module = nullptr;
+    shared_ptr<ModuleTrickPlay> trick = nullptr;
+    shared_ptr<ModuleRtspFanout> fanout = nullptr;
+    shared_ptr<ModuleLlHls> llhls = nullptr;
+    shared_ptr<ModuleRtspReceiver> receiver = nullptr;
     FILE* file_data = nullptr;
 
 } DemoData;
@@ -114,15 +148,38 @@ static void usage(char** argv)
         "-f, --file                   Enable save source output data to file, set filename, default disabled\n"
         "-p, --port                   Enable push stream, default rtsp stream, set push port, depend on encode enabled, default disabled\n"
         "    --push_type              Set push stream type, default rtsp. e.g. --push_type rtmp\n"
+        "                               fanout: rtsp server packetizing once for all viewers, for many clients of one stream\n"
+        "                               llhls: low-latency HLS over http for browsers, http://LocalIpAddr:port/live/N/index.m3u8\n"
+        "    --zerocopy               Send fanout frames of at least this many bytes to rtsp over tcp clients with MSG_ZEROCOPY.\n"
+        "                               e.g. --zerocopy 65536\n"
+        "    --gop_cache              Fanout GOP cache size in bytes, new viewers start from its keyframe, default 8M, 0 disables.\n"
+        "                               An optional speed paces the cached frames at that many times real time, default at once.\n"
+        "                               e.g. --gop_cache 4194304 | --gop_cache 4194304:4\n"
+        "    --multicast              Also offer the fanout stream on a multicast group, group:port[:ttl[:local address]], ttl default 1.\n"
+        "                               e.g. --multicast 239.0.0.1:5004 | --multicast 239.0.0.1:5004:1:127.0.0.1\n"
+        "    --hls_part               LL-HLS part and segment duration in ms, part[:segment], default 200:1000.\n"
+        "                               Segments end at the first keyframe after the segment duration. e.g. --hls_part 200:2000\n"
+        "    --hls_dir                Also write the LL-HLS playlist, segments and parts to this directory, /N appended per instance.\n"
         "    --rtmp_url               Set the rtmp client push address. e.g. --rtmp_url rtmp://xxx\n"
         "--rtsp_transport             Set the rtsp transport type, default udp.\n"
         "                               e.g. --rtsp_transport tcp | --rtsp_transport multicast\n"
+        "                               udp_batch: udp with batched receive and packet reordering, video only\n"
         "-m, --enmux                  Enable save encode data to file. Enable package as mp4, mkv, flv, ts, ps or raw stream files, muxer type depends on the filename suffix.\n"
         "                               default disabled. e.g. -m out.mp4 | -m out.mkv | -m out.yuv\n"
         "-s, --sync                   Enable synchronization module, default disabled. Enable the default audio.\n"
         "                               e.g. -s | --sync=video | --sync=abs\n"
         "-A, --aplay                  Enable play audio, default disabled. e.g. --aplay plughw:3,0\n"
         "-l, --loop                   Loop reads the media file.\n"
+        "    --mmap                   Read a mp4 file through a memory mapping without copying samples.\n"
+        "                               Video only, no seeking or trick play.\n"
+        "-B, --rga_balance            Balance the rga jobs of all instances across the rga cores.\n"
+        "    --codec                  Codec backend, auto, mpp or soft, default auto. soft needs -DSOFT_CODEC=ON\n"
+        "    --skip_frame             Drop frames before the decoder, default disabled.\n"
+        "                               key[:ms]   keyframes only, at most one per ms\n"
+        "                               gop:n      decode one gop out of n\n"
+        "                               late[:ms]  drop non-reference frames when more than ms behind, default 200\n"
+        "    --fragment               Save --enmux output as fragmented mp4, a fragment every ms, 0 at every keyframe.\n"
+        "                               Playable up to the last fragment after power loss. e.g. --fragment 1000\n"
         "-r, --rotate                 Image rotation degree, default 0\n"
         "                               0:   none\n"
         "                               1:   vertical mirror\n"
@@ -130,11 +187,17 @@ static void usage(char** argv)
         "                               90:  90 degree\n"
         "                               180: 180 degree\n"
         "                               270: 270 degree\n"
+        "\n"
+        "Raw .h264/.h265 files and fifos are read as Annex-B streams, -i gives their size.\n"
+        "\n"
+        "Keys while playing a mp4 file of the first instance:\n"
+        "  f fast forward, r reverse (keyframes only, press again for more speed), n normal play\n"
+        "  j / l seek 10s back / forward, [ / ] previous / next keyframe, q quit\n"
         "\n",
         argv[0]);
 }
 
-static const char* short_options = "i:o:a:b:c:d:z:e:f:p:m:r:s::A:xl";
+static const char* short_options = "i:o:a:b:c:d:z:e:f:p:m:r:s::A:xlB";
 
 // clang-format off
 static struct option long_options[] = {
@@ -160,6 +223,16 @@ static struct option long_options[] = {
     {"x11", no_argument, NULL, 'x'},
 #endif
     {"loop", no_argument, NULL, 'l'},
+    {"rga_balance", no_argument, NULL, 'B'},
+    {"codec", required_argument, NULL, 'K'},
+    {"skip_frame", required_argument, NULL, 'S'},
+    {"fragment", required_argument, NULL, 'F'},
+    {"mmap", no_argument, NULL, 'M'},
+    {"zerocopy", required_argument, NULL, 'Z'},
+    {"gop_cache", required_argument, NULL, 'G'},
+    {"multicast", required_argument, NULL, 'U'},
+    {"hls_part", required_argument, NULL, 'H'},
+    {"hls_dir", required_argument, NULL, 'D'},
     {NULL, 0, NULL, 0}
 };
 // clang-format on
@@ -180,6 +253,27 @@ static int parse_encode_parameters(char* str, EncodeType* encode_type)
     return 0;
 }
 
+static int parse_skip_parameters(char* str, DemoConfig* config)
+{
+    char* value = strchr(str, ':');
+    if (value != NULL)
+        *value++ = '\0';
+
+    if (strcmp(str, "key") == 0) {
+        config->skip_mode = ModuleFrameSkip::SKIP_KEYFRAME;
+    } else if (strcmp(str, "gop") == 0 && value != NULL) {
+        config->skip_mode = ModuleFrameSkip::SKIP_GOP;
+    } else if (strcmp(str, "late") == 0) {
+        config->skip_mode = ModuleFrameSkip::SKIP_LATE;
+    } else {
+        ff_error("Skip frame mode %s is not Support\n", str);
+        exit(-1);
+    }
+    config->skip_value = value ? atoi(value) : 0;
+
+    return 0;
+}
+
 static int parse_format_parameters(char* str, ImagePara* para)
 {
     uint32_t format = v4l2GetFmtByName(str);
@@ -269,6 +363,15 @@ void add_index_to_filename(char* filename, int index)
     }
 }
 
+static bool isElementaryStream(const char* filename)
+{
+    const char* extension = strrchr(filename, '.');
+    if (extension == NULL)
+        return false;
+    return !strcasecmp(extension, ".h264") || !strcasecmp(extension, ".264") || !strcasecmp(extension, ".h265")
+           || !strcasecmp(extension, ".265") || !strcasecmp(extension, ".hevc");
+}
+
 int start_instance(DemoData* inst, int inst_index, int inst_count)
 {
     int ret;
@@ -310,12 +413,20 @@ int start_instance(DemoData* inst, int inst_index, int inst_count)
                 inst_conf->cam_enabled = true;
                 break;
             case S_IFREG:
-                ff_info("enable file reader\n");
-                inst_conf->file_r_enabled = true;
+                if (isElementaryStream(inst_conf->input_source)) {
+                    ff_info("enable es reader\n");
+                    inst_conf->es_r_enabled = true;
+                } else {
+                    ff_info("enable file reader\n");
+                    inst_conf->file_r_enabled = true;
+                }
+                break;
+            case S_IFIFO:
+                ff_info("enable es reader\n");
+                inst_conf->es_r_enabled = true;
                 break;
             case S_IFBLK:
             case S_IFDIR:
-            case S_IFIFO:
             case S_IFLNK:
             case S_IFSOCK:
             default:
@@ -347,6 +458,34 @@ int start_instance(DemoData* inst, int inst_index, int inst_count)
             goto FAILED;
         }
         inst->last_module = cam;
+    } else if (inst_conf->es_r_enabled) {
+        ImagePara es_para = inst_conf->input_image_para;
+        if (es_para.width == 0 || es_para.height == 0) {
+            ff_warn("No -i size for the elementary stream, assume 1920x1080\n");
+            es_para = ImagePara(1920, 1080, 1920, 1080, 0);
+        }
+        es_para.v4l2Fmt = strstr(inst_conf->input_source, "265") || strstr(inst_conf->input_source, "hevc")
+                              ? V4L2_PIX_FMT_HEVC
+                              : V4L2_PIX_FMT_H264;
+        shared_ptr<ModuleEsReader> es_reader = make_shared<ModuleEsReader>(es_para, inst_conf->input_source, inst_conf->loop);
+        es_reader->setProductor(NULL);
+        es_reader->setRealtime(true);
+        ret = es_reader->init();
+        if (ret < 0) {
+            ff_error("es reader init failed\n");
+            goto FAILED;
+        }
+        inst->last_module = es_reader;
+    } else if (inst_conf->file_r_enabled && inst_conf->mmap_read) {
+        shared_ptr<ModuleMmapReader> mmap_reader = make_shared<ModuleMmapReader>(inst_conf->input_source, inst_conf->loop);
+        mmap_reader->setProductor(NULL);
+        mmap_reader->setRealtime(true);
+        ret = mmap_reader->init();
+        if (ret < 0) {
+            ff_error("mmap reader init failed\n");
+            goto FAILED;
+        }
+        inst->last_module = mmap_reader;
     } else if (inst_conf->file_r_enabled) {
         shared_ptr<ModuleFileReader> file_reader = make_shared<ModuleFileReader>(inst_conf->input_source, inst_conf->loop);
         if ((inst_conf->input_image_para.width > 0) || (inst_conf->input_image_para.height > 0)) {
@@ -359,6 +498,25 @@ int start_instance(DemoData* inst, int inst_index, int inst_count)
             goto FAILED;
         }
         inst->last_module = file_reader;
+    } else if (inst_conf->rtsp_c_enabled && inst_conf->rtsp_receiver) {
+        ImagePara rtsp_para = inst_conf->input_image_para;
+        if (rtsp_para.width == 0 || rtsp_para.height == 0) {
+            ff_warn("No -i size for the rtsp stream, assume 1920x1080\n");
+            rtsp_para = ImagePara(1920, 1080, 1920, 1080, 0);
+        }
+        if (inst_conf->aplay_enable) {
+            ff_warn("The rtsp receiver has no audio, --aplay ignored\n");
+            inst_conf->aplay_enable = false;
+        }
+        inst->receiver = make_shared<ModuleRtspReceiver>(inst_conf->input_source, rtsp_para);
+        inst->receiver->setProductor(NULL);
+        inst->receiver->setBufferCount(20);
+        ret = inst->receiver->init();
+        if (ret < 0) {
+            ff_error("rtsp receiver init failed\n");
+            goto FAILED;
+        }
+        inst->last_module = inst->receiver;
     } else if (inst_conf->rtsp_c_enabled) {
         shared_ptr<ModuleRtspClient> rtsp_c = make_shared<ModuleRtspClient>(inst_conf->input_source, inst_conf->rtsp_transport, true, inst_conf->aplay_enable);
         rtsp_c->setProductor(NULL);
@@ -435,13 +593,41 @@ SOURCE_CREATED:
 
     inst->last_module = inst->source_module;
 
+    // Seeking and trick play of a shared reader are driven by the first instance only.
+    if (inst_conf->file_r_enabled && !inst_conf->mmap_read && inst_conf->dec_enabled && inst_index == 0) {
+        inst->trick = make_shared<ModuleTrickPlay>(static_pointer_cast<ModuleFileReader>(inst->source_module),
+                                                   inst_conf->input_source);
+        inst->trick->setProductor(inst->last_module);
+        ret = inst->trick->init();
+        if (ret < 0) {
+            ff_error("Trick play init failed\n");
+            goto FAILED;
+        }
+        inst->last_module = inst->trick;
+    }
+
+    if (inst_conf->dec_enabled && inst_conf->skip_mode != ModuleFrameSkip::SKIP_NONE) {
+        shared_ptr<ModuleFrameSkip> skip = make_shared<ModuleFrameSkip>(inst_conf->skip_mode);
+        if (inst_conf->skip_mode == ModuleFrameSkip::SKIP_KEYFRAME)
+            skip->setMinInterval(inst_conf->skip_value * 1000);
+        else if (inst_conf->skip_mode == ModuleFrameSkip::SKIP_GOP)
+            skip->setGopInterval(inst_conf->skip_value);
+        else if (inst_conf->skip_value > 0)
+            skip->setMaxLatency(inst_conf->skip_value * 1000);
+        skip->setProductor(inst->last_module);
+        ret = skip->init();
+        if (ret < 0) {
+            ff_error("Frame skip init failed\n");
+            goto FAILED;
+        }
+        inst->last_module = skip;
+    }
+
     // inst->dec_enabled = false;
     if (inst_conf->dec_enabled) {
-        shared_ptr<ModuleMppDec> dec = make_shared<ModuleMppDec>();
-        dec->setProductor(inst->last_module);
-        dec->setBufferCount(10);
-        ret = dec->init();
-        if (ret < 0) {
+        shared_ptr<ModuleMedia> dec = CodecFactory::getDefault().createDecoder(inst->last_module, 10,
+                                                                              inst_conf->codec_backend);
+        if (dec == nullptr) {
             ff_error("Dec init failed\n");
             goto FAILED;
         }
@@ -472,7 +658,11 @@ SOURCE_CREATED:
     }
 
     if (inst_conf->rga_enabled) {
-        shared_ptr<ModuleRga> rga = make_shared<ModuleRga>(inst_conf->output_image_para, inst_conf->rotate);
+        shared_ptr<ModuleRga> rga;
+        if (inst_conf->rga_balance)
+            rga = make_shared<ModuleRgaBalanced>(inst_conf->output_image_para, inst_conf->rotate);
+        else
+            rga = make_shared<ModuleRga>(inst_conf->output_image_para, inst_conf->rotate);
         rga->setProductor(inst->last_module);
         rga->setBufferCount(2);
         ret = rga->init();
@@ -545,19 +735,29 @@ SOURCE_CREATED:
 #endif
 
     if (inst_conf->enc_enabled) {
-        shared_ptr<ModuleMppEnc> enc = make_shared<ModuleMppEnc>(inst_conf->encode_type);
-        enc->setProductor(inst->last_module);
-        enc->setBufferCount(8);
-        enc->setDuration(0);  // Use the input source timestamp
-        ret = enc->init();
-        if (ret < 0) {
+        EncodeConfig enc_conf;
+        enc_conf.type = inst_conf->encode_type;
+        enc_conf.duration = 0;  // Use the input source timestamp
+        shared_ptr<ModuleMedia> enc = CodecFactory::getDefault().createEncoder(inst->last_module, enc_conf, 8,
+                                                                              inst_conf->codec_backend);
+        if (enc == nullptr) {
             ff_error("Enc init failed\n");
             goto FAILED;
         }
         inst->last_module = enc;
     }
 
-    if (inst_conf->file_w_enabled) {
+    if (inst_conf->file_w_enabled && inst_conf->fragment_ms >= 0) {
+        shared_ptr<ModuleFmp4Writer> file_writer = make_shared<ModuleFmp4Writer>(inst_conf->output_filename);
+        file_writer->setProductor(inst->last_module);
+        file_writer->setFragmentDuration(inst_conf->fragment_ms * 1000LL);
+        file_writer->setWriteIndex(true);
+        ret = file_writer->init();
+        if (ret < 0) {
+            ff_error("ModuleFmp4Writer init failed\n");
+            goto FAILED;
+        }
+    } else if (inst_conf->file_w_enabled) {
         shared_ptr<ModuleFileWriter> file_writer = make_shared<ModuleFileWriter>(inst_conf->output_filename);
         file_writer->setProductor(inst->last_module);
         ret = file_writer->init();
@@ -570,7 +770,7 @@ SOURCE_CREATED:
     if (inst_conf->push_enabled) {
         char push_path[256] = "";
         sprintf(push_path, "/live/%d", inst_index);
-        if (inst_conf->push_type) {
+        if (inst_conf->push_type == 1) {
             shared_ptr<ModuleRtmpServer> rtmp_s = make_shared<ModuleRtmpServer>(push_path,
                                                                                 inst_conf->push_port);
             rtmp_s->setProductor(inst->last_module);
@@ -583,6 +783,39 @@ SOURCE_CREATED:
                 ff_error("rtmp server init failed\n");
                 goto FAILED;
             }
+        } else if (inst_conf->push_type == 2) {
+            inst->fanout = make_shared<ModuleRtspFanout>(push_path, inst_conf->push_port);
+            inst->fanout->setProductor(inst->last_module);
+            inst->fanout->setZeroCopyThreshold(inst_conf->zerocopy_bytes);
+            if (inst_conf->gop_cache_bytes >= 0)
+                inst->fanout->setGopCache(inst_conf->gop_cache_bytes, inst_conf->gop_cache_speed);
+            // Instances on the same port get consecutive port pairs of the group.
+            if (inst_conf->multicast_group[0])
+                inst->fanout->setMulticast(inst_conf->multicast_group, inst_conf->multicast_port + inst_index * 2,
+                                           inst_conf->multicast_ttl, inst_conf->multicast_iface);
+            if (inst_conf->sync_opt)
+                inst->fanout->setSynchronize(make_shared<Synchronize>(SynchronizeType(inst_conf->sync_opt - 1)));
+
+            ret = inst->fanout->init();
+            if (ret) {
+                ff_error("rtsp fan-out server init failed\n");
+                goto FAILED;
+            }
+        } else if (inst_conf->push_type == 3) {
+            inst->llhls = make_shared<ModuleLlHls>(push_path, inst_conf->push_port);
+            inst->llhls->setProductor(inst->last_module);
+            if (inst_conf->hls_part_ms > 0)
+                inst->llhls->setPartDuration(inst_conf->hls_part_ms);
+            if (inst_conf->hls_segment_ms > 0)
+                inst->llhls->setSegmentDuration(inst_conf->hls_segment_ms);
+            if (inst_conf->hls_dir[0] && (mkdir(inst_conf->hls_dir, 0755) == 0 || errno == EEXIST))
+                inst->llhls->setOutputDir(string(inst_conf->hls_dir) + "/" + to_string(inst_index));
+
+            ret = inst->llhls->init();
+            if (ret) {
+                ff_error("LL-HLS init failed\n");
+                goto FAILED;
+            }
         } else {
             shared_ptr<ModuleRtspServer> rtsp_s = make_shared<ModuleRtspServer>(push_path,
                                                                                 inst_conf->push_port);
@@ -597,7 +830,10 @@ SOURCE_CREATED:
                 goto FAILED;
             }
         }
-        ff_info("\n Start push stream: %s://LocalIpAddr:%d%s\n\n", inst_conf->push_type ? "rtmp" : "rtsp", inst_conf->push_port, push_path);
+        if (inst_conf->push_type == 3)
+            ff_info("\n Start push stream: http://LocalIpAddr:%d%s/index.m3u8\n\n", inst_conf->push_port, push_path);
+        else
+            ff_info("\n Start push stream: %s://LocalIpAddr:%d%s\n\n", inst_conf->push_type == 1 ? "rtmp" : "rtsp", inst_conf->push_port, push_path);
     }
 
     if (strlen(inst_conf->rtmp_url) > 0) {
@@ -642,7 +878,7 @@ SOURCE_CREATED:
 			 inst_conf->rtsp_c_enabled ? "enable" : "disable",
 			 inst_conf->file_w_enabled ? inst_conf->output_filename : "disable",
  			 inst_conf->savetofile_enabled ? inst_conf->dump_filename : "disable",
-             inst_conf->push_type ? "Rtmp" : "Rtsp",
+             inst_conf->push_type == 1 ? "Rtmp" : inst_conf->push_type == 3 ? "Hls " : "Rtsp",
 			 inst_conf->push_enabled ? to_string(inst_conf->push_port).c_str() : "disable");
     // clang-format on
 
@@ -689,6 +925,44 @@ static int parse_config(int argc, char** argv, DemoConfig* config)
             case 'l':
                 config->loop = true;
                 break;
+            case 'B':
+                config->rga_balance = true;
+                break;
+            case 'K':
+                config->codec_backend = CodecFactory::backendByName(optarg);
+                if (!CodecFactory::backendAvailable(config->codec_backend)) {
+                    ff_error("Codec backend %s is not built\n", optarg);
+                    exit(-1);
+                }
+                break;
+            case 'S':
+                parse_skip_parameters(optarg, config);
+                break;
+            case 'F':
+                config->fragment_ms = atoi(optarg);
+                break;
+            case 'M':
+                config->mmap_read = true;
+                break;
+            case 'Z':
+                config->zerocopy_bytes = atoi(optarg);
+                break;
+            case 'G':
+                sscanf(optarg, "%d:%d", &config->gop_cache_bytes, &config->gop_cache_speed);
+                break;
+            case 'U':
+                if (sscanf(optarg, "%31[^:]:%d:%d:%31s", config->multicast_group, &config->multicast_port,
+                           &config->multicast_ttl, config->multicast_iface) < 2) {
+                    ff_error("Bad multicast %s, e.g. --multicast 239.0.0.1:5004\n", optarg);
+                    exit(-1);
+                }
+                break;
+            case 'H':
+                sscanf(optarg, "%d:%d", &config->hls_part_ms, &config->hls_segment_ms);
+                break;
+            case 'D':
+                snprintf(config->hls_dir, sizeof(config->hls_dir), "%s", optarg);
+                break;
             case 'z':
                 config->drm_display_plane_zpos = atoi(optarg);
                 break;
@@ -708,6 +982,10 @@ static int parse_config(int argc, char** argv, DemoConfig* config)
             case 't':
                 if (strcmp(optarg, "rtmp") == 0)
                     config->push_type = 1;
+                else if (strcmp(optarg, "fanout") == 0)
+                    config->push_type = 2;
+                else if (strcmp(optarg, "llhls") == 0)
+                    config->push_type = 3;
                 else
                     config->push_type = 0;
                 break;
@@ -721,6 +999,8 @@ static int parse_config(int argc, char** argv, DemoConfig* config)
                     config->rtsp_transport = RTSP_STREAM_TYPE_TCP;
                 else if (strcmp(optarg, "multicast") == 0)
                     config->rtsp_transport = RTSP_STREAM_TYPE_MULTICAST;
+                else if (strcmp(optarg, "udp_batch") == 0)
+                    config->rtsp_receiver = true;
                 else
                     config->rtsp_transport = RTSP_STREAM_TYPE_UDP;
                 break;
@@ -815,12 +1095,58 @@ int main(int argc, char** argv)
         }
     }
 
-    while (mygetch() != 'q') {
+    int ch;
+    while ((ch = mygetch()) != 'q') {
+        shared_ptr<ModuleTrickPlay> trick = insts[0].trick;
+        if (trick != nullptr) {
+            int speed = trick->getSpeed();
+            int64_t pos = trick->getPosition();
+            switch (ch) {
+                case 'f':
+                    trick->setSpeed(speed > 1 ? std::min(speed * 2, 64) : 2);
+                    break;
+                case 'r':
+                    trick->setSpeed(speed < 0 ? std::max(speed * 2, -64) : -2);
+                    break;
+                case 'n':
+                    trick->setSpeed(1);
+                    break;
+                case 'j':
+                case 'l':
+                    if (pos >= 0)
+                        ff_info("seek to %" PRId64 " ms\n", trick->seek(std::max<int64_t>(0, pos + (ch == 'l' ? 10000 : -10000))));
+                    break;
+                case '[':
+                case ']':
+                    ff_info("seek to %" PRId64 " ms\n", trick->stepKeyframe(ch == ']' ? 1 : -1));
+                    break;
+                default:
+                    break;
+            }
+        }
         usleep(10000);
     }
 
 EXIT:
 
+    if (ori_config.rga_balance)
+        RgaCoreBalancer::getDefault()->dumpStats();
+
+    if (insts[0].trick != nullptr)
+        insts[0].trick->dumpStats();
+
+    if (ori_config.mmap_read && insts[0].source_module != nullptr)
+        static_pointer_cast<ModuleMmapReader>(insts[0].source_module)->dumpStats();
+
+    for (int i = 0; i < instance_count; i++) {
+        if (insts[i].receiver != nullptr)
+            insts[i].receiver->dumpStats();
+        if (insts[i].fanout != nullptr)
+            insts[i].fanout->dumpStats();
+        if (insts[i].llhls != nullptr)
+            insts[i].llhls->dumpStats();
+    }
+
     if (common_source_module != NULL) {
         common_source_module->dumpPipeSummary();
         common_source_module->stop();
@@ -0,0 +1,225 @@
+#include <getopt.h>
+#include <inttypes.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <string>
+
+#include "alsaMmapCapture.hpp"
+#include "module/vi/module_alsaCapture.hpp"
+
+/*
+ * Captures from an ALSA device for a while and reports what the pipeline
+ * saw: buffers, frames, the rate they came at and the largest gap between
+ * timestamps, next to the overrun counters of the mmap capture. Runs
+ * without a sound card on the null device (free running, no real time) or
+ * on snd-aloop with something playing into the other end.
+ *
+ * A consumer holding each buffer for a while (--hold) shows how many
+ * buffers in flight the ring takes before it overruns.
+ */
+
+enum CaptureMode {
+    MODE_MMAP,
+    MODE_COPY,
+    MODE_READ,
+};
+
+struct CaptureContext {
+    FILE* output;
+    int hold_ms;
+    size_t frame_bytes;
+    uint64_t buffers;
+    uint64_t frames;
+    int64_t first_pts;
+    int64_t last_pts;
+    int64_t max_gap;
+};
+
+static std::atomic_bool quit(false);
+
+static void sigterm_handler(int sig)
+{
+    (void)sig;
+    quit = true;
+}
+
+static void callback_capture(void* ctx, shared_ptr<MediaBuffer> buffer)
+{
+    CaptureContext* c = (CaptureContext*)ctx;
+    if (buffer == nullptr || buffer->getActiveSize() == 0)
+        return;
+
+    int64_t pts = buffer->getPUstimestamp();
+    if (c->buffers == 0)
+        c->first_pts = pts;
+    else
+        c->max_gap = std::max(c->max_gap, pts - c->last_pts);
+    c->last_pts = pts;
+    c->buffers++;
+    c->frames += buffer->getActiveSize() / c->frame_bytes;
+
+    if (c->output)
+        fwrite(buffer->getActiveData(), 1, buffer->getActiveSize(), c->output);
+    if (c->hold_ms > 0)
+        usleep(c->hold_ms * 1000);
+}
+
+static void usage(const char* name)
+{
+    ff_error("Usage: %s [options]\n"
+             "    -d, --device NAME       Capture device, default null, e.g. hw:Loopback,1\n"
+             "    -m, --mode MODE         mmap (default), copy (mmap, always copied out) or read (ModuleAlsaCapture)\n"
+             "    -r, --rate N            Sample rate, default 48000\n"
+             "    -c, --channels N        Channels, default 2\n"
+             "    -n, --samples N         Frames per buffer, default 1024\n"
+             "    -p, --period N          Hardware period in frames, default the frames per buffer\n"
+             "    -R, --ring N            Ring size in frames, default for the buffers in flight\n"
+             "    -b, --buffers N         Buffer count, default 8\n"
+             "    -w, --hold MS           Time the consumer holds each buffer, default 0\n"
+             "    -t, --time S            Seconds to capture, default 10\n"
+             "    -o, --output FILE       Write the raw S16 interleaved samples\n",
+             name);
+}
+
+// Capture from snd-aloop while something plays into it, periods of 256 batched 4 per buffer
+//./demo_alsa_capture -d hw:Loopback,1 -p 256 -t 30
+int main(int argc, char** argv)
+{
+    std::string device = "null";
+    CaptureMode mode = MODE_MMAP;
+    SampleInfo info;
+    info.fmt = SAMPLE_FMT_S16;
+    info.channels = 2;
+    info.sample_rate = 48000;
+    info.nb_samples = 1024;
+    int period = 0;
+    int ring = 0;
+    int buffers = 8;
+    int seconds = 10;
+    const char* output = NULL;
+    CaptureContext ctx = {};
+
+    static const struct option long_options[] = {
+        {"device", required_argument, NULL, 'd'},
+        {"mode", required_argument, NULL, 'm'},
+        {"rate", required_argument, NULL, 'r'},
+        {"channels", required_argument, NULL, 'c'},
+        {"samples", required_argument, NULL, 'n'},
+        {"period", required_argument, NULL, 'p'},
+        {"ring", required_argument, NULL, 'R'},
+        {"buffers", required_argument, NULL, 'b'},
+        {"hold", required_argument, NULL, 'w'},
+        {"time", required_argument, NULL, 't'},
+        {"output", required_argument, NULL, 'o'},
+        {"help", no_argument, NULL, 'h'},
+        {NULL, 0, NULL, 0},
+    };
+    int c;
+    while ((c = getopt_long(argc, argv, "d:m:r:c:n:p:R:b:w:t:o:h", long_options, NULL)) != -1) {
+        switch (c) {
+            case 'd':
+                device = optarg;
+                break;
+            case 'm':
+                if (strcmp(optarg, "mmap") == 0) {
+                    mode = MODE_MMAP;
+                } else if (strcmp(optarg, "copy") == 0) {
+                    mode = MODE_COPY;
+                } else if (strcmp(optarg, "read") == 0) {
+                    mode = MODE_READ;
+                } else {
+                    usage(argv[0]);
+                    return -1;
+                }
+                break;
+            case 'r':
+                info.sample_rate = atoi(optarg);
+                break;
+            case 'c':
+                info.channels = atoi(optarg);
+                break;
+            case 'n':
+                info.nb_samples = atoi(optarg);
+                break;
+            case 'p':
+                period = atoi(optarg);
+                break;
+            case 'R':
+                ring = atoi(optarg);
+                break;
+            case 'b':
+                buffers = atoi(optarg);
+                break;
+            case 'w':
+                ctx.hold_ms = atoi(optarg);
+                break;
+            case 't':
+                seconds = atoi(optarg);
+                break;
+            case 'o':
+                output = optarg;
+                break;
+            default:
+                usage(argv[0]);
+                return c == 'h' ? 0 : -1;
+        }
+    }
+    if (info.channels <= 0 || info.sample_rate <= 0 || info.nb_samples <= 0 || buffers <= 0) {
+        usage(argv[0]);
+        return -1;
+    }
+
+    ctx.frame_bytes = 2 * info.channels;
+    if (output) {
+        ctx.output = fopen(output, "wb");
+        if (ctx.output == NULL) {
+            ff_error("Failed to open %s\n", output);
+            return -1;
+        }
+    }
+
+    shared_ptr<ModuleMedia> capture;
+    shared_ptr<ModuleAlsaMmapCapture> mmap_capture;
+    if (mode == MODE_READ) {
+        capture = make_shared<ModuleAlsaCapture>(device, info);
+    } else {
+        mmap_capture = make_shared<ModuleAlsaMmapCapture>(device, info);
+        mmap_capture->setPeriodSize(period);
+        mmap_capture->setRingSize(ring);
+        mmap_capture->setZeroCopy(mode == MODE_MMAP);
+        capture = mmap_capture;
+    }
+    capture->setBufferCount(buffers);
+    if (capture->init() < 0) {
+        ff_error("capture init failed\n");
+        return -1;
+    }
+    capture->setOutputDataCallback(&ctx, callback_capture);
+
+    signal(SIGINT, sigterm_handler);
+    signal(SIGTERM, sigterm_handler);
+
+    auto begin = std::chrono::steady_clock::now();
+    capture->start();
+    for (int i = 0; i < seconds * 10 && !quit; i++)
+        usleep(100000);
+    capture->stop();
+    double elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - begin).count();
+
+    if (ctx.output)
+        fclose(ctx.output);
+
+    ff_info("%s: %" PRIu64 " buffers, %" PRIu64 " frames in %.2f s (%.0f frames/s), pts span %.2f s, max gap %.1f ms"
+            " (nominal %.1f ms)\n",
+            device.c_str(), ctx.buffers, ctx.frames, elapsed, ctx.frames / elapsed,
+            (ctx.last_pts - ctx.first_pts) / 1e6, ctx.max_gap / 1e3, info.nb_samples * 1e3 / info.sample_rate);
+    if (mmap_capture)
+        mmap_capture->dumpStats();
+    return 0;
+}
@@ -6,35 +6,59 @@
 #include "module/vi/module_memReader.hpp"
 #include "module/vp/module_mppdec.hpp"
 #include "module/vo/module_drmDisplay.hpp"
+#include "annexb.hpp"
 
 
-int H264ReadFrame(FILE* fp, char* in_buf, int in_buf_size)
-{
-    int bytes_used = 0, block_size = 4096;
-    size_t seek = ftell(fp);
-    bool is_find_end = false;
-    int i = 5;  // Skip the first startcode
-
-    while (!is_find_end) {
-        if (in_buf_size < bytes_used + block_size)
-            break;
-        size_t bytes_read = fread(&in_buf[bytes_used], 1, block_size, fp);
-        if (bytes_read == 0) {
-            return bytes_used;
-        }
-
-        bytes_used += bytes_read;
+typedef struct {
+    FILE* fp;
+    uint8_t* buf;
+    size_t buf_size;
+    size_t begin;   // first byte not returned yet
+    size_t filled;
+} FrameReader;
 
-        for (; i < bytes_used - 4; i++) {
-            if (in_buf[i] == 0 && in_buf[i + 1] == 0 && in_buf[i + 2] == 0 && in_buf[i + 3] == 1) {
-                is_find_end = true;
-                break;
+// Return the next access unit of a H.264 Annex-B file, it stays valid until the next call.
+// The file is read in large blocks, data is only moved when the buffer is full.
+int H264ReadFrame(FrameReader* r, uint8_t** frame)
+{
+    size_t scan = r->begin;
+    bool seen_vcl = false;
+
+    while (true) {
+        const uint8_t* end = r->buf + r->filled;
+        const uint8_t* sc = AnnexB::findStartCode(r->buf + scan, end);
+
+        if (sc + 6 <= end) {
+            scan = sc + 3 - r->buf;
+            if (seen_vcl && AnnexB::startsAccessUnit(AnnexB::CODEC_H264, sc + 3, end - sc - 3)) {
+                const uint8_t* next = sc > r->buf + r->begin && sc[-1] == 0 ? sc - 1 : sc;
+                *frame = r->buf + r->begin;
+                int bytes = next - *frame;
+                r->begin = next - r->buf;
+                return bytes;
             }
+            seen_vcl |= AnnexB::isVcl(AnnexB::CODEC_H264, sc[3] & 0x1f);
+            continue;
+        }
+        // A start code cut by the end of the data is found again after the next read.
+        scan = sc < end ? sc - r->buf : std::max(scan, r->filled > 2 ? r->filled - 2 : 0);
+
+        if (r->filled == r->buf_size && r->begin > 0) {
+            memmove(r->buf, r->buf + r->begin, r->filled - r->begin);
+            r->filled -= r->begin;
+            scan -= r->begin;
+            r->begin = 0;
+        }
+        size_t bytes_read = fread(r->buf + r->filled, 1, r->buf_size - r->filled, r->fp);
+        r->filled += bytes_read;
+        if (bytes_read == 0) {
+            // End of file, or an access unit larger than the buffer.
+            *frame = r->buf + r->begin;
+            int bytes = r->filled - r->begin;
+            r->begin = r->filled = 0;
+            return bytes;
         }
     }
-
-    fseek(fp, seek + i, SEEK_SET);
-    return i;
 }
 
 
@@ -46,8 +70,9 @@ int main(int argc, char** argv)
     shared_ptr<ModuleMppDec> dec = NULL;
     shared_ptr<ModuleDrmDisplay> drm_display = NULL;
     uint32_t width, height;
-    char* buf = nullptr;
+    uint8_t* buf = nullptr;
     uint32_t buf_size;
+    FrameReader reader;
     FILE* fp = nullptr;
 
     if (argc < 4) {
@@ -68,7 +93,8 @@ int main(int argc, char** argv)
             ff_error("Image size error\n");
             break;
         }
-        buf = new char[buf_size];
+        buf = new uint8_t[buf_size];
+        reader = {fp, buf, buf_size, 0, 0};
 
         // 1. memory reader module
         ImagePara input_para = ImagePara(width, height, width, height, V4L2_PIX_FMT_H264);
@@ -114,11 +140,12 @@ int main(int argc, char** argv)
         mem_r->start();
 
         while (true) {
-            int bytes = H264ReadFrame(fp, buf, buf_size);
+            uint8_t* frame;
+            int bytes = H264ReadFrame(&reader, &frame);
             if (bytes == 0)
                 break;
 
-            ret = mem_r->setInputBuffer(buf, bytes);
+            ret = mem_r->setInputBuffer(frame, bytes);
             if (ret != 0) {
                 ff_error("Failed to set the input buf\n");
                 break;
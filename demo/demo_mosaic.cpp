@@ -0,0 +1,97 @@
+#include <stdio.h>
+#include <stdarg.h>
+#include <stdlib.h>
+#include <math.h>
+
+#include "rgaMosaic.hpp"
+#include "module/vi/module_rtspClient.hpp"
+#include "module/vp/module_mppdec.hpp"
+#include "module/vp/module_mppenc.hpp"
+#include "module/vo/module_rtspServer.hpp"
+
+//./demo_mosaic rtsp://xxx rtsp://yyy ...
+int main(int argc, char** argv)
+{
+    int ret;
+    vector<shared_ptr<ModuleRtspClient>> rtsp_cs;
+    vector<shared_ptr<ModuleMedia>> decs;
+    shared_ptr<ModuleRgaMosaic> mosaic = NULL;
+    shared_ptr<ModuleMppEnc> enc = NULL;
+    shared_ptr<ModuleRtspServer> rtsp_s = NULL;
+    ImagePara input_para;
+
+    if (argc < 2 || argc > 17) {
+        ff_error("Usage: %s rtsp_url [rtsp_url ...], up to 16 urls\n", argv[0]);
+        return -1;
+    }
+
+    // 1. rtsp client and dec module for every input
+    for (int i = 1; i < argc; i++) {
+        shared_ptr<ModuleRtspClient> rtsp_c = make_shared<ModuleRtspClient>(argv[i], RTSP_STREAM_TYPE_TCP);
+        ret = rtsp_c->init();
+        if (ret < 0) {
+            ff_error("rtsp client %s init failed\n", argv[i]);
+            return ret;
+        }
+
+        input_para = rtsp_c->getOutputImagePara();
+        shared_ptr<ModuleMppDec> dec = make_shared<ModuleMppDec>(input_para);
+        dec->setProductor(rtsp_c);
+        ret = dec->init();
+        if (ret < 0) {
+            ff_error("Dec init failed\n");
+            return ret;
+        }
+
+        rtsp_cs.push_back(rtsp_c);
+        decs.push_back(dec);
+    }
+
+    // 2. mosaic module, 1/4/9/16 way grid at 25fps, every cell updates at most 15 times per second
+    uint32_t grid = ceil(sqrt(decs.size()));
+    mosaic = make_shared<ModuleRgaMosaic>(ImagePara(1920, 1080, 1920, 1080, V4L2_PIX_FMT_NV12), 25);
+    mosaic->setBufferCount(4);
+    mosaic->setRgaSchedulerCore(ModuleRga::SCHEDULER_RGA3_DEFAULT);
+    ret = mosaic->addGrid(decs, grid, grid, 1000000 / 15);
+    if (ret < 0)
+        return ret;
+    ret = mosaic->init();
+    if (ret < 0) {
+        ff_error("mosaic init failed\n");
+        return ret;
+    }
+
+    // 3. one encoder for the overview stream
+    enc = make_shared<ModuleMppEnc>(ENCODE_TYPE_H264);
+    enc->setProductor(mosaic);
+    enc->setBufferCount(8);
+    enc->setDuration(0);
+    ret = enc->init();
+    if (ret < 0) {
+        ff_error("Enc init failed\n");
+        return ret;
+    }
+
+    rtsp_s = make_shared<ModuleRtspServer>("/live/mosaic", 8554);
+    rtsp_s->setProductor(enc);
+    rtsp_s->setBufferCount(0);
+    ret = rtsp_s->init();
+    if (ret < 0) {
+        ff_error("rtsp server init failed\n");
+        return ret;
+    }
+
+    // 4. start the compositor first, then the inputs
+    mosaic->start();
+    for (auto& rtsp_c : rtsp_cs)
+        rtsp_c->start();
+    mosaic->dumpPipe();
+
+    getchar();
+
+    mosaic->dumpStats();
+    for (auto& rtsp_c : rtsp_cs)
+        rtsp_c->stop();
+    mosaic->stop();
+    return 0;
+}
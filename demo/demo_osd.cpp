@@ -25,10 +25,14 @@ int main(int argc, char** argv)
     sigemptyset(&st);
     sigaddset(&st, SIGINT);
     sigaddset(&st, SIGTERM);
+    sigaddset(&st, SIGUSR1);
     sigprocmask(SIG_SETMASK, &st, NULL);
     while (true) {
         err = sigwait(&st, &sig);
-        if (err == 0) {
+        if (err == 0 && sig == SIGUSR1) {
+            // event recording trigger, e.g. from a GPIO or network script: kill -USR1 <pid>
+            osd->triggerEvent();
+        } else if (err == 0) {
             ff_info("receive sig: %d\n", sig);
             break;
         }
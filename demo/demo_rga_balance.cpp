@@ -0,0 +1,111 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <algorithm>
+#include <vector>
+
+#include "rgaBalancer.hpp"
+
+/*
+ * Off target run of the rga core balancer against the simulated backend:
+ * streams of frames arrive at their frame rate, each frame is queued on the
+ * core the balancer picks and completes after the frames before it on that
+ * core, in virtual time. Prints how the jobs spread over the cores, the
+ * deepest queue each core had, and where the jobs with buffers above 4 GB
+ * went (never to RGA2).
+ */
+
+struct Stream {
+    RgaCoreBalancer::Job job;
+    int64_t interval_us;
+    int64_t next_us;
+};
+
+struct CoreCount {
+    uint64_t jobs;
+    uint64_t above_4g;
+    uint32_t max_queue;
+};
+
+static RgaCoreBalancer::Job makeJob(uint32_t sw, uint32_t sh, uint32_t dw, uint32_t dh, bool above_4g)
+{
+    RgaCoreBalancer::Job job;
+    job.src = ImagePara(sw, sh, sw, sh, V4L2_PIX_FMT_NV12);
+    job.dst = ImagePara(dw, dh, dw, dh, V4L2_PIX_FMT_NV12);
+    job.above_4g = above_4g;
+    return job;
+}
+
+// 20 streams 1080p -> 360p at 30fps for 10s, half of them with buffers above 4 GB
+//./demo_rga_balance 20 10 50
+int main(int argc, char** argv)
+{
+    int stream_count = argc > 1 ? atoi(argv[1]) : 20;
+    int seconds = argc > 2 ? atoi(argv[2]) : 10;
+    int above_4g_percent = argc > 3 ? atoi(argv[3]) : 50;
+    if (stream_count <= 0 || seconds <= 0 || above_4g_percent < 0 || above_4g_percent > 100) {
+        ff_error("Usage: %s [streams] [seconds] [percent of streams with buffers above 4 GB]\n", argv[0]);
+        return -1;
+    }
+
+    // 1. the RK3588 core layout with made up but plausible costs, rga2 slower per pixel
+    RgaCoreBalancer balancer(std::vector<RgaCoreBalancer::Core>{
+        {ModuleRga::SCHEDULER_RGA3_CORE0, RgaCoreBalancer::CORE_RGA3},
+        {ModuleRga::SCHEDULER_RGA3_CORE1, RgaCoreBalancer::CORE_RGA3},
+        {ModuleRga::SCHEDULER_RGA2_CORE0, RgaCoreBalancer::CORE_RGA2},
+    });
+    RgaSimulatedBackend backend;
+    backend.setCoreCost(ModuleRga::SCHEDULER_RGA3_CORE0, 200, 1500);
+    backend.setCoreCost(ModuleRga::SCHEDULER_RGA3_CORE1, 200, 1500);
+    backend.setCoreCost(ModuleRga::SCHEDULER_RGA2_CORE0, 300, 4000);
+    balancer.setClock([&backend]() { return backend.now(); });
+
+    // 2. display scaling streams, spread over the frame interval, plus one thumbnail stream
+    //    scaled 12x down, which only rga2 can do
+    std::vector<Stream> streams;
+    for (int i = 0; i < stream_count; i++) {
+        bool above_4g = i * 100 < stream_count * above_4g_percent;
+        streams.push_back({makeJob(1920, 1080, 640, 360, above_4g), 1000000 / 30, i * 1000000 / 30 / stream_count});
+    }
+    streams.push_back({makeJob(1920, 1080, 160, 90, false), 1000000 / 5, 0});
+
+    // 3. one millisecond ticks of virtual time
+    std::vector<CoreCount> counts(3, CoreCount{0, 0, 0});
+    uint64_t rejected = 0;
+    int64_t end_us = seconds * 1000000LL;
+    for (int64_t t = 0; t < end_us; t += 1000) {
+        backend.advance(t);
+        for (auto& s : streams) {
+            while (s.next_us <= t) {
+                int index = backend.submit(balancer, s.job);
+                s.next_us += s.interval_us;
+                if (index < 0) {
+                    rejected++;
+                    continue;
+                }
+                counts[index].jobs++;
+                counts[index].above_4g += s.job.above_4g;
+            }
+        }
+        std::vector<RgaCoreBalancer::CoreStats> stats = balancer.getStats();
+        for (size_t i = 0; i < stats.size(); i++)
+            counts[i].max_queue = std::max(counts[i].max_queue, stats[i].queue_depth);
+    }
+    backend.advance(end_us);
+    size_t backlog = backend.pending();
+
+    uint64_t total = 0;
+    for (auto& c : counts)
+        total += c.jobs;
+    ff_info("%d streams of 1080p->360p at 30fps (%d%% above 4 GB) and a 1080p->160x90 thumbnail at 5fps, %d s\n",
+            stream_count, above_4g_percent, seconds);
+    ff_info("%" PRIu64 " jobs, %" PRIu64 " rejected, %zu still queued at the end\n", total, rejected, backlog);
+    std::vector<RgaCoreBalancer::CoreStats> stats = balancer.getStats();
+    for (size_t i = 0; i < stats.size(); i++) {
+        ff_info("    %s core 0x%x: %5.1f%% of the jobs (%" PRIu64 ", %" PRIu64 " above 4 GB), max queue %u, "
+                "utilization %.1f%%, %.0f us/Mpixel\n",
+                stats[i].type == RgaCoreBalancer::CORE_RGA3 ? "rga3" : "rga2", stats[i].core,
+                total ? counts[i].jobs * 100.0 / total : 0.0, counts[i].jobs, counts[i].above_4g, counts[i].max_queue,
+                stats[i].utilization * 100, stats[i].us_per_mpixel);
+    }
+    return 0;
+}
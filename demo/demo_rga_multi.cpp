@@ -0,0 +1,130 @@
+#include <stdio.h>
+#include <stdarg.h>
+#include <stdlib.h>
+#include <sys/stat.h>
+
+#include "rgaMulti.hpp"
+#include "module/vi/module_rtspClient.hpp"
+#include "module/vp/module_mppdec.hpp"
+#include "module/vp/module_mppenc.hpp"
+#include "module/vo/module_drmDisplay.hpp"
+#include "module/vo/module_rtspServer.hpp"
+
+void callback_analyse(void* ctx, shared_ptr<MediaBuffer> buffer)
+{
+    (void)ctx;
+    if (buffer == NULL || buffer->getMediaBufferType() != BUFFER_TYPE_VIDEO)
+        return;
+    shared_ptr<VideoBuffer> buf = static_pointer_cast<VideoBuffer>(buffer);
+
+    // flush dma buf to cpu
+    buf->invalidateDrmBuf();
+    ff_info("analyse frame %dx%d pts %" PRId64 "\n", buf->getImagePara().width,
+            buf->getImagePara().height, buf->getPUstimestamp());
+}
+
+//./demo_rga_multi rtsp://xxx
+int main(int argc, char** argv)
+{
+    int ret;
+    shared_ptr<ModuleRtspClient> rtsp_c = NULL;
+    shared_ptr<ModuleMppDec> dec = NULL;
+    shared_ptr<ModuleDrmDisplay> drm_display = NULL;
+    shared_ptr<ModuleMppEnc> enc = NULL;
+    shared_ptr<ModuleRtspServer> rtsp_s = NULL;
+    ModuleRgaMulti multi;
+    ModuleRgaMulti::OutputSpec spec;
+    int display_out, analyse_out, push_out;
+    ImagePara input_para;
+
+    if (argc < 2) {
+        ff_error("Usage: %s rtsp_url\n", argv[0]);
+        return -1;
+    }
+
+    // 1. rtsp client module
+    rtsp_c = make_shared<ModuleRtspClient>(argv[1], RTSP_STREAM_TYPE_TCP);
+    ret = rtsp_c->init();
+    if (ret < 0) {
+        ff_error("rtsp client init failed\n");
+        return ret;
+    }
+
+    // 2. dec module
+    input_para = rtsp_c->getOutputImagePara();
+    dec = make_shared<ModuleMppDec>(input_para);
+    dec->setProductor(rtsp_c);
+    ret = dec->init();
+    if (ret < 0) {
+        ff_error("Dec init failed\n");
+        return ret;
+    }
+
+    // 3. rga multi outputs, the decoded frame is read only by the largest output, the others cover less of it
+    multi.setProductor(dec);
+    multi.setRgaSchedulerCore(ModuleRga::SCHEDULER_RGA3_DEFAULT);
+
+    spec.para = ImagePara(1280, 720, 1280, 720, V4L2_PIX_FMT_NV12);
+    spec.buffer_count = 2;
+    display_out = multi.addOutput(spec);
+
+    spec.para = ImagePara(640, 360, 640, 360, V4L2_PIX_FMT_BGR24);
+    spec.duration = 1000000 / 5;
+    analyse_out = multi.addOutput(spec);
+
+    // 16:9 like the source, only the stride is rounded up to the 16 lines of the encoder
+    spec.para = ImagePara(960, 540, 960, 544, V4L2_PIX_FMT_NV12);
+    spec.duration = 0;
+    spec.buffer_count = 4;
+    push_out = multi.addOutput(spec);
+
+    ret = multi.init();
+    if (ret < 0) {
+        ff_error("rga multi init failed\n");
+        return ret;
+    }
+
+    // 4. drm display module
+    input_para = multi.getOutput(display_out)->getOutputImagePara();
+    drm_display = make_shared<ModuleDrmDisplay>(input_para);
+    drm_display->setPlanePara(V4L2_PIX_FMT_NV12);
+    drm_display->setProductor(multi.getOutput(display_out));
+    ret = drm_display->init();
+    if (ret < 0) {
+        ff_error("drm display init failed\n");
+        return ret;
+    }
+
+    // 5. analyse callback
+    multi.getOutput(analyse_out)->setOutputDataCallback(NULL, callback_analyse);
+
+    // 6. encode and push
+    enc = make_shared<ModuleMppEnc>(ENCODE_TYPE_H264);
+    enc->setProductor(multi.getOutput(push_out));
+    enc->setBufferCount(8);
+    enc->setDuration(0);
+    ret = enc->init();
+    if (ret < 0) {
+        ff_error("Enc init failed\n");
+        return ret;
+    }
+
+    rtsp_s = make_shared<ModuleRtspServer>("/live/0", 8554);
+    rtsp_s->setProductor(enc);
+    rtsp_s->setBufferCount(0);
+    ret = rtsp_s->init();
+    if (ret < 0) {
+        ff_error("rtsp server init failed\n");
+        return ret;
+    }
+
+    // 7. start origin producer
+    rtsp_c->start();
+    rtsp_c->dumpPipe();
+
+    getchar();
+
+    rtsp_c->dumpPipeSummary();
+    rtsp_c->stop();
+    return 0;
+}
@@ -0,0 +1,907 @@
+#include <arpa/inet.h>
+#include <fcntl.h>
+#include <getopt.h>
+#include <inttypes.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+#include <algorithm>
+#include <atomic>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "esReader.hpp"
+#include "rtspFanout.hpp"
+#include "rtspReceiver.hpp"
+#include "rtspUtil.hpp"
+#include "module/vi/module_rtspClient.hpp"
+#include "module/vi/module_rtmpClient.hpp"
+#include "module/vo/module_rtspServer.hpp"
+#include "module/vo/module_rtmpServer.hpp"
+
+/*
+ * Loopback streaming benchmark: a recorded H.264/H.265 elementary stream is
+ * served in realtime by one of the server modules, in a child process so
+ * its CPU time is its own, and N client sessions pull it. The result is
+ * written as JSON, one object per run, to compare server changes.
+ *
+ * Clients:
+ *   sink      lightweight RTP sink in this process, UDP or TCP interleaved,
+ *             all sessions read by one thread. Counts packets, bytes, lost
+ *             sequence numbers and the time from PLAY to the first complete
+ *             keyframe.
+ *   receiver  ModuleRtspReceiver sessions (UDP), counting output frames.
+ *   module    ModuleRtspClient or ModuleRtmpClient sessions, counting output
+ *             frames; loss is not visible there and is reported as null.
+ */
+
+#define SINK_BATCH         32
+#define SINK_PACKET_SIZE   2048
+#define SINK_KEEPALIVE_US  20000000
+#define SINK_REPLY_TIMEOUT 3
+
+enum ServerType { SERVER_FANOUT, SERVER_RTSP, SERVER_RTMP };
+enum ClientType { CLIENT_SINK, CLIENT_RECEIVER, CLIENT_MODULE };
+
+struct BenchConfig {
+    const char* input;
+    ImagePara para;
+    int fps;
+    ServerType server;
+    ClientType client;
+    bool tcp;
+    int clients;
+    int duration_s;
+    int ramp_ms;
+    int port;
+    const char* output;
+};
+
+struct ClientResult {
+    int id;
+    bool ok;
+    std::string error;
+    uint64_t packets;
+    uint64_t bytes;
+    int64_t lost;           // -1 if the client can not tell
+    uint64_t frames;
+    int64_t setup_us;       // connect to PLAY reply
+    int64_t first_packet_us;
+    int64_t first_frame_us; // first complete keyframe, from PLAY
+    int64_t active_us;      // from PLAY to the end of the run
+};
+
+struct Sink {
+    ClientResult result;
+    int ctrl_fd;
+    int rtp_fd;
+    int rtcp_fd;
+    int cseq;
+    std::string url;
+    std::string session;
+    std::string inbuf;      // TCP: RTSP replies and '$' frames
+    int64_t play_at;
+    int64_t last_keepalive;
+    bool have_seq;
+    uint16_t next_seq;
+    bool frame_key;
+    bool hevc;
+};
+
+struct ModuleSession {
+    ClientResult result;
+    shared_ptr<ModuleMedia> module;
+    shared_ptr<ModuleRtspReceiver> receiver;
+    int64_t play_at;
+    std::atomic<uint64_t> frames;
+    std::atomic<uint64_t> bytes;
+    std::atomic<int64_t> first_frame;
+};
+
+static volatile sig_atomic_t server_quit = 0;
+
+static int64_t steadyClockUs()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+static void onServerSignal(int)
+{
+    server_quit = 1;
+}
+
+/// @brief Run the server pipeline until SIGTERM, in the forked child.
+/// @param ready written one byte once the server listens
+static int runServer(const BenchConfig& conf, int ready)
+{
+    signal(SIGTERM, onServerSignal);
+    signal(SIGINT, SIG_IGN);
+
+    shared_ptr<ModuleEsReader> reader = make_shared<ModuleEsReader>(conf.para, conf.input, true);
+    reader->setProductor(NULL);
+    reader->setFrameRate(conf.fps);
+    reader->setRealtime(true);
+    if (reader->init() < 0) {
+        ff_error("es reader init failed\n");
+        return -1;
+    }
+
+    shared_ptr<ModuleRtspFanout> fanout;
+    shared_ptr<ModuleMedia> server;
+    if (conf.server == SERVER_FANOUT) {
+        fanout = make_shared<ModuleRtspFanout>("/live/0", conf.port);
+        server = fanout;
+    } else if (conf.server == SERVER_RTSP) {
+        server = make_shared<ModuleRtspServer>("/live/0", conf.port);
+    } else {
+        server = make_shared<ModuleRtmpServer>("/live/0", conf.port);
+    }
+    server->setProductor(reader);
+    server->setBufferCount(0);
+    if (server->init() < 0) {
+        ff_error("server init failed\n");
+        return -1;
+    }
+
+    reader->start();
+    char c = 1;
+    if (write(ready, &c, 1) != 1)
+        return -1;
+    close(ready);
+
+    while (!server_quit)
+        usleep(100000);
+    reader->stop();
+    if (fanout)
+        fanout->dumpStats();
+    return 0;
+}
+
+/// @brief CPU time of a process in microseconds and its resident size, from /proc.
+static bool processUsage(pid_t pid, int64_t* cpu_us, int64_t* rss_kb)
+{
+    char path[64];
+    snprintf(path, sizeof(path), "/proc/%d/stat", (int)pid);
+    FILE* f = fopen(path, "r");
+    if (f == NULL)
+        return false;
+    char line[1024];
+    bool ok = fgets(line, sizeof(line), f) != NULL;
+    fclose(f);
+    // The command name may contain spaces, the fields start after the last ')'.
+    char* p = ok ? strrchr(line, ')') : NULL;
+    if (p == NULL)
+        return false;
+
+    unsigned long utime = 0, stime = 0;
+    long rss = 0;
+    // Fields 14, 15 (utime, stime) and 24 (rss), counting from the pid.
+    if (sscanf(p + 2, "%*c %*d %*d %*d %*d %*d %*u %*u %*u %*u %*u %lu %lu %*d %*d %*d %*d %*d %*d %*u %*u %ld",
+               &utime, &stime, &rss)
+        != 3)
+        return false;
+    long ticks = sysconf(_SC_CLK_TCK);
+    *cpu_us = (int64_t)(utime + stime) * 1000000 / ticks;
+    *rss_kb = rss * (sysconf(_SC_PAGESIZE) / 1024);
+    return true;
+}
+
+static int64_t selfCpuUs()
+{
+    struct rusage ru;
+    getrusage(RUSAGE_SELF, &ru);
+    return (int64_t)(ru.ru_utime.tv_sec + ru.ru_stime.tv_sec) * 1000000 + ru.ru_utime.tv_usec + ru.ru_stime.tv_usec;
+}
+
+static int sendRequest(Sink* s, const char* method, const std::string& url, const std::string& headers)
+{
+    char head[512];
+    snprintf(head, sizeof(head), "%s %s RTSP/1.0\r\nCSeq: %d\r\n", method, url.c_str(), ++s->cseq);
+    std::string req = head;
+    if (!s->session.empty())
+        req += "Session: " + s->session + "\r\n";
+    req += headers + "\r\n";
+    return send(s->ctrl_fd, req.data(), req.size(), MSG_NOSIGNAL) == (ssize_t)req.size() ? 0 : -1;
+}
+
+/// @brief Send a request and wait for its reply; what follows the reply stays in inbuf.
+/// @return the status code, -1 on a socket error
+static int request(Sink* s, const char* method, const std::string& url, const std::string& headers,
+                   std::string* reply)
+{
+    if (sendRequest(s, method, url, headers) < 0)
+        return -1;
+
+    char buf[4096];
+    for (;;) {
+        // Interleaved data of an earlier PLAY may come before the reply.
+        while (!s->inbuf.empty() && s->inbuf[0] == '$') {
+            if (s->inbuf.size() < 4)
+                break;
+            size_t len = 4 + ((uint8_t)s->inbuf[2] << 8 | (uint8_t)s->inbuf[3]);
+            if (s->inbuf.size() < len)
+                break;
+            s->inbuf.erase(0, len);
+        }
+        size_t end = s->inbuf.empty() || s->inbuf[0] == '$' ? std::string::npos : s->inbuf.find("\r\n\r\n");
+        if (end != std::string::npos) {
+            std::string head = s->inbuf.substr(0, end + 4);
+            size_t body = atoi(RtspUtil::header(head, "Content-Length").c_str());
+            if (s->inbuf.size() >= end + 4 + body) {
+                *reply = s->inbuf.substr(0, end + 4 + body);
+                s->inbuf.erase(0, end + 4 + body);
+                int code = 0;
+                if (sscanf(reply->c_str(), "RTSP/1.0 %d", &code) != 1)
+                    return -1;
+                return code;
+            }
+        }
+        ssize_t n = recv(s->ctrl_fd, buf, sizeof(buf), 0);
+        if (n <= 0)
+            return -1;
+        s->inbuf.append(buf, n);
+    }
+}
+
+/// @brief A UDP port pair, RTP on an even port and RTCP on the next one.
+static int openUdpPair(Sink* s)
+{
+    for (int attempt = 0; attempt < 16; attempt++) {
+        int rtp = socket(AF_INET, SOCK_DGRAM, 0);
+        int rtcp = socket(AF_INET, SOCK_DGRAM, 0);
+        sockaddr_in addr;
+        memset(&addr, 0, sizeof(addr));
+        addr.sin_family = AF_INET;
+        addr.sin_addr.s_addr = htonl(INADDR_ANY);
+        socklen_t len = sizeof(addr);
+        if (bind(rtp, (sockaddr*)&addr, sizeof(addr)) == 0 && getsockname(rtp, (sockaddr*)&addr, &len) == 0
+            && (ntohs(addr.sin_port) & 1) == 0) {
+            addr.sin_port = htons(ntohs(addr.sin_port) + 1);
+            if (bind(rtcp, (sockaddr*)&addr, sizeof(addr)) == 0) {
+                int size = 2 * 1024 * 1024;
+                setsockopt(rtp, SOL_SOCKET, SO_RCVBUF, &size, sizeof(size));
+                fcntl(rtp, F_SETFL, O_NONBLOCK);
+                fcntl(rtcp, F_SETFL, O_NONBLOCK);
+                s->rtp_fd = rtp;
+                s->rtcp_fd = rtcp;
+                return ntohs(addr.sin_port) - 1;
+            }
+        }
+        close(rtp);
+        close(rtcp);
+    }
+    return -1;
+}
+
+/// @brief Open a sink session up to PLAY, blocking.
+static int openSink(Sink* s, const BenchConfig& conf)
+{
+    int64_t begin = steadyClockUs();
+    s->ctrl_fd = socket(AF_INET, SOCK_STREAM, 0);
+    timeval tv = {SINK_REPLY_TIMEOUT, 0};
+    setsockopt(s->ctrl_fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+    int one = 1;
+    setsockopt(s->ctrl_fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    if (conf.tcp) {
+        int size = 2 * 1024 * 1024;
+        setsockopt(s->ctrl_fd, SOL_SOCKET, SO_RCVBUF, &size, sizeof(size));
+    }
+    sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(conf.port);
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    if (connect(s->ctrl_fd, (sockaddr*)&addr, sizeof(addr)) < 0) {
+        s->result.error = "connect failed";
+        return -1;
+    }
+
+    std::string reply;
+    if (request(s, "DESCRIBE", s->url, "Accept: application/sdp\r\n", &reply) != 200) {
+        s->result.error = "DESCRIBE failed";
+        return -1;
+    }
+    std::string sdp = reply.substr(reply.find("\r\n\r\n") + 4);
+    s->hevc = sdp.find("H265/") != std::string::npos;
+
+    // The track control is the last a=control, after the session level one.
+    std::string control;
+    size_t pos = sdp.find("m=video");
+    pos = sdp.find("a=control:", pos == std::string::npos ? 0 : pos);
+    if (pos != std::string::npos)
+        control = sdp.substr(pos + 10, sdp.find_first_of("\r\n", pos) - pos - 10);
+    std::string base = RtspUtil::header(reply, "Content-Base");
+    if (base.empty())
+        base = s->url;
+    std::string track;
+    if (control.compare(0, 7, "rtsp://") == 0)
+        track = control;
+    else if (control.empty() || control == "*")
+        track = base;
+    else
+        track = base + (base.back() == '/' ? "" : "/") + control;
+
+    std::string transport;
+    if (conf.tcp) {
+        transport = "Transport: RTP/AVP/TCP;unicast;interleaved=0-1\r\n";
+    } else {
+        int port = openUdpPair(s);
+        if (port < 0) {
+            s->result.error = "no udp ports";
+            return -1;
+        }
+        transport = "Transport: RTP/AVP;unicast;client_port=" + std::to_string(port) + "-" + std::to_string(port + 1) + "\r\n";
+    }
+    if (request(s, "SETUP", track, transport, &reply) != 200) {
+        s->result.error = "SETUP failed";
+        return -1;
+    }
+    std::string session = RtspUtil::header(reply, "Session");
+    s->session = session.substr(0, session.find(';'));
+
+    s->play_at = steadyClockUs();
+    if (request(s, "PLAY", s->url, "Range: npt=0.000-\r\n", &reply) != 200) {
+        s->result.error = "PLAY failed";
+        return -1;
+    }
+    s->result.setup_us = s->play_at - begin;
+    s->last_keepalive = s->play_at;
+    fcntl(s->ctrl_fd, F_SETFL, O_NONBLOCK);
+    return 0;
+}
+
+static void closeSink(Sink* s)
+{
+    if (s->ctrl_fd >= 0 && s->result.ok)
+        sendRequest(s, "TEARDOWN", s->url, "");
+    if (s->ctrl_fd >= 0)
+        close(s->ctrl_fd);
+    if (s->rtp_fd >= 0)
+        close(s->rtp_fd);
+    if (s->rtcp_fd >= 0)
+        close(s->rtcp_fd);
+    s->ctrl_fd = s->rtp_fd = s->rtcp_fd = -1;
+}
+
+static bool isKeyNal(const uint8_t* payload, size_t size, bool hevc)
+{
+    if (hevc) {
+        if (size < 3)
+            return false;
+        int type = (payload[0] >> 1) & 0x3f;
+        if (type == 49)    // FU, the start of a keyframe NAL
+            type = payload[2] & 0x3f;
+        else if (type == 48 && size > 5)    // AP, first aggregated NAL
+            type = (payload[4] >> 1) & 0x3f;
+        return type >= 16 && type <= 21;
+    }
+    if (size < 2)
+        return false;
+    int type = payload[0] & 0x1f;
+    if (type == 28)
+        type = payload[1] & 0x1f;
+    else if (type == 24 && size > 3)
+        type = payload[3] & 0x1f;
+    return type == 5;
+}
+
+static void countPacket(Sink* s, const uint8_t* data, size_t size, int64_t now)
+{
+    if (size < 12 || (data[0] >> 6) != 2)
+        return;
+    int pt = data[1] & 0x7f;
+    if (pt >= 72 && pt <= 76)    // RTCP on the RTP channel
+        return;
+
+    ClientResult& r = s->result;
+    uint16_t seq = data[2] << 8 | data[3];
+    if (s->have_seq) {
+        int16_t delta = seq - s->next_seq;
+        if (delta > 0)
+            r.lost += delta;
+        if (delta >= 0)
+            s->next_seq = seq + 1;
+    } else {
+        s->have_seq = true;
+        s->next_seq = seq + 1;
+    }
+    if (r.packets++ == 0)
+        r.first_packet_us = now - s->play_at;
+    r.bytes += size;
+
+    size_t header = 12 + (data[0] & 0x0f) * 4;
+    if ((data[0] & 0x10) && size >= header + 4)
+        header += 4 + ((data[header + 2] << 8 | data[header + 3]) * 4);
+    if (header < size && isKeyNal(data + header, size - header, s->hevc))
+        s->frame_key = true;
+    if (data[1] & 0x80) {
+        r.frames++;
+        if (s->frame_key && r.first_frame_us < 0)
+            r.first_frame_us = now - s->play_at;
+        s->frame_key = false;
+    }
+}
+
+/// @brief Read what is pending for one sink, without blocking.
+static void readSink(Sink* s, std::vector<uint8_t>& pool, std::vector<mmsghdr>& msgs, std::vector<iovec>& iovs)
+{
+    int64_t now = steadyClockUs();
+    if (s->rtp_fd >= 0) {
+        for (;;) {
+            for (int i = 0; i < SINK_BATCH; i++) {
+                iovs[i].iov_base = &pool[i * SINK_PACKET_SIZE];
+                iovs[i].iov_len = SINK_PACKET_SIZE;
+                memset(&msgs[i].msg_hdr, 0, sizeof(msgs[i].msg_hdr));
+                msgs[i].msg_hdr.msg_iov = &iovs[i];
+                msgs[i].msg_hdr.msg_iovlen = 1;
+            }
+            int n = recvmmsg(s->rtp_fd, msgs.data(), SINK_BATCH, MSG_DONTWAIT, NULL);
+            if (n <= 0)
+                break;
+            for (int i = 0; i < n; i++)
+                countPacket(s, &pool[i * SINK_PACKET_SIZE], msgs[i].msg_len, now);
+            if (n < SINK_BATCH)
+                break;
+        }
+        // Sender reports are not looked at, only drained.
+        char sr[512];
+        while (recv(s->rtcp_fd, sr, sizeof(sr), MSG_DONTWAIT) > 0)
+            ;
+    }
+
+    // TCP: interleaved frames and RTSP replies on the control connection.
+    char buf[65536];
+    for (;;) {
+        ssize_t n = recv(s->ctrl_fd, buf, sizeof(buf), MSG_DONTWAIT);
+        if (n == 0) {
+            s->result.error = "closed by the server";
+            close(s->ctrl_fd);
+            s->ctrl_fd = -1;
+            return;
+        }
+        if (n < 0)
+            break;
+        s->inbuf.append(buf, n);
+        if (n < (ssize_t)sizeof(buf))
+            break;
+    }
+    size_t pos = 0;
+    while (pos < s->inbuf.size()) {
+        if (s->inbuf[pos] == '$') {
+            if (s->inbuf.size() - pos < 4)
+                break;
+            size_t len = (uint8_t)s->inbuf[pos + 2] << 8 | (uint8_t)s->inbuf[pos + 3];
+            if (s->inbuf.size() - pos < 4 + len)
+                break;
+            if (s->inbuf[pos + 1] == 0)
+                countPacket(s, (const uint8_t*)s->inbuf.data() + pos + 4, len, now);
+            pos += 4 + len;
+        } else {
+            // A keepalive reply, no body.
+            size_t end = s->inbuf.find("\r\n\r\n", pos);
+            if (end == std::string::npos)
+                break;
+            pos = end + 4;
+        }
+    }
+    s->inbuf.erase(0, pos);
+}
+
+/// @brief Poll all sink sockets until stop is set.
+static void sinkThread(std::vector<Sink*>* sinks, std::atomic_bool* stop)
+{
+    std::vector<uint8_t> pool(SINK_BATCH * SINK_PACKET_SIZE);
+    std::vector<mmsghdr> msgs(SINK_BATCH);
+    std::vector<iovec> iovs(SINK_BATCH);
+    std::vector<pollfd> fds;
+    std::vector<Sink*> owners;
+
+    while (!*stop) {
+        fds.clear();
+        owners.clear();
+        for (Sink* s : *sinks) {
+            if (s->ctrl_fd < 0)
+                continue;
+            fds.push_back({s->rtp_fd >= 0 ? s->rtp_fd : s->ctrl_fd, POLLIN, 0});
+            owners.push_back(s);
+            if (s->rtp_fd >= 0) {
+                fds.push_back({s->ctrl_fd, POLLIN, 0});
+                owners.push_back(s);
+            }
+        }
+        if (fds.empty()) {
+            usleep(10000);
+            continue;
+        }
+        if (poll(fds.data(), fds.size(), 100) < 0)
+            continue;
+
+        int64_t now = steadyClockUs();
+        Sink* last_read = NULL;
+        for (size_t i = 0; i < fds.size(); i++) {
+            Sink* s = owners[i];
+            // readSink drains both sockets of a UDP sink, once is enough.
+            if ((fds[i].revents & (POLLIN | POLLERR | POLLHUP)) && s != last_read && s->ctrl_fd >= 0) {
+                readSink(s, pool, msgs, iovs);
+                last_read = s;
+            }
+            if (s->ctrl_fd >= 0 && now - s->last_keepalive > SINK_KEEPALIVE_US) {
+                s->last_keepalive = now;
+                sendRequest(s, "GET_PARAMETER", s->url, "");
+            }
+        }
+    }
+}
+
+static void callback_count(void* ctx, shared_ptr<MediaBuffer> buffer)
+{
+    ModuleSession* session = (ModuleSession*)ctx;
+    if (buffer == nullptr || buffer->getEos())
+        return;
+    int64_t expected = -1;
+    if (session->first_frame.load() < 0)
+        session->first_frame.compare_exchange_strong(expected, steadyClockUs() - session->play_at);
+    session->frames++;
+    session->bytes += buffer->getActiveSize();
+}
+
+/// @brief Start one ModuleRtspReceiver, ModuleRtspClient or ModuleRtmpClient session.
+static int openModule(ModuleSession* m, const BenchConfig& conf, const std::string& url)
+{
+    if (conf.client == CLIENT_RECEIVER) {
+        m->receiver = make_shared<ModuleRtspReceiver>(url, conf.para);
+        m->module = m->receiver;
+    } else if (conf.server == SERVER_RTMP) {
+        m->module = make_shared<ModuleRtmpClient>(url);
+    } else {
+        m->module = make_shared<ModuleRtspClient>(url, conf.tcp ? RTSP_STREAM_TYPE_TCP : RTSP_STREAM_TYPE_UDP);
+    }
+    m->module->setProductor(NULL);
+    m->play_at = steadyClockUs();
+    if (m->module->init() < 0) {
+        m->result.error = "init failed";
+        return -1;
+    }
+    m->result.setup_us = steadyClockUs() - m->play_at;
+    m->module->setOutputDataCallback(m, callback_count);
+    m->module->start();
+    return 0;
+}
+
+static void writeNumber(FILE* f, const char* name, int64_t value, bool valid = true)
+{
+    if (valid && value >= 0)
+        fprintf(f, "\"%s\": %" PRId64, name, value);
+    else
+        fprintf(f, "\"%s\": null", name);
+}
+
+static int64_t percentile(std::vector<int64_t> values, int pct)
+{
+    if (values.empty())
+        return -1;
+    std::sort(values.begin(), values.end());
+    return values[std::min(values.size() - 1, values.size() * pct / 100)];
+}
+
+static void writeJson(FILE* f, const BenchConfig& conf, const std::vector<ClientResult>& results, int64_t span_us,
+                      int64_t server_cpu_us, int64_t server_rss_kb, int64_t client_cpu_us)
+{
+    static const char* server_names[] = {"fanout", "rtsp", "rtmp"};
+    static const char* client_names[] = {"sink", "receiver", "module"};
+
+    uint64_t total_bytes = 0, total_packets = 0;
+    int64_t total_lost = 0;
+    int ok = 0;
+    bool loss_known = true;
+    std::vector<int64_t> kbps, first_frame;
+    for (auto& r : results) {
+        if (!r.ok)
+            continue;
+        ok++;
+        total_bytes += r.bytes;
+        total_packets += r.packets;
+        if (r.lost < 0)
+            loss_known = false;
+        else
+            total_lost += r.lost;
+        kbps.push_back(r.active_us > 0 ? (int64_t)(r.bytes * 8000 / r.active_us) : 0);
+        if (r.first_frame_us >= 0)
+            first_frame.push_back(r.first_frame_us / 1000);
+    }
+
+    fprintf(f, "{\n  \"input\": \"%s\",\n  \"server\": \"%s\",\n  \"client\": \"%s\",\n  \"transport\": \"%s\",\n",
+            conf.input, server_names[conf.server], client_names[conf.client], conf.tcp ? "tcp" : "udp");
+    fprintf(f, "  \"clients\": %d,\n  \"connected\": %d,\n  \"duration_ms\": %" PRId64 ",\n", conf.clients, ok,
+            span_us / 1000);
+    fprintf(f, "  \"server_cpu_percent\": %.1f,\n  \"server_rss_kb\": %" PRId64 ",\n  \"client_cpu_percent\": %.1f,\n",
+            span_us > 0 ? server_cpu_us * 100.0 / span_us : 0.0, server_rss_kb,
+            span_us > 0 ? client_cpu_us * 100.0 / span_us : 0.0);
+    fprintf(f, "  \"aggregate_kbps\": %" PRIu64 ",\n", span_us > 0 ? total_bytes * 8000 / span_us : 0);
+    fprintf(f, "  \"min_kbps\": %" PRId64 ",\n  \"max_kbps\": %" PRId64 ",\n",
+            kbps.empty() ? 0 : *std::min_element(kbps.begin(), kbps.end()),
+            kbps.empty() ? 0 : *std::max_element(kbps.begin(), kbps.end()));
+    if (loss_known && total_packets + total_lost > 0)
+        fprintf(f, "  \"loss_percent\": %.3f,\n", total_lost * 100.0 / (total_packets + total_lost));
+    else
+        fprintf(f, "  \"loss_percent\": null,\n");
+    fprintf(f, "  ");
+    writeNumber(f, "first_frame_ms_p50", percentile(first_frame, 50));
+    fprintf(f, ",\n  ");
+    writeNumber(f, "first_frame_ms_p95", percentile(first_frame, 95));
+    fprintf(f, ",\n  ");
+    writeNumber(f, "first_frame_ms_max", percentile(first_frame, 100));
+    fprintf(f, ",\n  \"sessions\": [\n");
+
+    for (size_t i = 0; i < results.size(); i++) {
+        const ClientResult& r = results[i];
+        fprintf(f, "    {\"id\": %d, \"ok\": %s, ", r.id, r.ok ? "true" : "false");
+        if (!r.error.empty())
+            fprintf(f, "\"error\": \"%s\", ", r.error.c_str());
+        fprintf(f, "\"kbps\": %" PRId64 ", \"bytes\": %" PRIu64 ", \"frames\": %" PRIu64 ", ",
+                r.active_us > 0 ? (int64_t)(r.bytes * 8000 / r.active_us) : 0, r.bytes, r.frames);
+        fprintf(f, "\"packets\": %" PRIu64 ", ", r.packets);
+        writeNumber(f, "lost", r.lost);
+        fprintf(f, ", ");
+        writeNumber(f, "setup_ms", r.setup_us / 1000, r.ok);
+        fprintf(f, ", ");
+        writeNumber(f, "first_packet_ms", r.first_packet_us < 0 ? -1 : r.first_packet_us / 1000);
+        fprintf(f, ", ");
+        writeNumber(f, "first_frame_ms", r.first_frame_us < 0 ? -1 : r.first_frame_us / 1000);
+        fprintf(f, "}%s\n", i + 1 < results.size() ? "," : "");
+    }
+    fprintf(f, "  ]\n}\n");
+}
+
+static void usage(const char* name)
+{
+    ff_error("Usage: %s file.h264|file.h265 [options]\n"
+             "    -i, --size WxH          Picture size of the stream, default 1920x1080\n"
+             "    -f, --fps N             Frame rate the file is served at, default 25\n"
+             "    -s, --server TYPE       fanout (default), rtsp or rtmp\n"
+             "    -k, --client TYPE       sink (default), receiver or module\n"
+             "    -t, --transport TYPE    udp (default) or tcp, for sink and module rtsp clients\n"
+             "    -n, --clients N         Number of client sessions, default 10\n"
+             "    -d, --duration S        Seconds to measure after the last client started, default 10\n"
+             "    -r, --ramp MS           Delay between client starts, default 10\n"
+             "    -p, --port N            Server port, default 8554 (1935 for rtmp)\n"
+             "    -o, --output FILE       JSON result, default stream_bench.json, - for stdout\n",
+             name);
+}
+
+// Serve a recorded stream on loopback and measure N clients pulling it
+//./demo_stream_bench test.h264 -s fanout -n 200 -t udp -d 30
+int main(int argc, char** argv)
+{
+    BenchConfig conf;
+    conf.para = ImagePara(1920, 1080, 1920, 1080, 0);
+    conf.fps = 25;
+    conf.server = SERVER_FANOUT;
+    conf.client = CLIENT_SINK;
+    conf.tcp = false;
+    conf.clients = 10;
+    conf.duration_s = 10;
+    conf.ramp_ms = 10;
+    conf.port = 0;
+    conf.output = "stream_bench.json";
+
+    static const struct option long_options[] = {
+        {"size", required_argument, NULL, 'i'},
+        {"fps", required_argument, NULL, 'f'},
+        {"server", required_argument, NULL, 's'},
+        {"client", required_argument, NULL, 'k'},
+        {"transport", required_argument, NULL, 't'},
+        {"clients", required_argument, NULL, 'n'},
+        {"duration", required_argument, NULL, 'd'},
+        {"ramp", required_argument, NULL, 'r'},
+        {"port", required_argument, NULL, 'p'},
+        {"output", required_argument, NULL, 'o'},
+        {"help", no_argument, NULL, 'h'},
+        {NULL, 0, NULL, 0},
+    };
+    int c;
+    while ((c = getopt_long(argc, argv, "i:f:s:k:t:n:d:r:p:o:h", long_options, NULL)) != -1) {
+        switch (c) {
+            case 'i':
+                if (sscanf(optarg, "%ux%u", &conf.para.width, &conf.para.height) != 2) {
+                    usage(argv[0]);
+                    return -1;
+                }
+                conf.para.hstride = conf.para.width;
+                conf.para.vstride = conf.para.height;
+                break;
+            case 'f':
+                conf.fps = atoi(optarg);
+                break;
+            case 's':
+                if (strcmp(optarg, "rtsp") == 0)
+                    conf.server = SERVER_RTSP;
+                else if (strcmp(optarg, "rtmp") == 0)
+                    conf.server = SERVER_RTMP;
+                else
+                    conf.server = SERVER_FANOUT;
+                break;
+            case 'k':
+                if (strcmp(optarg, "receiver") == 0)
+                    conf.client = CLIENT_RECEIVER;
+                else if (strcmp(optarg, "module") == 0)
+                    conf.client = CLIENT_MODULE;
+                else
+                    conf.client = CLIENT_SINK;
+                break;
+            case 't':
+                conf.tcp = strcmp(optarg, "tcp") == 0;
+                break;
+            case 'n':
+                conf.clients = std::max(1, atoi(optarg));
+                break;
+            case 'd':
+                conf.duration_s = std::max(1, atoi(optarg));
+                break;
+            case 'r':
+                conf.ramp_ms = std::max(0, atoi(optarg));
+                break;
+            case 'p':
+                conf.port = atoi(optarg);
+                break;
+            case 'o':
+                conf.output = optarg;
+                break;
+            default:
+                usage(argv[0]);
+                return -1;
+        }
+    }
+    if (optind >= argc) {
+        usage(argv[0]);
+        return -1;
+    }
+    conf.input = argv[optind];
+    conf.para.v4l2Fmt = strstr(conf.input, "265") || strstr(conf.input, "hevc") ? V4L2_PIX_FMT_HEVC : V4L2_PIX_FMT_H264;
+    if (conf.port == 0)
+        conf.port = conf.server == SERVER_RTMP ? 1935 : 8554;
+    if (conf.server == SERVER_RTMP && conf.client != CLIENT_MODULE) {
+        ff_warn("rtmp is only pulled by ModuleRtmpClient, using --client module\n");
+        conf.client = CLIENT_MODULE;
+    }
+    if (conf.client == CLIENT_RECEIVER && conf.tcp)
+        ff_warn("ModuleRtspReceiver receives over udp only\n");
+
+    // 1. server in a child process, started before any thread exists here
+    int pipefd[2];
+    if (pipe(pipefd) < 0)
+        return -1;
+    pid_t server_pid = fork();
+    if (server_pid < 0)
+        return -1;
+    if (server_pid == 0) {
+        close(pipefd[0]);
+        _exit(runServer(conf, pipefd[1]) < 0 ? 1 : 0);
+    }
+    close(pipefd[1]);
+    char ready = 0;
+    if (read(pipefd[0], &ready, 1) != 1) {
+        ff_error("server failed to start\n");
+        waitpid(server_pid, NULL, 0);
+        return -1;
+    }
+    close(pipefd[0]);
+
+    char url[128];
+    snprintf(url, sizeof(url), "%s://127.0.0.1:%d/live/0", conf.server == SERVER_RTMP ? "rtmp" : "rtsp", conf.port);
+
+    int64_t cpu_begin = 0, rss_kb = 0;
+    processUsage(server_pid, &cpu_begin, &rss_kb);
+    int64_t self_begin = selfCpuUs();
+    int64_t begin = steadyClockUs();
+
+    // 2. clients, started one by one
+    std::vector<Sink*> sinks;
+    std::vector<ModuleSession*> modules;
+    std::atomic_bool stop(false);
+    std::vector<Sink*> running;
+    std::thread reader;
+
+    if (conf.client == CLIENT_SINK) {
+        for (int i = 0; i < conf.clients; i++) {
+            Sink* s = new Sink();
+            s->result.id = i;
+            s->result.lost = 0;
+            s->result.first_packet_us = s->result.first_frame_us = -1;
+            s->ctrl_fd = s->rtp_fd = s->rtcp_fd = -1;
+            s->url = url;
+            s->result.ok = openSink(s, conf) == 0;
+            if (!s->result.ok)
+                closeSink(s);
+            sinks.push_back(s);
+            if (conf.ramp_ms)
+                usleep(conf.ramp_ms * 1000);
+        }
+        // The sessions are complete before the thread reads them, nothing is added after.
+        running = sinks;
+        reader = std::thread(sinkThread, &running, &stop);
+    } else {
+        for (int i = 0; i < conf.clients; i++) {
+            ModuleSession* m = new ModuleSession();
+            m->result.id = i;
+            m->result.lost = conf.client == CLIENT_RECEIVER ? 0 : -1;
+            m->result.first_packet_us = -1;
+            m->frames = 0;
+            m->bytes = 0;
+            m->first_frame = -1;
+            m->result.ok = openModule(m, conf, url) == 0;
+            modules.push_back(m);
+            if (conf.ramp_ms)
+                usleep(conf.ramp_ms * 1000);
+        }
+    }
+    ff_info("%d clients started in %" PRId64 " ms, measuring for %d s\n", conf.clients,
+            (steadyClockUs() - begin) / 1000, conf.duration_s);
+
+    // 3. measure
+    sleep(conf.duration_s);
+    int64_t end = steadyClockUs();
+    int64_t cpu_end = cpu_begin;
+    processUsage(server_pid, &cpu_end, &rss_kb);
+    int64_t self_end = selfCpuUs();
+
+    std::vector<ClientResult> results;
+    if (conf.client == CLIENT_SINK) {
+        stop = true;
+        reader.join();
+        for (Sink* s : sinks) {
+            if (s->result.ok)
+                s->result.active_us = end - s->play_at;
+            if (s->result.ok && s->ctrl_fd < 0)
+                s->result.ok = false;
+            closeSink(s);
+            results.push_back(s->result);
+            delete s;
+        }
+    } else {
+        for (ModuleSession* m : modules) {
+            if (m->result.ok) {
+                m->module->stop();
+                m->result.active_us = end - m->play_at;
+                m->result.frames = m->frames;
+                m->result.bytes = m->bytes;
+                m->result.first_frame_us = m->first_frame;
+                if (m->receiver) {
+                    ModuleRtspReceiver::Stats stats = m->receiver->getStats();
+                    m->result.packets = stats.packets;
+                    m->result.lost = stats.lost;
+                }
+            }
+            results.push_back(m->result);
+            delete m;
+        }
+    }
+
+    kill(server_pid, SIGTERM);
+    waitpid(server_pid, NULL, 0);
+
+    // 4. report
+    FILE* f = strcmp(conf.output, "-") == 0 ? stdout : fopen(conf.output, "w");
+    if (f == NULL) {
+        ff_error("open %s failed\n", conf.output);
+        return -1;
+    }
+    writeJson(f, conf, results, end - begin, cpu_end - cpu_begin, rss_kb, self_end - self_begin);
+    if (f != stdout) {
+        fclose(f);
+        ff_info("result written to %s\n", conf.output);
+    }
+    return 0;
+}
@@ -0,0 +1,91 @@
+#include <stdio.h>
+#include <stdarg.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <atomic>
+
+#include "temporalLayer.hpp"
+#include "module/vi/module_fileReader.hpp"
+
+struct SinkCount {
+    int target_fps;
+    shared_ptr<ModuleTemporalFilter> filter;
+    shared_ptr<ModuleMedia> tap;
+    uint64_t frames;
+    int64_t first_pts;
+    int64_t last_pts;
+};
+
+static std::atomic_bool eos(false);
+
+static void callback_count(void* ctx, shared_ptr<MediaBuffer> buffer)
+{
+    SinkCount* sink = (SinkCount*)ctx;
+    if (buffer == nullptr)
+        return;
+    if (buffer->getEos()) {
+        eos = true;
+        return;
+    }
+
+    int64_t pts = buffer->getPUstimestamp();
+    if (sink->frames++ == 0)
+        sink->first_pts = pts;
+    sink->last_pts = pts;
+}
+
+// Route a recorded temporally layered H.264/H.265 stream to one sink per target fps
+//./demo_temporal file.mp4 120 60 30
+int main(int argc, char** argv)
+{
+    int ret;
+    shared_ptr<ModuleFileReader> reader = NULL;
+    vector<SinkCount*> sinks;
+
+    if (argc < 3) {
+        ff_error("Usage: %s file target_fps [target_fps ...]\n", argv[0]);
+        return -1;
+    }
+
+    // 1. file reader, one pass over the recording
+    reader = make_shared<ModuleFileReader>(argv[1], false);
+    ret = reader->init();
+    if (ret < 0) {
+        ff_error("file reader init failed\n");
+        return ret;
+    }
+
+    // 2. one temporal filter per sink, each counting what it forwards
+    for (int i = 2; i < argc; i++) {
+        SinkCount* sink = new SinkCount();
+        sink->target_fps = atoi(argv[i]);
+        sink->filter = make_shared<ModuleTemporalFilter>();
+        sink->filter->setTargetFps(sink->target_fps);
+        sink->filter->setProductor(reader);
+        ret = sink->filter->init();
+        if (ret < 0) {
+            ff_error("temporal filter init failed\n");
+            return ret;
+        }
+
+        char name[32];
+        snprintf(name, sizeof(name), "sink_%dfps", sink->target_fps);
+        sink->tap = sink->filter->addExternalConsumer(name, sink, callback_count);
+        sinks.push_back(sink);
+    }
+
+    // 3. run until the end of the file
+    reader->start();
+    while (!eos)
+        usleep(100000);
+    reader->stop();
+
+    for (auto sink : sinks) {
+        double span = (sink->last_pts - sink->first_pts) / 1000000.0;
+        ff_info("target %d fps: %" PRIu64 " frames, %.1f fps\n", sink->target_fps, sink->frames,
+                span > 0 ? (sink->frames - 1) / span : 0.0);
+        sink->filter->dumpStats();
+        delete sink;
+    }
+    return 0;
+}
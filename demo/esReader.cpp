@@ -0,0 +1,257 @@
+#include <chrono>
+#include <algorithm>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "esReader.hpp"
+
+#define ES_DEFAULT_SEGMENT_SIZE (2 << 20)
+#define ES_DEFAULT_FPS 25
+
+static int64_t steadyClockUs()
+{
+    return std::chrono::duration_cast<std::chrono::microseconds>(
+               std::chrono::steady_clock::now().time_since_epoch())
+        .count();
+}
+
+ModuleEsReader::ModuleEsReader(const ImagePara& para, const std::string& path, bool loop_play)
+    : ModuleMedia("EsReader"), path(path), loop(loop_play), realtime(false), fps(ES_DEFAULT_FPS),
+      segment_size(ES_DEFAULT_SEGMENT_SIZE), codec(AnnexB::CODEC_H264), fd(-1), eof(false), cur(0),
+      au_begin(0), scan(0), seen_vcl(false), frames(0), start_clock(0), read_bytes(0), copied_bytes(0),
+      read_calls(0)
+{
+    output_para = para;
+    media_type = BUFFER_TYPE_VIDEO;
+}
+
+ModuleEsReader::~ModuleEsReader()
+{
+    if (fd > 0)
+        close(fd);
+}
+
+int ModuleEsReader::init()
+{
+    switch (output_para.v4l2Fmt) {
+        case V4L2_PIX_FMT_H264:
+            codec = AnnexB::CODEC_H264;
+            break;
+        case V4L2_PIX_FMT_HEVC:
+            codec = AnnexB::CODEC_H265;
+            break;
+        default:
+            ff_error("Es reader supports H264 and HEVC only\n");
+            return -1;
+    }
+
+    fd = path == "-" ? STDIN_FILENO : open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        ff_error("Failed to open %s: %s\n", path.c_str(), strerror(errno));
+        return -1;
+    }
+    posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+
+    int ret = initBuffer();
+    if (ret < 0) {
+        ff_error("Es reader buffer init failed\n");
+        return ret;
+    }
+
+    initialize = true;
+    return 0;
+}
+
+/// @brief The buffers only point into the segments, which are allocated on first use
+int ModuleEsReader::initBuffer()
+{
+    if (buffer_count == 0)
+        buffer_count = 8;
+
+    buffer_pool.clear();
+    buffer_ptr_queue.clear();
+    for (uint16_t i = 0; i < buffer_count; i++) {
+        shared_ptr<MediaBuffer> buffer = make_shared<MediaBuffer>(0);
+        buffer->setIndex(i);
+        buffer->setMediaBufferType(BUFFER_TYPE_VIDEO);
+        buffer_pool.push_back(buffer);
+        buffer_ptr_queue.push_back(buffer);
+    }
+
+    // Each buffer holds at most one segment, one more is read into and one is free to carry into.
+    segments.assign(buffer_count + 2, Segment{{}, 0, 0});
+    segments[cur].data.resize(segment_size);
+    return 0;
+}
+
+void ModuleEsReader::release(MediaBuffer* buffer)
+{
+    auto it = in_flight.find(buffer);
+    if (it == in_flight.end())
+        return;
+    segments[it->second].refs--;
+    in_flight.erase(it);
+}
+
+/// @brief Move the unfinished access unit to the start of a free segment
+int ModuleEsReader::carry()
+{
+    size_t next = segments.size();
+    if (segments[cur].refs == 0) {
+        next = cur;
+    } else {
+        for (size_t i = 0; i < segments.size(); i++) {
+            if (segments[i].refs == 0) {
+                next = i;
+                break;
+            }
+        }
+    }
+    if (next == segments.size())
+        return -1;
+
+    Segment& from = segments[cur];
+    Segment& to = segments[next];
+    size_t len = from.size - au_begin;
+    // An access unit larger than half a segment gets a segment twice its size.
+    size_t size = std::max(segment_size, len * 2);
+    if (to.data.size() < size)
+        to.data.resize(size);
+
+    memmove(to.data.data(), from.data.data() + au_begin, len);
+    if (next != cur)
+        copied_bytes += len;
+    to.size = len;
+    scan -= au_begin;
+    au_begin = 0;
+    cur = next;
+    return 0;
+}
+
+/// @brief Read into the rest of the current segment
+/// @return bytes read, 0 at the end of the stream, -1 on error
+int ModuleEsReader::fill()
+{
+    Segment& s = segments[cur];
+    ssize_t ret;
+    do {
+        ret = read(fd, s.data.data() + s.size, s.data.size() - s.size);
+    } while (ret < 0 && errno == EINTR);
+
+    if (ret < 0) {
+        ff_error("Failed to read %s: %s\n", path.c_str(), strerror(errno));
+        return -1;
+    }
+    s.size += ret;
+    read_bytes += ret;
+    read_calls++;
+    return ret;
+}
+
+/// @brief Start the file over, a pipe can not be rewound
+int ModuleEsReader::rewind()
+{
+    if (lseek(fd, 0, SEEK_SET) < 0)
+        return -1;
+    eof = false;
+    au_begin = scan = segments[cur].size;
+    seen_vcl = false;
+    return 0;
+}
+
+/// @brief Cut the next access unit from the stream
+/// @return false at the end of the stream
+bool ModuleEsReader::nextAccessUnit(size_t* begin, size_t* end)
+{
+    while (true) {
+        Segment& s = segments[cur];
+        const uint8_t* base = s.data.data();
+        const uint8_t* data_end = base + s.size;
+        const uint8_t* sc = AnnexB::findStartCode(base + scan, data_end);
+
+        // Three header bytes decide whether the NAL starts an access unit.
+        if (sc + 6 <= data_end) {
+            const uint8_t* nal = sc > base + au_begin && sc[-1] == 0 ? sc - 1 : sc;
+            bool vcl = AnnexB::isVcl(codec, codec == AnnexB::CODEC_H264 ? sc[3] & 0x1f : (sc[3] >> 1) & 0x3f);
+            scan = sc + 3 - base;
+            if (seen_vcl && AnnexB::startsAccessUnit(codec, sc + 3, data_end - sc - 3)) {
+                *begin = au_begin;
+                *end = nal - base;
+                au_begin = nal - base;
+                seen_vcl = vcl;
+                return true;
+            }
+            seen_vcl |= vcl;
+            continue;
+        }
+
+        // A start code cut by the end of the data is found again once more is read.
+        scan = sc < data_end ? sc - base : std::max(scan, s.size > 2 ? s.size - 2 : 0);
+
+        if (eof) {
+            if (au_begin == s.size)
+                return false;
+            *begin = au_begin;
+            *end = s.size;
+            au_begin = scan = s.size;
+            seen_vcl = false;
+            return true;
+        }
+
+        if (s.size == s.data.size() && carry() < 0) {
+            ff_error("No free segment to read %s into\n", path.c_str());
+            return false;
+        }
+        if (fill() <= 0)
+            eof = true;
+    }
+}
+
+ModuleMedia::ProduceResult ModuleEsReader::doProduce(shared_ptr<MediaBuffer> buffer)
+{
+    if (buffer == nullptr)
+        return PRODUCE_FAILED;
+
+    // The framework hands out a buffer only once every consumer is done with it.
+    release(buffer.get());
+
+    size_t begin, end;
+    if (!nextAccessUnit(&begin, &end)) {
+        if (!loop || rewind() < 0 || !nextAccessUnit(&begin, &end)) {
+            buffer->setActiveData(nullptr);
+            buffer->setActiveSize(0);
+            buffer->setEos(true);
+            return PRODUCE_EOS;
+        }
+    }
+
+    Segment& s = segments[cur];
+    s.refs++;
+    in_flight[buffer.get()] = cur;
+
+    int64_t pts = frames * 1000000 / fps;
+    buffer->setEos(false);
+    buffer->setActiveData(s.data.data() + begin);
+    buffer->setActiveSize(end - begin);
+    buffer->setPUstimestamp(pts);
+    buffer->setDUstimestamp(pts);
+    frames++;
+
+    if (realtime) {
+        if (start_clock == 0)
+            start_clock = steadyClockUs();
+        int64_t wait = start_clock + pts - steadyClockUs();
+        if (wait > 0)
+            usleep(wait);
+    }
+    return PRODUCE_SUCCESS;
+}
+
+void ModuleEsReader::dumpStats()
+{
+    ff_info("es reader %s: %" PRIu64 " access units, %" PRIu64 " bytes in %" PRIu64 " reads, %" PRIu64
+            " bytes carried between segments\n",
+            path.c_str(), frames, read_bytes, read_calls, copied_bytes);
+}
@@ -0,0 +1,75 @@
+#pragma once
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "module/module_media.hpp"
+#include "annexb.hpp"
+
+/*
+ * H.264/H.265 Annex-B elementary stream source, from a file or a pipe.
+ *
+ * The stream is read in large blocks into a few segments and cut into
+ * access units at an AUD, a parameter set or SEI NAL, or the first slice
+ * of a picture once a slice was seen. Every output buffer points at one
+ * access unit inside a segment, so a segment is refilled only after all
+ * buffers pointing into it came back. The unfinished access unit at the
+ * end of a full segment is the only data copied.
+ */
+class ModuleEsReader : public ModuleMedia
+{
+public:
+    // path "-" reads stdin, para gives the size and the format, H264 or HEVC.
+    ModuleEsReader(const ImagePara& para, const std::string& path, bool loop_play = false);
+    ~ModuleEsReader();
+
+    // Timestamps are generated from the frame rate, the stream carries none.
+    void setFrameRate(int _fps) { fps = _fps > 0 ? _fps : fps; }
+    // Pace the output by the timestamps, otherwise as fast as it is consumed.
+    void setRealtime(bool enable) { realtime = enable; }
+    void setSegmentSize(size_t bytes) { segment_size = bytes; }
+
+    int init() override;
+    void dumpStats();
+
+protected:
+    virtual ProduceResult doProduce(shared_ptr<MediaBuffer> buffer) override;
+    virtual int initBuffer() override;
+
+private:
+    struct Segment {
+        std::vector<uint8_t> data;
+        size_t size;        // bytes read into data
+        unsigned refs;      // buffers pointing into it
+    };
+
+    bool nextAccessUnit(size_t* begin, size_t* end);
+    int carry();
+    int fill();
+    int rewind();
+    void release(MediaBuffer* buffer);
+
+private:
+    std::string path;
+    bool loop;
+    bool realtime;
+    int fps;
+    size_t segment_size;
+    AnnexB::Codec codec;
+
+    int fd;
+    bool eof;
+    std::vector<Segment> segments;
+    size_t cur;
+    size_t au_begin;        // in the current segment
+    size_t scan;            // where the start code search resumes
+    bool seen_vcl;
+    std::unordered_map<MediaBuffer*, size_t> in_flight;
+
+    uint64_t frames;
+    int64_t start_clock;
+
+    uint64_t read_bytes;
+    uint64_t copied_bytes;
+    uint64_t read_calls;
+};
@@ -0,0 +1,336 @@
+#include <inttypes.h>
+#include <string.h>
+#include <algorithm>
+
+#include "eventRecorder.hpp"
+
+#define EVENT_DEFAULT_FRAGMENT 1000000
+
+ModuleEventRecorder::ModuleEventRecorder(NameGenerator generator, int64_t pre_roll_us, int64_t post_roll_us,
+                                         size_t ring_bytes)
+    : ModuleMedia("EventRecorder"), name_generator(generator), closed_callback(nullptr),
+      pre_roll(pre_roll_us), post_roll(post_roll_us), fragment_duration(EVENT_DEFAULT_FRAGMENT),
+      codec(AnnexB::CODEC_H264), audio_enabled(false), audio_channels(0), audio_sample_rate(0),
+      ring(ring_bytes), ring_head(0), next_seq(0), last_pts(0),
+      recording(false), need_open(false), file_open(false), cursor(0), stop_seq(UINT64_MAX), end_pts(0),
+      quit(false), worker(nullptr), events(0), evicted_unwritten(0)
+{
+    buffer_count = 0;
+}
+
+ModuleEventRecorder::~ModuleEventRecorder()
+{
+    if (worker) {
+        {
+            std::lock_guard<std::mutex> lk(mtx);
+            quit = true;
+            cond.notify_one();
+        }
+        worker->join();
+        delete worker;
+        worker = nullptr;
+    }
+}
+
+void ModuleEventRecorder::setVideoExtraData(const uint8_t* extra_data, unsigned extra_size)
+{
+    std::lock_guard<std::mutex> lk(mtx);
+    video_extra.assign(extra_data, extra_data + extra_size);
+}
+
+void ModuleEventRecorder::setAudioParameter(int channel_count, int bit_per_sample, int sample_rate, media_codec_t type)
+{
+    (void)bit_per_sample;
+    if (type != MEDIA_CODEC_AUDIO_AAC) {
+        ff_error("Event recorder only supports AAC audio\n");
+        return;
+    }
+    audio_enabled = true;
+    audio_channels = channel_count;
+    audio_sample_rate = sample_rate;
+}
+
+int ModuleEventRecorder::init()
+{
+    shared_ptr<ModuleMedia> productor = getProductor();
+    if (productor == nullptr || name_generator == nullptr) {
+        ff_error("Event recorder has no productor or file name generator\n");
+        return -1;
+    }
+
+    input_para = productor->getOutputImagePara();
+    media_type = productor->getMediaType();
+    if (input_para.v4l2Fmt == V4L2_PIX_FMT_H264) {
+        codec = AnnexB::CODEC_H264;
+    } else if (input_para.v4l2Fmt == V4L2_PIX_FMT_HEVC) {
+        codec = AnnexB::CODEC_H265;
+    } else {
+        ff_error("Event recorder does not support %s\n", v4l2GetFmtName(input_para.v4l2Fmt));
+        return -1;
+    }
+
+    worker = new std::thread(&ModuleEventRecorder::workerProcess, this);
+    return 0;
+}
+
+void ModuleEventRecorder::trigger()
+{
+    std::lock_guard<std::mutex> lk(mtx);
+    end_pts = last_pts + post_roll;
+    if (!recording) {
+        recording = true;
+        stop_seq = UINT64_MAX;
+        // A file still being finished just continues, otherwise start at the oldest GOP.
+        if (!file_open && !need_open) {
+            cursor = packets.empty() ? next_seq : packets.front().seq;
+            need_open = true;
+            events++;
+        }
+    }
+    cond.notify_one();
+}
+
+bool ModuleEventRecorder::isRecording()
+{
+    std::lock_guard<std::mutex> lk(mtx);
+    return recording || file_open || need_open;
+}
+
+/// @brief Drop the oldest GOP with the audio stored along with it
+void ModuleEventRecorder::evictGop()
+{
+    do {
+        if (packets.front().seq >= cursor && (file_open || need_open)) {
+            evicted_unwritten++;
+            cursor = packets.front().seq + 1;
+        }
+        packets.pop_front();
+    } while (!packets.empty() && !(packets.front().key && !packets.front().audio));
+
+    if (packets.empty())
+        ring_head = 0;
+}
+
+/// @brief Find room for a packet in the ring, evicting GOPs while there is none
+bool ModuleEventRecorder::reserve(size_t size, size_t* offset)
+{
+    if (size >= ring.size())
+        return false;
+
+    while (!packets.empty()) {
+        size_t tail = packets.front().offset;
+        bool wrapped = packets.back().offset < tail;
+
+        if (!wrapped) {
+            if (ring.size() - ring_head >= size) {
+                *offset = ring_head;
+                return true;
+            }
+            if (size < tail) {
+                *offset = 0;
+                return true;
+            }
+        } else if (tail - ring_head >= size) {
+            *offset = ring_head;
+            return true;
+        }
+        evictGop();
+    }
+
+    *offset = 0;
+    return true;
+}
+
+void ModuleEventRecorder::push(const uint8_t* data, size_t size, int64_t pts, bool key, bool audio)
+{
+    std::lock_guard<std::mutex> lk(mtx);
+
+    // The ring always starts at a video keyframe.
+    if (packets.empty() && !(key && !audio))
+        return;
+
+    if (!audio) {
+        last_pts = pts;
+        if (recording && pts > end_pts) {
+            recording = false;
+            stop_seq = next_seq;
+            cond.notify_one();
+        }
+    }
+
+    size_t offset;
+    if (!reserve(size, &offset)) {
+        ff_warn("Packet of %zu bytes does not fit the pre-event ring\n", size);
+        return;
+    }
+    memcpy(ring.data() + offset, data, size);
+    ring_head = offset + size;
+    packets.push_back({next_seq++, offset, size, pts, key, audio});
+
+    // Keep at least pre-roll, never drop what the worker still has to write.
+    while (!packets.empty()) {
+        auto next_gop = packets.begin() + 1;
+        while (next_gop != packets.end() && !(next_gop->key && !next_gop->audio))
+            next_gop++;
+        if (next_gop == packets.end() || next_gop->pts > last_pts - pre_roll)
+            break;
+        if ((file_open || need_open) && next_gop->seq > cursor)
+            break;
+        evictGop();
+    }
+
+    if (file_open && cursor < next_seq)
+        cond.notify_one();
+}
+
+void ModuleEventRecorder::workerProcess()
+{
+    shared_ptr<Fmp4Muxer> muxer = nullptr;
+    std::vector<uint8_t> data;
+    std::vector<Packet> batch;
+
+    std::unique_lock<std::mutex> lk(mtx);
+    while (!quit) {
+        if (need_open) {
+            std::vector<uint8_t> extra = video_extra;
+            lk.unlock();
+            std::string path = name_generator();
+            muxer = make_shared<Fmp4Muxer>(path);
+            muxer->setVideoTrack(codec, input_para.width, input_para.height);
+            if (!extra.empty())
+                muxer->setVideoExtraData(extra.data(), extra.size());
+            if (audio_enabled)
+                muxer->setAudioTrack(audio_channels, audio_sample_rate);
+            muxer->setFragmentDuration(fragment_duration);
+            if (muxer->open() < 0)
+                muxer = nullptr;
+            else
+                ff_info("Event recording to %s\n", path.c_str());
+            lk.lock();
+            need_open = false;
+            file_open = muxer != nullptr;
+            if (!file_open) {
+                recording = false;
+                continue;
+            }
+        }
+
+        uint64_t limit = std::min(next_seq, stop_seq);
+        if (file_open && cursor < limit) {
+            // Copy out under the lock, the ring may evict while the file is written. One GOP at
+            // a time, so a long pre-roll does not hold up push(); sequence numbers are contiguous,
+            // the cursor indexes the deque directly.
+            data.clear();
+            batch.clear();
+            size_t first = 0;
+            if (!packets.empty() && cursor > packets.front().seq)
+                first = std::min<uint64_t>(cursor - packets.front().seq, packets.size());
+            for (size_t i = first; i < packets.size(); i++) {
+                const Packet& p = packets[i];
+                if (p.seq >= limit || (i > first && p.key && !p.audio))
+                    break;
+                Packet c = p;
+                c.offset = data.size();
+                data.insert(data.end(), ring.begin() + p.offset, ring.begin() + p.offset + p.size);
+                batch.push_back(c);
+            }
+            cursor = batch.empty() ? limit : batch.back().seq + 1;
+            lk.unlock();
+            for (auto& p : batch) {
+                if (p.audio)
+                    muxer->writeAudio(data.data() + p.offset, p.size, p.pts);
+                else
+                    muxer->writeVideo(data.data() + p.offset, p.size, p.pts);
+            }
+            lk.lock();
+            continue;
+        }
+
+        if (file_open && !recording && cursor >= stop_seq) {
+            file_open = false;
+            lk.unlock();
+            std::string path = muxer->getPath();
+            muxer->close();
+            muxer->dumpStats();
+            muxer = nullptr;
+            if (closed_callback)
+                closed_callback(path);
+            lk.lock();
+            continue;
+        }
+
+        cond.wait(lk);
+    }
+    lk.unlock();
+
+    if (muxer)
+        muxer->close();
+}
+
+ModuleMedia::ConsumeResult ModuleEventRecorder::doConsume(shared_ptr<MediaBuffer> input_buffer, shared_ptr<MediaBuffer> output_buffer)
+{
+    (void)output_buffer;
+    if (input_buffer == nullptr || input_buffer->getActiveSize() == 0)
+        return CONSUME_SKIP;
+
+    const uint8_t* data = (const uint8_t*)input_buffer->getActiveData();
+    size_t size = input_buffer->getActiveSize();
+
+    shared_ptr<MediaBuffer> extra = input_buffer->getExtraData();
+    if (extra && extra->getActiveSize() && video_extra.empty())
+        setVideoExtraData((const uint8_t*)extra->getActiveData(), extra->getActiveSize());
+
+    AnnexB::FrameInfo info = AnnexB::parseFrame(data, size, codec);
+    push(data, size, input_buffer->getPUstimestamp(), info.type == AnnexB::FRAME_KEY, false);
+    return CONSUME_SUCCESS;
+}
+
+void ModuleEventRecorder::dumpStats()
+{
+    std::lock_guard<std::mutex> lk(mtx);
+    size_t used = 0;
+    for (auto& p : packets)
+        used += p.size;
+    int64_t span = packets.empty() ? 0 : last_pts - packets.front().pts;
+    ff_info("event recorder: %" PRIu64 " events, ring %zu/%zu bytes, %.1f s, %" PRIu64 " packets lost before writing\n",
+            events, used, ring.size(), span / 1000000.0, evicted_unwritten);
+}
+
+ModuleEventRecorderExtend::ModuleEventRecorderExtend(shared_ptr<ModuleEventRecorder> recorder)
+    : ModuleMedia("EventRecorderExtend"), recorder(recorder)
+{
+    buffer_count = 0;
+}
+
+ModuleEventRecorderExtend::~ModuleEventRecorderExtend()
+{
+}
+
+int ModuleEventRecorderExtend::init()
+{
+    shared_ptr<ModuleMedia> productor = getProductor();
+    if (recorder == nullptr || productor == nullptr) {
+        ff_error("Event recorder extend has no recorder or productor\n");
+        return -1;
+    }
+
+    if (!recorder->audio_enabled) {
+        ff_error("Event recorder audio parameter is not set\n");
+        return -1;
+    }
+
+    input_para = productor->getOutputImagePara();
+    media_type = productor->getMediaType();
+    return 0;
+}
+
+ModuleMedia::ConsumeResult ModuleEventRecorderExtend::doConsume(shared_ptr<MediaBuffer> input_buffer, shared_ptr<MediaBuffer> output_buffer)
+{
+    (void)output_buffer;
+    if (input_buffer == nullptr || input_buffer->getActiveSize() == 0)
+        return CONSUME_SKIP;
+
+    recorder->push((const uint8_t*)input_buffer->getActiveData(), input_buffer->getActiveSize(),
+                   input_buffer->getPUstimestamp(), true, true);
+    return CONSUME_SUCCESS;
+}
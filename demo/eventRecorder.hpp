@@ -0,0 +1,120 @@
+#pragma once
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "module/module_media.hpp"
+#include "fmp4Muxer.hpp"
+
+/*
+ * Triggered recording with pre-roll.
+ *
+ * Encoded packets from the encoder (and audio through
+ * ModuleEventRecorderExtend) go into a ring preallocated in memory that
+ * keeps the last pre-roll seconds, evicting whole GOPs so it always starts
+ * at a keyframe. trigger() opens a new file, writes the ring out and keeps
+ * recording live packets until post-roll after the last trigger. Files are
+ * fragmented MP4 written by a worker thread, the pipeline only copies into
+ * the ring.
+ */
+class ModuleEventRecorder : public ModuleMedia
+{
+    friend class ModuleEventRecorderExtend;
+
+public:
+    using NameGenerator = std::function<std::string()>;
+    using EventCallback = std::function<void(const std::string& path)>;
+
+public:
+    ModuleEventRecorder(NameGenerator generator, int64_t pre_roll_us, int64_t post_roll_us,
+                        size_t ring_bytes = 64 << 20);
+    ~ModuleEventRecorder();
+
+    // Start a recording, or extend the running one by post-roll.
+    void trigger();
+    bool isRecording();
+
+    // Called from the worker once a recording file is closed.
+    void setEventClosedCallback(EventCallback callback) { closed_callback = callback; }
+    void setFragmentDuration(int64_t duration_us) { fragment_duration = duration_us; }
+    void setVideoExtraData(const uint8_t* extra_data, unsigned extra_size);
+    void setAudioParameter(int channel_count, int bit_per_sample, int sample_rate, media_codec_t type);
+
+    void setBufferCount(uint16_t buffer_count) { (void)buffer_count; }
+    int init() override;
+    void dumpStats();
+
+protected:
+    virtual ConsumeResult doConsume(shared_ptr<MediaBuffer> input_buffer, shared_ptr<MediaBuffer> output_buffer) override;
+
+private:
+    struct Packet {
+        uint64_t seq;
+        size_t offset;
+        size_t size;
+        int64_t pts;
+        bool key;
+        bool audio;
+    };
+
+    void push(const uint8_t* data, size_t size, int64_t pts, bool key, bool audio);
+    bool reserve(size_t size, size_t* offset);
+    void evictGop();
+    void workerProcess();
+
+private:
+    NameGenerator name_generator;
+    EventCallback closed_callback;
+    int64_t pre_roll;
+    int64_t post_roll;
+    int64_t fragment_duration;
+
+    AnnexB::Codec codec;
+    std::vector<uint8_t> video_extra;
+    bool audio_enabled;
+    int audio_channels;
+    int audio_sample_rate;
+
+    std::mutex mtx;
+    std::condition_variable cond;
+    std::vector<uint8_t> ring;
+    std::deque<Packet> packets;
+    size_t ring_head;           // next write offset
+    uint64_t next_seq;
+    int64_t last_pts;
+
+    bool recording;
+    bool need_open;
+    bool file_open;             // set by the worker while a file is open
+    uint64_t cursor;            // next packet to write to the file
+    uint64_t stop_seq;          // packets before it belong to the recording
+    int64_t end_pts;
+    bool quit;
+    std::thread* worker;
+
+    uint64_t events;
+    uint64_t evicted_unwritten;
+};
+
+/*
+ * Audio input of a ModuleEventRecorder.
+ */
+class ModuleEventRecorderExtend : public ModuleMedia
+{
+public:
+    ModuleEventRecorderExtend(shared_ptr<ModuleEventRecorder> recorder);
+    ~ModuleEventRecorderExtend();
+
+    void setBufferCount(uint16_t buffer_count) { (void)buffer_count; }
+    int init() override;
+
+protected:
+    virtual ConsumeResult doConsume(shared_ptr<MediaBuffer> input_buffer, shared_ptr<MediaBuffer> output_buffer) override;
+
+private:
+    shared_ptr<ModuleEventRecorder> recorder;
+};
@@ -0,0 +1,710 @@
+#include <string.h>
+
+#include "fmp4Muxer.hpp"
+#include "base/ff_log.h"
+
+#define FMP4_VIDEO_TIMESCALE 90000
+#define FMP4_AAC_FRAME_SAMPLES 1024
+#define FMP4_DEFAULT_DURATION (FMP4_VIDEO_TIMESCALE / 30)
+#define FMP4_AUDIO_CONFIG_WAIT 1000000
+
+#define SAMPLE_FLAGS_SYNC 0x02000000
+#define SAMPLE_FLAGS_NON_SYNC 0x01010000
+
+static void put8(std::vector<uint8_t>& b, uint8_t v)
+{
+    b.push_back(v);
+}
+
+static void put16(std::vector<uint8_t>& b, uint16_t v)
+{
+    b.push_back(v >> 8);
+    b.push_back(v);
+}
+
+static void put24(std::vector<uint8_t>& b, uint32_t v)
+{
+    b.push_back(v >> 16);
+    b.push_back(v >> 8);
+    b.push_back(v);
+}
+
+static void put32(std::vector<uint8_t>& b, uint32_t v)
+{
+    put16(b, v >> 16);
+    put16(b, v);
+}
+
+static void put64(std::vector<uint8_t>& b, uint64_t v)
+{
+    put32(b, v >> 32);
+    put32(b, v);
+}
+
+static void putBytes(std::vector<uint8_t>& b, const void* data, size_t size)
+{
+    const uint8_t* p = (const uint8_t*)data;
+    b.insert(b.end(), p, p + size);
+}
+
+static void patch32(std::vector<uint8_t>& b, size_t pos, uint32_t v)
+{
+    b[pos] = v >> 24;
+    b[pos + 1] = v >> 16;
+    b[pos + 2] = v >> 8;
+    b[pos + 3] = v;
+}
+
+static size_t beginBox(std::vector<uint8_t>& b, const char* type)
+{
+    size_t pos = b.size();
+    put32(b, 0);
+    putBytes(b, type, 4);
+    return pos;
+}
+
+static size_t beginFullBox(std::vector<uint8_t>& b, const char* type, uint8_t version, uint32_t flags)
+{
+    size_t pos = beginBox(b, type);
+    put8(b, version);
+    put24(b, flags);
+    return pos;
+}
+
+static void endBox(std::vector<uint8_t>& b, size_t pos)
+{
+    patch32(b, pos, b.size() - pos);
+}
+
+static void putMatrix(std::vector<uint8_t>& b)
+{
+    const uint32_t matrix[9] = {0x00010000, 0, 0, 0, 0x00010000, 0, 0, 0, 0x40000000};
+    for (int i = 0; i < 9; i++)
+        put32(b, matrix[i]);
+}
+
+static uint64_t toTimescale(int64_t us, uint32_t timescale)
+{
+    return us <= 0 ? 0 : (uint64_t)us * timescale / 1000000;
+}
+
+static const int aac_sample_rates[13] = {96000, 88200, 64000, 48000, 44100, 32000, 24000, 22050, 16000, 12000, 11025, 8000, 7350};
+
+static int aacSampleRateIndex(int sample_rate)
+{
+    for (int i = 0; i < 13; i++) {
+        if (aac_sample_rates[i] == sample_rate)
+            return i;
+    }
+    return 4;
+}
+
+Fmp4Muxer::Fmp4Muxer(const std::string& path)
+    : path(path), header_written(false), sync_fragment(true),
+      fragment_duration(0), fragment_start(0), base_pts(0), sequence(0), write_index(false),
+      part_mode(false), fragment_handler(nullptr), handler_open(false), codec(AnnexB::CODEC_H264), width(0), height(0),
+      audio_enabled(false), audio_known(false), audio_channels(2), audio_sample_rate(44100), audio_wait_start(-1)
+{
+    video = {1, FMP4_VIDEO_TIMESCALE, {}, {}, 0, 0, -1};
+    audio = {2, 44100, {}, {}, 0, 0, -1};
+}
+
+Fmp4Muxer::~Fmp4Muxer()
+{
+    close();
+}
+
+void Fmp4Muxer::setVideoTrack(AnnexB::Codec _codec, int _width, int _height)
+{
+    codec = _codec;
+    width = _width;
+    height = _height;
+}
+
+/// @brief Take the parameter sets from Annex-B extra data
+void Fmp4Muxer::setVideoExtraData(const uint8_t* extra_data, size_t extra_size)
+{
+    std::lock_guard<std::mutex> lk(mtx);
+    storeParameterSets(extra_data, extra_size);
+}
+
+/// @brief Keep the first VPS/SPS/PPS found in an Annex-B buffer
+void Fmp4Muxer::storeParameterSets(const uint8_t* data, size_t size)
+{
+    std::vector<AnnexB::Nal> nals;
+
+    AnnexB::split(data, size, codec, nals);
+    for (auto& nal : nals) {
+        std::vector<uint8_t>* dst = nullptr;
+        if (codec == AnnexB::CODEC_H264)
+            dst = nal.type == 7 ? &sps : nal.type == 8 ? &pps : nullptr;
+        else
+            dst = nal.type == 32 ? &vps : nal.type == 33 ? &sps : nal.type == 34 ? &pps : nullptr;
+        if (dst && dst->empty())
+            dst->assign(nal.data, nal.data + nal.size);
+    }
+}
+
+bool Fmp4Muxer::hasParameterSets() const
+{
+    return !sps.empty() && !pps.empty() && (codec == AnnexB::CODEC_H264 || !vps.empty());
+}
+
+void Fmp4Muxer::setAudioTrack(int channels, int sample_rate)
+{
+    audio_enabled = true;
+    if (channels > 0)
+        audio_channels = channels;
+    if (sample_rate > 0)
+        audio_sample_rate = sample_rate;
+    audio_known = channels > 0 && sample_rate > 0;
+    audio.timescale = audio_sample_rate;
+}
+
+/// @brief AudioSpecificConfig of the AAC track
+void Fmp4Muxer::setAudioExtraData(const uint8_t* extra_data, size_t extra_size)
+{
+    std::lock_guard<std::mutex> lk(mtx);
+    audio_config.assign(extra_data, extra_data + extra_size);
+    if (extra_size >= 2) {
+        // Rate and channels for the sample entry and the timescale.
+        uint8_t rate_index = (extra_data[0] & 7) << 1 | extra_data[1] >> 7;
+        uint8_t channels = (extra_data[1] >> 3) & 0xf;
+        if (rate_index < 13)
+            audio_sample_rate = audio.timescale = aac_sample_rates[rate_index];
+        if (channels)
+            audio_channels = channels;
+        audio_known = true;
+    }
+}
+
+int Fmp4Muxer::open()
+{
+    std::lock_guard<std::mutex> lk(mtx);
+    if (isOpen())
+        return 0;
+
+    if (fragment_handler)
+        handler_open = true;
+    else if (file.open(path) < 0)
+        return -1;
+    header_written = false;
+    audio_wait_start = -1;
+    sequence = 0;
+    keyframes.clear();
+    return 0;
+}
+
+int Fmp4Muxer::close()
+{
+    std::lock_guard<std::mutex> lk(mtx);
+    if (!isOpen())
+        return 0;
+
+    int ret = 0;
+    if (header_written)
+        ret = flushFragment(-1);
+    if (fragment_handler) {
+        handler_open = false;
+        return ret;
+    }
+    uint64_t size = file.size();
+    if (file.close() < 0)
+        ret = -1;
+    if (write_index && ret == 0 && !keyframes.empty()) {
+        keyframes.setFileSize(size);
+        keyframes.save(path);
+    }
+    return ret;
+}
+
+int Fmp4Muxer::writeBuffer(const std::vector<uint8_t>& buf)
+{
+    if (buf.empty())
+        return 0;
+    return file.write(buf.data(), buf.size());
+}
+
+void Fmp4Muxer::videoConfig(std::vector<uint8_t>& b)
+{
+    if (codec == AnnexB::CODEC_H264) {
+        size_t pos = beginBox(b, "avcC");
+        put8(b, 1);
+        put8(b, sps.size() > 1 ? sps[1] : 66);
+        put8(b, sps.size() > 2 ? sps[2] : 0);
+        put8(b, sps.size() > 3 ? sps[3] : 30);
+        put8(b, 0xff);  // 4 byte NAL lengths
+        put8(b, 0xe1);
+        put16(b, sps.size());
+        putBytes(b, sps.data(), sps.size());
+        put8(b, 1);
+        put16(b, pps.size());
+        putBytes(b, pps.data(), pps.size());
+        uint8_t profile = sps.size() > 1 ? sps[1] : 66;
+        if (profile == 100 || profile == 110 || profile == 122 || profile == 144) {
+            // The VPU only produces 8 bit 4:2:0.
+            put8(b, 0xfc | 1);
+            put8(b, 0xf8);
+            put8(b, 0xf8);
+            put8(b, 0);
+        }
+        endBox(b, pos);
+        return;
+    }
+
+    // profile_tier_level follows two bytes of NAL header and one of SPS fields, unescape that much.
+    uint8_t ptl[13] = {0};
+    size_t len = 0;
+    int zeros = 0;
+    for (size_t i = 2; i < sps.size() && len < sizeof(ptl); i++) {
+        if (zeros >= 2 && sps[i] == 3) {
+            zeros = 0;
+            continue;
+        }
+        zeros = sps[i] == 0 ? zeros + 1 : 0;
+        ptl[len++] = sps[i];
+    }
+    uint8_t sub_layers = ((ptl[0] >> 1) & 0x7) + 1;
+
+    size_t pos = beginBox(b, "hvcC");
+    put8(b, 1);
+    putBytes(b, ptl + 1, 12);
+    put16(b, 0xf000);
+    put8(b, 0xfc);
+    put8(b, 0xfc | 1);
+    put8(b, 0xf8);
+    put8(b, 0xf8);
+    put16(b, 0);
+    put8(b, (sub_layers << 3) | ((ptl[0] & 1) << 2) | 3);
+
+    const std::vector<uint8_t>* arrays[3] = {&vps, &sps, &pps};
+    const uint8_t types[3] = {32, 33, 34};
+    put8(b, 3);
+    for (int i = 0; i < 3; i++) {
+        put8(b, types[i]);
+        put16(b, 1);
+        put16(b, arrays[i]->size());
+        putBytes(b, arrays[i]->data(), arrays[i]->size());
+    }
+    endBox(b, pos);
+}
+
+void Fmp4Muxer::audioConfig(std::vector<uint8_t>& b)
+{
+    if (audio_config.empty()) {
+        // AAC LC from the configured rate and channels
+        uint16_t asc = (2 << 11) | (aacSampleRateIndex(audio_sample_rate) << 7) | (audio_channels << 3);
+        put16(audio_config, asc);
+    }
+
+    uint8_t asc_size = audio_config.size();
+    size_t pos = beginFullBox(b, "esds", 0, 0);
+    put8(b, 0x03);  // ES_Descriptor
+    put8(b, 3 + (2 + 13 + 2 + asc_size) + 3);
+    put16(b, 0);
+    put8(b, 0);
+    put8(b, 0x04);  // DecoderConfigDescriptor
+    put8(b, 13 + 2 + asc_size);
+    put8(b, 0x40);  // MPEG-4 audio
+    put8(b, 0x15);
+    put24(b, 0);
+    put32(b, 0);
+    put32(b, 0);
+    put8(b, 0x05);  // DecoderSpecificInfo
+    put8(b, asc_size);
+    putBytes(b, audio_config.data(), asc_size);
+    put8(b, 0x06);  // SLConfigDescriptor
+    put8(b, 1);
+    put8(b, 2);
+    endBox(b, pos);
+}
+
+void Fmp4Muxer::trackBox(std::vector<uint8_t>& b, const Track& t, bool is_video)
+{
+    size_t trak = beginBox(b, "trak");
+
+    size_t tkhd = beginFullBox(b, "tkhd", 0, 3);
+    put32(b, 0);
+    put32(b, 0);
+    put32(b, t.id);
+    put32(b, 0);
+    put32(b, 0);
+    put64(b, 0);
+    put16(b, 0);
+    put16(b, 0);
+    put16(b, is_video ? 0 : 0x0100);
+    put16(b, 0);
+    putMatrix(b);
+    put32(b, is_video ? width << 16 : 0);
+    put32(b, is_video ? height << 16 : 0);
+    endBox(b, tkhd);
+
+    size_t mdia = beginBox(b, "mdia");
+    size_t mdhd = beginFullBox(b, "mdhd", 0, 0);
+    put32(b, 0);
+    put32(b, 0);
+    put32(b, t.timescale);
+    put32(b, 0);
+    put16(b, 0x55c4);  // und
+    put16(b, 0);
+    endBox(b, mdhd);
+
+    size_t hdlr = beginFullBox(b, "hdlr", 0, 0);
+    put32(b, 0);
+    putBytes(b, is_video ? "vide" : "soun", 4);
+    put32(b, 0);
+    put32(b, 0);
+    put32(b, 0);
+    const char* name = is_video ? "VideoHandler" : "SoundHandler";
+    putBytes(b, name, strlen(name) + 1);
+    endBox(b, hdlr);
+
+    size_t minf = beginBox(b, "minf");
+    if (is_video) {
+        size_t vmhd = beginFullBox(b, "vmhd", 0, 1);
+        put64(b, 0);
+        endBox(b, vmhd);
+    } else {
+        size_t smhd = beginFullBox(b, "smhd", 0, 0);
+        put32(b, 0);
+        endBox(b, smhd);
+    }
+
+    size_t dinf = beginBox(b, "dinf");
+    size_t dref = beginFullBox(b, "dref", 0, 0);
+    put32(b, 1);
+    endBox(b, beginFullBox(b, "url ", 0, 1));
+    endBox(b, dref);
+    endBox(b, dinf);
+
+    size_t stbl = beginBox(b, "stbl");
+    size_t stsd = beginFullBox(b, "stsd", 0, 0);
+    put32(b, 1);
+    if (is_video) {
+        size_t entry = beginBox(b, codec == AnnexB::CODEC_H264 ? "avc1" : "hev1");
+        put32(b, 0);
+        put16(b, 0);
+        put16(b, 1);
+        put16(b, 0);
+        put16(b, 0);
+        put32(b, 0);
+        put32(b, 0);
+        put32(b, 0);
+        put16(b, width);
+        put16(b, height);
+        put32(b, 0x00480000);
+        put32(b, 0x00480000);
+        put32(b, 0);
+        put16(b, 1);
+        uint8_t compressor[32] = {0};
+        putBytes(b, compressor, sizeof(compressor));
+        put16(b, 0x0018);
+        put16(b, 0xffff);
+        videoConfig(b);
+        endBox(b, entry);
+    } else {
+        size_t entry = beginBox(b, "mp4a");
+        put32(b, 0);
+        put16(b, 0);
+        put16(b, 1);
+        put64(b, 0);
+        put16(b, audio_channels);
+        put16(b, 16);
+        put16(b, 0);
+        put16(b, 0);
+        put32(b, audio_sample_rate << 16);
+        audioConfig(b);
+        endBox(b, entry);
+    }
+    endBox(b, stsd);
+
+    // Sample tables stay empty, the samples live in the fragments.
+    size_t stts = beginFullBox(b, "stts", 0, 0);
+    put32(b, 0);
+    endBox(b, stts);
+    size_t stsc = beginFullBox(b, "stsc", 0, 0);
+    put32(b, 0);
+    endBox(b, stsc);
+    size_t stsz = beginFullBox(b, "stsz", 0, 0);
+    put32(b, 0);
+    put32(b, 0);
+    endBox(b, stsz);
+    size_t stco = beginFullBox(b, "stco", 0, 0);
+    put32(b, 0);
+    endBox(b, stco);
+    endBox(b, stbl);
+
+    endBox(b, minf);
+    endBox(b, mdia);
+    endBox(b, trak);
+}
+
+/// @brief Write ftyp and moov once the first keyframe provides the parameter sets
+int Fmp4Muxer::writeHeader(const uint8_t* data, size_t size)
+{
+    if (!hasParameterSets())
+        storeParameterSets(data, size);
+    if (!hasParameterSets()) {
+        ff_error("No parameter sets for %s\n", path.c_str());
+        return -1;
+    }
+
+    box.clear();
+    size_t ftyp = beginBox(box, "ftyp");
+    putBytes(box, "iso5", 4);
+    put32(box, 512);
+    putBytes(box, "iso5iso6mp41", 12);
+    putBytes(box, codec == AnnexB::CODEC_H264 ? "avc1" : "hev1", 4);
+    endBox(box, ftyp);
+
+    size_t moov = beginBox(box, "moov");
+    size_t mvhd = beginFullBox(box, "mvhd", 0, 0);
+    put32(box, 0);
+    put32(box, 0);
+    put32(box, 1000);
+    put32(box, 0);
+    put32(box, 0x00010000);
+    put16(box, 0x0100);
+    put16(box, 0);
+    put64(box, 0);
+    putMatrix(box);
+    for (int i = 0; i < 6; i++)
+        put32(box, 0);
+    put32(box, audio_enabled ? 3 : 2);
+    endBox(box, mvhd);
+
+    trackBox(box, video, true);
+    if (audio_enabled)
+        trackBox(box, audio, false);
+
+    size_t mvex = beginBox(box, "mvex");
+    for (int i = 0; i < (audio_enabled ? 2 : 1); i++) {
+        size_t trex = beginFullBox(box, "trex", 0, 0);
+        put32(box, i + 1);
+        put32(box, 1);
+        put32(box, 0);
+        put32(box, 0);
+        put32(box, 0);
+        endBox(box, trex);
+    }
+    endBox(box, mvex);
+    endBox(box, moov);
+
+    if (fragment_handler) {
+        Fragment f = {true, true, 0, 0, {}, {}, {}};
+        f.header.swap(box);
+        fragment_handler(f);
+    } else {
+        if (writeBuffer(box) < 0)
+            return -1;
+        file.flush(false);
+    }
+    header_written = true;
+    return 0;
+}
+
+/// @brief Append the pending samples as one moof + mdat
+/// @param next_pts pts of the frame after the fragment, -1 at close
+int Fmp4Muxer::flushFragment(int64_t next_pts)
+{
+    if (video.samples.empty() && audio.samples.empty())
+        return 0;
+
+    if (!video.samples.empty()) {
+        Sample& last = video.samples.back();
+        if (next_pts > video.last_pts)
+            last.duration = toTimescale(next_pts - video.last_pts, video.timescale);
+        else
+            last.duration = video.samples.size() > 1 ? video.samples[video.samples.size() - 2].duration : FMP4_DEFAULT_DURATION;
+    }
+
+    Track* tracks[2] = {&video, &audio};
+    size_t offset_pos[2] = {0, 0};
+    std::vector<KeyframeIndex::Entry> keys;
+    uint64_t start_time = video.base_time;
+    bool independent = video.samples.empty() || video.samples.front().key;
+
+    box.clear();
+    size_t moof = beginBox(box, "moof");
+    size_t mfhd = beginFullBox(box, "mfhd", 0, 0);
+    put32(box, ++sequence);
+    endBox(box, mfhd);
+
+    for (int i = 0; i < 2; i++) {
+        Track& t = *tracks[i];
+        if (t.samples.empty())
+            continue;
+
+        size_t traf = beginBox(box, "traf");
+        size_t tfhd = beginFullBox(box, "tfhd", 0, 0x020000);  // default-base-is-moof
+        put32(box, t.id);
+        endBox(box, tfhd);
+
+        size_t tfdt = beginFullBox(box, "tfdt", 1, 0);
+        put64(box, t.base_time);
+        endBox(box, tfdt);
+
+        // data-offset, sample-duration, sample-size, sample-flags
+        size_t trun = beginFullBox(box, "trun", 0, 0x000701);
+        put32(box, t.samples.size());
+        offset_pos[i] = box.size();
+        put32(box, 0);
+        for (auto& s : t.samples) {
+            put32(box, s.duration);
+            put32(box, s.size);
+            put32(box, s.key ? SAMPLE_FLAGS_SYNC : SAMPLE_FLAGS_NON_SYNC);
+            if (i == 0 && s.key && write_index && !fragment_handler)
+                keys.push_back({(int64_t)(t.next_time * 1000000 / t.timescale), s.offset});
+            t.next_time += s.duration;
+        }
+        endBox(box, trun);
+        endBox(box, traf);
+    }
+    endBox(box, moof);
+
+    uint32_t data_offset = box.size() + 8;
+    for (int i = 0; i < 2; i++) {
+        if (offset_pos[i]) {
+            patch32(box, offset_pos[i], data_offset);
+            data_offset += tracks[i]->data.size();
+        }
+    }
+
+    put32(box, 8 + video.data.size() + audio.data.size());
+    putBytes(box, "mdat", 4);
+
+    // Video is first in the mdat, sample offsets are relative to its payload.
+    for (auto& k : keys)
+        keyframes.append(k.time_us, file.size() + box.size() + k.offset);
+
+    int ret = 0;
+    if (fragment_handler) {
+        // The sample data goes out as it is, no copy into a fragment buffer.
+        Fragment f = {false, independent, (int64_t)(start_time * 1000000 / video.timescale),
+                      (int64_t)((video.next_time - start_time) * 1000000 / video.timescale), {}, {}, {}};
+        f.header.swap(box);
+        f.video.swap(video.data);
+        f.audio.swap(audio.data);
+        fragment_handler(f);
+    } else {
+        if (writeBuffer(box) < 0 || writeBuffer(video.data) < 0 || writeBuffer(audio.data) < 0)
+            ret = -1;
+        file.flush(sync_fragment);
+    }
+
+    for (int i = 0; i < 2; i++) {
+        tracks[i]->samples.clear();
+        tracks[i]->data.clear();
+        tracks[i]->base_time = tracks[i]->next_time;
+    }
+    return ret;
+}
+
+int Fmp4Muxer::writeVideo(const uint8_t* data, size_t size, int64_t pts)
+{
+    std::vector<AnnexB::Nal> nals;
+    bool key = false;
+
+    std::lock_guard<std::mutex> lk(mtx);
+    if (!isOpen())
+        return -1;
+
+    AnnexB::split(data, size, codec, nals);
+    for (auto& nal : nals)
+        key |= AnnexB::isKeyframe(codec, nal.type);
+
+    if (!header_written) {
+        // The file starts at a keyframe.
+        if (!key)
+            return 0;
+        // Without rate and channels from the caller, the first ADTS header gives them.
+        if (audio_enabled && !audio_known) {
+            if (audio_wait_start < 0)
+                audio_wait_start = pts;
+            if (pts - audio_wait_start < FMP4_AUDIO_CONFIG_WAIT)
+                return 0;
+            ff_warn("No audio config for %s, assuming %d Hz and %d channels\n", path.c_str(), audio_sample_rate,
+                    audio_channels);
+            audio_known = true;
+        }
+        if (writeHeader(data, size) < 0)
+            return -1;
+        base_pts = pts;
+        fragment_start = pts;
+        video.base_time = video.next_time = 0;
+        video.last_pts = -1;
+    }
+
+    if (pts < base_pts)
+        return 0;
+
+    if (!video.samples.empty()) {
+        bool cut = fragment_duration > 0 ? pts - fragment_start >= fragment_duration : key;
+        if (part_mode && fragment_duration > 0) {
+            // This frame is expected to last as long as the previous one, cut before it overruns.
+            int64_t frame = pts > video.last_pts ? pts - video.last_pts : 0;
+            cut = key || pts + frame - fragment_start > fragment_duration;
+        }
+        if (cut) {
+            if (flushFragment(pts) < 0)
+                return -1;
+            fragment_start = pts;
+        } else {
+            Sample& last = video.samples.back();
+            last.duration = pts > video.last_pts ? toTimescale(pts - video.last_pts, video.timescale) : FMP4_DEFAULT_DURATION;
+        }
+    }
+
+    Sample s = {(uint32_t)video.data.size(), 0, 0, key};
+    for (auto& nal : nals) {
+        // Access unit delimiters are not carried in MP4 samples.
+        if ((codec == AnnexB::CODEC_H264 && nal.type == 9) || (codec == AnnexB::CODEC_H265 && nal.type == 35))
+            continue;
+        put32(video.data, nal.size);
+        putBytes(video.data, nal.data, nal.size);
+    }
+    s.size = video.data.size() - s.offset;
+    video.samples.push_back(s);
+    video.last_pts = pts;
+    return 0;
+}
+
+int Fmp4Muxer::writeAudio(const uint8_t* data, size_t size, int64_t pts)
+{
+    std::lock_guard<std::mutex> lk(mtx);
+    if (!isOpen() || !audio_enabled)
+        return -1;
+
+    // Strip ADTS framing, its header also gives the config if none was set.
+    if (size > 7 && data[0] == 0xff && (data[1] & 0xf6) == 0xf0) {
+        size_t header = (data[1] & 1) ? 7 : 9;
+        if (audio_config.empty() && !header_written) {
+            uint8_t profile = ((data[2] >> 6) & 0x3) + 1;
+            uint8_t rate_index = (data[2] >> 2) & 0xf;
+            uint8_t channels = ((data[2] & 1) << 2) | (data[3] >> 6);
+            put16(audio_config, (profile << 11) | (rate_index << 7) | (channels << 3));
+            if (rate_index < 13)
+                audio_sample_rate = audio.timescale = aac_sample_rates[rate_index];
+            if (channels)
+                audio_channels = channels;
+            audio_known = true;
+        }
+        if (size <= header)
+            return 0;
+        data += header;
+        size -= header;
+    }
+
+    if (!header_written || pts < base_pts)
+        return 0;
+
+    if (audio.last_pts < 0) {
+        audio.base_time = audio.next_time = toTimescale(pts - base_pts, audio.timescale);
+    }
+
+    Sample s = {(uint32_t)audio.data.size(), (uint32_t)size, FMP4_AAC_FRAME_SAMPLES, true};
+    putBytes(audio.data, data, size);
+    audio.samples.push_back(s);
+    audio.last_pts = pts;
+    return 0;
+}
@@ -0,0 +1,140 @@
+#pragma once
+#include <stdint.h>
+#include <stdio.h>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "annexb.hpp"
+#include "keyframeIndex.hpp"
+#include "writeBehind.hpp"
+
+/*
+ * Fragmented MP4 muxer for H.264/H.265 video with an optional AAC track.
+ *
+ * ftyp and a moov without samples are written when the first keyframe
+ * arrives, after that every fragment is appended as moof + mdat and
+ * queued (and optionally fdatasync'ed) on its own. Nothing is rewritten
+ * at close, a file cut off by power loss plays up to its last complete
+ * fragment. Only the samples of the current fragment are held in memory,
+ * the file itself is written behind by a WriteBehindFile.
+ *
+ * With setWriteIndex() the keyframe times and offsets are saved as a
+ * KeyframeIndex sidecar at close, so readers can seek without parsing.
+ *
+ * With a fragment handler nothing is written: the init segment and every
+ * fragment are handed over as buffers the handler may keep, for output
+ * from memory like LL-HLS parts.
+ *
+ * Video comes in as Annex-B access units with pts == dts, audio as raw or
+ * ADTS framed AAC. Timestamps are in microseconds.
+ */
+class Fmp4Muxer
+{
+public:
+    // ftyp + moov of the init segment, or a fragment as its moof and mdat
+    // header followed by the video and audio sample data.
+    struct Fragment {
+        bool init;
+        bool independent;       // starts with a keyframe
+        int64_t start_us;       // from the first frame
+        int64_t duration_us;
+        std::vector<uint8_t> header;
+        std::vector<uint8_t> video;
+        std::vector<uint8_t> audio;
+    };
+    // Called with the muxer locked, the buffers may be swapped out.
+    using FragmentHandler = std::function<void(Fragment& fragment)>;
+
+public:
+    Fmp4Muxer(const std::string& path);
+    ~Fmp4Muxer();
+
+    void setVideoTrack(AnnexB::Codec codec, int width, int height);
+    void setVideoExtraData(const uint8_t* extra_data, size_t extra_size);
+    // Without both, the header waits for the rate and channels of the first ADTS frame.
+    void setAudioTrack(int channels, int sample_rate);
+    void setAudioExtraData(const uint8_t* extra_data, size_t extra_size);
+
+    // 0 cuts a fragment at every keyframe, otherwise at the first frame past the interval.
+    void setFragmentDuration(int64_t duration_us) { fragment_duration = duration_us; }
+    void setSyncEachFragment(bool sync) { sync_fragment = sync; }
+    void setPreallocateSize(uint64_t bytes) { file.setPreallocateSize(bytes); }
+    void setWriteIndex(bool enable) { write_index = enable; }
+    // No fragment longer than the fragment duration and a new one at every keyframe, as LL-HLS parts need.
+    void setPartMode(bool enable) { part_mode = enable; }
+    // Hand the output to handler instead of writing the file, set before open().
+    void setFragmentHandler(FragmentHandler handler) { fragment_handler = handler; }
+
+    int open();
+    int writeVideo(const uint8_t* data, size_t size, int64_t pts);
+    int writeAudio(const uint8_t* data, size_t size, int64_t pts);
+    int close();
+
+    const std::string& getPath() const { return path; }
+    uint64_t getFileSize() const { return file.size(); }
+    void dumpStats() { file.dumpStats(path.c_str()); }
+    uint32_t getFragmentCount() const { return sequence; }
+
+private:
+    struct Sample {
+        uint32_t offset;    // in the pending mdat payload
+        uint32_t size;
+        uint32_t duration;
+        bool key;
+    };
+
+    struct Track {
+        uint32_t id;
+        uint32_t timescale;
+        std::vector<Sample> samples;
+        std::vector<uint8_t> data;
+        uint64_t base_time;     // decode time of the first pending sample
+        uint64_t next_time;     // decode time after the last pending sample
+        int64_t last_pts;
+    };
+
+    bool isOpen() const { return fragment_handler ? handler_open : file.isOpen(); }
+    void storeParameterSets(const uint8_t* data, size_t size);
+    bool hasParameterSets() const;
+    int writeHeader(const uint8_t* data, size_t size);
+    int flushFragment(int64_t next_pts);
+    int writeBuffer(const std::vector<uint8_t>& buf);
+
+    void videoConfig(std::vector<uint8_t>& out);
+    void audioConfig(std::vector<uint8_t>& out);
+    void trackBox(std::vector<uint8_t>& out, const Track& t, bool video);
+
+private:
+    std::mutex mtx;
+    std::string path;
+    WriteBehindFile file;
+    bool header_written;
+    bool sync_fragment;
+    int64_t fragment_duration;
+    int64_t fragment_start;
+    int64_t base_pts;
+    uint32_t sequence;
+    bool write_index;
+    KeyframeIndex keyframes;
+    bool part_mode;
+    FragmentHandler fragment_handler;
+    bool handler_open;
+
+    AnnexB::Codec codec;
+    int width;
+    int height;
+    std::vector<uint8_t> vps, sps, pps;
+
+    bool audio_enabled;
+    bool audio_known;           // rate and channels given or parsed, not the defaults
+    int audio_channels;
+    int audio_sample_rate;
+    std::vector<uint8_t> audio_config;
+    int64_t audio_wait_start;   // first keyframe held back for the audio config
+
+    Track video;
+    Track audio;
+    std::vector<uint8_t> box;
+};
@@ -0,0 +1,198 @@
+#include "fmp4Writer.hpp"
+
+ModuleFmp4Writer::ModuleFmp4Writer(string path)
+    : ModuleMedia("Fmp4Writer"), filepath(path), muxer(nullptr), codec(AnnexB::CODEC_H264),
+      fragment_duration(0), sync_fragment(true), prealloc_size(0), write_index(false), max_pending_close(2),
+      closed_callback(nullptr), finalizer(nullptr), audio_enabled(false), audio_channels(0), audio_sample_rate(0)
+{
+    buffer_count = 0;
+}
+
+ModuleFmp4Writer::~ModuleFmp4Writer()
+{
+    // Waits for the files still closing.
+    delete finalizer;
+    finalizer = nullptr;
+
+    std::lock_guard<std::mutex> lk(muxer_mtx);
+    muxer = nullptr;
+}
+
+void ModuleFmp4Writer::setVideoExtraData(const uint8_t* extra_data, unsigned extra_size)
+{
+    video_extra.assign(extra_data, extra_data + extra_size);
+}
+
+void ModuleFmp4Writer::setAudioParameter(int channel_count, int bit_per_sample, int sample_rate, media_codec_t type)
+{
+    (void)bit_per_sample;
+    if (type != MEDIA_CODEC_AUDIO_AAC) {
+        ff_error("Fmp4 writer only supports AAC audio\n");
+        return;
+    }
+    audio_enabled = true;
+    audio_channels = channel_count;
+    audio_sample_rate = sample_rate;
+}
+
+void ModuleFmp4Writer::setAudioExtraData(const uint8_t* extra_data, unsigned extra_size)
+{
+    audio_extra.assign(extra_data, extra_data + extra_size);
+}
+
+shared_ptr<Fmp4Muxer> ModuleFmp4Writer::makeMuxer(const string& path)
+{
+    shared_ptr<Fmp4Muxer> m = make_shared<Fmp4Muxer>(path);
+    m->setVideoTrack(codec, input_para.width, input_para.height);
+    if (!video_extra.empty())
+        m->setVideoExtraData(video_extra.data(), video_extra.size());
+    if (audio_enabled) {
+        m->setAudioTrack(audio_channels, audio_sample_rate);
+        if (!audio_extra.empty())
+            m->setAudioExtraData(audio_extra.data(), audio_extra.size());
+    }
+    m->setFragmentDuration(fragment_duration);
+    m->setSyncEachFragment(sync_fragment);
+    m->setPreallocateSize(prealloc_size);
+    m->setWriteIndex(write_index);
+    if (m->open() < 0)
+        return nullptr;
+    return m;
+}
+
+int ModuleFmp4Writer::init()
+{
+    shared_ptr<ModuleMedia> productor = getProductor();
+    if (productor == nullptr) {
+        ff_error("Fmp4 writer has no productor\n");
+        return -1;
+    }
+
+    input_para = productor->getOutputImagePara();
+    media_type = productor->getMediaType();
+    if (input_para.v4l2Fmt == V4L2_PIX_FMT_H264) {
+        codec = AnnexB::CODEC_H264;
+    } else if (input_para.v4l2Fmt == V4L2_PIX_FMT_HEVC) {
+        codec = AnnexB::CODEC_H265;
+    } else {
+        ff_error("Fmp4 writer does not support %s\n", v4l2GetFmtName(input_para.v4l2Fmt));
+        return -1;
+    }
+
+    shared_ptr<Fmp4Muxer> m = makeMuxer(filepath);
+    if (m == nullptr)
+        return -1;
+
+    finalizer = new SegmentFinalizer(max_pending_close);
+    finalizer->setFinishedCallback([this](const std::string& path) {
+        if (closed_callback)
+            closed_callback(path);
+    });
+
+    std::lock_guard<std::mutex> lk(muxer_mtx);
+    muxer = m;
+    return 0;
+}
+
+/// @brief Continue in a new file, the current one is closed in the background
+/// @note Waits only when max_pending_close files are still closing.
+int ModuleFmp4Writer::changeFileName(string file_name)
+{
+    shared_ptr<Fmp4Muxer> m = makeMuxer(file_name);
+    if (m == nullptr)
+        return -1;
+
+    shared_ptr<Fmp4Muxer> old;
+    string old_path;
+    {
+        std::lock_guard<std::mutex> lk(muxer_mtx);
+        old = muxer;
+        old_path = filepath;
+        muxer = m;
+        filepath = file_name;
+    }
+    // The audio thread may still hold the old muxer for one packet, close() serializes with it.
+    if (old) {
+        finalizer->push(old_path, [old]() {
+            old->close();
+            old->dumpStats();
+        });
+    }
+    return 0;
+}
+
+void ModuleFmp4Writer::dumpStats()
+{
+    std::lock_guard<std::mutex> lk(muxer_mtx);
+    if (muxer)
+        muxer->dumpStats();
+}
+
+ModuleMedia::ConsumeResult ModuleFmp4Writer::doConsume(shared_ptr<MediaBuffer> input_buffer, shared_ptr<MediaBuffer> output_buffer)
+{
+    (void)output_buffer;
+    if (input_buffer == nullptr || input_buffer->getActiveSize() == 0)
+        return CONSUME_SKIP;
+
+    shared_ptr<Fmp4Muxer> m;
+    {
+        std::lock_guard<std::mutex> lk(muxer_mtx);
+        m = muxer;
+    }
+    if (m == nullptr)
+        return CONSUME_SKIP;
+
+    m->writeVideo((const uint8_t*)input_buffer->getActiveData(), input_buffer->getActiveSize(),
+                  input_buffer->getPUstimestamp());
+    return CONSUME_SUCCESS;
+}
+
+ModuleMedia::ConsumeResult ModuleFmp4Writer::consumeAudio(shared_ptr<MediaBuffer> buffer)
+{
+    shared_ptr<Fmp4Muxer> m;
+    {
+        std::lock_guard<std::mutex> lk(muxer_mtx);
+        m = muxer;
+    }
+    if (m == nullptr)
+        return CONSUME_SKIP;
+
+    m->writeAudio((const uint8_t*)buffer->getActiveData(), buffer->getActiveSize(), buffer->getPUstimestamp());
+    return CONSUME_SUCCESS;
+}
+
+ModuleFmp4WriterExtend::ModuleFmp4WriterExtend(shared_ptr<ModuleFmp4Writer> writer)
+    : ModuleMedia("Fmp4WriterExtend"), writer(writer)
+{
+    buffer_count = 0;
+}
+
+ModuleFmp4WriterExtend::~ModuleFmp4WriterExtend()
+{
+}
+
+int ModuleFmp4WriterExtend::init()
+{
+    shared_ptr<ModuleMedia> productor = getProductor();
+    if (writer == nullptr || productor == nullptr) {
+        ff_error("Fmp4 writer extend has no writer or productor\n");
+        return -1;
+    }
+
+    if (!writer->audio_enabled) {
+        ff_error("Fmp4 writer audio parameter is not set\n");
+        return -1;
+    }
+
+    input_para = productor->getOutputImagePara();
+    media_type = productor->getMediaType();
+    return 0;
+}
+
+ModuleMedia::ConsumeResult ModuleFmp4WriterExtend::doConsume(shared_ptr<MediaBuffer> input_buffer, shared_ptr<MediaBuffer> output_buffer)
+{
+    (void)output_buffer;
+    if (input_buffer == nullptr || input_buffer->getActiveSize() == 0)
+        return CONSUME_SKIP;
+    return writer->consumeAudio(input_buffer);
+}
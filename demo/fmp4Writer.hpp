@@ -0,0 +1,79 @@
+#pragma once
+#include "module/module_media.hpp"
+#include "fmp4Muxer.hpp"
+#include "segmentFinalizer.hpp"
+
+/*
+ * Fragmented MP4 counterpart of ModuleFileWriter: H.264/H.265 from an
+ * encoder, AAC through ModuleFmp4WriterExtend. See Fmp4Muxer for the
+ * file layout. changeFileName() hands the old file to a SegmentFinalizer
+ * and returns as soon as the new one is open.
+ */
+class ModuleFmp4Writer : public ModuleMedia
+{
+    friend class ModuleFmp4WriterExtend;
+
+public:
+    ModuleFmp4Writer(string path);
+    ~ModuleFmp4Writer();
+
+    int changeFileName(string file_name);
+    // Files closing in the background at most, changeFileName waits beyond that.
+    void setMaxPendingClose(size_t count) { max_pending_close = count; }
+    // Called from the finalizer thread once a file given up by changeFileName is closed.
+    void setFileClosedCallback(SegmentFinalizer::FinishedCallback callback) { closed_callback = callback; }
+    void setFragmentDuration(int64_t duration_us) { fragment_duration = duration_us; }
+    void setSyncEachFragment(bool sync) { sync_fragment = sync; }
+    void setPreallocateSize(uint64_t bytes) { prealloc_size = bytes; }
+    // Save a KeyframeIndex sidecar next to every file for fast seeking.
+    void setWriteIndex(bool enable) { write_index = enable; }
+    void setVideoExtraData(const uint8_t* extra_data, unsigned extra_size);
+    void setAudioParameter(int channel_count, int bit_per_sample, int sample_rate, media_codec_t type);
+    void setAudioExtraData(const uint8_t* extra_data, unsigned extra_size);
+
+    void setBufferCount(uint16_t buffer_count) { (void)buffer_count; }
+    int init() override;
+    void dumpStats();
+
+protected:
+    virtual ConsumeResult doConsume(shared_ptr<MediaBuffer> input_buffer, shared_ptr<MediaBuffer> output_buffer) override;
+
+private:
+    shared_ptr<Fmp4Muxer> makeMuxer(const string& path);
+    ConsumeResult consumeAudio(shared_ptr<MediaBuffer> buffer);
+
+private:
+    string filepath;
+    std::mutex muxer_mtx;
+    shared_ptr<Fmp4Muxer> muxer;
+    AnnexB::Codec codec;
+    int64_t fragment_duration;
+    bool sync_fragment;
+    uint64_t prealloc_size;
+    bool write_index;
+    size_t max_pending_close;
+    SegmentFinalizer::FinishedCallback closed_callback;
+    SegmentFinalizer* finalizer;
+
+    std::vector<uint8_t> video_extra;
+    std::vector<uint8_t> audio_extra;
+    bool audio_enabled;
+    int audio_channels;
+    int audio_sample_rate;
+};
+
+class ModuleFmp4WriterExtend : public ModuleMedia
+{
+public:
+    ModuleFmp4WriterExtend(shared_ptr<ModuleFmp4Writer> writer);
+    ~ModuleFmp4WriterExtend();
+
+    void setBufferCount(uint16_t buffer_count) { (void)buffer_count; }
+    int init() override;
+
+protected:
+    virtual ConsumeResult doConsume(shared_ptr<MediaBuffer> input_buffer, shared_ptr<MediaBuffer> output_buffer) override;
+
+private:
+    shared_ptr<ModuleFmp4Writer> writer;
+};
@@ -0,0 +1,171 @@
+#include <chrono>
+#include "frameSkip.hpp"
+
+#define FRAME_SKIP_DEFAULT_LATENCY 200000
+
+static int64_t steadyClockUs()
+{
+    return std::chrono::duration_cast<std::chrono::microseconds>(
+               std::chrono::steady_clock::now().time_since_epoch())
+        .count();
+}
+
+ModuleFrameSkip::ModuleFrameSkip(SkipMode mode)
+    : ModuleMedia("FrameSkip"), mode(mode), min_interval(0), gop_interval(1),
+      max_latency(FRAME_SKIP_DEFAULT_LATENCY), annexb(false), codec(AnnexB::CODEC_H264),
+      passed(0), dropped(0)
+{
+    buffer_count = 0;
+    reset();
+}
+
+ModuleFrameSkip::~ModuleFrameSkip()
+{
+}
+
+void ModuleFrameSkip::reset()
+{
+    got_keyframe = false;
+    last_kept_pts = INT64_MIN;
+    gop_index = 0;
+    keep_gop = false;
+    max_temporal_id = 0;
+    clock_synced = false;
+    min_offset = 0;
+    max_pts = INT64_MIN;
+}
+
+int ModuleFrameSkip::init()
+{
+    shared_ptr<ModuleMedia> productor = getProductor();
+    if (productor == nullptr) {
+        ff_error("Frame skip has no productor\n");
+        return -1;
+    }
+
+    input_para = productor->getOutputImagePara();
+    output_para = input_para;
+    media_type = productor->getMediaType();
+
+    switch (input_para.v4l2Fmt) {
+        case V4L2_PIX_FMT_H264:
+            annexb = true;
+            codec = AnnexB::CODEC_H264;
+            break;
+        case V4L2_PIX_FMT_HEVC:
+            annexb = true;
+            codec = AnnexB::CODEC_H265;
+            break;
+        case V4L2_PIX_FMT_MJPEG:
+            // every frame is a keyframe
+            annexb = false;
+            break;
+        default:
+            ff_error("Frame skip does not support %s\n", v4l2GetFmtName(input_para.v4l2Fmt));
+            return -1;
+    }
+    return 0;
+}
+
+/// @brief Compare the pts progress with the wall clock
+/// @return true if the buffer arrives more than max_latency later than the earliest one did
+bool ModuleFrameSkip::isLate(int64_t pts)
+{
+    int64_t offset = steadyClockUs() - pts;
+
+    // A pts jump backwards restarts the reference, e.g. a reconnect or a looped file. It makes the
+    // offset larger, so it is told from running late by the pts, beyond any B-frame reordering.
+    if (!clock_synced || pts < max_pts - 10 * max_latency) {
+        clock_synced = true;
+        min_offset = offset;
+        max_pts = pts;
+        return false;
+    }
+
+    if (pts > max_pts)
+        max_pts = pts;
+    // A jump forward only lowers the offset.
+    if (offset < min_offset)
+        min_offset = offset;
+    return offset - min_offset > max_latency;
+}
+
+bool ModuleFrameSkip::keepFrame(const AnnexB::FrameInfo& info, int64_t pts)
+{
+    bool key = info.type == AnnexB::FRAME_KEY;
+    SkipMode m = mode;
+
+    if (key) {
+        if (!got_keyframe || m != SKIP_GOP)
+            gop_index = 0;
+        else
+            gop_index++;
+        got_keyframe = true;
+        keep_gop = gop_index % gop_interval == 0;
+    }
+    if (info.temporal_id > max_temporal_id)
+        max_temporal_id = info.temporal_id;
+
+    switch (m) {
+        case SKIP_KEYFRAME:
+            if (!key && info.type != AnnexB::FRAME_INTRA)
+                return false;
+            if (min_interval > 0 && last_kept_pts != INT64_MIN
+                && pts >= last_kept_pts && pts - last_kept_pts < min_interval)
+                return false;
+            last_kept_pts = pts;
+            return true;
+
+        case SKIP_GOP:
+            return got_keyframe && keep_gop;
+
+        case SKIP_LATE:
+            if (!isLate(pts))
+                return true;
+            if (info.reference)
+                return true;
+            // A H.265 sub-layer non-reference picture may still be referenced by higher sub-layers.
+            return annexb && codec == AnnexB::CODEC_H265 && info.temporal_id < max_temporal_id;
+
+        default:
+            return true;
+    }
+}
+
+ModuleMedia::ConsumeResult ModuleFrameSkip::doConsume(shared_ptr<MediaBuffer> input_buffer, shared_ptr<MediaBuffer> output_buffer)
+{
+    (void)output_buffer;
+    if (input_buffer == nullptr)
+        return CONSUME_SKIP;
+
+    if (mode == SKIP_NONE || input_buffer->getEos()) {
+        passed++;
+        return CONSUME_BYPASS;
+    }
+
+    AnnexB::FrameInfo info;
+    if (annexb) {
+        info = AnnexB::parseFrame((const uint8_t*)input_buffer->getActiveData(), input_buffer->getActiveSize(), codec);
+        if (info.vcl_count == 0) {
+            passed++;
+            return CONSUME_BYPASS;
+        }
+    } else {
+        info = {AnnexB::FRAME_KEY, false, 0, false, 1, false};
+    }
+
+    if (!keepFrame(info, input_buffer->getPUstimestamp())) {
+        dropped++;
+        return CONSUME_SKIP;
+    }
+
+    passed++;
+    return CONSUME_BYPASS;
+}
+
+void ModuleFrameSkip::dumpStats()
+{
+    uint64_t total = passed + dropped;
+    ff_info("frame skip: passed %" PRIu64 ", dropped %" PRIu64 " (%.1f%%)\n", passed, dropped,
+            total ? dropped * 100.0 / total : 0.0);
+}
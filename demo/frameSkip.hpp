@@ -0,0 +1,77 @@
+#pragma once
+#include <atomic>
+
+#include "module/module_media.hpp"
+#include "annexb.hpp"
+
+/*
+ * Bitstream level frame skipping in front of a decoder.
+ *
+ * The module sits between a source and ModuleMppDec (or any decoder) and
+ * passes the encoded buffers it keeps straight through, timestamps
+ * untouched, so the frames it drops never reach the VPU:
+ *   SKIP_KEYFRAME  only IDR/IRAP and H.264 all-intra frames, optionally at
+ *                  most one per min interval (thumbnails, 1 fps analytics)
+ *   SKIP_GOP       one whole GOP out of every N
+ *   SKIP_LATE      non-reference frames while the stream runs behind
+ * Buffers without slices (parameter sets, SEI) always pass.
+ */
+class ModuleFrameSkip : public ModuleMedia
+{
+public:
+    enum SkipMode {
+        SKIP_NONE = 0,
+        SKIP_KEYFRAME,
+        SKIP_GOP,
+        SKIP_LATE,
+    };
+
+public:
+    ModuleFrameSkip(SkipMode mode = SKIP_NONE);
+    ~ModuleFrameSkip();
+
+    void setMode(SkipMode _mode) { mode = _mode; }
+    SkipMode getMode() const { return mode; }
+    void setMinInterval(int64_t interval_us) { min_interval = interval_us; }
+    void setGopInterval(uint32_t gops) { gop_interval = gops ? gops : 1; }
+    void setMaxLatency(int64_t latency_us) { max_latency = latency_us; }
+
+    // Kept packets are the source's own buffers, handed on before the decoder sees them.
+    void setBufferCount(uint16_t buffer_count) { (void)buffer_count; }
+    int init() override;
+
+    uint64_t getPassedCount() const { return passed; }
+    uint64_t getDroppedCount() const { return dropped; }
+    void dumpStats();
+
+public:
+    virtual ConsumeResult doConsume(shared_ptr<MediaBuffer> input_buffer, shared_ptr<MediaBuffer> output_buffer) override;
+
+protected:
+    void reset() override;
+
+private:
+    bool keepFrame(const AnnexB::FrameInfo& info, int64_t pts);
+    bool isLate(int64_t pts);
+
+private:
+    std::atomic<SkipMode> mode;
+    int64_t min_interval;
+    uint32_t gop_interval;
+    int64_t max_latency;
+
+    bool annexb;
+    AnnexB::Codec codec;
+
+    bool got_keyframe;
+    int64_t last_kept_pts;
+    uint64_t gop_index;
+    bool keep_gop;
+    uint8_t max_temporal_id;
+    bool clock_synced;
+    int64_t min_offset;
+    int64_t max_pts;
+
+    uint64_t passed;
+    uint64_t dropped;
+};
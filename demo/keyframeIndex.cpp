@@ -0,0 +1,134 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <algorithm>
+
+#include "keyframeIndex.hpp"
+#include "mp4Parser.hpp"
+#include "base/ff_log.h"
+
+#define KFI_MAGIC 0x3149464b  // "KFI1"
+struct KfiHeader {
+    uint32_t magic;
+    uint32_t count;
+    uint64_t file_size;
+};
+
+KeyframeIndex::KeyframeIndex() : file_size(0)
+{
+}
+
+void KeyframeIndex::clear()
+{
+    entries.clear();
+    file_size = 0;
+}
+
+void KeyframeIndex::append(int64_t time_us, uint64_t offset)
+{
+    entries.push_back({time_us, offset});
+}
+
+size_t KeyframeIndex::lookup(int64_t time_us) const
+{
+    auto it = std::upper_bound(entries.begin(), entries.end(), time_us,
+                               [](int64_t t, const Entry& e) { return t < e.time_us; });
+    return it == entries.begin() ? 0 : it - entries.begin() - 1;
+}
+
+/// @brief Load the sidecar index, or build it from the file when there is none or it is stale
+int KeyframeIndex::load(const std::string& path)
+{
+    struct stat st;
+    if (stat(path.c_str(), &st) < 0) {
+        ff_error("Failed to stat %s: %s\n", path.c_str(), strerror(errno));
+        return -1;
+    }
+
+    if (loadSidecar(path + SIDECAR_SUFFIX, st.st_size) == 0)
+        return 0;
+    return build(path);
+}
+
+int KeyframeIndex::loadSidecar(const std::string& path, uint64_t size)
+{
+    int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0)
+        return -1;
+
+    // A sidecar whose length does not match its count is truncated or corrupt, rebuild instead
+    // of trusting the count with an allocation.
+    KfiHeader header;
+    struct stat st;
+    int ret = -1;
+    if (read(fd, &header, sizeof(header)) == sizeof(header) && header.magic == KFI_MAGIC
+        && header.file_size == size && fstat(fd, &st) == 0
+        && (uint64_t)st.st_size == sizeof(header) + (uint64_t)header.count * sizeof(Entry)) {
+        std::vector<Entry> loaded(header.count);
+        ssize_t bytes = (uint64_t)header.count * sizeof(Entry);
+        if (read(fd, loaded.data(), bytes) == bytes) {
+            entries.swap(loaded);
+            file_size = size;
+            ret = 0;
+        }
+    }
+    ::close(fd);
+    return ret;
+}
+
+int KeyframeIndex::save(const std::string& path) const
+{
+    std::string sidecar = path + SIDECAR_SUFFIX;
+    std::string tmp = sidecar + ".tmp";
+    int fd = ::open(tmp.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd < 0) {
+        ff_warn("Failed to create %s: %s\n", tmp.c_str(), strerror(errno));
+        return -1;
+    }
+
+    KfiHeader header = {KFI_MAGIC, (uint32_t)entries.size(), file_size};
+    ssize_t bytes = entries.size() * sizeof(Entry);
+    bool ok = write(fd, &header, sizeof(header)) == sizeof(header)
+              && write(fd, entries.data(), bytes) == bytes;
+    ::close(fd);
+
+    // Replace atomically, a reader never sees a half written index.
+    if (!ok || rename(tmp.c_str(), sidecar.c_str()) < 0) {
+        unlink(tmp.c_str());
+        return -1;
+    }
+    return 0;
+}
+
+/// @brief Build the index from the MP4 boxes, reading only moov and moof
+int KeyframeIndex::build(const std::string& path)
+{
+    int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        ff_error("Failed to open %s: %s\n", path.c_str(), strerror(errno));
+        return -1;
+    }
+
+    struct stat st;
+    fstat(fd, &st);
+    clear();
+    file_size = st.st_size;
+
+    Mp4Parser parser;
+    int ret = parser.parse(fd, file_size, [this](const Mp4Parser::Sample& s) {
+        if (s.key)
+            append(s.time_us, s.offset);
+    });
+    ::close(fd);
+
+    if (ret < 0) {
+        ff_error("Failed to build keyframe index of %s\n", path.c_str());
+        return -1;
+    }
+    std::stable_sort(entries.begin(), entries.end(),
+                     [](const Entry& a, const Entry& b) { return a.time_us < b.time_us; });
+    return 0;
+}
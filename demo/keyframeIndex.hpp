@@ -0,0 +1,50 @@
+#pragma once
+#include <stdint.h>
+#include <stddef.h>
+#include <string>
+#include <vector>
+
+/*
+ * Keyframe index of a recording: media time -> byte offset of every video
+ * sync sample, sorted by time.
+ *
+ * load() reads the "<file>.kfi" sidecar when it still matches the file,
+ * otherwise it builds the index from the sync samples Mp4Parser reports,
+ * which reads only moov and moof, so a large file is never scanned. Times
+ * are in microseconds from the start of the file.
+ */
+class KeyframeIndex
+{
+public:
+    struct Entry {
+        int64_t time_us;
+        uint64_t offset;
+    };
+
+    static constexpr const char* SIDECAR_SUFFIX = ".kfi";
+
+public:
+    KeyframeIndex();
+
+    int load(const std::string& path);
+    int build(const std::string& path);
+    int save(const std::string& path) const;
+
+    void clear();
+    void append(int64_t time_us, uint64_t offset);
+    void setFileSize(uint64_t size) { file_size = size; }
+
+    size_t size() const { return entries.size(); }
+    bool empty() const { return entries.empty(); }
+    const Entry& at(size_t i) const { return entries[i]; }
+
+    // Index of the last keyframe at or before time_us, 0 when it precedes the first one.
+    size_t lookup(int64_t time_us) const;
+
+private:
+    int loadSidecar(const std::string& path, uint64_t size);
+
+private:
+    std::vector<Entry> entries;
+    uint64_t file_size;
+};
@@ -0,0 +1,873 @@
+#include <arpa/inet.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <stdio.h>
+#include <string.h>
+#include <strings.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <time.h>
+#include <unistd.h>
+#include <algorithm>
+#include <chrono>
+#include <deque>
+
+#include "base/ff_log.h"
+#include "rtspUtil.hpp"
+#include "llHls.hpp"
+
+#define HLS_PART_DURATION_MS 200
+#define HLS_SEGMENT_DURATION_MS 1000
+#define HLS_SEGMENT_COUNT 6
+#define HLS_MAX_REQUEST (8 << 10)
+#define HLS_IDLE_TIMEOUT_US 30000000
+#define HLS_SEND_IOV 64
+#define HLS_POLL_MS 500
+#define HLS_HOLD_POLL_MS 100
+
+using SharedBytes = shared_ptr<std::vector<uint8_t>>;
+
+static int64_t steadyClockUs()
+{
+    return std::chrono::duration_cast<std::chrono::microseconds>(
+               std::chrono::steady_clock::now().time_since_epoch())
+        .count();
+}
+
+static int64_t wallClockUs()
+{
+    return std::chrono::duration_cast<std::chrono::microseconds>(
+               std::chrono::system_clock::now().time_since_epoch())
+        .count();
+}
+
+static std::string segmentName(uint64_t msn)
+{
+    return "seg" + std::to_string(msn) + ".m4s";
+}
+
+static std::string partName(uint64_t msn, size_t index)
+{
+    return "part" + std::to_string(msn) + "." + std::to_string(index) + ".m4s";
+}
+
+/// @brief Integer value of a query parameter, -1 if it is missing.
+static int64_t queryValue(const std::string& query, const char* key)
+{
+    size_t len = strlen(key);
+    for (size_t pos = 0; pos < query.size();) {
+        size_t end = query.find('&', pos);
+        if (end == std::string::npos)
+            end = query.size();
+        if (end - pos > len && query.compare(pos, len, key) == 0 && query[pos + len] == '=')
+            return strtoll(query.c_str() + pos + len + 1, NULL, 10);
+        pos = end + 1;
+    }
+    return -1;
+}
+
+static int writeFile(const std::string& path, const std::vector<SharedBytes>& data)
+{
+    // Written aside and renamed, a web server never sees half a file.
+    std::string tmp = path + ".tmp";
+    int fd = open(tmp.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd < 0)
+        return -1;
+    for (auto& bytes : data) {
+        for (size_t done = 0; done < bytes->size();) {
+            ssize_t n = write(fd, bytes->data() + done, bytes->size() - done);
+            if (n < 0 && errno == EINTR)
+                continue;
+            if (n <= 0) {
+                close(fd);
+                unlink(tmp.c_str());
+                return -1;
+            }
+            done += n;
+        }
+    }
+    close(fd);
+    return rename(tmp.c_str(), path.c_str());
+}
+
+struct LlHlsServer::Stream {
+    struct Part {
+        std::vector<SharedBytes> data;  // moof + mdat header, then the samples
+        size_t size;
+        int64_t duration_us;
+        bool independent;
+        uint64_t serial;
+    };
+
+    struct Segment {
+        uint64_t msn;
+        std::vector<Part> parts;
+        int64_t duration_us;
+        int64_t wall_us;        // wall clock at its start, for EXT-X-PROGRAM-DATE-TIME
+        bool complete;
+    };
+
+    std::string path;
+    int64_t part_us;
+    int64_t segment_us;
+    size_t segment_count;
+    std::string dir;
+
+    SharedBytes init;
+    std::deque<Segment> segments;   // the last one is being filled
+    uint64_t next_serial;
+    int target_duration;            // seconds, only grows
+
+    // Directory output, the files are written by the server thread outside the lock.
+    bool dir_dirty;
+    bool dir_init;
+    uint64_t dir_serial;            // parts before this are written
+    uint64_t dir_msn;               // complete segments before this are written
+    std::vector<std::pair<uint64_t, size_t>> evicted;  // segments and their part counts to remove
+
+    uint64_t parts;
+    uint64_t completed_segments;
+    uint64_t requests;
+    uint64_t held;
+    uint64_t timeouts;
+    uint64_t not_found;
+    uint64_t sent_bytes;
+};
+
+struct LlHlsServer::Client {
+    struct Chunk {
+        SharedBytes owner;
+        size_t offset;
+        size_t size;
+    };
+
+    int fd;
+    bool closed;
+    std::string in;
+    std::deque<Chunk> out;      // references the part buffers, nothing is copied
+    int64_t last_seen;
+
+    // The request being answered, possibly held until what it asks for exists.
+    bool pending;
+    std::string target;
+    bool head;
+    bool close_after;
+    bool counted;
+    int64_t deadline;
+};
+
+shared_ptr<LlHlsServer> LlHlsServer::get(int port)
+{
+    static std::mutex registry_mtx;
+    static std::map<int, std::weak_ptr<LlHlsServer>> registry;
+
+    std::lock_guard<std::mutex> lk(registry_mtx);
+    shared_ptr<LlHlsServer> server = registry[port].lock();
+    if (server)
+        return server;
+
+    server = shared_ptr<LlHlsServer>(new LlHlsServer(port));
+    if (server->start() < 0)
+        return nullptr;
+    registry[port] = server;
+    return server;
+}
+
+LlHlsServer::LlHlsServer(int port)
+    : port(port), listen_fd(-1), wake_fd(-1), quit(false), thread(nullptr)
+{
+}
+
+LlHlsServer::~LlHlsServer()
+{
+    if (thread) {
+        quit = true;
+        wake();
+        thread->join();
+        delete thread;
+        thread = nullptr;
+    }
+
+    for (auto& c : clients) {
+        if (!c->closed)
+            close(c->fd);
+    }
+    clients.clear();
+    for (int fd : {listen_fd, wake_fd}) {
+        if (fd >= 0)
+            close(fd);
+    }
+}
+
+int LlHlsServer::start()
+{
+    if (port > 0) {
+        int on = 1;
+        sockaddr_in addr = {};
+        addr.sin_family = AF_INET;
+        addr.sin_addr.s_addr = htonl(INADDR_ANY);
+        addr.sin_port = htons(port);
+        listen_fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+        setsockopt(listen_fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+        if (bind(listen_fd, (sockaddr*)&addr, sizeof(addr)) < 0 || listen(listen_fd, 64) < 0) {
+            ff_error("Failed to listen on http port %d: %s\n", port, strerror(errno));
+            return -1;
+        }
+    }
+
+    wake_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    thread = new std::thread(&LlHlsServer::serverProcess, this);
+    if (port > 0)
+        ff_info("LL-HLS server on http port %d\n", port);
+    return 0;
+}
+
+void LlHlsServer::wake()
+{
+    uint64_t one = 1;
+    if (write(wake_fd, &one, sizeof(one)) < 0)
+        ff_warn("Failed to wake the http thread\n");
+}
+
+shared_ptr<LlHlsServer::Stream> LlHlsServer::addStream(const std::string& path, int part_ms, int segment_ms,
+                                                       size_t segment_count, const std::string& dir)
+{
+    std::lock_guard<std::mutex> lk(mtx);
+    std::string key = RtspUtil::urlPath(path);
+    if (streams.count(key)) {
+        ff_error("LL-HLS path %s is already published\n", path.c_str());
+        return nullptr;
+    }
+    if (!dir.empty() && mkdir(dir.c_str(), 0755) < 0 && errno != EEXIST) {
+        ff_error("Failed to create %s: %s\n", dir.c_str(), strerror(errno));
+        return nullptr;
+    }
+
+    shared_ptr<Stream> stream = make_shared<Stream>();
+    stream->path = key;
+    stream->part_us = (int64_t)std::max(part_ms, 1) * 1000;
+    stream->segment_us = (int64_t)std::max(segment_ms, part_ms) * 1000;
+    stream->segment_count = std::max<size_t>(segment_count, 1);
+    stream->dir = dir;
+    stream->next_serial = 0;
+    stream->target_duration = std::max(1, (int)((stream->segment_us + 999999) / 1000000));
+    stream->dir_dirty = false;
+    stream->dir_init = false;
+    stream->dir_serial = 0;
+    stream->dir_msn = 0;
+    stream->parts = stream->completed_segments = stream->requests = stream->held = 0;
+    stream->timeouts = stream->not_found = stream->sent_bytes = 0;
+    streams[key] = stream;
+    return stream;
+}
+
+void LlHlsServer::removeStream(const shared_ptr<Stream>& stream)
+{
+    std::lock_guard<std::mutex> lk(mtx);
+    streams.erase(stream->path);
+}
+
+/// @brief Add a fragment of the muxer as the next part, starting a segment at a keyframe past the segment duration
+void LlHlsServer::publish(Stream* stream, Fmp4Muxer::Fragment& fragment)
+{
+    SharedBytes header = make_shared<std::vector<uint8_t>>();
+    header->swap(fragment.header);
+
+    Stream::Part part = {{header}, header->size(), fragment.duration_us, fragment.independent, 0};
+    for (std::vector<uint8_t>* data : {&fragment.video, &fragment.audio}) {
+        if (data->empty())
+            continue;
+        SharedBytes bytes = make_shared<std::vector<uint8_t>>();
+        bytes->swap(*data);
+        part.size += bytes->size();
+        part.data.push_back(bytes);
+    }
+    int64_t wall = wallClockUs();
+
+    std::lock_guard<std::mutex> lk(mtx);
+    stream->dir_dirty = true;
+    if (fragment.init) {
+        stream->init = header;
+        stream->dir_init = false;
+        wake();
+        return;
+    }
+
+    if (stream->segments.empty()
+        || (fragment.independent && stream->segments.back().duration_us >= stream->segment_us)) {
+        uint64_t msn = 0;
+        if (!stream->segments.empty()) {
+            Stream::Segment& last = stream->segments.back();
+            last.complete = true;
+            stream->completed_segments++;
+            int seconds = (last.duration_us + 500000) / 1000000;
+            if (seconds > stream->target_duration) {
+                ff_warn("LL-HLS %s: segment of %.2f s, raising the target duration, is the GOP longer than the segment?\n",
+                        stream->path.c_str(), last.duration_us / 1000000.0);
+                stream->target_duration = seconds;
+            }
+            msn = last.msn + 1;
+        }
+        stream->segments.push_back({msn, {}, 0, wall - fragment.duration_us, false});
+        while (stream->segments.size() > stream->segment_count + 1) {
+            if (!stream->dir.empty())
+                stream->evicted.push_back({stream->segments.front().msn, stream->segments.front().parts.size()});
+            stream->segments.pop_front();
+        }
+    }
+
+    part.serial = stream->next_serial++;
+    Stream::Segment& segment = stream->segments.back();
+    segment.parts.push_back(std::move(part));
+    segment.duration_us += fragment.duration_us;
+    stream->parts++;
+    wake();
+}
+
+void LlHlsServer::dumpStats(Stream* stream)
+{
+    std::lock_guard<std::mutex> lk(mtx);
+    ff_info("LL-HLS %s: %" PRIu64 " parts, %" PRIu64 " segments, target duration %d s, %" PRIu64 " requests, %" PRIu64
+            " held, %" PRIu64 " timed out, %" PRIu64 " not found, %" PRIu64 " bytes sent\n",
+            stream->path.c_str(), stream->parts, stream->completed_segments, stream->target_duration, stream->requests,
+            stream->held, stream->timeouts, stream->not_found, stream->sent_bytes);
+}
+
+void LlHlsServer::serverProcess()
+{
+    std::vector<pollfd> fds;
+    std::vector<Client*> polled;
+    bool holding = false;
+
+    while (!quit) {
+        fds.clear();
+        polled.clear();
+        fds.push_back({wake_fd, POLLIN, 0});
+        fds.push_back({listen_fd, POLLIN, 0});  // poll skips -1 when there is no http port
+        {
+            std::lock_guard<std::mutex> lk(mtx);
+            for (auto& c : clients) {
+                fds.push_back({c->fd, (short)(POLLIN | (c->out.empty() ? 0 : POLLOUT)), 0});
+                polled.push_back(c.get());
+            }
+        }
+
+        int ret = poll(fds.data(), fds.size(), holding ? HLS_HOLD_POLL_MS : HLS_POLL_MS);
+        if (ret < 0 && errno != EINTR) {
+            ff_error("http poll failed: %s\n", strerror(errno));
+            break;
+        }
+        if (ret > 0 && (fds[0].revents & POLLIN)) {
+            uint64_t count;
+            if (read(wake_fd, &count, sizeof(count)) < 0)
+                ff_warn("Failed to read the wake event\n");
+        }
+
+        {
+            std::lock_guard<std::mutex> lk(mtx);
+            if (ret > 0) {
+                if (fds[1].revents & POLLIN)
+                    acceptClient();
+                for (size_t i = 0; i < polled.size(); i++) {
+                    if (fds[i + 2].revents & POLLOUT)
+                        flushClient(polled[i]);
+                    if ((fds[i + 2].revents & ~POLLOUT) && !polled[i]->closed)
+                        readClient(polled[i]);
+                }
+            }
+
+            // Held requests are looked at again on every new part and at their deadline.
+            int64_t now = steadyClockUs();
+            holding = false;
+            for (auto& c : clients) {
+                if (c->closed)
+                    continue;
+                if (c->pending)
+                    processRequests(c.get(), now);
+                if (!c->closed && !c->pending && c->out.empty() && now - c->last_seen > HLS_IDLE_TIMEOUT_US)
+                    closeClient(c.get());
+                holding |= !c->closed && c->pending;
+            }
+            clients.erase(std::remove_if(clients.begin(), clients.end(),
+                                         [](const std::unique_ptr<Client>& c) { return c->closed; }),
+                          clients.end());
+        }
+
+        writeDirectories();
+    }
+}
+
+void LlHlsServer::acceptClient()
+{
+    for (;;) {
+        int fd = accept4(listen_fd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+        if (fd < 0)
+            return;
+
+        std::unique_ptr<Client> c(new Client());
+        c->fd = fd;
+        c->closed = false;
+        c->last_seen = steadyClockUs();
+        c->pending = false;
+        c->head = false;
+        c->close_after = false;
+        c->counted = false;
+        c->deadline = 0;
+        clients.push_back(std::move(c));
+    }
+}
+
+void LlHlsServer::readClient(Client* client)
+{
+    char buf[4096];
+    for (;;) {
+        ssize_t n = recv(client->fd, buf, sizeof(buf), MSG_DONTWAIT);
+        if (n > 0) {
+            client->in.append(buf, n);
+            if (client->in.size() > HLS_MAX_REQUEST) {
+                closeClient(client);
+                return;
+            }
+            continue;
+        }
+        if (n == 0 || (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR)) {
+            closeClient(client);
+            return;
+        }
+        break;
+    }
+
+    client->last_seen = steadyClockUs();
+    processRequests(client, client->last_seen);
+}
+
+/// @brief Close a connection, it is removed from the list by the server loop
+void LlHlsServer::closeClient(Client* client)
+{
+    if (client->closed)
+        return;
+    close(client->fd);
+    client->closed = true;
+    client->pending = false;
+    client->out.clear();
+}
+
+void LlHlsServer::flushClient(Client* client)
+{
+    while (!client->closed && !client->out.empty()) {
+        iovec iov[HLS_SEND_IOV];
+        size_t count = 0;
+        for (auto it = client->out.begin(); it != client->out.end() && count < HLS_SEND_IOV; ++it, ++count) {
+            iov[count].iov_base = it->owner->data() + it->offset;
+            iov[count].iov_len = it->size;
+        }
+        msghdr msg = {};
+        msg.msg_iov = iov;
+        msg.msg_iovlen = count;
+        ssize_t sent = sendmsg(client->fd, &msg, MSG_NOSIGNAL | MSG_DONTWAIT);
+        if (sent < 0) {
+            if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR)
+                closeClient(client);
+            return;
+        }
+
+        while (sent > 0) {
+            Client::Chunk& front = client->out.front();
+            if ((size_t)sent < front.size) {
+                front.offset += sent;
+                front.size -= sent;
+                break;
+            }
+            sent -= front.size;
+            client->out.pop_front();
+        }
+    }
+
+    if (!client->closed && client->out.empty() && client->close_after && !client->pending)
+        closeClient(client);
+}
+
+/// @brief Answer the buffered requests in order, stopping at one that has to wait
+void LlHlsServer::processRequests(Client* client, int64_t now)
+{
+    while (!client->closed) {
+        if (!client->pending) {
+            size_t end = client->in.find("\r\n\r\n");
+            if (end == std::string::npos)
+                break;
+            std::string request = client->in.substr(0, end + 4);
+            client->in.erase(0, end + 4);
+
+            char method[16], target[2048], version[16];
+            if (sscanf(request.c_str(), "%15s %2047s %15s", method, target, version) != 3) {
+                closeClient(client);
+                return;
+            }
+            client->pending = true;
+            client->target = target;
+            client->head = strcmp(method, "HEAD") == 0;
+            client->close_after = strcmp(version, "HTTP/1.0") == 0
+                                  || strcasecmp(RtspUtil::header(request, "Connection").c_str(), "close") == 0;
+            client->counted = false;
+            client->deadline = 0;
+            if (strcmp(method, "GET") != 0 && !client->head) {
+                respond(client, 405, "Method not allowed\n");
+                client->pending = false;
+                continue;
+            }
+        }
+        if (!handleRequest(client, now))
+            break;
+        client->pending = false;
+    }
+    flushClient(client);
+}
+
+/// @brief Answer the pending request of a client
+/// @return false while it is held for a part that does not exist yet
+bool LlHlsServer::handleRequest(Client* client, int64_t now)
+{
+    size_t query_pos = client->target.find('?');
+    std::string path = client->target.substr(0, query_pos);
+    std::string query = query_pos == std::string::npos ? std::string() : client->target.substr(query_pos + 1);
+    std::string name;
+    shared_ptr<Stream> found = findStream(path, &name);
+    if (found == nullptr) {
+        respond(client, 404, "Not found\n");
+        return true;
+    }
+
+    Stream* stream = found.get();
+    if (client->deadline == 0) {
+        stream->requests++;
+        client->deadline = now + 3LL * stream->target_duration * 1000000;
+    }
+    // Nothing can be played before the first part.
+    Stream::Segment* live = stream->init && !stream->segments.empty() ? &stream->segments.back() : nullptr;
+    uint64_t first_msn = live ? stream->segments.front().msn : 0;
+
+    if (name == "index.m3u8") {
+        int64_t msn = queryValue(query, "_HLS_msn");
+        int64_t part = queryValue(query, "_HLS_part");
+        if (live && msn > (int64_t)live->msn + 2) {
+            respond(client, 400, "_HLS_msn is too far ahead\n");
+            return true;
+        }
+        bool ready = live
+                     && (msn < (int64_t)live->msn
+                         || (msn == (int64_t)live->msn && part >= 0 && part < (int64_t)live->parts.size()));
+        if (!ready)
+            return holdRequest(client, stream, now);
+        respond(client, 200, playlist(stream, true));
+        return true;
+    }
+
+    if (name == "init.mp4") {
+        if (stream->init == nullptr)
+            return holdRequest(client, stream, now);
+        respondData(client, stream, "video/mp4", "max-age=3600", {stream->init});
+        return true;
+    }
+
+    uint64_t msn = 0;
+    size_t index = 0;
+    int used = 0;
+    if (sscanf(name.c_str(), "seg%" SCNu64 ".m4s%n", &msn, &used) == 1 && used == (int)name.size()) {
+        if (live && msn >= first_msn && msn - first_msn < stream->segments.size()
+            && stream->segments[msn - first_msn].complete) {
+            std::vector<SharedBytes> data;
+            for (auto& p : stream->segments[msn - first_msn].parts)
+                data.insert(data.end(), p.data.begin(), p.data.end());
+            respondData(client, stream, "video/mp4", "max-age=60", data);
+            return true;
+        }
+        if (live ? msn == live->msn : msn == 0)
+            return holdRequest(client, stream, now);
+    } else if (sscanf(name.c_str(), "part%" SCNu64 ".%zu.m4s%n", &msn, &index, &used) == 2 && used == (int)name.size()) {
+        if (live && msn >= first_msn && msn - first_msn < stream->segments.size()
+            && index < stream->segments[msn - first_msn].parts.size()) {
+            respondData(client, stream, "video/mp4", "max-age=60", stream->segments[msn - first_msn].parts[index].data);
+            return true;
+        }
+        // The preload hint, or the first part of the next segment; a hinted part that a keyframe
+        // moved into a new segment is not found once that segment starts.
+        bool next = live ? (msn == live->msn && index == live->parts.size()) || (msn == live->msn + 1 && index == 0)
+                         : msn == 0 && index == 0;
+        if (next)
+            return holdRequest(client, stream, now);
+    }
+
+    stream->not_found++;
+    respond(client, 404, "Not found\n");
+    return true;
+}
+
+/// @brief Keep a request waiting, or answer it with 503 at its deadline
+bool LlHlsServer::holdRequest(Client* client, Stream* stream, int64_t now)
+{
+    if (!client->counted) {
+        stream->held++;
+        client->counted = true;
+    }
+    if (now < client->deadline)
+        return false;
+    stream->timeouts++;
+    respond(client, 503, "Timed out waiting for the stream\n");
+    return true;
+}
+
+static std::string httpHeader(int status, const char* type, size_t length, const char* cache, bool close_after)
+{
+    const char* reason = status == 200   ? "OK"
+                         : status == 400 ? "Bad Request"
+                         : status == 404 ? "Not Found"
+                         : status == 405 ? "Method Not Allowed"
+                                         : "Service Unavailable";
+    char head[512];
+    snprintf(head, sizeof(head),
+             "HTTP/1.1 %d %s\r\nContent-Type: %s\r\nContent-Length: %zu\r\nCache-Control: %s\r\n"
+             "Access-Control-Allow-Origin: *\r\nConnection: %s\r\n\r\n",
+             status, reason, type, length, cache, close_after ? "close" : "keep-alive");
+    return head;
+}
+
+/// @brief Queue a playlist, or a text error for other statuses
+void LlHlsServer::respond(Client* client, int status, const std::string& body)
+{
+    const char* type = status == 200 ? "application/vnd.apple.mpegurl" : "text/plain";
+    std::string text = httpHeader(status, type, body.size(), "no-cache", client->close_after);
+    if (!client->head)
+        text += body;
+    SharedBytes bytes = make_shared<std::vector<uint8_t>>(text.begin(), text.end());
+    client->out.push_back({bytes, 0, bytes->size()});
+}
+
+/// @brief Queue a response whose body is sent from the given buffers
+void LlHlsServer::respondData(Client* client, Stream* stream, const char* type, const char* cache,
+                              const std::vector<SharedBytes>& data)
+{
+    size_t length = 0;
+    for (auto& bytes : data)
+        length += bytes->size();
+    std::string head = httpHeader(200, type, length, cache, client->close_after);
+    SharedBytes bytes = make_shared<std::vector<uint8_t>>(head.begin(), head.end());
+    client->out.push_back({bytes, 0, bytes->size()});
+    if (client->head)
+        return;
+    for (auto& d : data) {
+        if (!d->empty())
+            client->out.push_back({d, 0, d->size()});
+    }
+    stream->sent_bytes += length;
+}
+
+std::string LlHlsServer::playlist(Stream* stream, bool blocking_reload)
+{
+    char line[256];
+    std::string out = "#EXTM3U\n#EXT-X-VERSION:6\n";
+    snprintf(line, sizeof(line), "#EXT-X-TARGETDURATION:%d\n", stream->target_duration);
+    out += line;
+    double part_target = stream->part_us / 1000000.0;
+    snprintf(line, sizeof(line), "#EXT-X-SERVER-CONTROL:%sPART-HOLD-BACK=%.3f\n",
+             blocking_reload ? "CAN-BLOCK-RELOAD=YES," : "", part_target * 3);
+    out += line;
+    snprintf(line, sizeof(line), "#EXT-X-PART-INF:PART-TARGET=%.3f\n", part_target);
+    out += line;
+    snprintf(line, sizeof(line), "#EXT-X-MEDIA-SEQUENCE:%" PRIu64 "\n",
+             stream->segments.empty() ? 0 : stream->segments.front().msn);
+    out += line;
+    out += "#EXT-X-INDEPENDENT-SEGMENTS\n#EXT-X-MAP:URI=\"init.mp4\"\n";
+    if (stream->segments.empty())
+        return out;
+
+    time_t seconds = stream->segments.front().wall_us / 1000000;
+    struct tm tm;
+    gmtime_r(&seconds, &tm);
+    strftime(line, sizeof(line), "#EXT-X-PROGRAM-DATE-TIME:%Y-%m-%dT%H:%M:%S", &tm);
+    out += line;
+    snprintf(line, sizeof(line), ".%03dZ\n", (int)(stream->segments.front().wall_us / 1000 % 1000));
+    out += line;
+
+    // Parts are listed for the segments within three target durations of the live edge.
+    int64_t total = 0;
+    for (auto& s : stream->segments)
+        total += s.duration_us;
+    int64_t parts_from = total - 3LL * stream->target_duration * 1000000;
+    int64_t start = 0;
+    for (auto& s : stream->segments) {
+        if (start + s.duration_us > parts_from || !s.complete) {
+            for (size_t i = 0; i < s.parts.size(); i++) {
+                snprintf(line, sizeof(line), "#EXT-X-PART:DURATION=%.3f,URI=\"%s\"%s\n",
+                         s.parts[i].duration_us / 1000000.0, partName(s.msn, i).c_str(),
+                         s.parts[i].independent ? ",INDEPENDENT=YES" : "");
+                out += line;
+            }
+        }
+        if (s.complete) {
+            snprintf(line, sizeof(line), "#EXTINF:%.3f,\n%s\n", s.duration_us / 1000000.0, segmentName(s.msn).c_str());
+            out += line;
+        }
+        start += s.duration_us;
+    }
+
+    const Stream::Segment& live = stream->segments.back();
+    snprintf(line, sizeof(line), "#EXT-X-PRELOAD-HINT:TYPE=PART,URI=\"%s\"\n",
+             partName(live.msn, live.parts.size()).c_str());
+    out += line;
+    return out;
+}
+
+/// @brief Write what is new of the streams with an output directory, outside the lock
+void LlHlsServer::writeDirectories()
+{
+    struct Output {
+        std::string dir;
+        std::vector<std::pair<std::string, std::vector<SharedBytes>>> files;
+        std::vector<std::string> removed;
+    };
+    std::vector<Output> outputs;
+
+    {
+        std::lock_guard<std::mutex> lk(mtx);
+        for (auto& it : streams) {
+            Stream* s = it.second.get();
+            if (s->dir.empty() || !s->dir_dirty)
+                continue;
+            s->dir_dirty = false;
+
+            Output o;
+            o.dir = s->dir;
+            if (!s->dir_init && s->init) {
+                o.files.push_back({"init.mp4", {s->init}});
+                s->dir_init = true;
+            }
+            for (auto& seg : s->segments) {
+                for (size_t i = 0; i < seg.parts.size(); i++) {
+                    if (seg.parts[i].serial >= s->dir_serial)
+                        o.files.push_back({partName(seg.msn, i), seg.parts[i].data});
+                }
+                if (seg.complete && seg.msn >= s->dir_msn) {
+                    std::vector<SharedBytes> data;
+                    for (auto& p : seg.parts)
+                        data.insert(data.end(), p.data.begin(), p.data.end());
+                    o.files.push_back({segmentName(seg.msn), data});
+                    s->dir_msn = seg.msn + 1;
+                }
+            }
+            s->dir_serial = s->next_serial;
+            for (auto& e : s->evicted) {
+                o.removed.push_back(segmentName(e.first));
+                for (size_t i = 0; i < e.second; i++)
+                    o.removed.push_back(partName(e.first, i));
+            }
+            s->evicted.clear();
+
+            // The playlist goes last, after everything it lists.
+            std::string text = playlist(s, false);
+            o.files.push_back({"index.m3u8", {make_shared<std::vector<uint8_t>>(text.begin(), text.end())}});
+            outputs.push_back(std::move(o));
+        }
+    }
+
+    for (auto& o : outputs) {
+        for (auto& f : o.files) {
+            if (writeFile(o.dir + "/" + f.first, f.second) < 0)
+                ff_warn("Failed to write %s/%s: %s\n", o.dir.c_str(), f.first.c_str(), strerror(errno));
+        }
+        for (auto& name : o.removed)
+            unlink((o.dir + "/" + name).c_str());
+    }
+}
+
+shared_ptr<LlHlsServer::Stream> LlHlsServer::findStream(const std::string& path, std::string* name)
+{
+    for (auto& it : streams) {
+        const std::string& prefix = it.first;
+        if (path.size() > prefix.size() + 1 && path.compare(0, prefix.size(), prefix) == 0 && path[prefix.size()] == '/') {
+            *name = path.substr(prefix.size() + 1);
+            return it.second;
+        }
+    }
+    return nullptr;
+}
+
+ModuleLlHls::ModuleLlHls(const char* path, int port)
+    : ModuleMedia("LlHls"), path(path), port(port), codec(AnnexB::CODEC_H264), part_ms(HLS_PART_DURATION_MS),
+      segment_ms(HLS_SEGMENT_DURATION_MS), segment_count(HLS_SEGMENT_COUNT), server(nullptr), stream(nullptr),
+      muxer(nullptr), last_extra_buffer(nullptr)
+{
+    buffer_count = 0;
+}
+
+ModuleLlHls::~ModuleLlHls()
+{
+    // The last part is published by close().
+    if (muxer)
+        muxer->close();
+    if (server && stream)
+        server->removeStream(stream);
+}
+
+int ModuleLlHls::init()
+{
+    shared_ptr<ModuleMedia> productor = getProductor();
+    if (productor == nullptr) {
+        ff_error("LL-HLS has no productor\n");
+        return -1;
+    }
+
+    input_para = productor->getOutputImagePara();
+    media_type = productor->getMediaType();
+    if (input_para.v4l2Fmt == V4L2_PIX_FMT_H264) {
+        codec = AnnexB::CODEC_H264;
+    } else if (input_para.v4l2Fmt == V4L2_PIX_FMT_HEVC) {
+        codec = AnnexB::CODEC_H265;
+    } else {
+        ff_error("LL-HLS does not support %s\n", v4l2GetFmtName(input_para.v4l2Fmt));
+        return -1;
+    }
+
+    server = LlHlsServer::get(port);
+    if (server == nullptr)
+        return -1;
+    stream = server->addStream(path, part_ms, segment_ms, segment_count, output_dir);
+    if (stream == nullptr)
+        return -1;
+
+    muxer = make_shared<Fmp4Muxer>(path);
+    muxer->setVideoTrack(codec, input_para.width, input_para.height);
+    muxer->setFragmentDuration(part_ms * 1000LL);
+    muxer->setPartMode(true);
+    LlHlsServer* s = server.get();
+    LlHlsServer::Stream* st = stream.get();
+    muxer->setFragmentHandler([s, st](Fmp4Muxer::Fragment& fragment) { s->publish(st, fragment); });
+    return muxer->open();
+}
+
+void ModuleLlHls::dumpStats()
+{
+    if (server && stream)
+        server->dumpStats(stream.get());
+}
+
+ModuleMedia::ConsumeResult ModuleLlHls::doConsume(shared_ptr<MediaBuffer> input_buffer, shared_ptr<MediaBuffer> output_buffer)
+{
+    (void)output_buffer;
+    if (input_buffer == nullptr || input_buffer->getActiveSize() == 0)
+        return CONSUME_SKIP;
+
+    shared_ptr<MediaBuffer> extra = input_buffer->getExtraData();
+    if (extra != nullptr && extra != last_extra_buffer && extra->getActiveSize() > 0) {
+        muxer->setVideoExtraData((const uint8_t*)extra->getActiveData(), extra->getActiveSize());
+        last_extra_buffer = extra;
+    }
+
+    muxer->writeVideo((const uint8_t*)input_buffer->getActiveData(), input_buffer->getActiveSize(),
+                      input_buffer->getPUstimestamp());
+    return CONSUME_SUCCESS;
+}
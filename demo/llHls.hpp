@@ -0,0 +1,123 @@
+#pragma once
+#include <atomic>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "module/module_media.hpp"
+#include "annexb.hpp"
+#include "fmp4Muxer.hpp"
+
+/*
+ * Low-latency HLS output (CMAF fMP4 parts) for browsers, from memory.
+ *
+ * An Fmp4Muxer in part mode cuts the encoder output into fragments no
+ * longer than the part duration, with a new one at every keyframe. Each
+ * fragment is an LL-HLS part as it is: its moof and the sample data the
+ * muxer built are moved into the part, and a segment is the run of parts
+ * from a keyframe to the first keyframe past the segment duration, never
+ * muxed again. A window of segments stays in memory; responses are sent
+ * with sendmsg straight from the part buffers, a segment as the iovec of
+ * its parts.
+ *
+ * A playlist request with _HLS_msn/_HLS_part is held until that part
+ * exists (blocking playlist reload), and so is a request for the part of
+ * the preload hint, so a player gets every part as soon as the encoder
+ * has finished it. The same files can also be written to a directory for
+ * another web server, which can not offer blocking reload.
+ *
+ * One server per port runs the HTTP connections on its own thread, the
+ * ModuleLlHls instances register their paths with it, and the playlist of
+ * /live/0 is http://host:port/live/0/index.m3u8. Port 0 only writes the
+ * directories.
+ */
+class LlHlsServer
+{
+public:
+    struct Stream;
+    struct Client;
+
+    static shared_ptr<LlHlsServer> get(int port);
+    ~LlHlsServer();
+
+    // Parts of part_ms, segments of at least segment_ms, segment_count complete segments kept.
+    shared_ptr<Stream> addStream(const std::string& path, int part_ms, int segment_ms, size_t segment_count,
+                                 const std::string& dir);
+    void removeStream(const shared_ptr<Stream>& stream);
+
+    // Takes the buffers of the fragment.
+    void publish(Stream* stream, Fmp4Muxer::Fragment& fragment);
+    void dumpStats(Stream* stream);
+
+private:
+    LlHlsServer(int port);
+    int start();
+    void serverProcess();
+
+    void wake();
+    void acceptClient();
+    void readClient(Client* client);
+    void closeClient(Client* client);
+    void flushClient(Client* client);
+    void processRequests(Client* client, int64_t now);
+    bool handleRequest(Client* client, int64_t now);
+    bool holdRequest(Client* client, Stream* stream, int64_t now);
+    void respond(Client* client, int status, const std::string& body);
+    void respondData(Client* client, Stream* stream, const char* type, const char* cache,
+                     const std::vector<shared_ptr<std::vector<uint8_t>>>& data);
+    static std::string playlist(Stream* stream, bool blocking_reload);
+    void writeDirectories();
+    shared_ptr<Stream> findStream(const std::string& path, std::string* name);
+
+private:
+    int port;
+    int listen_fd;
+    int wake_fd;
+
+    std::mutex mtx;
+    std::map<std::string, shared_ptr<Stream>> streams;
+    std::vector<std::unique_ptr<Client>> clients;
+
+    std::atomic_bool quit;
+    std::thread* thread;
+};
+
+/*
+ * Pipeline sink publishing an encoded H.264/H.265 stream as LL-HLS on a
+ * LlHlsServer path, video only.
+ */
+class ModuleLlHls : public ModuleMedia
+{
+public:
+    ModuleLlHls(const char* path, int port);
+    ~ModuleLlHls();
+
+    void setBufferCount(uint16_t buffer_count) { (void)buffer_count; }
+    void setPartDuration(int ms) { part_ms = ms; }
+    // Segments end at the first keyframe after this, keep it near the GOP length.
+    void setSegmentDuration(int ms) { segment_ms = ms; }
+    void setSegmentCount(size_t count) { segment_count = count; }
+    // Also write the playlist, init segment, segments and parts into dir.
+    void setOutputDir(const std::string& dir) { output_dir = dir; }
+    int init() override;
+    void dumpStats();
+
+protected:
+    virtual ConsumeResult doConsume(shared_ptr<MediaBuffer> input_buffer, shared_ptr<MediaBuffer> output_buffer) override;
+
+private:
+    std::string path;
+    int port;
+    AnnexB::Codec codec;
+    int part_ms;
+    int segment_ms;
+    size_t segment_count;
+    std::string output_dir;
+    shared_ptr<LlHlsServer> server;
+    shared_ptr<LlHlsServer::Stream> stream;
+    shared_ptr<Fmp4Muxer> muxer;
+    shared_ptr<MediaBuffer> last_extra_buffer;
+};
@@ -0,0 +1,384 @@
+#include <chrono>
+#include <algorithm>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "mmapReader.hpp"
+
+#define MMAP_DEFAULT_READ_AHEAD 2000000
+#define MMAP_MIN_WINDOW (1 << 20)
+#define MMAP_MAX_WINDOW (64 << 20)
+#define MMAP_RATE_INTERVAL 500000
+
+static int64_t steadyClockUs()
+{
+    return std::chrono::duration_cast<std::chrono::microseconds>(
+               std::chrono::steady_clock::now().time_since_epoch())
+        .count();
+}
+
+static uint32_t rd32(const uint8_t* p)
+{
+    return ((uint32_t)p[0] << 24) | ((uint32_t)p[1] << 16) | ((uint32_t)p[2] << 8) | p[3];
+}
+
+static void wr32(uint8_t* p, uint32_t v)
+{
+    p[0] = v >> 24;
+    p[1] = v >> 16;
+    p[2] = v >> 8;
+    p[3] = v;
+}
+
+static const uint8_t start_code[4] = {0, 0, 0, 1};
+
+ModuleMmapReader::ModuleMmapReader(const std::string& path, bool loop_play)
+    : ModuleMedia("MmapReader"), path(path), loop(loop_play), realtime(false),
+      read_ahead(MMAP_DEFAULT_READ_AHEAD), drop_consumed(false), fd(-1), map(nullptr), map_size(0),
+      page_size(sysconf(_SC_PAGESIZE)), track({0, 0, 0, 0, 0, {}}), nal_length_size(4), pos(0),
+      pending_seek(-1), send_param_sets(true), released_until(0), prefetched_until(0),
+      consume_rate(0), rate_offset(0), rate_time(0), start_clock(0), start_pts(0),
+      produced(0), produced_bytes(0), released_bytes(0), prefetch_calls(0)
+{
+    media_type = BUFFER_TYPE_VIDEO;
+}
+
+ModuleMmapReader::~ModuleMmapReader()
+{
+    if (map)
+        munmap(map, map_size);
+    if (fd >= 0)
+        close(fd);
+}
+
+/// @brief Parameter sets and NAL length size from avcC or hvcC
+int ModuleMmapReader::parseConfig()
+{
+    const std::vector<uint8_t>& c = track.config;
+    bool hevc = track.format == Mp4Parser::fourcc("hvc1") || track.format == Mp4Parser::fourcc("hev1");
+    size_t p;
+
+    param_sets.clear();
+    auto putNal = [&](size_t at) -> bool {
+        if (at + 2 > c.size())
+            return false;
+        size_t len = (c[at] << 8) | c[at + 1];
+        if (at + 2 + len > c.size())
+            return false;
+        param_sets.insert(param_sets.end(), start_code, start_code + 4);
+        param_sets.insert(param_sets.end(), c.begin() + at + 2, c.begin() + at + 2 + len);
+        p = at + 2 + len;
+        return true;
+    };
+
+    if (!hevc) {
+        if (c.size() < 7)
+            return -1;
+        nal_length_size = (c[4] & 3) + 1;
+        p = 6;
+        for (int i = 0, n = c[5] & 0x1f; i < n; i++) {
+            if (!putNal(p))
+                return -1;
+        }
+        if (p >= c.size())
+            return -1;
+        for (int i = 0, n = c[p++]; i < n; i++) {
+            if (!putNal(p))
+                return -1;
+        }
+    } else {
+        if (c.size() < 23)
+            return -1;
+        nal_length_size = (c[21] & 3) + 1;
+        p = 23;
+        for (int a = 0, arrays = c[22]; a < arrays; a++) {
+            if (p + 3 > c.size())
+                return -1;
+            int n = (c[p + 1] << 8) | c[p + 2];
+            p += 3;
+            for (int i = 0; i < n; i++) {
+                if (!putNal(p))
+                    return -1;
+            }
+        }
+    }
+    return 0;
+}
+
+int ModuleMmapReader::init()
+{
+    fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        ff_error("Failed to open %s: %s\n", path.c_str(), strerror(errno));
+        return -1;
+    }
+
+    struct stat st;
+    fstat(fd, &st);
+    map_size = st.st_size;
+
+    Mp4Parser parser;
+    int ret = parser.parse(fd, map_size, [this](const Mp4Parser::Sample& s) {
+        if (s.size > 0 && s.offset + s.size <= map_size) {
+            if (s.key)
+                keys.push_back(samples.size());
+            samples.push_back(s);
+        }
+    });
+    track = parser.getVideoTrack();
+    if (ret < 0 || samples.empty() || keys.empty()) {
+        ff_error("No video samples found in %s\n", path.c_str());
+        return -1;
+    }
+
+    uint32_t v4l2_fmt;
+    if (track.format == Mp4Parser::fourcc("avc1") || track.format == Mp4Parser::fourcc("avc3")) {
+        v4l2_fmt = V4L2_PIX_FMT_H264;
+    } else if (track.format == Mp4Parser::fourcc("hvc1") || track.format == Mp4Parser::fourcc("hev1")) {
+        v4l2_fmt = V4L2_PIX_FMT_HEVC;
+    } else {
+        ff_error("Mmap reader does not support sample entry %.4s\n", (const char*)&track.format);
+        return -1;
+    }
+    if (parseConfig() < 0) {
+        ff_error("Invalid decoder configuration in %s\n", path.c_str());
+        return -1;
+    }
+    if (nal_length_size != 4) {
+        ff_error("Mmap reader needs 4-byte NAL lengths to write start codes in place, got %u\n", nal_length_size);
+        return -1;
+    }
+
+    // Private and writable: only the pages with rewritten NAL lengths get copied.
+    map = (uint8_t*)mmap(nullptr, map_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+    if (map == MAP_FAILED) {
+        map = nullptr;
+        ff_error("Failed to map %s: %s\n", path.c_str(), strerror(errno));
+        return -1;
+    }
+
+    output_para = ImagePara(track.width, track.height, track.width, track.height, v4l2_fmt);
+    int64_t duration = getDuration();
+    consume_rate = duration > 0 ? map_size * 1000000.0 / duration : MMAP_MIN_WINDOW;
+
+    ret = initBuffer();
+    if (ret < 0) {
+        ff_error("Mmap reader buffer init failed\n");
+        return ret;
+    }
+
+    initialize = true;
+    return 0;
+}
+
+/// @brief The buffers only point into the mapping, nothing is allocated
+int ModuleMmapReader::initBuffer()
+{
+    if (buffer_count == 0)
+        buffer_count = 8;
+
+    buffer_pool.clear();
+    buffer_ptr_queue.clear();
+    for (uint16_t i = 0; i < buffer_count; i++) {
+        shared_ptr<MediaBuffer> buffer = make_shared<MediaBuffer>(0);
+        buffer->setIndex(i);
+        buffer->setMediaBufferType(BUFFER_TYPE_VIDEO);
+        buffer_pool.push_back(buffer);
+        buffer_ptr_queue.push_back(buffer);
+    }
+    return 0;
+}
+
+bool ModuleMmapReader::setup()
+{
+    std::lock_guard<std::mutex> lk(mtx);
+    reposition(pos);
+    return true;
+}
+
+int64_t ModuleMmapReader::getDuration() const
+{
+    return samples.empty() ? 0 : samples.back().time_us;
+}
+
+int64_t ModuleMmapReader::seek(int64_t ms)
+{
+    if (keys.empty())
+        return -1;
+
+    // Keyframes are in decode order, their presentation times increase with it.
+    auto it = std::upper_bound(keys.begin(), keys.end(), ms * 1000,
+                               [this](int64_t t, size_t k) { return t < samples[k].time_us; });
+    size_t key = it == keys.begin() ? keys.front() : *(it - 1);
+
+    std::lock_guard<std::mutex> lk(mtx);
+    pending_seek = key;
+    return samples[key].time_us / 1000;
+}
+
+void ModuleMmapReader::reposition(size_t sample)
+{
+    pos = sample;
+    send_param_sets = true;
+    start_clock = 0;
+    uint64_t offset = pos < samples.size() ? samples[pos].offset : map_size;
+    released_until = offset & ~(uint64_t)(page_size - 1);
+    prefetched_until = released_until;
+    rate_offset = offset;
+    rate_time = steadyClockUs();
+}
+
+/// @brief Rewrite the NAL lengths of a sample to start codes
+bool ModuleMmapReader::toAnnexB(const Mp4Parser::Sample& s, std::vector<Header>& headers)
+{
+    uint8_t* data = map + s.offset;
+
+    // Check the whole sample first, a broken one is left untouched.
+    headers.clear();
+    for (uint32_t p = 0; p < s.size;) {
+        if (s.size - p < 4)
+            return false;
+        uint32_t len = rd32(data + p);
+        if (len == 0 || len > s.size - p - 4)
+            return false;
+        headers.push_back({p, len});
+        p += 4 + len;
+    }
+
+    for (auto& h : headers)
+        memcpy(data + h.offset, start_code, 4);
+    return true;
+}
+
+/// @brief Put back the NAL lengths of the sample a returned buffer pointed at
+void ModuleMmapReader::restore(MediaBuffer* buffer)
+{
+    auto it = in_flight.find(buffer);
+    if (it == in_flight.end())
+        return;
+
+    uint8_t* data = map + it->second.offset;
+    for (auto& h : it->second.headers)
+        wr32(data + h.offset, h.length);
+    in_flight.erase(it);
+}
+
+/// @brief Drop the pages before the oldest sample still in use
+void ModuleMmapReader::release()
+{
+    uint64_t oldest = pos < samples.size() ? samples[pos].offset : map_size;
+    for (auto& f : in_flight)
+        oldest = std::min(oldest, f.second.offset);
+
+    uint64_t end = oldest & ~(uint64_t)(page_size - 1);
+    if (end <= released_until)
+        return;
+
+    madvise(map + released_until, end - released_until, MADV_DONTNEED);
+    if (drop_consumed)
+        posix_fadvise(fd, released_until, end - released_until, POSIX_FADV_DONTNEED);
+    released_bytes += end - released_until;
+    released_until = end;
+}
+
+/// @brief Keep the window ahead of offset prefetched, sized by the consumption rate
+void ModuleMmapReader::readAhead(uint64_t offset)
+{
+    int64_t now = steadyClockUs();
+    if (now - rate_time >= MMAP_RATE_INTERVAL) {
+        if (offset > rate_offset)
+            consume_rate = consume_rate / 2 + (offset - rate_offset) * 1000000.0 / (now - rate_time) / 2;
+        rate_offset = offset;
+        rate_time = now;
+    }
+
+    uint64_t window = consume_rate * read_ahead / 1000000;
+    window = std::max<uint64_t>(MMAP_MIN_WINDOW, std::min<uint64_t>(window, MMAP_MAX_WINDOW));
+    // Refill at half the window, one madvise per half window instead of per sample.
+    if (offset + window / 2 < prefetched_until)
+        return;
+
+    uint64_t begin = std::max(offset, prefetched_until) & ~(uint64_t)(page_size - 1);
+    uint64_t end = std::min(offset + window, map_size);
+    if (end > begin) {
+        madvise(map + begin, end - begin, MADV_WILLNEED);
+        prefetch_calls++;
+    }
+    prefetched_until = end;
+}
+
+ModuleMedia::ProduceResult ModuleMmapReader::doProduce(shared_ptr<MediaBuffer> buffer)
+{
+    if (buffer == nullptr)
+        return PRODUCE_FAILED;
+
+    std::unique_lock<std::mutex> lk(mtx);
+    // The framework hands out a buffer only once every consumer is done with it.
+    restore(buffer.get());
+
+    if (pending_seek >= 0) {
+        reposition(pending_seek);
+        pending_seek = -1;
+    }
+
+    if (pos >= samples.size()) {
+        if (!loop) {
+            buffer->setActiveData(nullptr);
+            buffer->setActiveSize(0);
+            buffer->setEos(true);
+            return PRODUCE_EOS;
+        }
+        reposition(0);
+    }
+
+    const Mp4Parser::Sample& s = samples[pos];
+    buffer->setEos(false);
+    buffer->setPUstimestamp(s.time_us);
+    buffer->setDUstimestamp(s.time_us);
+
+    if (send_param_sets) {
+        send_param_sets = false;
+        buffer->setActiveData(param_sets.data());
+        buffer->setActiveSize(param_sets.size());
+        return PRODUCE_SUCCESS;
+    }
+
+    InFlight f = {s.offset, {}};
+    pos++;
+    if (!toAnnexB(s, f.headers)) {
+        ff_warn("Skip broken sample at %" PRIu64 "\n", s.offset);
+        return PRODUCE_CONTINUE;
+    }
+    in_flight[buffer.get()] = std::move(f);
+    release();
+    readAhead(s.offset);
+
+    buffer->setActiveData(map + s.offset);
+    buffer->setActiveSize(s.size);
+    produced++;
+    produced_bytes += s.size;
+
+    if (realtime) {
+        if (start_clock == 0) {
+            start_clock = steadyClockUs();
+            start_pts = s.time_us;
+        }
+        int64_t wait = start_clock + (s.time_us - start_pts) - steadyClockUs();
+        lk.unlock();
+        if (wait > 0)
+            usleep(wait);
+    }
+    return PRODUCE_SUCCESS;
+}
+
+void ModuleMmapReader::dumpStats()
+{
+    std::lock_guard<std::mutex> lk(mtx);
+    ff_info("mmap reader %s: %" PRIu64 " samples, %" PRIu64 " bytes without copy, %" PRIu64
+            " bytes released, %" PRIu64 " read-ahead calls, %.1f MB/s\n",
+            path.c_str(), produced, produced_bytes, released_bytes, prefetch_calls, consume_rate / 1000000);
+}
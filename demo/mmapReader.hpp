@@ -0,0 +1,105 @@
+#pragma once
+#include <atomic>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "module/module_media.hpp"
+#include "mp4Parser.hpp"
+
+/*
+ * Zero-copy MP4 video source.
+ *
+ * The file is mapped privately and every output buffer points straight at
+ * one sample in the mapping, nothing is copied on the way to the decoder.
+ * The 4-byte NAL lengths of a sample are rewritten to start codes in place
+ * when it is produced (only the pages holding them become private) and
+ * written back once the buffer comes back, so the released range can be
+ * dropped with MADV_DONTNEED and the page cache stays the only copy, shared
+ * by every reader of the file. Read-ahead is issued with MADV_WILLNEED for
+ * a window of read_ahead worth of the measured consumption rate.
+ *
+ * Parameter sets from avcC/hvcC are sent as their own buffer before the
+ * first sample and after every seek or loop. Only the video track is read.
+ */
+class ModuleMmapReader : public ModuleMedia
+{
+public:
+    ModuleMmapReader(const std::string& path, bool loop_play = false);
+    ~ModuleMmapReader();
+
+    // Pace the output by the timestamps, otherwise as fast as it is consumed.
+    void setRealtime(bool enable) { realtime = enable; }
+    void setReadAhead(int64_t duration_us) { read_ahead = duration_us; }
+    // Also drop consumed ranges from the page cache, for one pass over large archives.
+    void setDropConsumed(bool enable) { drop_consumed = enable; }
+    // Seek to the keyframe at or before ms, returns its time in ms or -1.
+    int64_t seek(int64_t ms);
+    int64_t getDuration() const;
+    const uint8_t* videoExtraData() { return param_sets.data(); }
+    unsigned videoExtraDataSize() { return param_sets.size(); }
+
+    int init() override;
+    void dumpStats();
+
+protected:
+    virtual ProduceResult doProduce(shared_ptr<MediaBuffer> buffer) override;
+    virtual int initBuffer() override;
+    virtual bool setup() override;
+
+private:
+    struct Header {
+        uint32_t offset;    // of the length field in the sample
+        uint32_t length;
+    };
+
+    struct InFlight {
+        uint64_t offset;
+        std::vector<Header> headers;
+    };
+
+    int parseConfig();
+    bool toAnnexB(const Mp4Parser::Sample& s, std::vector<Header>& headers);
+    void restore(MediaBuffer* buffer);
+    void release();
+    void readAhead(uint64_t offset);
+    void reposition(size_t sample);
+
+private:
+    std::string path;
+    bool loop;
+    bool realtime;
+    int64_t read_ahead;
+    bool drop_consumed;
+
+    int fd;
+    uint8_t* map;
+    uint64_t map_size;
+    size_t page_size;
+
+    Mp4Parser::VideoTrack track;
+    std::vector<Mp4Parser::Sample> samples;
+    std::vector<size_t> keys;               // sync samples, in decode order
+    std::vector<uint8_t> param_sets;        // Annex-B
+    unsigned nal_length_size;
+
+    std::mutex mtx;
+    size_t pos;
+    int64_t pending_seek;
+    bool send_param_sets;
+    std::unordered_map<MediaBuffer*, InFlight> in_flight;
+
+    uint64_t released_until;
+    uint64_t prefetched_until;
+    double consume_rate;                    // bytes per second
+    uint64_t rate_offset;
+    int64_t rate_time;
+    int64_t start_clock;
+    int64_t start_pts;
+
+    uint64_t produced;
+    uint64_t produced_bytes;
+    uint64_t released_bytes;
+    uint64_t prefetch_calls;
+};
@@ -0,0 +1,382 @@
+#include <unistd.h>
+
+#include "mp4Parser.hpp"
+
+#define MP4_MAX_BOX (64 << 20)
+
+#define TFHD_BASE_DATA_OFFSET 0x000001
+#define TFHD_SAMPLE_DESCRIPTION 0x000002
+#define TFHD_DEFAULT_DURATION 0x000008
+#define TFHD_DEFAULT_SIZE 0x000010
+#define TFHD_DEFAULT_FLAGS 0x000020
+
+#define TRUN_DATA_OFFSET 0x000001
+#define TRUN_FIRST_SAMPLE_FLAGS 0x000004
+#define TRUN_SAMPLE_DURATION 0x000100
+#define TRUN_SAMPLE_SIZE 0x000200
+#define TRUN_SAMPLE_FLAGS 0x000400
+#define TRUN_SAMPLE_CTO 0x000800
+
+#define SAMPLE_NON_SYNC 0x00010000
+
+static uint32_t rd32(const uint8_t* p)
+{
+    return ((uint32_t)p[0] << 24) | ((uint32_t)p[1] << 16) | ((uint32_t)p[2] << 8) | p[3];
+}
+
+static uint64_t rd64(const uint8_t* p)
+{
+    return ((uint64_t)rd32(p) << 32) | rd32(p + 4);
+}
+
+uint32_t Mp4Parser::fourcc(const char* s)
+{
+    return rd32((const uint8_t*)s);
+}
+
+/*
+ * Walks the boxes of one level of an in-memory box body.
+ */
+struct BoxReader {
+    const uint8_t* p;
+    const uint8_t* end;
+
+    BoxReader(const uint8_t* data, size_t size) : p(data), end(data + size) {}
+
+    bool next(uint32_t* type, const uint8_t** body, size_t* body_size)
+    {
+        if (end - p < 8)
+            return false;
+        uint64_t size = rd32(p);
+        size_t header = 8;
+        *type = rd32(p + 4);
+        if (size == 1) {
+            if (end - p < 16)
+                return false;
+            size = rd64(p + 8);
+            header = 16;
+        } else if (size == 0) {
+            size = end - p;
+        }
+        if (size < header || size > (uint64_t)(end - p))
+            return false;
+        *body = p + header;
+        *body_size = size - header;
+        p += size;
+        return true;
+    }
+
+    bool find(uint32_t type, const uint8_t** body, size_t* body_size)
+    {
+        uint32_t t;
+        while (next(&t, body, body_size)) {
+            if (t == type)
+                return true;
+        }
+        return false;
+    }
+};
+
+static bool findChild(const uint8_t* data, size_t size, const char* type, const uint8_t** body, size_t* body_size)
+{
+    BoxReader r(data, size);
+    return r.find(Mp4Parser::fourcc(type), body, body_size);
+}
+
+Mp4Parser::Mp4Parser()
+    : track({0, 0, 0, 0, 0, {}}), fragmented(false), default_duration(0), default_size(0),
+      default_flags(0), next_dts(0)
+{
+}
+
+int Mp4Parser::parse(int fd, uint64_t file_size, SampleCallback callback)
+{
+    std::vector<uint8_t> body;
+    uint64_t pos = 0;
+    bool got_moov = false;
+    int ret = 0;
+    while (pos + 8 <= file_size) {
+        uint8_t h[16];
+        if (pread(fd, h, 16, pos) < 8)
+            break;
+        uint64_t size = rd32(h);
+        uint32_t type = rd32(h + 4);
+        uint64_t header = 8;
+        if (size == 1) {
+            size = rd64(h + 8);
+            header = 16;
+        } else if (size == 0) {
+            size = file_size - pos;
+        }
+        // A file cut off in the middle of a box ends the walk.
+        if (size < header || pos + size > file_size)
+            break;
+
+        if (type == fourcc("moov") || (type == fourcc("moof") && fragmented)) {
+            if (size - header > MP4_MAX_BOX) {
+                ret = -1;
+                break;
+            }
+            body.resize(size - header);
+            if (pread(fd, body.data(), body.size(), pos + header) != (ssize_t)body.size())
+                break;
+            if (type == fourcc("moov")) {
+                ret = parseMoov(body, callback);
+                got_moov = true;
+                if (ret < 0 || !fragmented)
+                    break;
+            } else {
+                parseMoof(body, pos, callback);
+            }
+        }
+        pos += size;
+    }
+    return got_moov && ret == 0 ? 0 : -1;
+}
+
+/// @brief Read the video track description and its sample tables, or the defaults of a fragmented one
+int Mp4Parser::parseMoov(const std::vector<uint8_t>& moov, const SampleCallback& callback)
+{
+    const uint8_t* trak;
+    size_t trak_size;
+    BoxReader traks(moov.data(), moov.size());
+    const uint8_t *b, *stbl = nullptr;
+    size_t bs, stbl_size = 0;
+
+    while (traks.find(fourcc("trak"), &trak, &trak_size)) {
+        const uint8_t *mdia, *hdlr, *mdhd, *tkhd, *minf;
+        size_t mdia_size, hdlr_size, mdhd_size, tkhd_size, minf_size;
+        if (!findChild(trak, trak_size, "mdia", &mdia, &mdia_size)
+            || !findChild(mdia, mdia_size, "hdlr", &hdlr, &hdlr_size) || hdlr_size < 12
+            || rd32(hdlr + 8) != fourcc("vide"))
+            continue;
+        if (!findChild(trak, trak_size, "tkhd", &tkhd, &tkhd_size) || tkhd_size < 24
+            || !findChild(mdia, mdia_size, "mdhd", &mdhd, &mdhd_size) || mdhd_size < 24
+            || !findChild(mdia, mdia_size, "minf", &minf, &minf_size)
+            || !findChild(minf, minf_size, "stbl", &stbl, &stbl_size))
+            return -1;
+        track.id = rd32(tkhd + (tkhd[0] == 1 ? 20 : 12));
+        track.timescale = rd32(mdhd + (mdhd[0] == 1 ? 20 : 12));
+        break;
+    }
+    if (stbl == nullptr || track.timescale == 0)
+        return -1;
+
+    // The first visual sample entry, its fixed part is 78 bytes before the codec boxes.
+    if (findChild(stbl, stbl_size, "stsd", &b, &bs) && bs >= 8) {
+        BoxReader entries(b + 8, bs - 8);
+        const uint8_t* entry;
+        size_t entry_size;
+        if (entries.next(&track.format, &entry, &entry_size) && entry_size >= 78) {
+            track.width = (entry[24] << 8) | entry[25];
+            track.height = (entry[26] << 8) | entry[27];
+            if (findChild(entry + 78, entry_size - 78, "avcC", &b, &bs)
+                || findChild(entry + 78, entry_size - 78, "hvcC", &b, &bs))
+                track.config.assign(b, b + bs);
+        }
+    }
+
+    const uint8_t* mvex;
+    size_t mvex_size;
+    if (findChild(moov.data(), moov.size(), "mvex", &mvex, &mvex_size)) {
+        fragmented = true;
+        BoxReader trexs(mvex, mvex_size);
+        while (trexs.find(fourcc("trex"), &b, &bs)) {
+            if (bs >= 24 && rd32(b + 4) == track.id) {
+                default_duration = rd32(b + 12);
+                default_size = rd32(b + 16);
+                default_flags = rd32(b + 20);
+            }
+        }
+    }
+
+    // Sample sizes, an empty table is normal for a fragmented file.
+    std::vector<uint32_t> sizes;
+    if (findChild(stbl, stbl_size, "stsz", &b, &bs) && bs >= 12) {
+        uint32_t fixed = rd32(b + 4);
+        uint32_t count = rd32(b + 8);
+        if (fixed == 0 && bs < 12 + 4ull * count)
+            return -1;
+        sizes.resize(count, fixed);
+        for (uint32_t i = 0; fixed == 0 && i < count; i++)
+            sizes[i] = rd32(b + 12 + 4 * i);
+    }
+    if (sizes.empty())
+        return 0;
+
+    // Chunk offsets and the samples in each chunk give every sample offset.
+    std::vector<uint64_t> chunks;
+    bool co64 = false;
+    if (findChild(stbl, stbl_size, "stco", &b, &bs) || (co64 = findChild(stbl, stbl_size, "co64", &b, &bs))) {
+        uint32_t count = bs >= 8 ? rd32(b + 4) : 0;
+        if (bs < 8 + (co64 ? 8ull : 4ull) * count)
+            return -1;
+        for (uint32_t i = 0; i < count; i++)
+            chunks.push_back(co64 ? rd64(b + 8 + 8 * i) : rd32(b + 8 + 4 * i));
+    }
+    std::vector<uint64_t> offsets(sizes.size(), 0);
+    if (findChild(stbl, stbl_size, "stsc", &b, &bs) && bs >= 8) {
+        uint32_t count = rd32(b + 4);
+        if (bs < 8 + 12ull * count)
+            return -1;
+        size_t sample = 0;
+        for (uint32_t e = 0; e < count; e++) {
+            uint32_t first = rd32(b + 8 + 12 * e);
+            uint32_t per_chunk = rd32(b + 12 + 12 * e);
+            uint32_t last = e + 1 < count ? rd32(b + 20 + 12 * e) : chunks.size() + 1;
+            for (uint32_t c = first; c < last && c <= chunks.size(); c++) {
+                uint64_t off = chunks[c - 1];
+                for (uint32_t s = 0; s < per_chunk && sample < sizes.size(); s++, sample++) {
+                    offsets[sample] = off;
+                    off += sizes[sample];
+                }
+            }
+        }
+    }
+
+    // Decode times plus composition offsets.
+    std::vector<int64_t> times(sizes.size(), 0);
+    if (findChild(stbl, stbl_size, "stts", &b, &bs) && bs >= 8) {
+        uint32_t count = rd32(b + 4);
+        if (bs < 8 + 8ull * count)
+            return -1;
+        size_t sample = 0;
+        int64_t dts = 0;
+        for (uint32_t e = 0; e < count; e++) {
+            uint32_t n = rd32(b + 8 + 8 * e);
+            uint32_t delta = rd32(b + 12 + 8 * e);
+            for (uint32_t i = 0; i < n && sample < times.size(); i++, sample++) {
+                times[sample] = dts;
+                dts += delta;
+            }
+        }
+    }
+    if (findChild(stbl, stbl_size, "ctts", &b, &bs) && bs >= 8) {
+        uint32_t count = rd32(b + 4);
+        if (bs < 8 + 8ull * count)
+            return -1;
+        size_t sample = 0;
+        for (uint32_t e = 0; e < count; e++) {
+            uint32_t n = rd32(b + 8 + 8 * e);
+            int64_t cto = b[0] == 1 ? (int32_t)rd32(b + 12 + 8 * e) : rd32(b + 12 + 8 * e);
+            for (uint32_t i = 0; i < n && sample < times.size(); i++, sample++)
+                times[sample] += cto;
+        }
+    }
+
+    // No sync sample table: every sample is a sync sample.
+    const uint8_t* stss = nullptr;
+    uint32_t sync_count = 0, sync = 0;
+    if (findChild(stbl, stbl_size, "stss", &b, &bs) && bs >= 8) {
+        sync_count = rd32(b + 4);
+        if (bs < 8 + 4ull * sync_count)
+            return -1;
+        stss = b + 8;
+    }
+    for (size_t i = 0; i < sizes.size(); i++) {
+        bool key = stss == nullptr;
+        while (stss && sync < sync_count && rd32(stss + 4 * sync) - 1 < i)
+            sync++;
+        if (stss && sync < sync_count && rd32(stss + 4 * sync) - 1 == i)
+            key = true;
+        callback({offsets[i], sizes[i], times[i] * 1000000 / track.timescale, key});
+    }
+    return 0;
+}
+
+/// @brief Report the samples of the video track fragment
+int Mp4Parser::parseMoof(const std::vector<uint8_t>& moof, uint64_t moof_offset, const SampleCallback& callback)
+{
+    const uint8_t* traf;
+    size_t traf_size;
+    BoxReader trafs(moof.data(), moof.size());
+
+    while (trafs.find(fourcc("traf"), &traf, &traf_size)) {
+        const uint8_t* b;
+        size_t bs;
+        if (!findChild(traf, traf_size, "tfhd", &b, &bs) || bs < 8 || rd32(b + 4) != track.id)
+            continue;
+
+        uint32_t flags = rd32(b) & 0xffffff;
+        const uint8_t* p = b + 8;
+        uint64_t base = moof_offset;
+        uint32_t duration = default_duration, size = default_size, sample_flags = default_flags;
+        if ((flags & TFHD_BASE_DATA_OFFSET) && p + 8 <= b + bs) {
+            base = rd64(p);
+            p += 8;
+        }
+        if (flags & TFHD_SAMPLE_DESCRIPTION)
+            p += 4;
+        if ((flags & TFHD_DEFAULT_DURATION) && p + 4 <= b + bs) {
+            duration = rd32(p);
+            p += 4;
+        }
+        if ((flags & TFHD_DEFAULT_SIZE) && p + 4 <= b + bs) {
+            size = rd32(p);
+            p += 4;
+        }
+        if ((flags & TFHD_DEFAULT_FLAGS) && p + 4 <= b + bs)
+            sample_flags = rd32(p);
+
+        int64_t dts = next_dts;
+        if (findChild(traf, traf_size, "tfdt", &b, &bs) && bs >= 8)
+            dts = b[0] == 1 && bs >= 12 ? rd64(b + 4) : rd32(b + 4);
+
+        uint64_t data = base;
+        BoxReader truns(traf, traf_size);
+        while (truns.find(fourcc("trun"), &b, &bs)) {
+            if (bs < 8)
+                break;
+            uint8_t version = b[0];
+            flags = rd32(b) & 0xffffff;
+            uint32_t count = rd32(b + 4);
+            p = b + 8;
+            const uint8_t* end = b + bs;
+            uint32_t first_flags = sample_flags;
+            bool has_first_flags = false;
+            if ((flags & TRUN_DATA_OFFSET) && p + 4 <= end) {
+                data = base + (int32_t)rd32(p);
+                p += 4;
+            }
+            if ((flags & TRUN_FIRST_SAMPLE_FLAGS) && p + 4 <= end) {
+                first_flags = rd32(p);
+                has_first_flags = true;
+                p += 4;
+            }
+
+            for (uint32_t i = 0; i < count; i++) {
+                uint32_t d = duration, s = size, f = i == 0 && has_first_flags ? first_flags : sample_flags;
+                int64_t cto = 0;
+                if (flags & TRUN_SAMPLE_DURATION) {
+                    if (p + 4 > end)
+                        return -1;
+                    d = rd32(p);
+                    p += 4;
+                }
+                if (flags & TRUN_SAMPLE_SIZE) {
+                    if (p + 4 > end)
+                        return -1;
+                    s = rd32(p);
+                    p += 4;
+                }
+                if (flags & TRUN_SAMPLE_FLAGS) {
+                    if (p + 4 > end)
+                        return -1;
+                    f = rd32(p);
+                    p += 4;
+                }
+                if (flags & TRUN_SAMPLE_CTO) {
+                    if (p + 4 > end)
+                        return -1;
+                    cto = version == 1 ? (int32_t)rd32(p) : rd32(p);
+                    p += 4;
+                }
+                callback({data, s, (dts + cto) * 1000000 / track.timescale, !(f & SAMPLE_NON_SYNC)});
+                dts += d;
+                data += s;
+            }
+        }
+        next_dts = dts;
+    }
+    return 0;
+}
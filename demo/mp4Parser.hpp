@@ -0,0 +1,58 @@
+#pragma once
+#include <stdint.h>
+#include <stddef.h>
+#include <functional>
+#include <vector>
+
+/*
+ * Sample table of the first video track of a MP4 file, plain or
+ * fragmented.
+ *
+ * parse() walks the top level boxes of an open file and reads only moov
+ * and moof, media data is skipped by box size. Every video sample is
+ * reported in decode order with its byte range, presentation time and
+ * sync flag, from the stbl tables (stss, stts, ctts, stsc, stsz,
+ * stco/co64) or from the trun boxes of each fragment. A file cut off in
+ * the middle of a box ends at the last complete one.
+ */
+class Mp4Parser
+{
+public:
+    struct Sample {
+        uint64_t offset;
+        uint32_t size;
+        int64_t time_us;    // presentation time from the start of the file
+        bool key;
+    };
+
+    struct VideoTrack {
+        uint32_t id;
+        uint32_t timescale;
+        uint32_t format;        // sample entry type, avc1, hvc1, ...
+        int width;
+        int height;
+        std::vector<uint8_t> config;    // avcC or hvcC payload
+    };
+
+    using SampleCallback = std::function<void(const Sample&)>;
+
+public:
+    Mp4Parser();
+
+    int parse(int fd, uint64_t file_size, SampleCallback callback);
+    const VideoTrack& getVideoTrack() const { return track; }
+
+    static uint32_t fourcc(const char* s);
+
+private:
+    int parseMoov(const std::vector<uint8_t>& moov, const SampleCallback& callback);
+    int parseMoof(const std::vector<uint8_t>& moof, uint64_t moof_offset, const SampleCallback& callback);
+
+private:
+    VideoTrack track;
+    bool fragmented;
+    uint32_t default_duration;
+    uint32_t default_size;
+    uint32_t default_flags;
+    int64_t next_dts;       // decode time after the last fragment, for fragments without tfdt
+};
@@ -140,6 +140,14 @@ static void parseADev(std::stringstream& lineStream, ModuleOsd::OsdConfPara& con
     lineStream >> conf.aDev;
 }
 
+/// @brief 读取配置文件中的mmap音频采集参数
+/// @param lineStream 
+/// @param conf 
+static void parseAMmap(std::stringstream& lineStream, ModuleOsd::OsdConfPara& conf)
+{ // 该函数从 lineStream 中读取硬件周期和可选的环形缓冲大小，并将其赋值给 conf.aMmapPeriod 和 conf.aMmapRing
+    lineStream >> conf.aMmapPeriod >> conf.aMmapRing;
+}
+
 /// @brief 读取摄像头输入的图像宽高
 /// @param lineStream 
 /// @param conf 
@@ -367,12 +375,41 @@ static void parseFileMaxDuration(std::stringstream& lineStream, ModuleOsd::OsdCo
     }
 }
 
+/// @brief 指定录像文件的fMP4分片时长
+/// @param lineStream 
+/// @param conf 
+static void parseFileFragment(std::stringstream& lineStream, ModuleOsd::OsdConfPara& conf)
+{ // 该函数从 lineStream 中读取输入，并将其赋值给 conf.fFragment
+    lineStream >> conf.fFragment;
+}
+
+/// @brief 指定事件录像的触发前、后保留时长(秒)
+/// @param lineStream 
+/// @param conf 
+static void parseEventRecord(std::stringstream& lineStream, ModuleOsd::OsdConfPara& conf)
+{ // 该函数从 lineStream 中读取输入，并将其赋值给 conf.evPreRoll 和 conf.evPostRoll
+    lineStream >> conf.evPreRoll >> conf.evPostRoll;
+}
+
 /// @brief 指定监控输出文件路径文件剩余大小字节，超过则输出该路径下最旧文件
 /// @param lineStream
 /// @param conf
 static void parseFileSystemFreeSize(std::stringstream& lineStream, ModuleOsd::OsdConfPara& conf)
-{ // 该函数从 lineStream 中读取输入，并将其赋值给 conf.fFreeSize
+{ // 该函数从 lineStream 中读取输入，并将其赋值给 conf.fFreeSize 和可选的 conf.fFreeSizeHigh
     lineStream >> conf.fFreeSize;
+    if (!(lineStream >> conf.fFreeSizeHigh))
+        conf.fFreeSizeHigh = conf.fFreeSize + conf.fFreeSize / 10;
+}
+
+/// @brief 指定输出目录下某个子目录的容量上限字节，超过则删除该子目录下最旧文件
+/// @param lineStream
+/// @param conf
+static void parseFileQuota(std::stringstream& lineStream, ModuleOsd::OsdConfPara& conf)
+{ // 该函数从 lineStream 中读取子目录名和容量，并加入 conf.fQuota
+    std::string dir;
+    uint64_t bytes = 0;
+    if (lineStream >> dir >> bytes)
+        conf.fQuota.emplace_back(dir, bytes);
 }
 
 /// @brief 指定输出文件
@@ -463,6 +500,14 @@ static void parsePushFps(std::stringstream& lineStream, ModuleOsd::OsdConfPara&
     lineStream >> conf.pFps;
 }
 
+/// @brief 推流复用录像编码器
+/// @param lineStream 
+/// @param conf 
+static void parsePushShareEnc(std::stringstream& lineStream, ModuleOsd::OsdConfPara& conf)
+{ // 该函数从 lineStream 中读取输入，并将其赋值给 conf.pShareEnc
+    lineStream >> conf.pShareEnc;
+}
+
 /// @brief 推流端口设置
 /// @param lineStream 
 /// @param conf 
@@ -514,6 +559,7 @@ static void parseBroadcastPort(std::stringstream& lineStream, ModuleOsd::OsdConf
 static std::unordered_map<std::string, void (*)(std::stringstream &, ModuleOsd::OsdConfPara &)> osd_parsers = {
     {"vDev", parseVDev},                         // 视频节点配置
     {"aDev", parseADev},                         // 音频采集设置
+    {"aMmap", parseAMmap},                       // mmap方式音频采集的硬件周期及环形缓冲大小
     {"iImgPara", parseIImgPara},                 // 设置摄像头输出图像宽高
     {"oImgPara", parseOImgPara},                 // 设置调整图像分辨率
     {"oRotate", parseORotate},                   // 设置图像旋转角度
@@ -527,7 +573,10 @@ static std::unordered_map<std::string, void (*)(std::stringstream &, ModuleOsd::
     {"encType", parseEncType},                   // 指定编码类型
     {"encFps", parseEncFps},                     // 指定编码帧率
     {"fileMaxDuration", parseFileMaxDuration},   // 指定文件录制最大时长
+    {"fileFragment", parseFileFragment},         // 指定录像文件的fMP4分片时长
+    {"eventRecord", parseEventRecord},           // 指定事件录像的触发前、后保留时长
     {"systemFreeSize", parseFileSystemFreeSize}, // 指定监控输出文件路径文件剩余大小字节，超过则输出该路径下最旧文件
+    {"fileQuota", parseFileQuota},               // 指定输出目录下子目录的容量上限
     {"outputFile", parseOutPutFile},             // 指定输出文件路径
     {"outputFileDir", parseOutPutFileDir},       // 指定输出文件目录
     {"displayEnable", parseDisplayEnable},       // 屏幕显示开启关闭
@@ -539,6 +588,7 @@ static std::unordered_map<std::string, void (*)(std::stringstream &, ModuleOsd::
     {"pushVideoEnable", parsePushVideoEnable},   // 视频推流开关
     {"pushAudioEnable", parsePushAudioEnable},   // 音频推流开关
     {"pushFps", parsePushFps},                   // 推流帧率设置
+    {"pushShareEnc", parsePushShareEnc},         // 推流复用录像编码器
     {"pushPort", parsePushPort},                 // 推流端口设置
     {"pushPath", parsePushPath},                 // 推流路径设置
     {"pushPara", parsePushResolution},           // 设置推流分辨率
@@ -566,11 +616,12 @@ ModuleOsd::ModuleOsd(const std::string& filename)
       a_source(nullptr), 
       f_enc(nullptr), 
       writer(nullptr),
+      event_recorder(nullptr),
+      retention(nullptr),
       r_enc(nullptr), 
       rtsp(nullptr), 
       display(nullptr), 
-      current_pts(-1), 
-      start_pts(-1)
+      current_pts(-1)
 {
 }
 
@@ -665,9 +716,10 @@ int ModuleOsd::init()
     int ret;
     // shared_ptr 表示智能指针
     shared_ptr<ModuleCam> cam;
-    shared_ptr<ModuleAlsaCapture> capture = nullptr;
+    shared_ptr<ModuleMedia> capture = nullptr;
     shared_ptr<ModuleMppEnc> enc = nullptr;
-    shared_ptr<ModuleFileWriter> file_writer = nullptr;
+    shared_ptr<ModuleSegmentWriter> file_writer = nullptr;
+    shared_ptr<ModuleEventRecorder> ev_recorder = nullptr;
     shared_ptr<ModuleMppEnc> enc_r = nullptr;
     shared_ptr<ModuleRtspServer> rtsp_s = nullptr;
     shared_ptr<ModuleDrmDisplay> drm_display = nullptr;
@@ -675,6 +727,7 @@ int ModuleOsd::init()
     shared_ptr<ModuleMedia> last_vmod = nullptr;
     shared_ptr<ModuleMedia> last_amod = nullptr;
     ImagePara output, input;
+    SampleInfo a_info = {SAMPLE_FMT_S16, 2, 48000, 1024}; // 音频采集参数，录像的音轨也使用该参数
 
     //解析配置文件
     if (parseConfFileInfo(para)) {
@@ -714,12 +767,15 @@ int ModuleOsd::init()
     //初始化音频设备
     if (!para.aDev.empty()) //若音频设备aDev不为空
     {
-        SampleInfo info;
-        info.channels = 2;
-        info.fmt = SAMPLE_FMT_S16;
-        info.nb_samples = 1024;
-        info.sample_rate = 48000;
-        capture = make_shared<ModuleAlsaCapture>(para.aDev, info);
+        if (para.aMmapPeriod >= 0) {
+            // 直接从 ALSA 环形缓冲取数据，较短的硬件周期合并为每个缓冲 1024 帧
+            mmap_capture = make_shared<ModuleAlsaMmapCapture>(para.aDev, a_info);
+            mmap_capture->setPeriodSize(para.aMmapPeriod);
+            mmap_capture->setRingSize(para.aMmapRing);
+            capture = mmap_capture;
+        } else {
+            capture = make_shared<ModuleAlsaCapture>(para.aDev, a_info);
+        }
         capture->setBufferCount(8);
         ret = capture->init();
         if (ret < 0) {
@@ -727,7 +783,7 @@ int ModuleOsd::init()
             return -1;
         }
         last_amod = capture;
-        auto aac_enc = make_shared<ModuleAacEnc>(info); // 初始化 AAC 编码器 ModuleAacEnc
+        auto aac_enc = make_shared<ModuleAacEnc>(a_info); // 初始化 AAC 编码器 ModuleAacEnc
         aac_enc->setProductor(last_amod);               // 并将其设置为音频模块的生产者
         ret = aac_enc->init();
         if (ret < 0) {
@@ -769,17 +825,40 @@ int ModuleOsd::init()
             output.vstride = para.oPara.height;
         }
     }
-    // 创建一个ModuleRga实例，这是一个图像处理模块（RGA，Rockchip Graphics Adapter）
-    shared_ptr<ModuleRga> rga = make_shared<ModuleRga>(output, para.oRotate);
-    rga->setProductor(last_vmod);//将RGA模块设置为上一个视频的生产者
-    rga->setBufferCount(8); //RGA模块的缓冲区数量为8
-    rga->setOutputDataCallback(this, osdHandlerCallback); // 设置 RGA 模块的输出数据回调函数 osdHandlerCallback
-    rga->setRgaSchedulerCore(ModuleRga::SCHEDULER_RGA3_DEFAULT); // 设置 RGA 模块的调度核心为 SCHEDULER_RGA3_DEFAULT
-    ret = rga->init();//初始化RGA模块
+    // 分析(叠加OSD)与推流两路RGA输出由 ModuleRgaMulti 统一创建（RGA，Rockchip Graphics Adapter）
+    ModuleRgaMulti rga_multi(last_vmod);
+    rga_multi.setRgaSchedulerCore(ModuleRga::SCHEDULER_RGA3_DEFAULT); // 设置 RGA 模块的调度核心为 SCHEDULER_RGA3_DEFAULT
+    ModuleRgaMulti::OutputSpec analysis_spec;
+    analysis_spec.para = output;
+    analysis_spec.rotate = para.oRotate;
+    analysis_spec.buffer_count = 8; //RGA模块的缓冲区数量为8
+    int analysis_out = rga_multi.addOutput(analysis_spec);
+
+    // 推流画面需带OSD字符，固定从分析输出转换，不直接读取解码帧
+    int push_out = -1;
+    if (para.pushVideoEnable && para.pPort > 0) {
+        ModuleRgaMulti::OutputSpec push_spec;
+        push_spec.para = output;
+        if (para.pPara.width && para.pPara.height) {
+            push_spec.para.width = para.pPara.width;
+            push_spec.para.height = para.pPara.height;
+            push_spec.para.hstride = para.pPara.width;
+            push_spec.para.vstride = para.pPara.height;
+        }
+        push_spec.buffer_count = 2;
+        if (para.pFps > 0)
+            push_spec.duration = 1000000 / para.pFps;
+        push_spec.source = analysis_out;
+        push_out = rga_multi.addOutput(push_spec);
+    }
+
+    ret = rga_multi.init();
     if (ret < 0) {
         ff_error("rga init failed\n");
         return -1;
     }
+    shared_ptr<ModuleRga> rga = rga_multi.getOutput(analysis_out);
+    rga->setOutputDataCallback(this, osdHandlerCallback); // 设置 RGA 模块的输出数据回调函数 osdHandlerCallback
 
     //显示模块初始化
     last_vmod = rga; // 将last_vmod更新为RGA
@@ -844,27 +923,15 @@ int ModuleOsd::init()
         }
     }
 
+    // ModuleMppEnc 只输出单一时域层，按层丢帧无从谈起，推流始终单独编码
+    if (para.pShareEnc)
+        ff_warn("pushShareEnc ignored, the recording encoder produces a single temporal layer\n");
+
     //RTSP推流模块初始化
     if (para.pushVideoEnable && para.pPort > 0) 
     {
-        output = last_vmod->getOutputImagePara();
-        if (para.pPara.width && para.pPara.height) {
-            output.width = para.pPara.width;
-            output.height = para.pPara.height;
-            output.hstride = output.width;
-            output.vstride = output.height;
-        }
-        shared_ptr<ModuleRga> push_rga = make_shared<ModuleRga>(output, RgaRotate::RGA_ROTATE_NONE);
-        push_rga->setProductor(last_vmod);
-        push_rga->setBufferCount(2);
-        if (para.pFps > 0)
-            push_rga->setDuration(1000000 / para.pFps);
-        ret = push_rga->init();
-        if (ret < 0) {
-            ff_error("Failed to init push rga\n");
-            return ret;
-        }
-        
+        shared_ptr<ModuleRga> push_rga = rga_multi.getOutput(push_out);
+
         /*
         enc_r = make_shared<ModuleMppEnc>(ENCODE_TYPE_H264,
                                           para.pFps, 
@@ -895,22 +962,74 @@ int ModuleOsd::init()
         }
     }
 
-    //音频推流模块初始化
-    if (para.pushAudioEnable && last_amod) 
+    //录像保留索引：按时间记录已关闭的录像文件，空间不足时直接删除最旧的，无需遍历目录
+    if (!para.oFile.empty() && (para.fFreeSize || !para.fQuota.empty()))
     {
-        auto rtsp_s_a = make_shared<ModuleRtspServerExtend>(rtsp_s, para.pPath.c_str(), para.pPort);
-        rtsp_s_a->setProductor(last_amod);
-        rtsp_s_a->setAudioParameter(MEDIA_CODEC_AUDIO_AAC);
-        ret = rtsp_s_a->init();
-        if (ret) {
-            ff_error("rtsp server audio init failed\n");
-            last_amod->removeConsumer(rtsp_s_a);
-            rtsp_s_a = nullptr;
+        if (para.oFileDir.empty()) { // 分组按 outputFileDir 下的第一级目录，未指定输出目录时不启用
+            ff_warn("outputFileDir is not set, systemFreeSize and fileQuota are ignored\n");
+        } else {
+            retention = make_shared<RecordingRetention>(para.oFileDir);
+            retention->setWatermarks(para.fFreeSize, para.fFreeSizeHigh);
+            for (auto& quota : para.fQuota)
+                retention->setQuota(quota.first, quota.second);
+            if (retention->load() < 0)
+                ff_warn("Failed to load the retention index, old files are not deleted\n");
         }
     }
 
+    //事件录像模块与初始化：内存中保留触发前的码流，触发后连同之后的码流写入文件
+    if (!para.oFile.empty() && para.evPreRoll > 0) 
+    {
+        enc = make_shared<ModuleMppEnc>(para.eType, 
+                                        para.eFps,
+                                        para.eFps << 1, 
+                                        (para.eFps / 30.0) * 2048);
+        enc->setProductor(last_vmod);
+        enc->setBufferCount(20);
+        ret = enc->init();
+        if (ret < 0) {
+            ff_error("Enc init failed\n");
+            return -1;
+        }
+
+        // 环形缓冲按码率容纳触发前时长再加一个GOP，至少16MB
+        size_t ring_bytes = (para.eFps / 30.0) * 2048 * 1000 / 8 * (para.evPreRoll + 2);
+        ev_recorder = make_shared<ModuleEventRecorder>([this]() {
+            std::string filePath = para.oFileDir + ptsToTimeStr(0, para.oFile) + ".mp4";
+            createDirectory(filePath.c_str());
+            return filePath;
+        }, para.evPreRoll * 1000000LL, para.evPostRoll * 1000000LL, std::max(ring_bytes, (size_t)16 << 20));
+        if (para.fFragment >= 0)
+            ev_recorder->setFragmentDuration(para.fFragment * 1000LL);
+        ev_recorder->setEventClosedCallback([this](const std::string& path) {
+            // 事件文件关闭后加入保留索引，并通知 osdProcess 检查磁盘空间
+            if (retention)
+                retention->add(path);
+            std::lock_guard<std::mutex> lk(event_mtx);
+            event |= 1;
+            event_conv.notify_one();
+        });
+        ev_recorder->setProductor(enc);
+        if (last_amod)
+            ev_recorder->setAudioParameter(a_info.channels, 16, a_info.sample_rate, MEDIA_CODEC_AUDIO_AAC);
+        ret = ev_recorder->init();
+        if (ret < 0) {
+            ff_error("event recorder init failed\n");
+            return -1;
+        }
+
+        if (last_amod) {
+            auto ev_recorder_a = make_shared<ModuleEventRecorderExtend>(ev_recorder);
+            ev_recorder_a->setProductor(last_amod);
+            ret = ev_recorder_a->init();
+            if (ret < 0) {
+                ff_error("audio event recorder init failed\n");
+                return -1;
+            }
+        }
+    }
     //文件写入模块与初始化
-    if (!para.oFile.empty()) 
+    else if (!para.oFile.empty()) 
     {
         enc = make_shared<ModuleMppEnc>(para.eType, 
                                         para.eFps,
@@ -924,10 +1043,33 @@ int ModuleOsd::init()
             return -1;
         }
 
-        std::string filePath = para.oFileDir + ptsToTimeStr(0, para.oFile) + ".mp4";
-        createDirectory(filePath.c_str());
-        file_writer = make_shared<ModuleFileWriter>(filePath.c_str());
+        // 分段写入模块在关键帧处自行切换文件，编码器无需停止
+        file_writer = make_shared<ModuleSegmentWriter>([this]() {
+            std::string filePath = para.oFileDir + ptsToTimeStr(0, para.oFile) + ".mp4";
+            createDirectory(filePath.c_str());
+            return filePath;
+        });
+        file_writer->setMaxDuration(para.fMaxDuration);
+        // fMP4 断电后仍可播放到最后一个分片，关闭文件时也无需回写索引，且由后台I/O线程写入
+        if (para.fFragment >= 0 && para.eType == EncodeType::ENCODE_TYPE_MJPEG)
+            ff_warn("fileFragment needs H.264 or H.265, recording regular MP4\n");
+        else if (para.fFragment >= 0) {
+            file_writer->setFragmentDuration(para.fFragment * 1000LL);
+            // 按码率预分配整段文件，减少磁盘碎片
+            if (para.fMaxDuration > 0)
+                file_writer->setPreallocateSize((para.eFps / 30.0) * 2048 * 1000 / 8 * (para.fMaxDuration / 1000000));
+        }
+        file_writer->setSegmentClosedCallback([this](const std::string& path) {
+            // 旧文件关闭后加入保留索引，并通知 osdProcess 检查磁盘空间
+            if (retention)
+                retention->add(path);
+            std::lock_guard<std::mutex> lk(event_mtx);
+            event |= 1;
+            event_conv.notify_one();
+        });
         file_writer->setProductor(enc);
+        if (last_amod)
+            file_writer->setAudioParameter(a_info.channels, 16, a_info.sample_rate, MEDIA_CODEC_AUDIO_AAC);
         ret = file_writer->init();
         if (ret < 0) {
             ff_error("file writer init failed\n");
@@ -935,9 +1077,8 @@ int ModuleOsd::init()
         }
 
         if (last_amod) {
-            auto file_writer_a = make_shared<ModuleFileWriterExtend>(file_writer, string());
+            auto file_writer_a = make_shared<ModuleSegmentWriterExtend>(file_writer);
             file_writer_a->setProductor(last_amod);
-            file_writer_a->setAudioParameter(0, 0, 0, MEDIA_CODEC_AUDIO_AAC);
             ret = file_writer_a->init();
             if (ret < 0) {
                 ff_error("audio writer init failed\n");
@@ -946,11 +1087,26 @@ int ModuleOsd::init()
         }
     }
 
+    //音频推流模块初始化
+    if (para.pushAudioEnable && last_amod) 
+    {
+        auto rtsp_s_a = make_shared<ModuleRtspServerExtend>(rtsp_s, para.pPath.c_str(), para.pPort);
+        rtsp_s_a->setProductor(last_amod);
+        rtsp_s_a->setAudioParameter(MEDIA_CODEC_AUDIO_AAC);
+        ret = rtsp_s_a->init();
+        if (ret) {
+            ff_error("rtsp server audio init failed\n");
+            last_amod->removeConsumer(rtsp_s_a);
+            rtsp_s_a = nullptr;
+        }
+    }
+
     //模块指针的报错和返回
     v_source = cam;
     a_source = capture;
     f_enc = enc;
     writer = file_writer;
+    event_recorder = ev_recorder;
     r_enc = enc_r;
     rtsp = rtsp_s;
     display = drm_display;
@@ -996,6 +1152,24 @@ void ModuleOsd::stop()
         v_source->dumpPipeSummary();
         v_source->stop();
     }
+
+    if (mmap_capture)
+        mmap_capture->dumpStats();
+
+    if (event_recorder)
+        event_recorder->dumpStats();
+
+    if (retention)
+        retention->dumpStats();
+}
+
+void ModuleOsd::triggerEvent()
+{
+    if (event_recorder == nullptr) {
+        ff_warn("Event recording is not enabled\n");
+        return;
+    }
+    event_recorder->trigger();
 }
 
 /// @brief  通过一个循环不断检查 event 的状态，根据不同的事件位进行文件操作和 OSD 文本更新，
@@ -1017,23 +1191,9 @@ void ModuleOsd::osdProcess()
             {
                 event &= ~1;
                 lk.unlock();
-                //文件操作
-                if (f_enc != nullptr && writer != nullptr) 
-                {
-                    f_enc->stop();//停止编码
-                    std::string filePath = para.oFileDir + ptsToTimeStr(0, para.oFile) + ".mp4";
-                    createDirectory(filePath.c_str());  //创建新的目录来保存新的文件
-                    writer->changeFileName(filePath);   //更改文件写入器的文件路径
-                    f_enc->start();//重新启动编码
-                    if (para.fFreeSize)//磁盘空间管理
-                    {                  // 如果设置了 para.fFreeSize，则循环检查当前磁盘空间是否足够，如果不够，则删除最旧的文件以释放空间
-                        while (para.fFreeSize > getSystemFreeSize(filePath.c_str())) 
-                        {
-                            if (removeDirectoryOldestFile(para.oFileDir.empty() ? filePath.c_str() : para.oFileDir.c_str()) <= 0)
-                                break;
-                        }
-                    }
-                }
+                //文件操作：分段写入模块已切换到新文件（或事件录像已结束），这里只做磁盘空间管理
+                if (retention) // 超出子目录容量或剩余空间低于 fFreeSize 时，从索引中删除最旧的文件直到剩余空间高于 fFreeSizeHigh
+                    retention->enforce();
             }
         }
         handletEtcText();   //处理OSD文本信息
@@ -1288,15 +1448,4 @@ void ModuleOsd::osdHandlerCallback(void* arg, std::shared_ptr<MediaBuffer> media
     auto end = std::chrono::high_resolution_clock::now();
     ff_info("duration %ld\n", std::chrono::duration_cast<std::chrono::microseconds>(end - start).count());
 #endif
-
-    //条件触发事件
-    if (osd->start_pts < 0) // 检查 start_pts 是否为负数，如果是，则初始化为当前时间戳
-        osd->start_pts = osd->current_pts;
-    else if (osd->para.fMaxDuration && osd->current_pts - osd->start_pts > osd->para.fMaxDuration)
-    { // 如果 fMaxDuration 参数有效，且当前时间戳与起始时间戳之差大于 fMaxDuration，则触发事件
-        std::lock_guard<std::mutex> lk(osd->event_mtx); // 锁定互斥量，修改事件状态，通知等待的条件变量，然后更新起始时间戳
-        osd->event |= 1;
-        osd->event_conv.notify_one();
-        osd->start_pts = osd->current_pts;
-    }
 }
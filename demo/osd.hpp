@@ -29,6 +29,11 @@
 #include "module/vi/module_alsaCapture.hpp"
 
 #include "system_common.hpp"
+#include "rgaMulti.hpp"
+#include "segmentWriter.hpp"
+#include "eventRecorder.hpp"
+#include "retention.hpp"
+#include "alsaMmapCapture.hpp"
 
 /// @brief 
 class ModuleOsd
@@ -47,6 +52,8 @@ public:
     { // 其中std::string用于表示操作字符串
         std::string vDev; // 摄像头设备节点字符串
         std::string aDev; // 音频采集设备节点字符串
+        int aMmapPeriod = -1;   // mmap方式采集音频的硬件周期(帧)，0为每个缓冲一个周期，-1为读方式采集
+        int aMmapRing = 0;      // mmap采集的环形缓冲大小(帧)，0为按缓冲数量自动设定
         ImagePara iPara;  // 摄像头输出结构体
         ImagePara oPara;  // 调整图像分辨率结构体
         RgaRotate oRotate = RgaRotate::RGA_ROTATE_NONE; // 图像旋转角度枚举，并与之赋初始值，不旋转
@@ -68,7 +75,12 @@ public:
         EncodeType eType = EncodeType::ENCODE_TYPE_H265;// 编码类型枚举，并与之赋初始值，H265
         int eFps = 120;         // 指定编码频率
         int fMaxDuration = 0;   // 指定文件最大录制时长
-        uint64_t fFreeSize = 0; // 循环空间
+        int fFragment = 1000;   // fMP4分片时长(毫秒)，0为每个关键帧一个分片，-1为普通MP4(在编码线程同步写入)
+        uint64_t fFreeSize = 0; // 循环空间，剩余空间低于该值时开始删除最旧文件
+        uint64_t fFreeSizeHigh = 0; // 删除到剩余空间高于该值为止，默认比 fFreeSize 多10%
+        std::vector<std::pair<std::string, uint64_t>> fQuota; // 输出目录下各子目录(摄像头)的容量上限
+        int evPreRoll = 0;      // 事件录像触发前保留时长(秒)，0为持续录像
+        int evPostRoll = 0;     // 事件录像最后一次触发后继续录制时长(秒)
         std::string oFile;      // 存储文件名
         std::string oFileDir;   // 存储文件目录
 
@@ -83,6 +95,7 @@ public:
         bool pushVideoEnable = false;   // 视频推流开关
         bool pushAudioEnable = false;   // 音频推流开关
         int pFps = 30;          // 视频推流帧率设置
+        bool pShareEnc = false; // 推流复用录像编码器，需编码器输出时域分层码流，MPP编码器不支持
         int pPort = 0;          // 视频推流端口设置
         std::string pPath;      // 推流路径设置
         ImagePara pPara;        // 推流分辨率设定
@@ -101,6 +114,8 @@ public:
     int init();
     void start();
     void stop();
+    // 事件录像模式下触发一次录像，录像中再次触发则延长录制时间
+    void triggerEvent();
 
 protected:
     void osdProcess();
@@ -129,9 +144,12 @@ private:
 
     shared_ptr<ModuleMedia> v_source;
     shared_ptr<ModuleMedia> a_source;
+    shared_ptr<ModuleAlsaMmapCapture> mmap_capture;
 
     shared_ptr<ModuleMppEnc> f_enc;
-    shared_ptr<ModuleFileWriter> writer;
+    shared_ptr<ModuleSegmentWriter> writer;
+    shared_ptr<ModuleEventRecorder> event_recorder;
+    shared_ptr<RecordingRetention> retention;
 
     shared_ptr<ModuleMppEnc> r_enc;
     shared_ptr<ModuleRtspServer> rtsp;
@@ -139,5 +157,4 @@ private:
     shared_ptr<ModuleDrmDisplay> display;
 
     int64_t current_pts = -1;
-    int64_t start_pts = -1;
 };
@@ -0,0 +1,270 @@
+#include <errno.h>
+#include <fts.h>
+#include <inttypes.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <algorithm>
+
+#include "base/ff_log.h"
+#include "system_common.hpp"
+#include "retention.hpp"
+
+#define RETENTION_COMPACT_MIN 1024
+
+RecordingRetention::RecordingRetention(const std::string& _root)
+    : root(_root), journal_fp(nullptr), journal_lines(0), low_free(0), high_free(0), total_bytes(0),
+      deleted(0), deleted_bytes(0)
+{
+    while (root.size() > 1 && root.back() == '/')
+        root.pop_back();
+    journal_path = root + "/" + JOURNAL_NAME;
+}
+
+RecordingRetention::~RecordingRetention()
+{
+    if (journal_fp)
+        fclose(journal_fp);
+}
+
+/// @brief Rebuild the index from the journal, or from one walk of the tree without it
+int RecordingRetention::load()
+{
+    std::lock_guard<std::mutex> lk(mtx);
+    FILE* fp = fopen(journal_path.c_str(), "r");
+    int ret;
+
+    if (fp) {
+        ret = replay(fp);
+        fclose(fp);
+    } else {
+        ret = scan();
+    }
+    if (ret < 0)
+        return ret;
+
+    // Start the journal over with the live entries only.
+    ret = compact();
+    ff_info("Retention index of %s: %zu files, %" PRIu64 " bytes\n", root.c_str(), files.size(), total_bytes);
+    return ret;
+}
+
+int RecordingRetention::scan()
+{
+    char* path[] = {(char*)root.c_str(), NULL};
+    FTS* fts = fts_open(path, FTS_PHYSICAL | FTS_NOCHDIR, NULL);
+    if (fts == NULL) {
+        // Nothing recorded yet.
+        if (errno == ENOENT)
+            return 0;
+        ff_error("Failed to fts_open %s: %s\n", root.c_str(), strerror(errno));
+        return -1;
+    }
+
+    FTSENT* ent;
+    while ((ent = fts_read(fts)) != NULL) {
+        if (ent->fts_info == FTS_F && strncmp(ent->fts_path, journal_path.c_str(), journal_path.size()) != 0)
+            insert(ent->fts_path, ent->fts_statp->st_mtim.tv_sec, ent->fts_statp->st_size);
+    }
+    fts_close(fts);
+    return 0;
+}
+
+/// @brief Apply the journal lines, "+ <mtime> <size> <path>" and "- <path>"
+int RecordingRetention::replay(FILE* fp)
+{
+    char* line = nullptr;
+    size_t cap = 0;
+    ssize_t len;
+
+    while ((len = getline(&line, &cap, fp)) > 0) {
+        if (line[len - 1] != '\n')
+            break;      // cut off by a crash
+        line[len - 1] = 0;
+
+        long long mtime;
+        unsigned long long size;
+        int pos = 0;
+        if (line[0] == '+' && sscanf(line, "+ %lld %llu %n", &mtime, &size, &pos) == 2 && pos > 0)
+            insert(line + pos, mtime, size);
+        else if (line[0] == '-' && line[1] == ' ')
+            erase(line + 2);
+    }
+    free(line);
+    return 0;
+}
+
+/// @brief Rewrite the journal with the live entries, through a temporary file
+int RecordingRetention::compact()
+{
+    if (journal_fp) {
+        fclose(journal_fp);
+        journal_fp = nullptr;
+    }
+
+    std::string tmp = journal_path + ".tmp";
+    createDirectory(journal_path.c_str());
+    FILE* fp = fopen(tmp.c_str(), "w");
+    if (fp == nullptr) {
+        ff_error("Failed to open %s: %s\n", tmp.c_str(), strerror(errno));
+        return -1;
+    }
+    for (auto& key : files) {
+        const File& f = by_path[key.path];
+        fprintf(fp, "+ %lld %" PRIu64 " %s\n", (long long)f.mtime, f.size, key.path.c_str());
+    }
+    if (fflush(fp) != 0 || fsync(fileno(fp)) != 0 || fclose(fp) != 0 || rename(tmp.c_str(), journal_path.c_str()) != 0) {
+        ff_error("Failed to write %s: %s\n", journal_path.c_str(), strerror(errno));
+        return -1;
+    }
+
+    journal_fp = fopen(journal_path.c_str(), "a");
+    journal_lines = files.size();
+    return journal_fp ? 0 : -1;
+}
+
+void RecordingRetention::journal(const char* op, const std::string& path, time_t mtime, uint64_t size)
+{
+    if (journal_fp == nullptr)
+        return;
+
+    if (op[0] == '+')
+        fprintf(journal_fp, "+ %lld %" PRIu64 " %s\n", (long long)mtime, size, path.c_str());
+    else
+        fprintf(journal_fp, "- %s\n", path.c_str());
+    fflush(journal_fp);
+
+    if (++journal_lines > std::max<size_t>(files.size() * 2, RETENTION_COMPACT_MIN))
+        compact();
+}
+
+std::string RecordingRetention::groupOf(const std::string& path) const
+{
+    if (path.compare(0, root.size(), root) != 0 || path.size() <= root.size() + 1 || path[root.size()] != '/')
+        return "";
+    size_t begin = root.size() + 1;
+    size_t end = path.find('/', begin);
+    // Files right in the root form the "" group.
+    return end == std::string::npos ? "" : path.substr(begin, end - begin);
+}
+
+void RecordingRetention::insert(const std::string& path, time_t mtime, uint64_t size)
+{
+    erase(path);
+
+    File f = {mtime, size, groupOf(path)};
+    Group& g = groups[f.group];
+    files.insert({mtime, path});
+    g.files.insert({mtime, path});
+    g.bytes += size;
+    total_bytes += size;
+    by_path[path] = f;
+}
+
+void RecordingRetention::erase(const std::string& path)
+{
+    auto it = by_path.find(path);
+    if (it == by_path.end())
+        return;
+
+    Key key = {it->second.mtime, path};
+    Group& g = groups[it->second.group];
+    files.erase(key);
+    g.files.erase(key);
+    g.bytes -= it->second.size;
+    total_bytes -= it->second.size;
+    by_path.erase(it);
+}
+
+void RecordingRetention::add(const std::string& path)
+{
+    struct stat st;
+    if (stat(path.c_str(), &st) != 0 || !S_ISREG(st.st_mode))
+        return;
+
+    std::lock_guard<std::mutex> lk(mtx);
+    insert(path, st.st_mtim.tv_sec, st.st_size);
+    journal("+", path, st.st_mtim.tv_sec, st.st_size);
+}
+
+void RecordingRetention::setWatermarks(uint64_t _low_free, uint64_t _high_free)
+{
+    std::lock_guard<std::mutex> lk(mtx);
+    low_free = _low_free;
+    high_free = std::max(_low_free, _high_free);
+}
+
+void RecordingRetention::setQuota(const std::string& group, uint64_t bytes)
+{
+    std::lock_guard<std::mutex> lk(mtx);
+    groups[group].quota = bytes;
+}
+
+/// @brief Delete one file and the directories it leaves empty
+/// @return false if it could not be deleted, it is dropped from the index anyway
+bool RecordingRetention::evict(const Key& key)
+{
+    std::string path = key.path;
+    uint64_t size = by_path[path].size;
+    bool ok = remove(path.c_str()) == 0 || errno == ENOENT;
+
+    if (ok) {
+        ff_info("remove %s file\n", path.c_str());
+        deleted++;
+        deleted_bytes += size;
+        for (size_t slash = path.rfind('/'); slash != std::string::npos && slash > root.size(); slash = path.rfind('/')) {
+            path.resize(slash);
+            if (rmdir(path.c_str()) != 0)
+                break;
+        }
+    } else {
+        ff_warn("Failed to remove %s: %s\n", path.c_str(), strerror(errno));
+    }
+
+    erase(key.path);
+    journal("-", key.path);
+    return ok;
+}
+
+int RecordingRetention::enforce()
+{
+    std::lock_guard<std::mutex> lk(mtx);
+    int count = 0;
+
+    for (auto& it : groups) {
+        Group& g = it.second;
+        while (g.quota > 0 && g.bytes > g.quota && !g.files.empty()) {
+            Key key = *g.files.begin();
+            count += evict(key);
+        }
+    }
+
+    if (low_free == 0 || getSystemFreeSize(journal_path.c_str()) >= low_free)
+        return count;
+
+    // Below the low watermark, delete up to the high one.
+    while (!files.empty() && getSystemFreeSize(journal_path.c_str()) < high_free) {
+        Key key = *files.begin();
+        count += evict(key);
+    }
+    return count;
+}
+
+size_t RecordingRetention::size()
+{
+    std::lock_guard<std::mutex> lk(mtx);
+    return files.size();
+}
+
+uint64_t RecordingRetention::totalBytes()
+{
+    std::lock_guard<std::mutex> lk(mtx);
+    return total_bytes;
+}
+
+void RecordingRetention::dumpStats()
+{
+    std::lock_guard<std::mutex> lk(mtx);
+    ff_info("retention %s: %zu files, %" PRIu64 " bytes, deleted %" PRIu64 " files, %" PRIu64 " bytes\n",
+            root.c_str(), files.size(), total_bytes, deleted, deleted_bytes);
+}
@@ -0,0 +1,98 @@
+#pragma once
+#include <stdint.h>
+#include <stdio.h>
+#include <time.h>
+#include <mutex>
+#include <set>
+#include <string>
+#include <unordered_map>
+
+/*
+ * Index of the closed recordings under a root directory, for deleting the
+ * oldest ones when the disk fills up.
+ *
+ * Files are added when their segment is closed and kept ordered by mtime,
+ * so eviction takes the first entry instead of walking the tree. Files are
+ * grouped by the first directory under the root (one per camera with
+ * "outputFile /<camera>/%Y/..."), and a group may have its own size quota.
+ * Free space is managed with a watermark pair: eviction starts below the
+ * low mark and continues up to the high mark, so a full disk does not
+ * delete one file per segment.
+ *
+ * The index is persisted as an append-only journal in the root, compacted
+ * when it grows to twice the live entries. The tree is walked only once,
+ * when there is no journal yet; deleting the journal rebuilds it.
+ */
+class RecordingRetention
+{
+public:
+    static constexpr const char* JOURNAL_NAME = ".retention";
+
+public:
+    RecordingRetention(const std::string& root);
+    ~RecordingRetention();
+
+    int load();
+    // A closed recording, the path must be under the root.
+    void add(const std::string& path);
+
+    void setWatermarks(uint64_t low_free, uint64_t high_free);
+    // Size quota of the files under root/group, 0 for none.
+    void setQuota(const std::string& group, uint64_t bytes);
+
+    // Delete files until the quotas and the high watermark are met, returns the number deleted.
+    int enforce();
+
+    size_t size();
+    uint64_t totalBytes();
+    void dumpStats();
+
+private:
+    struct Key {
+        time_t mtime;
+        std::string path;
+        bool operator<(const Key& other) const
+        {
+            return mtime != other.mtime ? mtime < other.mtime : path < other.path;
+        }
+    };
+
+    struct File {
+        time_t mtime;
+        uint64_t size;
+        std::string group;
+    };
+
+    struct Group {
+        uint64_t bytes = 0;
+        uint64_t quota = 0;
+        std::set<Key> files;
+    };
+
+    int scan();
+    int replay(FILE* fp);
+    int compact();
+    void insert(const std::string& path, time_t mtime, uint64_t size);
+    void erase(const std::string& path);
+    bool evict(const Key& key);
+    std::string groupOf(const std::string& path) const;
+    void journal(const char* op, const std::string& path, time_t mtime = 0, uint64_t size = 0);
+
+private:
+    std::string root;
+    std::string journal_path;
+    FILE* journal_fp;
+    size_t journal_lines;
+
+    uint64_t low_free;
+    uint64_t high_free;
+
+    std::mutex mtx;
+    std::set<Key> files;
+    std::unordered_map<std::string, File> by_path;
+    std::unordered_map<std::string, Group> groups;
+    uint64_t total_bytes;
+
+    uint64_t deleted;
+    uint64_t deleted_bytes;
+};
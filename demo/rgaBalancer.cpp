@@ -0,0 +1,343 @@
+#include <unistd.h>
+#include <algorithm>
+#include <chrono>
+#include "rgaBalancer.hpp"
+
+// Cost priors before the first measurement, only their ratio matters.
+static const double RGA3_PRIOR_US_PER_MPIXEL = 2000.0;
+static const double RGA2_PRIOR_US_PER_MPIXEL = 3000.0;
+static const double COST_EWMA_ALPHA = 0.125;
+
+static int64_t steadyClockUs()
+{
+    return std::chrono::duration_cast<std::chrono::microseconds>(
+               std::chrono::steady_clock::now().time_since_epoch())
+        .count();
+}
+
+RgaCoreBalancer::RgaCoreBalancer(const std::vector<Core>& _cores)
+    : now(steadyClockUs)
+{
+    for (auto& c : _cores) {
+        CoreState state;
+        state.info = c;
+        state.queue_depth = 0;
+        state.queue_pixels = 0;
+        state.jobs = 0;
+        state.busy_us = 0;
+        state.us_per_mpixel = c.type == CORE_RGA3 ? RGA3_PRIOR_US_PER_MPIXEL : RGA2_PRIOR_US_PER_MPIXEL;
+        cores.push_back(state);
+    }
+    stats_start = now();
+}
+
+RgaCoreBalancer::~RgaCoreBalancer()
+{
+}
+
+shared_ptr<RgaCoreBalancer> RgaCoreBalancer::getDefault()
+{
+    static shared_ptr<RgaCoreBalancer> balancer = make_shared<RgaCoreBalancer>(std::vector<Core>{
+        {ModuleRga::SCHEDULER_RGA3_CORE0, CORE_RGA3},
+        {ModuleRga::SCHEDULER_RGA3_CORE1, CORE_RGA3},
+        {ModuleRga::SCHEDULER_RGA2_CORE0, CORE_RGA2},
+    });
+    return balancer;
+}
+
+static bool rga3SupportFormat(uint32_t fmt)
+{
+    switch (fmt) {
+        case V4L2_PIX_FMT_NV12:
+        case V4L2_PIX_FMT_NV21:
+        case V4L2_PIX_FMT_NV16:
+        case V4L2_PIX_FMT_NV61:
+        case V4L2_PIX_FMT_YUYV:
+        case V4L2_PIX_FMT_UYVY:
+        case V4L2_PIX_FMT_RGB24:
+        case V4L2_PIX_FMT_BGR24:
+        case V4L2_PIX_FMT_RGB565:
+        case V4L2_PIX_FMT_ARGB32:
+        case V4L2_PIX_FMT_ABGR32:
+        case V4L2_PIX_FMT_XRGB32:
+        case V4L2_PIX_FMT_XBGR32:
+        case V4L2_PIX_FMT_RGB32:
+        case V4L2_PIX_FMT_BGR32:
+            return true;
+        default:
+            return false;
+    }
+}
+
+/// @brief Check the per core type size, scale and format limits
+bool RgaCoreBalancer::coreSupportJob(CoreType type, const Job& job)
+{
+    const ImagePara& s = job.src;
+    const ImagePara& d = job.dst;
+
+    if (v4l2fmtIsCompressed(s.v4l2Fmt) || v4l2fmtIsCompressed(d.v4l2Fmt))
+        return false;
+
+    if (type == CORE_RGA3) {
+        if (s.width < 68 || s.height < 2 || s.width > 8176 || s.height > 8176)
+            return false;
+        if (d.width < 68 || d.height < 2 || d.width > 8128 || d.height > 8128)
+            return false;
+        if (!rga3SupportFormat(s.v4l2Fmt) || !rga3SupportFormat(d.v4l2Fmt))
+            return false;
+        // scale range 1/8 ~ 8
+        if (d.width * 8 < s.width || d.height * 8 < s.height
+            || d.width > s.width * 8 || d.height > s.height * 8)
+            return false;
+    } else {
+        if (job.above_4g)
+            return false;
+        if (s.width < 2 || s.height < 2 || s.width > 8192 || s.height > 8192)
+            return false;
+        if (d.width < 2 || d.height < 2 || d.width > 4096 || d.height > 4096)
+            return false;
+        // scale range 1/16 ~ 16
+        if (d.width * 16 < s.width || d.height * 16 < s.height
+            || d.width > s.width * 16 || d.height > s.height * 16)
+            return false;
+    }
+
+    return true;
+}
+
+void RgaCoreBalancer::setClock(std::function<int64_t()> clock)
+{
+    std::lock_guard<std::mutex> lk(mtx);
+    now = clock;
+    stats_start = now();
+}
+
+uint64_t RgaCoreBalancer::jobPixels(const Job& job)
+{
+    // RGA is bandwidth bound, count both the read and the written pixels.
+    return (uint64_t)job.src.width * job.src.height + (uint64_t)job.dst.width * job.dst.height;
+}
+
+/// @brief Choose a core for the job and account it as queued on that core
+/// @return core index, or -1 if no core supports the job
+int RgaCoreBalancer::acquire(const Job& job)
+{
+    std::lock_guard<std::mutex> lk(mtx);
+    uint64_t pixels = jobPixels(job);
+    double best_cost = 0;
+    int best = -1;
+
+    for (size_t i = 0; i < cores.size(); i++) {
+        CoreState& c = cores[i];
+        if (!coreSupportJob(c.info.type, job))
+            continue;
+
+        double cost = (c.queue_pixels + pixels) / 1000000.0 * c.us_per_mpixel;
+        if (best < 0 || cost < best_cost) {
+            best = i;
+            best_cost = cost;
+        }
+    }
+
+    if (best >= 0) {
+        cores[best].queue_depth++;
+        cores[best].queue_pixels += pixels;
+    }
+    return best;
+}
+
+/// @brief Finish a job started by acquire()
+/// @param cost_us measured latency, negative if the job was not executed
+void RgaCoreBalancer::release(int index, const Job& job, int64_t cost_us)
+{
+    std::lock_guard<std::mutex> lk(mtx);
+    if (index < 0 || index >= (int)cores.size())
+        return;
+
+    CoreState& c = cores[index];
+    uint64_t pixels = jobPixels(job);
+    c.queue_depth = c.queue_depth ? c.queue_depth - 1 : 0;
+    c.queue_pixels = c.queue_pixels > pixels ? c.queue_pixels - pixels : 0;
+
+    if (cost_us < 0 || pixels == 0)
+        return;
+
+    double sample = cost_us / (pixels / 1000000.0);
+    c.us_per_mpixel += (sample - c.us_per_mpixel) * COST_EWMA_ALPHA;
+    c.busy_us += cost_us;
+    c.jobs++;
+}
+
+ModuleRga::RGA_SCHEDULER_CORE RgaCoreBalancer::getCore(int index)
+{
+    if (index < 0 || index >= (int)cores.size())
+        return ModuleRga::SCHEDULER_DEFAULT;
+    return cores[index].info.core;
+}
+
+std::vector<RgaCoreBalancer::CoreStats> RgaCoreBalancer::getStats()
+{
+    std::lock_guard<std::mutex> lk(mtx);
+    std::vector<CoreStats> stats;
+    int64_t elapsed = now() - stats_start;
+
+    for (auto& c : cores) {
+        CoreStats s;
+        s.core = c.info.core;
+        s.type = c.info.type;
+        s.jobs = c.jobs;
+        s.queue_depth = c.queue_depth;
+        s.busy_us = c.busy_us;
+        s.us_per_mpixel = c.us_per_mpixel;
+        s.utilization = elapsed > 0 ? (double)c.busy_us / elapsed : 0;
+        stats.push_back(s);
+    }
+    return stats;
+}
+
+void RgaCoreBalancer::resetStats()
+{
+    std::lock_guard<std::mutex> lk(mtx);
+    for (auto& c : cores) {
+        c.jobs = 0;
+        c.busy_us = 0;
+    }
+    stats_start = now();
+}
+
+void RgaCoreBalancer::dumpStats()
+{
+    for (auto& s : getStats()) {
+        ff_info("rga core 0x%x(%s): jobs %" PRIu64 ", queue %u, busy %" PRId64 "us, %.1f us/Mpixel, utilization %.1f%%\n",
+                s.core, s.type == CORE_RGA3 ? "rga3" : "rga2", s.jobs, s.queue_depth, s.busy_us,
+                s.us_per_mpixel, s.utilization * 100);
+    }
+}
+
+/// @brief Run one job on the core chosen by the balancer
+/// @return the job latency, or -1 if no core supports the job
+int64_t RgaCoreBackend::run(RgaCoreBalancer& balancer, const RgaCoreBalancer::Job& job)
+{
+    int index = balancer.acquire(job);
+    if (index < 0)
+        return -1;
+
+    int64_t cost = process(balancer.getCore(index), job);
+    balancer.release(index, job, cost);
+    return cost;
+}
+
+RgaSimulatedBackend::RgaSimulatedBackend()
+    : clock_us(0)
+{
+}
+
+void RgaSimulatedBackend::setCoreCost(ModuleRga::RGA_SCHEDULER_CORE core, int64_t fixed_us, double us_per_mpixel)
+{
+    for (auto& c : costs) {
+        if (c.core == core) {
+            c.fixed_us = fixed_us;
+            c.us_per_mpixel = us_per_mpixel;
+            return;
+        }
+    }
+    costs.push_back({core, fixed_us, us_per_mpixel, 0});
+}
+
+int64_t RgaSimulatedBackend::process(ModuleRga::RGA_SCHEDULER_CORE core, const RgaCoreBalancer::Job& job)
+{
+    double mpixels = ((uint64_t)job.src.width * job.src.height + (uint64_t)job.dst.width * job.dst.height) / 1000000.0;
+    for (auto& c : costs) {
+        if (c.core == core)
+            return c.fixed_us + (int64_t)(c.us_per_mpixel * mpixels);
+    }
+    return -1;
+}
+
+/// @brief Queue a job on the core chosen by the balancer, it completes in advance()
+int RgaSimulatedBackend::submit(RgaCoreBalancer& balancer, const RgaCoreBalancer::Job& job)
+{
+    int index = balancer.acquire(job);
+    if (index < 0)
+        return -1;
+
+    ModuleRga::RGA_SCHEDULER_CORE core = balancer.getCore(index);
+    int64_t cost = process(core, job);
+    auto c = std::find_if(costs.begin(), costs.end(), [core](const Cost& entry) { return entry.core == core; });
+    if (cost < 0 || c == costs.end()) {
+        balancer.release(index, job, -1);
+        return -1;
+    }
+
+    // The core runs its queue in order, the job starts when the ones before it are done.
+    c->free_us = std::max(c->free_us, clock_us) + cost;
+    inflight.emplace(c->free_us, Inflight{&balancer, index, job, cost});
+    return index;
+}
+
+/// @brief Move the virtual clock to to_us, completing the jobs done by then in order
+void RgaSimulatedBackend::advance(int64_t to_us)
+{
+    while (!inflight.empty() && inflight.begin()->first <= to_us) {
+        auto it = inflight.begin();
+        clock_us = std::max(clock_us, it->first);
+        it->second.balancer->release(it->second.index, it->second.job, it->second.cost_us);
+        inflight.erase(it);
+    }
+    clock_us = std::max(clock_us, to_us);
+}
+
+static bool physicalMemoryAbove4G()
+{
+    long pages = sysconf(_SC_PHYS_PAGES);
+    long page_size = sysconf(_SC_PAGESIZE);
+    return pages > 0 && page_size > 0 && (uint64_t)pages * page_size > (4ULL << 30);
+}
+
+ModuleRgaBalanced::ModuleRgaBalanced(const ImagePara& output_para, RgaRotate rotate,
+                                     shared_ptr<RgaCoreBalancer> balancer)
+    : ModuleRga(output_para, rotate), balancer(balancer), last_core(-1), above_4g(physicalMemoryAbove4G())
+{
+}
+
+ModuleRgaBalanced::ModuleRgaBalanced(const ImagePara& input_para, const ImagePara& output_para, RgaRotate rotate,
+                                     shared_ptr<RgaCoreBalancer> balancer)
+    : ModuleRga(input_para, output_para, rotate), balancer(balancer), last_core(-1),
+      above_4g(physicalMemoryAbove4G())
+{
+}
+
+ModuleRgaBalanced::~ModuleRgaBalanced()
+{
+}
+
+ModuleMedia::ConsumeResult ModuleRgaBalanced::doConsume(shared_ptr<MediaBuffer> input_buffer,
+                                                        shared_ptr<MediaBuffer> output_buffer)
+{
+    if (balancer == nullptr || input_buffer == nullptr)
+        return ModuleRga::doConsume(input_buffer, output_buffer);
+
+    RgaCoreBalancer::Job job;
+    if (input_buffer->getMediaBufferType() == BUFFER_TYPE_VIDEO)
+        job.src = static_pointer_cast<VideoBuffer>(input_buffer)->getImagePara();
+    else
+        job.src = input_para;
+    job.dst = output_para;
+    job.above_4g = above_4g;
+
+    int index = balancer->acquire(job);
+    if (index != last_core) {
+        setRgaSchedulerCore(balancer->getCore(index));
+        last_core = index;
+    }
+
+    auto start = std::chrono::steady_clock::now();
+    ConsumeResult ret = ModuleRga::doConsume(input_buffer, output_buffer);
+    auto end = std::chrono::steady_clock::now();
+
+    int64_t cost = -1;
+    if (ret == CONSUME_SUCCESS)
+        cost = std::chrono::duration_cast<std::chrono::microseconds>(end - start).count();
+    balancer->release(index, job, cost);
+    return ret;
+}
@@ -0,0 +1,167 @@
+#pragma once
+#include <vector>
+#include <map>
+#include <mutex>
+#include <functional>
+
+#include "module/vp/module_rga.hpp"
+
+/*
+ * Per-job RGA core selection.
+ *
+ * Every job is given to the supported core with the smallest predicted
+ * completion time: the pixels already queued on the core plus the job's own
+ * pixels, times the core's measured cost per pixel. The costs are learned
+ * from the job latencies reported back to the balancer, so the same logic
+ * runs against the hardware (ModuleRgaBalanced) or a simulated backend.
+ *
+ * RGA2 only takes 32-bit physical addresses: a job whose buffers may lie
+ * above 4 GB never goes to an RGA2 core.
+ */
+class RgaCoreBalancer
+{
+public:
+    enum CoreType {
+        CORE_RGA2 = 0,
+        CORE_RGA3,
+    };
+
+    struct Core {
+        ModuleRga::RGA_SCHEDULER_CORE core;
+        CoreType type;
+    };
+
+    struct Job {
+        ImagePara src;
+        ImagePara dst;
+        bool above_4g;      // a buffer may lie above 4 GB physical, out of reach of RGA2
+    };
+
+    struct CoreStats {
+        ModuleRga::RGA_SCHEDULER_CORE core;
+        CoreType type;
+        uint64_t jobs;
+        uint32_t queue_depth;
+        int64_t busy_us;
+        double us_per_mpixel;
+        double utilization;
+    };
+
+public:
+    RgaCoreBalancer(const std::vector<Core>& cores);
+    ~RgaCoreBalancer();
+
+    // RK3588 layout: two RGA3 cores and one RGA2 core, shared by all users in the process.
+    static shared_ptr<RgaCoreBalancer> getDefault();
+
+    static bool coreSupportJob(CoreType type, const Job& job);
+
+    // The clock only matters for utilization; a simulation can drive a virtual one.
+    void setClock(std::function<int64_t()> clock);
+
+    int acquire(const Job& job);
+    void release(int index, const Job& job, int64_t cost_us);
+    ModuleRga::RGA_SCHEDULER_CORE getCore(int index);
+
+    std::vector<CoreStats> getStats();
+    void resetStats();
+    void dumpStats();
+
+private:
+    struct CoreState {
+        Core info;
+        uint32_t queue_depth;
+        uint64_t queue_pixels;
+        uint64_t jobs;
+        int64_t busy_us;
+        double us_per_mpixel;
+    };
+
+    static uint64_t jobPixels(const Job& job);
+
+private:
+    std::mutex mtx;
+    std::vector<CoreState> cores;
+    std::function<int64_t()> now;
+    int64_t stats_start;
+};
+
+/*
+ * Something that can run an RGA job on a given core and report its latency.
+ */
+class RgaCoreBackend
+{
+public:
+    virtual ~RgaCoreBackend() {}
+    virtual int64_t process(ModuleRga::RGA_SCHEDULER_CORE core, const RgaCoreBalancer::Job& job) = 0;
+
+    int64_t run(RgaCoreBalancer& balancer, const RgaCoreBalancer::Job& job);
+};
+
+/*
+ * Backend with configurable per-core costs, for exercising the balancer off target.
+ *
+ * process() gives the latency of a job run alone. submit() queues the job
+ * on its core in virtual time, behind the jobs already queued there, and
+ * returns at once; advance() moves the clock and completes the jobs done
+ * by then, reporting their latency to the balancer. Jobs arriving faster
+ * than the cores finish them pile up, so the balancer sees real queue
+ * depths. Driving the balancer clock with now() makes the utilization
+ * virtual too.
+ */
+class RgaSimulatedBackend : public RgaCoreBackend
+{
+public:
+    RgaSimulatedBackend();
+
+    void setCoreCost(ModuleRga::RGA_SCHEDULER_CORE core, int64_t fixed_us, double us_per_mpixel);
+    int64_t process(ModuleRga::RGA_SCHEDULER_CORE core, const RgaCoreBalancer::Job& job) override;
+
+    /// @return core index given by the balancer, or -1 if no core supports the job
+    int submit(RgaCoreBalancer& balancer, const RgaCoreBalancer::Job& job);
+    void advance(int64_t to_us);
+    int64_t now() const { return clock_us; }
+    size_t pending() const { return inflight.size(); }
+
+private:
+    struct Cost {
+        ModuleRga::RGA_SCHEDULER_CORE core;
+        int64_t fixed_us;
+        double us_per_mpixel;
+        int64_t free_us;    // when the jobs queued on the core are done
+    };
+    struct Inflight {
+        RgaCoreBalancer* balancer;
+        int index;
+        RgaCoreBalancer::Job job;
+        int64_t cost_us;
+    };
+    std::vector<Cost> costs;
+    std::multimap<int64_t, Inflight> inflight;  // by completion time
+    int64_t clock_us;
+};
+
+/*
+ * ModuleRga that picks the scheduler core per frame through a RgaCoreBalancer.
+ */
+class ModuleRgaBalanced : public ModuleRga
+{
+public:
+    ModuleRgaBalanced(const ImagePara& output_para, RgaRotate rotate,
+                      shared_ptr<RgaCoreBalancer> balancer = RgaCoreBalancer::getDefault());
+    ModuleRgaBalanced(const ImagePara& input_para, const ImagePara& output_para, RgaRotate rotate,
+                      shared_ptr<RgaCoreBalancer> balancer = RgaCoreBalancer::getDefault());
+    ~ModuleRgaBalanced();
+
+    shared_ptr<RgaCoreBalancer> getBalancer() { return balancer; }
+    // By default buffers count as above 4 GB when the system has more memory than that.
+    void setBuffersAbove4G(bool above) { above_4g = above; }
+
+public:
+    virtual ConsumeResult doConsume(shared_ptr<MediaBuffer> input_buffer, shared_ptr<MediaBuffer> output_buffer) override;
+
+private:
+    shared_ptr<RgaCoreBalancer> balancer;
+    int last_core;
+    bool above_4g;
+};
@@ -0,0 +1,305 @@
+#include <chrono>
+#include <algorithm>
+#include "rgaMosaic.hpp"
+
+#define MOSAIC_DEFAULT_STALL_TIMEOUT 2000000
+
+static int64_t steadyClockUs()
+{
+    return std::chrono::duration_cast<std::chrono::microseconds>(
+               std::chrono::steady_clock::now().time_since_epoch())
+        .count();
+}
+
+ModuleRgaMosaic::ModuleRgaMosaic(const ImagePara& para, uint32_t fps)
+    : ModuleMedia("ModuleRgaMosaic"), blitter(nullptr), scheduler_core(ModuleRga::SCHEDULER_DEFAULT),
+      interval(1000000 / (fps ? fps : 25)), start_time(0), next_tick(0),
+      stall_timeout(MOSAIC_DEFAULT_STALL_TIMEOUT), frames(0), late_ticks(0)
+{
+    output_para = para;
+    media_type = BUFFER_TYPE_VIDEO;
+}
+
+ModuleRgaMosaic::~ModuleRgaMosaic()
+{
+}
+
+/// @brief Place a source into the output frame, must be called before init()
+/// @param rect cell position in the output frame, should be 2 pixel aligned
+/// @param duration minimum interval in us between cell updates, 0 takes every frame
+/// @return the cell index, or -1 on error
+int ModuleRgaMosaic::addCell(shared_ptr<ModuleMedia> source, const ImageCrop& rect, int64_t duration)
+{
+    if (initialize) {
+        ff_error("Cells can not be added after init\n");
+        return -1;
+    }
+
+    if (source == nullptr || rect.w == 0 || rect.h == 0
+        || rect.x + rect.w > output_para.width || rect.y + rect.h > output_para.height) {
+        ff_error("Cell %u,%u %ux%u is invalid\n", rect.x, rect.y, rect.w, rect.h);
+        return -1;
+    }
+
+    unique_ptr<Cell> cell(new Cell());
+    cell->source = source;
+    cell->rect = rect;
+    cell->duration = duration;
+    cell->front = 0;
+    cell->generation = 0;
+    cell->last_pts = -1;
+    cell->last_update = 0;
+    cell->received = 0;
+    cell->dropped = 0;
+    cell->failed = 0;
+    cells.push_back(std::move(cell));
+    return cells.size() - 1;
+}
+
+/// @brief Add the sources row by row into a cols x rows grid
+/// @return number of cells added, or -1 on error
+int ModuleRgaMosaic::addGrid(const vector<shared_ptr<ModuleMedia>>& sources, uint32_t cols, uint32_t rows, int64_t duration)
+{
+    if (cols == 0 || rows == 0 || sources.size() > cols * rows) {
+        ff_error("%zu sources do not fit a %ux%u grid\n", sources.size(), cols, rows);
+        return -1;
+    }
+
+    for (size_t i = 0; i < sources.size(); i++) {
+        if (addCell(sources[i], gridCell(output_para, cols, rows, i), duration) < 0)
+            return -1;
+    }
+    return sources.size();
+}
+
+/// @brief Rectangle of a grid cell, aligned for the rga
+ImageCrop ModuleRgaMosaic::gridCell(const ImagePara& para, uint32_t cols, uint32_t rows, uint32_t index)
+{
+    uint32_t w = (para.width / cols) & ~15u;
+    uint32_t h = (para.height / rows) & ~1u;
+    uint32_t x = (index % cols) * w + (para.width - w * cols) / 2;
+    uint32_t y = (index / cols) * h + (para.height - h * rows) / 2;
+    return {x & ~1u, y & ~1u, w, h};
+}
+
+int ModuleRgaMosaic::initCell(int index)
+{
+    Cell& c = *cells[index];
+    ImagePara src = c.source->getOutputImagePara();
+    uint32_t hstride = c.rect.w;
+    uint32_t vstride = c.rect.h;
+    int ret;
+
+    if (src.width == 0 || src.height == 0) {
+        ff_error("Cell %d source output para is invalid\n", index);
+        return -1;
+    }
+
+    ModuleRga::alignStride(output_para.v4l2Fmt, hstride, vstride);
+    ImagePara cell_para(c.rect.w, c.rect.h, hstride, vstride, output_para.v4l2Fmt);
+
+    // Only used as a converter, its own pool is never produced into.
+    c.scaler = make_shared<ModuleRga>(src, cell_para, RGA_ROTATE_NONE);
+    c.scaler->setBufferCount(1);
+    c.scaler->setRgaSchedulerCore(scheduler_core);
+    ret = c.scaler->init();
+    if (ret < 0) {
+        ff_error("Cell %d scaler init failed\n", index);
+        return ret;
+    }
+
+    for (int i = 0; i < 2; i++) {
+        c.frames[i] = static_pointer_cast<VideoBuffer>(c.scaler->newModuleMediaBuffer());
+        if (c.frames[i] == nullptr || c.frames[i]->getData() == nullptr) {
+            ff_error("Cell %d buffer alloc failed\n", index);
+            return -1;
+        }
+    }
+
+    char tap_name[32];
+    snprintf(tap_name, sizeof(tap_name), "mosaic_cell%d", index);
+    c.tap = c.source->addExternalConsumer(tap_name, NULL, [this, index](void_object, shared_ptr<MediaBuffer> buffer) {
+        onSourceFrame(index, buffer);
+    });
+    if (c.tap == nullptr) {
+        ff_error("Cell %d failed to attach to its source\n", index);
+        return -1;
+    }
+    return 0;
+}
+
+/// @brief Create the cell converters and attach them to their sources
+/// @return 0 on success, negative on failure
+int ModuleRgaMosaic::init()
+{
+    int ret;
+
+    if (initialize)
+        return 0;
+
+    if (cells.empty() || output_para.width == 0 || output_para.height == 0) {
+        ff_error("Mosaic output para or cells are not set\n");
+        return -1;
+    }
+
+    if (output_para.hstride == 0 || output_para.vstride == 0) {
+        output_para.hstride = output_para.width;
+        output_para.vstride = output_para.height;
+        ModuleRga::alignStride(output_para.v4l2Fmt, output_para.hstride, output_para.vstride);
+    }
+
+    // The cell buffers are already in the output format, this is a plain copy.
+    const ImageCrop& r = cells[0]->rect;
+    ImagePara first(r.w, r.h, r.w, r.h, output_para.v4l2Fmt);
+    blitter = make_shared<ModuleRga>(first, output_para, RGA_ROTATE_NONE);
+    blitter->setBufferCount(1);
+    blitter->setRgaSchedulerCore(scheduler_core);
+    ret = blitter->init();
+    if (ret < 0) {
+        ff_error("Mosaic blitter init failed\n");
+        return ret;
+    }
+
+    for (size_t i = 0; i < cells.size(); i++) {
+        ret = initCell(i);
+        if (ret < 0)
+            return ret;
+    }
+
+    ret = initBuffer();
+    if (ret < 0) {
+        ff_error("Mosaic buffer init failed\n");
+        return ret;
+    }
+
+    initialize = true;
+    return 0;
+}
+
+int ModuleRgaMosaic::initBuffer()
+{
+    int ret = ModuleMedia::initBuffer(VideoBuffer::DRM_BUFFER_CACHEABLE);
+    if (ret < 0)
+        return ret;
+
+    drawn.clear();
+    for (auto& buf : buffer_pool) {
+        shared_ptr<VideoBuffer> canvas = static_pointer_cast<VideoBuffer>(buf);
+        canvas->fillWithBlack();
+        canvas->flushDrmBuf();
+        drawn[buf.get()] = vector<uint64_t>(cells.size(), 0);
+    }
+    return 0;
+}
+
+bool ModuleRgaMosaic::setup()
+{
+    start_time = steadyClockUs();
+    next_tick = start_time;
+    frames = 0;
+    late_ticks = 0;
+    return true;
+}
+
+/// @brief Runs in the source's consumer thread, keeps the latest accepted frame of the cell
+void ModuleRgaMosaic::onSourceFrame(int index, shared_ptr<MediaBuffer> buffer)
+{
+    if (buffer == nullptr || buffer->getMediaBufferType() != BUFFER_TYPE_VIDEO)
+        return;
+
+    Cell& c = *cells[index];
+    int64_t pts = buffer->getPUstimestamp();
+    c.received++;
+
+    // A pts jump backwards means the source restarted, accept the frame.
+    if (c.duration > 0 && c.last_pts >= 0 && pts >= c.last_pts && pts - c.last_pts < c.duration) {
+        c.dropped++;
+        return;
+    }
+
+    // Only this thread writes front, the reader holds the lock while it copies the front frame.
+    int back = c.front ^ 1;
+    if (c.scaler->doConsume(buffer, c.frames[back]) != CONSUME_SUCCESS) {
+        c.failed++;
+        return;
+    }
+
+    std::lock_guard<std::mutex> lk(c.mtx);
+    c.front = back;
+    c.generation++;
+    c.last_pts = pts;
+    c.last_update = steadyClockUs();
+}
+
+/// @brief Copy every cell that changed since this canvas was last drawn
+void ModuleRgaMosaic::compose(shared_ptr<VideoBuffer> canvas)
+{
+    vector<uint64_t>& canvas_drawn = drawn[canvas.get()];
+    if (canvas_drawn.size() != cells.size())
+        canvas_drawn.assign(cells.size(), 0);
+
+    for (size_t i = 0; i < cells.size(); i++) {
+        Cell& c = *cells[i];
+        std::lock_guard<std::mutex> lk(c.mtx);
+        if (c.generation == canvas_drawn[i])
+            continue;
+
+        const ImagePara& fp = c.frames[c.front]->getImagePara();
+        blitter->setSrcPara(fp.v4l2Fmt, 0, 0, c.rect.w, c.rect.h, fp.hstride, fp.vstride);
+        blitter->setDstPara(output_para.v4l2Fmt, c.rect.x, c.rect.y, c.rect.w, c.rect.h,
+                            output_para.hstride, output_para.vstride);
+        if (blitter->doConsume(c.frames[c.front], canvas) == CONSUME_SUCCESS)
+            canvas_drawn[i] = c.generation;
+    }
+
+    // The canvas always describes the whole frame, whatever rect was written last.
+    canvas->setImagePara(output_para);
+}
+
+ModuleMedia::ProduceResult ModuleRgaMosaic::doProduce(shared_ptr<MediaBuffer> buffer)
+{
+    if (buffer == nullptr)
+        return PRODUCE_FAILED;
+
+    int64_t now = steadyClockUs();
+    if (now < next_tick) {
+        usleep(next_tick - now);
+    } else if (now - next_tick >= interval) {
+        // Fell behind, skip the missed ticks instead of bursting to catch up.
+        int64_t missed = (now - next_tick) / interval;
+        late_ticks += missed;
+        next_tick += missed * interval;
+    }
+
+    shared_ptr<VideoBuffer> canvas = static_pointer_cast<VideoBuffer>(buffer);
+    compose(canvas);
+    canvas->setPUstimestamp(next_tick - start_time);
+    canvas->setDUstimestamp(next_tick - start_time);
+
+    next_tick += interval;
+    frames++;
+    return PRODUCE_SUCCESS;
+}
+
+bool ModuleRgaMosaic::cellIsStalled(int index)
+{
+    if (index < 0 || index >= (int)cells.size())
+        return false;
+
+    Cell& c = *cells[index];
+    std::lock_guard<std::mutex> lk(c.mtx);
+    return c.generation == 0 || steadyClockUs() - c.last_update > stall_timeout;
+}
+
+void ModuleRgaMosaic::dumpStats()
+{
+    ff_info("mosaic %dx%d: %" PRIu64 " frames, %" PRIu64 " late ticks\n",
+            output_para.width, output_para.height, frames, late_ticks);
+    for (size_t i = 0; i < cells.size(); i++) {
+        Cell& c = *cells[i];
+        ff_info("  cell %zu %u,%u %ux%u: received %" PRIu64 ", updated %" PRIu64 ", dropped %" PRIu64
+                ", failed %" PRIu64 "%s\n",
+                i, c.rect.x, c.rect.y, c.rect.w, c.rect.h, c.received, c.generation, c.dropped,
+                c.failed, cellIsStalled(i) ? ", stalled" : "");
+    }
+}
@@ -0,0 +1,82 @@
+#pragma once
+#include <vector>
+#include <map>
+#include <mutex>
+
+#include "module/vp/module_rga.hpp"
+
+/*
+ * N-input mosaic compositor.
+ *
+ * Every cell taps its source with an external consumer and scales the
+ * frames it accepts (at most one per cell duration) into a small cell sized
+ * double buffer. The module itself is a source that emits one canvas per
+ * output tick: the cells that changed since that canvas was last drawn are
+ * copied into it in one pass, a stalled cell keeps its last frame and a cell
+ * that never got a frame stays black.
+ */
+class ModuleRgaMosaic : public ModuleMedia
+{
+public:
+    ModuleRgaMosaic(const ImagePara& output_para, uint32_t fps);
+    ~ModuleRgaMosaic();
+
+    int addCell(shared_ptr<ModuleMedia> source, const ImageCrop& rect, int64_t duration = 0);
+    int addGrid(const vector<shared_ptr<ModuleMedia>>& sources, uint32_t cols, uint32_t rows, int64_t duration = 0);
+    static ImageCrop gridCell(const ImagePara& para, uint32_t cols, uint32_t rows, uint32_t index);
+
+    void setRgaSchedulerCore(ModuleRga::RGA_SCHEDULER_CORE core) { scheduler_core = core; }
+    void setStallTimeout(int64_t timeout_us) { stall_timeout = timeout_us; }
+
+    int init() override;
+
+    size_t getCellCount() const { return cells.size(); }
+    bool cellIsStalled(int index);
+    void dumpStats();
+
+protected:
+    virtual ProduceResult doProduce(shared_ptr<MediaBuffer> buffer) override;
+    virtual int initBuffer() override;
+    virtual bool setup() override;
+
+private:
+    struct Cell {
+        shared_ptr<ModuleMedia> source;
+        ImageCrop rect;
+        int64_t duration;
+
+        shared_ptr<ModuleRga> scaler;
+        shared_ptr<ModuleMedia> tap;
+        shared_ptr<VideoBuffer> frames[2];
+        int front;
+
+        // guards front and generation, held while the front frame is copied
+        std::mutex mtx;
+        uint64_t generation;
+        int64_t last_pts;
+        int64_t last_update;
+
+        uint64_t received;
+        uint64_t dropped;
+        uint64_t failed;
+    };
+
+    int initCell(int index);
+    void onSourceFrame(int index, shared_ptr<MediaBuffer> buffer);
+    void compose(shared_ptr<VideoBuffer> canvas);
+
+private:
+    vector<unique_ptr<Cell>> cells;
+    shared_ptr<ModuleRga> blitter;
+    ModuleRga::RGA_SCHEDULER_CORE scheduler_core;
+
+    // generation of every cell drawn into each canvas of the ring
+    std::map<MediaBuffer*, vector<uint64_t>> drawn;
+
+    int64_t interval;
+    int64_t start_time;
+    int64_t next_tick;
+    int64_t stall_timeout;
+    uint64_t frames;
+    uint64_t late_ticks;
+};
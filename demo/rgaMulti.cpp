@@ -0,0 +1,259 @@
+#include <algorithm>
+#include "rgaMulti.hpp"
+
+static inline bool cropIsEmpty(const ImageCrop& crop)
+{
+    return crop.w == 0 || crop.h == 0;
+}
+
+static inline bool rotateSwapSize(RgaRotate rotate)
+{
+    return rotate == RGA_ROTATE_90 || rotate == RGA_ROTATE_270;
+}
+
+ModuleRgaMulti::ModuleRgaMulti()
+    : productor(nullptr), scheduler_core(ModuleRga::SCHEDULER_DEFAULT), initialized(false)
+{
+}
+
+ModuleRgaMulti::ModuleRgaMulti(shared_ptr<ModuleMedia> productor)
+    : productor(productor), scheduler_core(ModuleRga::SCHEDULER_DEFAULT), initialized(false)
+{
+}
+
+ModuleRgaMulti::~ModuleRgaMulti()
+{
+}
+
+/// @brief Add an output port, must be called before init()
+/// @param spec output description, an explicit source must be an earlier output
+/// @return the output index, or -1 on error
+int ModuleRgaMulti::addOutput(const OutputSpec& spec)
+{
+    if (initialized) {
+        ff_error("Outputs can not be added after init\n");
+        return -1;
+    }
+
+    if (spec.source >= (int)outputs.size() || spec.source < SOURCE_AUTO) {
+        ff_error("Output source %d is invalid\n", spec.source);
+        return -1;
+    }
+
+    if (spec.para.width == 0 || spec.para.height == 0) {
+        ff_error("Output size is not set\n");
+        return -1;
+    }
+
+    Output out;
+    out.spec = spec;
+    out.source = spec.source;
+    out.rga = nullptr;
+    outputs.push_back(out);
+    return outputs.size() - 1;
+}
+
+int ModuleRgaMulti::addOutput(const ImagePara& para, RgaRotate rotate)
+{
+    OutputSpec spec;
+    spec.para = para;
+    spec.rotate = rotate;
+    return addOutput(spec);
+}
+
+/// @brief Check whether child can be converted from the parent's output without losing resolution
+bool ModuleRgaMulti::canFeed(const Output& parent, const Output& child)
+{
+    const OutputSpec& p = parent.spec;
+    const OutputSpec& c = child.spec;
+
+    if (!p.cascade || p.rotate != RGA_ROTATE_NONE || !cropIsEmpty(p.crop))
+        return false;
+
+    // The parent drops frames, the child would not get more than that.
+    if (p.duration > c.duration)
+        return false;
+
+    if (v4l2fmtIsCompressed(p.para.v4l2Fmt))
+        return false;
+
+    // Only a parent in the child's format, or in the source's, carries what reading the source
+    // would give: no NV12 from a BGR24 parent, that round trip costs colour precision.
+    if (p.para.v4l2Fmt != c.para.v4l2Fmt && p.para.v4l2Fmt != input_para.v4l2Fmt)
+        return false;
+
+    uint32_t cw = cropIsEmpty(c.crop) ? input_para.width : c.crop.w;
+    uint32_t ch = cropIsEmpty(c.crop) ? input_para.height : c.crop.h;
+    uint64_t rw = (uint64_t)cw * p.para.width / input_para.width;
+    uint64_t rh = (uint64_t)ch * p.para.height / input_para.height;
+    uint32_t ow = rotateSwapSize(c.rotate) ? c.para.height : c.para.width;
+    uint32_t oh = rotateSwapSize(c.rotate) ? c.para.width : c.para.height;
+
+    return rw >= ow && rh >= oh;
+}
+
+/// @brief Scale the child's source crop into the parent's coordinates
+ImageCrop ModuleRgaMulti::mapCrop(const Output& parent, const Output& child)
+{
+    const ImagePara& pp = parent.spec.para;
+    ImageCrop crop = {0, 0, pp.width, pp.height};
+
+    if (!cropIsEmpty(child.spec.crop)) {
+        const ImageCrop& c = child.spec.crop;
+        crop.x = (uint64_t)c.x * pp.width / input_para.width;
+        crop.y = (uint64_t)c.y * pp.height / input_para.height;
+        crop.w = (uint64_t)c.w * pp.width / input_para.width;
+        crop.h = (uint64_t)c.h * pp.height / input_para.height;
+        // keep yuv chroma sample aligned
+        crop.x &= ~1u;
+        crop.y &= ~1u;
+        crop.w &= ~1u;
+        crop.h &= ~1u;
+    }
+
+    return crop;
+}
+
+void ModuleRgaMulti::planOutputs()
+{
+    vector<int> order(outputs.size());
+    vector<bool> planned(outputs.size(), false);
+
+    for (size_t i = 0; i < order.size(); i++)
+        order[i] = i;
+
+    // Large outputs first, so the smaller ones can be derived from them.
+    std::stable_sort(order.begin(), order.end(), [this](int a, int b) {
+        const ImagePara& pa = outputs[a].spec.para;
+        const ImagePara& pb = outputs[b].spec.para;
+        return (uint64_t)pa.width * pa.height > (uint64_t)pb.width * pb.height;
+    });
+
+    for (int i : order) {
+        Output& child = outputs[i];
+        if (child.spec.source != SOURCE_AUTO) {
+            child.source = child.spec.source;
+            planned[i] = true;
+            continue;
+        }
+
+        int best = SOURCE_INPUT;
+        uint64_t best_area = (uint64_t)input_para.width * input_para.height;
+        for (size_t j = 0; j < outputs.size(); j++) {
+            if (!planned[j] || (int)j == i)
+                continue;
+            const ImagePara& pp = outputs[j].spec.para;
+            uint64_t area = (uint64_t)pp.width * pp.height;
+            if (area < best_area && canFeed(outputs[j], child)) {
+                best = j;
+                best_area = area;
+            }
+        }
+        child.source = best;
+        planned[i] = true;
+    }
+}
+
+/// @brief Plan the conversion tree and create a ModuleRga for every output
+/// @return 0 on success, negative on failure
+int ModuleRgaMulti::init()
+{
+    int ret;
+
+    if (initialized)
+        return 0;
+
+    if (productor == nullptr || outputs.empty()) {
+        ff_error("Productor or outputs is not set\n");
+        return -1;
+    }
+
+    input_para = productor->getOutputImagePara();
+    if (input_para.width == 0 || input_para.height == 0) {
+        ff_error("Productor output para is invalid\n");
+        return -1;
+    }
+
+    planOutputs();
+
+    // Create the ports parents first, an output may only be fed by one created before it.
+    vector<bool> created(outputs.size(), false);
+    size_t created_count = 0;
+    while (created_count < outputs.size()) {
+        bool progress = false;
+        for (size_t i = 0; i < outputs.size(); i++) {
+            Output& out = outputs[i];
+            if (created[i] || (out.source >= 0 && !created[out.source]))
+                continue;
+
+            shared_ptr<ModuleMedia> source = out.source >= 0 ? outputs[out.source].rga : productor;
+            out.rga = make_shared<ModuleRga>(out.spec.para, out.spec.rotate);
+            out.rga->setProductor(source);
+            out.rga->setBufferCount(out.spec.buffer_count);
+            out.rga->setRgaSchedulerCore(scheduler_core);
+            if (out.spec.duration > 0)
+                out.rga->setDuration(out.spec.duration);
+
+            ret = out.rga->init();
+            if (ret < 0) {
+                ff_error("rga output %zu init failed\n", i);
+                return ret;
+            }
+
+            // Without a crop the port reads its source's whole frame, whatever the source's rotation.
+            if (out.source >= 0 && !cropIsEmpty(out.spec.crop)) {
+                const Output& parent = outputs[out.source];
+                const ImagePara& pp = parent.rga->getOutputImagePara();
+                ImageCrop crop = mapCrop(parent, out);
+                out.rga->setSrcPara(pp.v4l2Fmt, crop.x, crop.y, crop.w, crop.h, pp.hstride, pp.vstride);
+            } else if (!cropIsEmpty(out.spec.crop)) {
+                const ImageCrop& crop = out.spec.crop;
+                out.rga->setSrcPara(input_para.v4l2Fmt, crop.x, crop.y, crop.w, crop.h,
+                                    input_para.hstride, input_para.vstride);
+            }
+
+            created[i] = true;
+            created_count++;
+            progress = true;
+        }
+
+        if (!progress) {
+            ff_error("Output sources form a loop\n");
+            return -1;
+        }
+    }
+
+    initialized = true;
+    dumpPlan();
+    return 0;
+}
+
+shared_ptr<ModuleRga> ModuleRgaMulti::getOutput(int index)
+{
+    if (index < 0 || index >= (int)outputs.size())
+        return nullptr;
+    return outputs[index].rga;
+}
+
+int ModuleRgaMulti::getOutputSource(int index)
+{
+    if (index < 0 || index >= (int)outputs.size())
+        return SOURCE_INPUT;
+    return outputs[index].source;
+}
+
+void ModuleRgaMulti::dumpPlan()
+{
+    int reads = std::count_if(outputs.begin(), outputs.end(), [](const Output& out) { return out.source < 0; });
+    ff_info("rga multi input: %dx%d %s, read by %d of %zu outputs\n", input_para.width, input_para.height,
+            v4l2GetFmtName(input_para.v4l2Fmt), reads, outputs.size());
+    for (size_t i = 0; i < outputs.size(); i++) {
+        const ImagePara& p = outputs[i].spec.para;
+        if (outputs[i].source >= 0)
+            ff_info("  output %zu: %dx%d %s <- output %d\n", i, p.width, p.height,
+                    v4l2GetFmtName(p.v4l2Fmt), outputs[i].source);
+        else
+            ff_info("  output %zu: %dx%d %s <- input\n", i, p.width, p.height,
+                    v4l2GetFmtName(p.v4l2Fmt));
+    }
+}
@@ -0,0 +1,76 @@
+#pragma once
+#include <vector>
+
+#include "module/vp/module_rga.hpp"
+
+/*
+ * One-to-many RGA conversion.
+ *
+ * Each output is a ModuleRga port with its own buffers and consumers.
+ * At init() the outputs are arranged as a tree: only the root outputs read
+ * the source frame, every other output is converted from the smallest
+ * already produced output that still covers it and is in the output's own
+ * format or the source's (no NV12 from BGR24), so a large source frame is
+ * read once per root instead of once per output. Outputs that no other
+ * output covers (a rotation, a crop, cascade off) are roots of their own
+ * and each read the source again; dumpPlan() shows how many do.
+ *
+ * Scaling keeps no aspect ratio: an output whose size does not have the
+ * aspect of its crop (the whole frame by default) is stretched. Give such
+ * an output a crop of the matching aspect, or keep the size and round
+ * only the strides up to the alignment the consumer needs.
+ */
+class ModuleRgaMulti
+{
+public:
+    enum {
+        SOURCE_AUTO = -2,   // pick the cheapest source automatically
+        SOURCE_INPUT = -1,  // always read the productor's frame
+    };
+
+    struct OutputSpec {
+        ImagePara para;
+        ImageCrop crop = {0, 0, 0, 0};  // in source coordinates, zero means full frame
+        RgaRotate rotate = RGA_ROTATE_NONE;
+        uint16_t buffer_count = 2;
+        int64_t duration = 0;           // minimum frame interval in us, 0 keeps every frame
+        int source = SOURCE_AUTO;       // SOURCE_AUTO, SOURCE_INPUT or an earlier output index
+        bool cascade = true;            // allow other outputs to be converted from this one
+    };
+
+public:
+    ModuleRgaMulti();
+    ModuleRgaMulti(shared_ptr<ModuleMedia> productor);
+    ~ModuleRgaMulti();
+
+    void setProductor(shared_ptr<ModuleMedia> module) { productor = module; }
+    void setRgaSchedulerCore(ModuleRga::RGA_SCHEDULER_CORE core) { scheduler_core = core; }
+
+    int addOutput(const OutputSpec& spec);
+    int addOutput(const ImagePara& para, RgaRotate rotate = RGA_ROTATE_NONE);
+    int init();
+
+    shared_ptr<ModuleRga> getOutput(int index);
+    int getOutputSource(int index);
+    size_t getOutputCount() const { return outputs.size(); }
+
+    void dumpPlan();
+
+private:
+    struct Output {
+        OutputSpec spec;
+        int source;
+        shared_ptr<ModuleRga> rga;
+    };
+
+    bool canFeed(const Output& parent, const Output& child);
+    ImageCrop mapCrop(const Output& parent, const Output& child);
+    void planOutputs();
+
+private:
+    shared_ptr<ModuleMedia> productor;
+    ImagePara input_para;
+    ModuleRga::RGA_SCHEDULER_CORE scheduler_core;
+    vector<Output> outputs;
+    bool initialized;
+};
@@ -0,0 +1,209 @@
+#include <algorithm>
+#include "rgaPattern.hpp"
+
+#define PATTERN_BPP            4
+#define PATTERN_MIN_WIDTH      68  // rga3 minimum image width
+#define PATTERN_MAX_OCCUPIED   16
+
+RgaPatternLayer::RgaPatternLayer(shared_ptr<ModuleRga> rga, ModuleRga::RGA_BLEND_MODE mode)
+    : rga(rga), blend_mode(mode), dma_buf(nullptr), canvas(nullptr),
+      width(0), height(0), stride(0), blend_rect({0, 0, 0, 0}),
+      blend_enabled(false), upload_bytes(0)
+{
+}
+
+RgaPatternLayer::~RgaPatternLayer()
+{
+    if (canvas)
+        free(canvas);
+}
+
+/// @brief Allocate the canvas and the pattern buffer with the rga output size
+/// @return 0 on success
+int RgaPatternLayer::init()
+{
+    if (rga == nullptr)
+        return -1;
+
+    ImagePara para = rga->getOutputImagePara();
+    if (para.width == 0 || para.height == 0) {
+        ff_error("rga output para is not ready\n");
+        return -1;
+    }
+
+    ImagePara bgra(para.width, para.height, para.hstride, para.vstride, V4L2_PIX_FMT_BGR32);
+    dma_buf = make_shared<VideoBuffer>(VideoBuffer::DRM_BUFFER_NONCACHEABLE);
+    dma_buf->allocBuffer(bgra);
+    if (dma_buf->getData() == nullptr) {
+        ff_error("Failed to alloc pattern buffer\n");
+        return -1;
+    }
+    memset(dma_buf->getData(), 0, dma_buf->getSize());
+
+    width = para.width;
+    height = para.height;
+    stride = para.hstride * PATTERN_BPP;
+    canvas = (uint8_t*)calloc(stride, para.vstride);
+    if (canvas == nullptr) {
+        ff_error("Failed to alloc pattern canvas\n");
+        return -1;
+    }
+
+    if (dma_buf->getBufFd() > 0)
+        rga->setPatBuffer(dma_buf->getBufFd(), ModuleRga::BLEND_DISABLE);
+    else
+        rga->setPatBuffer(dma_buf->getData(), ModuleRga::BLEND_DISABLE);
+    blend_enabled = false;
+    return 0;
+}
+
+bool RgaPatternLayer::clip(ImageCrop& rect)
+{
+    if (rect.x >= width || rect.y >= height || rect.w == 0 || rect.h == 0)
+        return false;
+    rect.w = std::min(rect.w, width - rect.x);
+    rect.h = std::min(rect.h, height - rect.y);
+    return true;
+}
+
+/// @brief Mark a canvas area as changed since the last commit
+void RgaPatternLayer::markDirty(const ImageCrop& rect)
+{
+    ImageCrop r = rect;
+    if (clip(r))
+        dirty.push_back(r);
+}
+
+/// @brief Make a canvas area transparent
+void RgaPatternLayer::clear(const ImageCrop& rect)
+{
+    ImageCrop r = rect;
+    if (!clip(r) || canvas == nullptr)
+        return;
+
+    for (uint32_t y = r.y; y < r.y + r.h; y++)
+        memset(canvas + y * stride + r.x * PATTERN_BPP, 0, r.w * PATTERN_BPP);
+    dirty.push_back(r);
+}
+
+bool RgaPatternLayer::alphaBoundingBox(const ImageCrop& rect, ImageCrop& box)
+{
+    uint32_t x0 = UINT32_MAX, y0 = UINT32_MAX, x1 = 0, y1 = 0;
+
+    for (uint32_t y = rect.y; y < rect.y + rect.h; y++) {
+        const uint8_t* p = canvas + y * stride + rect.x * PATTERN_BPP + 3;
+        for (uint32_t x = rect.x; x < rect.x + rect.w; x++, p += PATTERN_BPP) {
+            if (*p == 0)
+                continue;
+            x0 = std::min(x0, x);
+            x1 = std::max(x1, x);
+            y0 = std::min(y0, y);
+            y1 = y;
+        }
+    }
+
+    if (x0 == UINT32_MAX)
+        return false;
+
+    box = {x0, y0, x1 - x0 + 1, y1 - y0 + 1};
+    return true;
+}
+
+void RgaPatternLayer::upload(const ImageCrop& rect)
+{
+    uint8_t* dst = (uint8_t*)dma_buf->getData();
+    size_t bytes = rect.w * PATTERN_BPP;
+
+    // Sequential writes to the non-cacheable buffer, no cache maintenance needed.
+    for (uint32_t y = rect.y; y < rect.y + rect.h; y++) {
+        size_t offset = y * stride + rect.x * PATTERN_BPP;
+        memcpy(dst + offset, canvas + offset, bytes);
+    }
+    upload_bytes += bytes * rect.h;
+}
+
+ImageCrop RgaPatternLayer::unionRects()
+{
+    uint32_t x0 = UINT32_MAX, y0 = UINT32_MAX, x1 = 0, y1 = 0;
+    for (auto& r : occupied) {
+        x0 = std::min(x0, r.x);
+        y0 = std::min(y0, r.y);
+        x1 = std::max(x1, r.x + r.w);
+        y1 = std::max(y1, r.y + r.h);
+    }
+
+    if (x0 == UINT32_MAX)
+        return {0, 0, 0, 0};
+    return {x0, y0, x1 - x0, y1 - y0};
+}
+
+/// @brief Upload the dirty areas and update the rga pattern rectangle
+/// @return 0 on success
+int RgaPatternLayer::commit()
+{
+    if (canvas == nullptr || dma_buf == nullptr)
+        return -1;
+
+    upload_bytes = 0;
+    for (auto& d : dirty) {
+        upload(d);
+
+        // Content fully inside a redrawn area is replaced by what is there now.
+        occupied.erase(std::remove_if(occupied.begin(), occupied.end(), [&d](const ImageCrop& o) {
+                           return o.x >= d.x && o.y >= d.y && o.x + o.w <= d.x + d.w && o.y + o.h <= d.y + d.h;
+                       }),
+                       occupied.end());
+
+        ImageCrop box;
+        if (alphaBoundingBox(d, box))
+            occupied.push_back(box);
+    }
+    dirty.clear();
+
+    if (occupied.size() > PATTERN_MAX_OCCUPIED) {
+        ImageCrop all = unionRects();
+        occupied.clear();
+        occupied.push_back(all);
+    }
+
+    ImageCrop rect = unionRects();
+    if (rect.w == 0 || rect.h == 0) {
+        if (blend_enabled) {
+            if (dma_buf->getBufFd() > 0)
+                rga->setPatBuffer(dma_buf->getBufFd(), ModuleRga::BLEND_DISABLE);
+            else
+                rga->setPatBuffer(dma_buf->getData(), ModuleRga::BLEND_DISABLE);
+            blend_enabled = false;
+        }
+        blend_rect = rect;
+        return 0;
+    }
+
+    // keep the rectangle inside the rga limits and chroma aligned
+    if (rect.w < PATTERN_MIN_WIDTH) {
+        uint32_t w = std::min((uint32_t)PATTERN_MIN_WIDTH, width);
+        rect.x = std::min(rect.x, width - w);
+        rect.w = w;
+    }
+    rect.w += rect.x & 1;
+    rect.x &= ~1u;
+    rect.h += rect.y & 1;
+    rect.y &= ~1u;
+    rect.w = std::min(ALIGN(rect.w, 2), width - rect.x);
+    rect.h = std::min(ALIGN(std::max(rect.h, 2u), 2), height - rect.y);
+
+    if (rect.x != blend_rect.x || rect.y != blend_rect.y || rect.w != blend_rect.w || rect.h != blend_rect.h) {
+        const ImagePara& para = dma_buf->getImagePara();
+        rga->setPatPara(V4L2_PIX_FMT_BGR32, rect.x, rect.y, rect.w, rect.h, para.hstride, para.vstride);
+        blend_rect = rect;
+    }
+
+    if (!blend_enabled) {
+        if (dma_buf->getBufFd() > 0)
+            rga->setPatBuffer(dma_buf->getBufFd(), blend_mode);
+        else
+            rga->setPatBuffer(dma_buf->getData(), blend_mode);
+        blend_enabled = true;
+    }
+    return 0;
+}
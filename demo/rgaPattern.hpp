@@ -0,0 +1,56 @@
+#pragma once
+#include <vector>
+
+#include "module/vp/module_rga.hpp"
+
+/*
+ * BGRA pattern layer for ModuleRga blending with dirty region tracking.
+ *
+ * Drawing goes to a cacheable CPU canvas. commit() copies only the dirty
+ * rectangles to a non-cacheable dma buffer, so no full cache flush is
+ * needed, and limits the rga pattern rectangle to the bounding box of the
+ * non-transparent content. A fully transparent layer disables blending.
+ * Call commit() from the rga blend callback after drawing.
+ */
+class RgaPatternLayer
+{
+public:
+    RgaPatternLayer(shared_ptr<ModuleRga> rga, ModuleRga::RGA_BLEND_MODE mode = ModuleRga::BLEND_DST_OVER);
+    ~RgaPatternLayer();
+
+    int init();
+
+    uint8_t* getCanvas() const { return canvas; }
+    uint32_t getCanvasStride() const { return stride; }
+    uint32_t getWidth() const { return width; }
+    uint32_t getHeight() const { return height; }
+
+    void markDirty(const ImageCrop& rect);
+    void clear(const ImageCrop& rect);
+    int commit();
+
+    bool isTransparent() const { return occupied.empty(); }
+    ImageCrop getBlendRect() const { return blend_rect; }
+    size_t getLastUploadBytes() const { return upload_bytes; }
+
+private:
+    bool clip(ImageCrop& rect);
+    bool alphaBoundingBox(const ImageCrop& rect, ImageCrop& box);
+    void upload(const ImageCrop& rect);
+    ImageCrop unionRects();
+
+private:
+    shared_ptr<ModuleRga> rga;
+    ModuleRga::RGA_BLEND_MODE blend_mode;
+    shared_ptr<VideoBuffer> dma_buf;
+    uint8_t* canvas;
+    uint32_t width;
+    uint32_t height;
+    uint32_t stride;
+
+    std::vector<ImageCrop> dirty;
+    std::vector<ImageCrop> occupied;
+    ImageCrop blend_rect;
+    bool blend_enabled;
+    size_t upload_bytes;
+};
@@ -0,0 +1,105 @@
+#include <stdlib.h>
+
+#include "rtpPacketizer.hpp"
+
+void RtpPacketizer::PacketSet::clear()
+{
+    headers.clear();
+    packets.clear();
+    timestamp = 0;
+    first_seq = 0;
+    payload_bytes = 0;
+    key = false;
+}
+
+RtpPacketizer::RtpPacketizer(AnnexB::Codec codec, uint32_t ssrc, size_t max_packet)
+    : codec(codec), ssrc(ssrc), max_payload(max_packet - HEADER_SIZE), seq(random()), ts_base(random())
+{
+}
+
+uint32_t RtpPacketizer::toTimestamp(int64_t pts) const
+{
+    return ts_base + (uint32_t)(pts * 9 / 100);
+}
+
+/// @brief Append a packet with its RTP header
+/// @return where its FU-A / FU header goes
+uint8_t* RtpPacketizer::addPacket(PacketSet& set, size_t fu_size, const uint8_t* payload, size_t payload_size,
+                                  uint32_t timestamp)
+{
+    size_t offset = set.headers.size();
+    set.headers.resize(offset + HEADER_SIZE + fu_size);
+    set.packets.push_back({(uint32_t)offset, (uint32_t)(HEADER_SIZE + fu_size), payload, (uint32_t)payload_size});
+    set.payload_bytes += payload_size;
+
+    uint8_t* h = set.headers.data() + offset;
+    h[0] = 0x80;
+    h[1] = PAYLOAD_TYPE;
+    h[2] = seq >> 8;
+    h[3] = seq;
+    h[4] = timestamp >> 24;
+    h[5] = timestamp >> 16;
+    h[6] = timestamp >> 8;
+    h[7] = timestamp;
+    h[8] = ssrc >> 24;
+    h[9] = ssrc >> 16;
+    h[10] = ssrc >> 8;
+    h[11] = ssrc;
+    seq++;
+    return h + HEADER_SIZE;
+}
+
+void RtpPacketizer::packetizeNal(const AnnexB::Nal& nal, uint32_t timestamp, PacketSet& set)
+{
+    if (nal.size <= max_payload) {
+        addPacket(set, 0, nal.data, nal.size, timestamp);
+        return;
+    }
+
+    // FU-A: indicator and header, FU: two byte payload header and FU header.
+    size_t header_len = codec == AnnexB::CODEC_H264 ? 1 : 2;
+    size_t fu_len = header_len + 1;
+    const uint8_t* p = nal.data + header_len;
+    size_t left = nal.size - header_len;
+    size_t count = (left + max_payload - fu_len - 1) / (max_payload - fu_len);
+    size_t chunk = (left + count - 1) / count;
+
+    for (bool first = true; left > 0; first = false) {
+        size_t n = left < chunk ? left : chunk;
+        uint8_t* out = addPacket(set, fu_len, p, n, timestamp);
+        uint8_t se = (first ? 0x80 : 0) | (n == left ? 0x40 : 0);
+        if (codec == AnnexB::CODEC_H264) {
+            out[0] = (nal.data[0] & 0xe0) | 28;
+            out[1] = se | (nal.data[0] & 0x1f);
+        } else {
+            out[0] = (nal.data[0] & 0x81) | (49 << 1);
+            out[1] = nal.data[1];
+            out[2] = se | ((nal.data[0] >> 1) & 0x3f);
+        }
+        p += n;
+        left -= n;
+    }
+}
+
+void RtpPacketizer::packetize(const uint8_t* data, size_t size, int64_t pts, PacketSet& set)
+{
+    uint32_t timestamp = toTimestamp(pts);
+
+    set.clear();
+    set.timestamp = timestamp;
+    set.first_seq = seq;
+    set.headers.reserve((size / max_payload + 8) * MAX_HEADER_SIZE);
+
+    AnnexB::split(data, size, codec, nals);
+    for (auto& nal : nals) {
+        if (nal.size == 0)
+            continue;
+        if ((codec == AnnexB::CODEC_H264 && nal.type == 9) || (codec == AnnexB::CODEC_H265 && nal.type == 35))
+            continue;
+        set.key |= AnnexB::isKeyframe(codec, nal.type);
+        packetizeNal(nal, timestamp, set);
+    }
+
+    if (!set.packets.empty())
+        set.headers[set.packets.back().header + 1] |= 0x80;
+}
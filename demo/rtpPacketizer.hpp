@@ -0,0 +1,70 @@
+#pragma once
+#include <stdint.h>
+#include <stddef.h>
+#include <vector>
+
+#include "annexb.hpp"
+
+/*
+ * RTP packetization of H.264 (RFC 6184) and H.265 (RFC 7798) access units.
+ *
+ * An access unit is packetized once into a PacketSet, so every receiver is
+ * served from the same bytes. Only the headers are written: each packet is
+ * its RTP header (and FU-A / FU header) in a small buffer plus a pointer to
+ * its payload inside the access unit, to be sent with scatter-gather I/O.
+ * The set is valid only as long as the access unit data it was made from.
+ * NAL units that fit are sent as single NAL unit packets, larger ones as
+ * FU-A / FU fragments of nearly equal size. AUDs are left out, the marker
+ * bit is set on the last packet.
+ */
+class RtpPacketizer
+{
+public:
+    static constexpr uint8_t PAYLOAD_TYPE = 96;
+    static constexpr size_t HEADER_SIZE = 12;
+    static constexpr size_t MAX_HEADER_SIZE = HEADER_SIZE + 3;
+    static constexpr size_t DEFAULT_MAX_PACKET = 1400;
+
+    struct Packet {
+        uint32_t header;            // offset in PacketSet::headers
+        uint32_t header_size;       // RTP header and FU-A / FU header
+        const uint8_t* payload;     // in the access unit
+        uint32_t payload_size;
+
+        size_t size() const { return header_size + payload_size; }
+    };
+
+    struct PacketSet {
+        std::vector<uint8_t> headers;
+        std::vector<Packet> packets;
+        uint32_t timestamp;
+        uint16_t first_seq;
+        size_t payload_bytes;
+        bool key;
+
+        const uint8_t* header(size_t i) const { return headers.data() + packets[i].header; }
+        void clear();
+    };
+
+public:
+    RtpPacketizer(AnnexB::Codec codec, uint32_t ssrc, size_t max_packet = DEFAULT_MAX_PACKET);
+
+    // pts in microseconds, mapped to the 90 kHz clock.
+    void packetize(const uint8_t* data, size_t size, int64_t pts, PacketSet& set);
+
+    uint32_t getSsrc() const { return ssrc; }
+    uint16_t nextSeq() const { return seq; }
+    uint32_t toTimestamp(int64_t pts) const;
+
+private:
+    uint8_t* addPacket(PacketSet& set, size_t fu_size, const uint8_t* payload, size_t payload_size, uint32_t timestamp);
+    void packetizeNal(const AnnexB::Nal& nal, uint32_t timestamp, PacketSet& set);
+
+private:
+    AnnexB::Codec codec;
+    uint32_t ssrc;
+    size_t max_payload;
+    uint16_t seq;
+    uint32_t ts_base;
+    std::vector<AnnexB::Nal> nals;
+};
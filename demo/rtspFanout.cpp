@@ -0,0 +1,1416 @@
+#include <arpa/inet.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <limits.h>
+#include <linux/errqueue.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <string.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <sys/uio.h>
+#include <unistd.h>
+#include <algorithm>
+#include <chrono>
+#include <deque>
+#include <sstream>
+
+#include "base/ff_log.h"
+#include "rtpPacketizer.hpp"
+#include "rtspUtil.hpp"
+#include "rtspFanout.hpp"
+
+#define RTSP_SESSION_TIMEOUT 60
+#define RTSP_REPORT_INTERVAL 5000000
+#define RTSP_MAX_REQUEST (16 << 10)
+#define RTSP_SEND_BATCH 1024
+#define RTSP_SNDBUF (4 << 20)
+#define RTSP_RTP_PORT_BASE 30000
+#define RTSP_TCP_BACKLOG (4 << 20)
+#define RTSP_ZEROCOPY_MAX_PENDING 32
+#define RTSP_CATCHUP_POLL_MS 5
+#define RTSP_GOP_CACHE_SIZE (8 << 20)
+
+#ifndef SO_ZEROCOPY
+#define SO_ZEROCOPY 60
+#endif
+#ifndef MSG_ZEROCOPY
+#define MSG_ZEROCOPY 0x4000000
+#endif
+#ifndef SO_EE_ORIGIN_ZEROCOPY
+#define SO_EE_ORIGIN_ZEROCOPY 5
+#endif
+#ifndef SO_EE_CODE_ZEROCOPY_COPIED
+#define SO_EE_CODE_ZEROCOPY_COPIED 1
+#endif
+
+static int64_t steadyClockUs()
+{
+    return std::chrono::duration_cast<std::chrono::microseconds>(
+               std::chrono::steady_clock::now().time_since_epoch())
+        .count();
+}
+
+static bool sameAddress(const sockaddr_in& a, const sockaddr_in& b)
+{
+    return a.sin_addr.s_addr == b.sin_addr.s_addr && a.sin_port == b.sin_port;
+}
+
+/// @return datagrams the socket took
+static size_t sendBatch(int fd, mmsghdr* msgs, size_t count, uint64_t* calls)
+{
+    size_t sent = 0;
+    while (sent < count) {
+        int ret = sendmmsg(fd, msgs + sent, std::min<size_t>(count - sent, RTSP_SEND_BATCH), MSG_DONTWAIT);
+        (*calls)++;
+        if (ret < 0 && errno == EINTR)
+            continue;
+        if (ret <= 0)
+            break;
+        sent += ret;
+    }
+    return sent;
+}
+
+/*
+ * RTSP connection of a client. Interleaved RTP is written by the pipeline
+ * thread and RTSP replies by the control thread, so all writes go through
+ * the lock and the backlog, and the fd is closed only when neither holds
+ * the connection any more.
+ */
+struct RtspFanoutServer::Connection {
+    int fd;
+    std::mutex mtx;
+    std::string backlog;        // bytes the socket did not take, sent before anything else
+    bool closed;
+    bool wait_keyframe;
+    uint8_t channel;            // interleaved RTP channel, RTCP is the next one
+    bool zerocopy;
+    uint32_t zerocopy_sent;     // sendmsg calls with MSG_ZEROCOPY
+    uint32_t zerocopy_done;     // and how many the kernel has completed
+    uint32_t zerocopy_copied;   // completed sends the kernel copied anyway, not in the stats yet
+    // Access units the kernel may still read from, each with zerocopy_sent after its send.
+    std::deque<std::pair<uint32_t, shared_ptr<const std::vector<uint8_t>>>> zerocopy_pending;
+
+    explicit Connection(int fd)
+        : fd(fd), closed(false), wait_keyframe(true), channel(0), zerocopy(false), zerocopy_sent(0), zerocopy_done(0),
+          zerocopy_copied(0)
+    {
+    }
+    ~Connection() { close(fd); }
+
+    /// @brief Send as much as the socket takes right now, iov and count are left at what is not sent
+    /// @return bytes sent
+    size_t sendIov(iovec*& iov, size_t& count, int flags)
+    {
+        size_t total = 0;
+        while (count > 0) {
+            msghdr msg = {};
+            msg.msg_iov = iov;
+            msg.msg_iovlen = std::min<size_t>(count, IOV_MAX);
+            ssize_t n = sendmsg(fd, &msg, flags | MSG_DONTWAIT | MSG_NOSIGNAL);
+            if (n < 0) {
+                if (errno == EINTR)
+                    continue;
+                if (errno != EAGAIN && errno != EWOULDBLOCK && errno != ENOBUFS)
+                    closed = true;
+                break;
+            }
+            if (flags & MSG_ZEROCOPY)
+                zerocopy_sent++;
+            total += n;
+            // Skip what went out, the first iovec left may be partly sent.
+            while (count > 0 && (size_t)n >= iov->iov_len) {
+                n -= iov->iov_len;
+                iov++;
+                count--;
+            }
+            if (count == 0)
+                break;
+            iov->iov_base = (uint8_t*)iov->iov_base + n;
+            iov->iov_len -= n;
+        }
+        return total;
+    }
+
+    /// @brief Copy what is left of the iovecs into the backlog
+    size_t keep(const iovec* iov, size_t count)
+    {
+        size_t total = 0;
+        for (size_t i = 0; i < count; i++) {
+            backlog.append((const char*)iov[i].iov_base, iov[i].iov_len);
+            total += iov[i].iov_len;
+        }
+        return total;
+    }
+
+    /// @return true if the backlog is empty
+    bool flush()
+    {
+        if (backlog.empty())
+            return true;
+        iovec iov = {(void*)backlog.data(), backlog.size()};
+        iovec* p = &iov;
+        size_t count = 1;
+        backlog.erase(0, sendIov(p, count, 0));
+        return backlog.empty();
+    }
+
+    /// @brief Queue a control message, replies and interleaved RTCP
+    bool write(const void* data, size_t size)
+    {
+        std::lock_guard<std::mutex> lk(mtx);
+        if (closed)
+            return false;
+        iovec iov = {(void*)data, size};
+        iovec* p = &iov;
+        size_t count = 1;
+        if (flush())
+            sendIov(p, count, 0);
+        keep(p, count);
+        return !closed;
+    }
+
+    /// @brief Take the zerocopy completions queued so far, without waiting, and let go of the access units done
+    void reapZeroCopy()
+    {
+        while (zerocopy_done != zerocopy_sent) {
+            char control[128];
+            msghdr msg = {};
+            msg.msg_control = control;
+            msg.msg_controllen = sizeof(control);
+            if (recvmsg(fd, &msg, MSG_ERRQUEUE | MSG_DONTWAIT) < 0) {
+                if (errno == EINTR)
+                    continue;
+                break;
+            }
+            for (cmsghdr* cm = CMSG_FIRSTHDR(&msg); cm; cm = CMSG_NXTHDR(&msg, cm)) {
+                sock_extended_err* err = (sock_extended_err*)CMSG_DATA(cm);
+                if (err->ee_errno != 0 || err->ee_origin != SO_EE_ORIGIN_ZEROCOPY)
+                    continue;
+                // The range of sends from ee_info to ee_data is done.
+                zerocopy_done = err->ee_data + 1;
+                if (err->ee_code & SO_EE_CODE_ZEROCOPY_COPIED)
+                    zerocopy_copied += err->ee_data - err->ee_info + 1;
+            }
+        }
+        while (!zerocopy_pending.empty() && (int32_t)(zerocopy_done - zerocopy_pending.front().first) >= 0)
+            zerocopy_pending.pop_front();
+    }
+};
+
+/*
+ * What a new viewer gets before it joins the shared packets: the cached
+ * GOP and then the live packets sent meanwhile, each with the time it is
+ * due. Guarded by the target lock of the stream.
+ */
+struct RtspFanoutServer::Catchup {
+    struct Packet {
+        int64_t due;
+        std::string data;
+    };
+    std::deque<Packet> queue;
+    size_t bytes;
+    size_t max_bytes;
+    bool overflow;
+
+    explicit Catchup(size_t max_bytes) : bytes(0), max_bytes(max_bytes), overflow(false) {}
+
+    void add(int64_t due, const uint8_t* header, size_t header_size, const uint8_t* payload, size_t payload_size)
+    {
+        if (overflow || bytes + header_size + payload_size > max_bytes) {
+            overflow = true;
+            return;
+        }
+        queue.push_back({due, std::string()});
+        std::string& data = queue.back().data;
+        data.reserve(header_size + payload_size);
+        data.append((const char*)header, header_size);
+        data.append((const char*)payload, payload_size);
+        bytes += data.size();
+    }
+};
+
+struct RtspFanoutServer::Stream {
+    std::string path;
+    AnnexB::Codec codec;
+    int rtp_fd;
+    RtpPacketizer packetizer;
+    RtpPacketizer::PacketSet set;
+    std::vector<iovec> iovs;        // header and payload of each packet
+    std::vector<mmsghdr> msgs;
+    std::vector<iovec> tcp_iovs;    // framing, header and payload of each packet
+    std::vector<uint8_t> framing;
+    size_t zerocopy_threshold;
+    // The current access unit framed for one channel, a copy the kernel can read after send() returns.
+    shared_ptr<std::vector<uint8_t>> zerocopy_au;
+    uint8_t zerocopy_channel;
+
+    std::mutex param_mtx;
+    std::vector<uint8_t> param_sets;    // Annex-B
+
+    // Copied on write by the control thread, read without copying by send().
+    std::mutex target_mtx;
+    shared_ptr<const std::vector<sockaddr_in>> targets;
+    shared_ptr<const std::vector<shared_ptr<Connection>>> tcp_targets;
+    std::vector<shared_ptr<Catchup>> joining;
+    size_t mcast_viewers;
+
+    // Multicast group shared by every multicast viewer, no fds without one.
+    int mcast_fd;
+    int mcast_rtcp_fd;
+    sockaddr_in mcast_addr;
+    int mcast_ttl;
+
+    // Access units since the last keyframe, also under the target lock.
+    std::vector<std::vector<uint8_t>> gop;
+    std::vector<int64_t> gop_pts;
+    size_t gop_count;
+    size_t gop_bytes;
+    bool gop_valid;
+    size_t gop_cache_max;
+    int gop_speed;
+
+    std::mutex stats_mtx;
+    uint32_t last_timestamp;
+    int64_t last_send_clock;
+    uint64_t frames;
+    uint64_t packets;
+    uint64_t octets;
+    uint64_t datagrams;
+    uint64_t syscalls;
+    uint64_t dropped;
+    uint64_t tcp_bytes;
+    uint64_t tcp_copied;
+    uint64_t tcp_skipped;
+    uint64_t zerocopy_frames;
+    uint64_t zerocopy_copied;
+    uint64_t fast_starts;
+    uint64_t catchup_overflows;
+    uint64_t mcast_datagrams;
+
+    Stream(const std::string& path, AnnexB::Codec codec, int rtp_fd)
+        : path(path), codec(codec), rtp_fd(rtp_fd), packetizer(codec, random()), zerocopy_threshold(0),
+          targets(make_shared<std::vector<sockaddr_in>>()),
+          tcp_targets(make_shared<std::vector<shared_ptr<Connection>>>()), mcast_viewers(0), mcast_fd(-1),
+          mcast_rtcp_fd(-1), mcast_addr(), mcast_ttl(0), gop_count(0), gop_bytes(0), gop_valid(false), gop_cache_max(0),
+          gop_speed(0), last_timestamp(0), last_send_clock(0), frames(0), packets(0), octets(0), datagrams(0),
+          syscalls(0), dropped(0), tcp_bytes(0), tcp_copied(0), tcp_skipped(0), zerocopy_frames(0), zerocopy_copied(0),
+          fast_starts(0), catchup_overflows(0), mcast_datagrams(0)
+    {
+        set.clear();
+    }
+    ~Stream()
+    {
+        for (int fd : {mcast_fd, mcast_rtcp_fd}) {
+            if (fd >= 0)
+                close(fd);
+        }
+    }
+};
+
+struct RtspFanoutServer::Client {
+    shared_ptr<Connection> conn;
+    sockaddr_in peer;
+    std::string inbuf;
+    std::string session;
+    shared_ptr<Stream> stream;
+    bool interleaved;
+    bool multicast;
+    shared_ptr<Catchup> catchup;    // until it joins the shared packets
+    sockaddr_in rtp_addr;
+    sockaddr_in rtcp_addr;
+    bool playing;
+    int64_t last_seen;
+};
+
+shared_ptr<RtspFanoutServer> RtspFanoutServer::get(int port)
+{
+    static std::mutex registry_mtx;
+    static std::map<int, std::weak_ptr<RtspFanoutServer>> registry;
+
+    std::lock_guard<std::mutex> lk(registry_mtx);
+    shared_ptr<RtspFanoutServer> server = registry[port].lock();
+    if (server)
+        return server;
+
+    server = shared_ptr<RtspFanoutServer>(new RtspFanoutServer(port));
+    if (server->start() < 0)
+        return nullptr;
+    registry[port] = server;
+    return server;
+}
+
+RtspFanoutServer::RtspFanoutServer(int port)
+    : port(port), listen_fd(-1), rtp_fd(-1), rtcp_fd(-1), rtp_port(0), wake_fd(-1), quit(false), thread(nullptr),
+      last_report(0)
+{
+}
+
+RtspFanoutServer::~RtspFanoutServer()
+{
+    if (thread) {
+        quit = true;
+        uint64_t one = 1;
+        if (write(wake_fd, &one, sizeof(one)) < 0)
+            ff_warn("Failed to wake the rtsp thread\n");
+        thread->join();
+        delete thread;
+        thread = nullptr;
+    }
+
+    clients.clear();
+    for (int fd : {listen_fd, rtp_fd, rtcp_fd, wake_fd}) {
+        if (fd >= 0)
+            close(fd);
+    }
+}
+
+int RtspFanoutServer::start()
+{
+    int on = 1;
+    sockaddr_in addr = {};
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_ANY);
+
+    listen_fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    setsockopt(listen_fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+    addr.sin_port = htons(port);
+    if (bind(listen_fd, (sockaddr*)&addr, sizeof(addr)) < 0 || listen(listen_fd, 16) < 0) {
+        ff_error("Failed to listen on rtsp port %d: %s\n", port, strerror(errno));
+        return -1;
+    }
+
+    // RTP and RTCP of every stream go out of one even/odd port pair.
+    for (uint16_t p = RTSP_RTP_PORT_BASE; p < RTSP_RTP_PORT_BASE + 1000 && rtp_port == 0; p += 2) {
+        rtp_fd = socket(AF_INET, SOCK_DGRAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+        rtcp_fd = socket(AF_INET, SOCK_DGRAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+        addr.sin_port = htons(p);
+        bool ok = bind(rtp_fd, (sockaddr*)&addr, sizeof(addr)) == 0;
+        addr.sin_port = htons(p + 1);
+        ok = ok && bind(rtcp_fd, (sockaddr*)&addr, sizeof(addr)) == 0;
+        if (ok) {
+            rtp_port = p;
+        } else {
+            close(rtp_fd);
+            close(rtcp_fd);
+            rtp_fd = rtcp_fd = -1;
+        }
+    }
+    if (rtp_port == 0) {
+        ff_error("No free rtp port pair\n");
+        return -1;
+    }
+    int sndbuf = RTSP_SNDBUF;
+    setsockopt(rtp_fd, SOL_SOCKET, SO_SNDBUF, &sndbuf, sizeof(sndbuf));
+
+    wake_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    thread = new std::thread(&RtspFanoutServer::controlProcess, this);
+    ff_info("Rtsp fan-out server on port %d, rtp %u-%u\n", port, rtp_port, rtp_port + 1);
+    return 0;
+}
+
+shared_ptr<RtspFanoutServer::Stream> RtspFanoutServer::addStream(const std::string& path, AnnexB::Codec codec)
+{
+    std::lock_guard<std::mutex> lk(mtx);
+    if (streams.count(RtspUtil::urlPath(path))) {
+        ff_error("Rtsp path %s is already published\n", path.c_str());
+        return nullptr;
+    }
+    shared_ptr<Stream> stream = make_shared<Stream>(RtspUtil::urlPath(path), codec, rtp_fd);
+    streams[stream->path] = stream;
+    return stream;
+}
+
+void RtspFanoutServer::removeStream(const shared_ptr<Stream>& stream)
+{
+    std::lock_guard<std::mutex> lk(mtx);
+    streams.erase(stream->path);
+    for (auto& c : clients) {
+        if (c->stream == stream) {
+            c->stream = nullptr;
+            c->playing = false;
+            c->catchup = nullptr;
+        }
+    }
+}
+
+void RtspFanoutServer::setParameterSets(Stream* stream, const uint8_t* data, size_t size)
+{
+    std::lock_guard<std::mutex> lk(stream->param_mtx);
+    stream->param_sets.assign(data, data + size);
+}
+
+void RtspFanoutServer::setZeroCopyThreshold(Stream* stream, size_t bytes)
+{
+    std::lock_guard<std::mutex> lk(stream->target_mtx);
+    stream->zerocopy_threshold = bytes;
+}
+
+int RtspFanoutServer::setMulticast(Stream* stream, const std::string& group, int port, int ttl, const std::string& iface)
+{
+    sockaddr_in addr = {};
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(port + 1);
+    in_addr local = {};
+    local.s_addr = htonl(INADDR_ANY);
+    if (inet_pton(AF_INET, group.c_str(), &addr.sin_addr) != 1 || !IN_MULTICAST(ntohl(addr.sin_addr.s_addr)) ||
+        port <= 0 || port > 65534 || ttl < 0 || ttl > 255 ||
+        (!iface.empty() && inet_pton(AF_INET, iface.c_str(), &local) != 1)) {
+        ff_error("Bad rtsp multicast %s:%d ttl %d %s\n", group.c_str(), port, ttl, iface.c_str());
+        return -1;
+    }
+
+    int fd = socket(AF_INET, SOCK_DGRAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    unsigned char mttl = ttl, loop = 1;
+    int sndbuf = RTSP_SNDBUF;
+    setsockopt(fd, SOL_SOCKET, SO_SNDBUF, &sndbuf, sizeof(sndbuf));
+    setsockopt(fd, IPPROTO_IP, IP_MULTICAST_LOOP, &loop, sizeof(loop));
+    if (setsockopt(fd, IPPROTO_IP, IP_MULTICAST_TTL, &mttl, sizeof(mttl)) < 0 ||
+        (!iface.empty() && setsockopt(fd, IPPROTO_IP, IP_MULTICAST_IF, &local, sizeof(local)) < 0)) {
+        ff_error("Failed to set up rtsp multicast %s: %s\n", group.c_str(), strerror(errno));
+        close(fd);
+        return -1;
+    }
+
+    // Receiver reports of the group, without them the RTSP keepalives still work.
+    int on = 1;
+    int rtcp_fd = socket(AF_INET, SOCK_DGRAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    ip_mreq mreq = {};
+    mreq.imr_multiaddr = addr.sin_addr;
+    mreq.imr_interface = local;
+    setsockopt(rtcp_fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+    if (bind(rtcp_fd, (sockaddr*)&addr, sizeof(addr)) < 0 ||
+        setsockopt(rtcp_fd, IPPROTO_IP, IP_ADD_MEMBERSHIP, &mreq, sizeof(mreq)) < 0) {
+        ff_warn("Rtsp multicast %s gets no receiver reports: %s\n", group.c_str(), strerror(errno));
+        close(rtcp_fd);
+        rtcp_fd = -1;
+    }
+
+    std::lock_guard<std::mutex> lk(mtx);
+    std::lock_guard<std::mutex> target_lk(stream->target_mtx);
+    for (int old : {stream->mcast_fd, stream->mcast_rtcp_fd}) {
+        if (old >= 0)
+            close(old);
+    }
+    stream->mcast_fd = fd;
+    stream->mcast_rtcp_fd = rtcp_fd;
+    stream->mcast_addr = addr;
+    stream->mcast_addr.sin_port = htons(port);
+    stream->mcast_ttl = ttl;
+    ff_info("Rtsp %s multicast on %s:%d-%d ttl %d\n", stream->path.c_str(), group.c_str(), port, port + 1, ttl);
+    return 0;
+}
+
+void RtspFanoutServer::setGopCache(Stream* stream, size_t max_bytes, int speed)
+{
+    std::lock_guard<std::mutex> lk(stream->target_mtx);
+    stream->gop_cache_max = max_bytes;
+    stream->gop_speed = speed;
+    stream->gop_count = 0;
+    stream->gop_bytes = 0;
+    stream->gop_valid = false;
+}
+
+/// @brief Packetize an access unit once and send it to every playing client
+void RtspFanoutServer::send(Stream* stream, const uint8_t* data, size_t size, int64_t pts)
+{
+    shared_ptr<const std::vector<sockaddr_in>> targets;
+    shared_ptr<const std::vector<shared_ptr<Connection>>> tcp_targets;
+    bool multicast;
+    RtpPacketizer::PacketSet& set = stream->set;
+    {
+        // Under the lock, so a client starting to play gets exactly the packets after its RTP-Info.
+        std::lock_guard<std::mutex> lk(stream->target_mtx);
+        targets = stream->targets;
+        tcp_targets = stream->tcp_targets;
+        multicast = stream->mcast_viewers > 0;
+        stream->packetizer.packetize(data, size, pts, set);
+        stream->zerocopy_au = nullptr;
+        if (set.key)
+            stream->gop_valid = stream->gop_cache_max > 0;
+        if (stream->gop_valid)
+            cacheFrame(stream, data, size, pts);
+        for (auto& catchup : stream->joining) {
+            for (size_t i = 0; i < set.packets.size(); i++) {
+                const RtpPacketizer::Packet& packet = set.packets[i];
+                catchup->add(0, set.header(i), packet.header_size, packet.payload, packet.payload_size);
+            }
+        }
+    }
+
+    stream->iovs.resize(set.packets.size() * 2);
+    for (size_t i = 0; i < set.packets.size(); i++) {
+        const RtpPacketizer::Packet& packet = set.packets[i];
+        stream->iovs[i * 2] = {(void*)set.header(i), packet.header_size};
+        stream->iovs[i * 2 + 1] = {(void*)packet.payload, packet.payload_size};
+    }
+
+    // Packet by packet, so all viewers get each packet at about the same time.
+    size_t n = set.packets.size() * targets->size();
+    stream->msgs.resize(n);
+    size_t m = 0;
+    for (size_t i = 0; i < set.packets.size(); i++) {
+        for (auto& target : *targets) {
+            mmsghdr& msg = stream->msgs[m];
+            memset(&msg, 0, sizeof(msg));
+            msg.msg_hdr.msg_name = (void*)&target;
+            msg.msg_hdr.msg_namelen = sizeof(target);
+            msg.msg_hdr.msg_iov = &stream->iovs[i * 2];
+            msg.msg_hdr.msg_iovlen = 2;
+            m++;
+        }
+    }
+
+    uint64_t calls = 0;
+    size_t sent = sendBatch(stream->rtp_fd, stream->msgs.data(), n, &calls);
+
+    // Once to the group, however many watch it.
+    size_t mcast_count = multicast ? set.packets.size() : 0;
+    size_t mcast_sent = 0;
+    if (mcast_count > 0) {
+        stream->msgs.resize(mcast_count);
+        for (size_t i = 0; i < mcast_count; i++) {
+            mmsghdr& msg = stream->msgs[i];
+            memset(&msg, 0, sizeof(msg));
+            msg.msg_hdr.msg_name = (void*)&stream->mcast_addr;
+            msg.msg_hdr.msg_namelen = sizeof(stream->mcast_addr);
+            msg.msg_hdr.msg_iov = &stream->iovs[i * 2];
+            msg.msg_hdr.msg_iovlen = 2;
+        }
+        mcast_sent = sendBatch(stream->mcast_fd, stream->msgs.data(), mcast_count, &calls);
+    }
+
+    for (auto& conn : *tcp_targets)
+        sendInterleaved(stream, conn.get());
+
+    std::lock_guard<std::mutex> lk(stream->stats_mtx);
+    stream->last_timestamp = set.timestamp;
+    stream->last_send_clock = steadyClockUs();
+    stream->frames++;
+    stream->packets += set.packets.size();
+    stream->octets += set.payload_bytes;
+    stream->datagrams += sent + mcast_sent;
+    stream->mcast_datagrams += mcast_sent;
+    stream->syscalls += calls;
+    stream->dropped += n - sent + mcast_count - mcast_sent;
+}
+
+/// @brief Keep a copy of an access unit of the current GOP, the target lock is held
+void RtspFanoutServer::cacheFrame(Stream* stream, const uint8_t* data, size_t size, int64_t pts)
+{
+    if (stream->set.key) {
+        stream->gop_count = 0;
+        stream->gop_bytes = 0;
+    }
+    if (stream->gop_bytes + size > stream->gop_cache_max) {
+        // A new viewer waits for the next keyframe, as without the cache.
+        stream->gop_valid = false;
+        stream->gop.clear();
+        stream->gop_pts.clear();
+        stream->gop_count = 0;
+        stream->gop_bytes = 0;
+        return;
+    }
+    if (stream->gop.size() <= stream->gop_count) {
+        stream->gop.emplace_back();
+        stream->gop_pts.push_back(0);
+    }
+    stream->gop[stream->gop_count].assign(data, data + size);
+    stream->gop_pts[stream->gop_count] = pts;
+    stream->gop_count++;
+    stream->gop_bytes += size;
+}
+
+/// @brief The packets of the current access unit to a TCP client, framed as RTSP interleaved data
+void RtspFanoutServer::sendInterleaved(Stream* stream, Connection* conn)
+{
+    const RtpPacketizer::PacketSet& set = stream->set;
+    size_t count = set.packets.size();
+    size_t total = 0;
+
+    stream->framing.resize(count * 4);
+    stream->tcp_iovs.resize(count * 3);
+    for (size_t i = 0; i < count; i++) {
+        size_t len = set.packets[i].size();
+        uint8_t* f = stream->framing.data() + i * 4;
+        f[0] = '$';
+        f[1] = conn->channel;
+        f[2] = len >> 8;
+        f[3] = len;
+        stream->tcp_iovs[i * 3] = {f, 4};
+        stream->tcp_iovs[i * 3 + 1] = stream->iovs[i * 2];
+        stream->tcp_iovs[i * 3 + 2] = stream->iovs[i * 2 + 1];
+        total += 4 + len;
+    }
+
+    std::lock_guard<std::mutex> lk(conn->mtx);
+    if (conn->closed)
+        return;
+
+    // A slow client misses frames up to the next keyframe instead of holding up the others.
+    bool backed_up = !conn->flush();
+    if (conn->wait_keyframe && !set.key)
+        return;
+    if (backed_up && conn->backlog.size() + total > RTSP_TCP_BACKLOG) {
+        conn->wait_keyframe = true;
+        std::lock_guard<std::mutex> lk(stream->stats_mtx);
+        stream->tcp_skipped++;
+        return;
+    }
+    conn->wait_keyframe = false;
+
+    conn->reapZeroCopy();
+    iovec* iov = stream->tcp_iovs.data();
+    size_t left = stream->tcp_iovs.size();
+    size_t sent = 0;
+    bool zerocopy = false;
+    iovec zerocopy_iov;
+    if (!backed_up) {
+        // The encoder buffer goes back when send() returns, so the kernel reads a framed copy of the access unit,
+        // made once for all connections on the channel and kept until the completions of each of them arrive.
+        zerocopy = conn->zerocopy && stream->zerocopy_threshold > 0 && set.payload_bytes >= stream->zerocopy_threshold &&
+                   conn->zerocopy_pending.size() < RTSP_ZEROCOPY_MAX_PENDING;
+        if (zerocopy) {
+            if (!stream->zerocopy_au || stream->zerocopy_channel != conn->channel) {
+                stream->zerocopy_au = make_shared<std::vector<uint8_t>>();
+                stream->zerocopy_au->reserve(total);
+                for (const iovec& v : stream->tcp_iovs)
+                    stream->zerocopy_au->insert(stream->zerocopy_au->end(), (const uint8_t*)v.iov_base,
+                                                (const uint8_t*)v.iov_base + v.iov_len);
+                stream->zerocopy_channel = conn->channel;
+            }
+            zerocopy_iov = {stream->zerocopy_au->data(), stream->zerocopy_au->size()};
+            iov = &zerocopy_iov;
+            left = 1;
+        }
+        uint32_t zerocopy_sent = conn->zerocopy_sent;
+        sent = conn->sendIov(iov, left, zerocopy ? MSG_ZEROCOPY : 0);
+        if (conn->zerocopy_sent != zerocopy_sent)
+            conn->zerocopy_pending.emplace_back(conn->zerocopy_sent, stream->zerocopy_au);
+    }
+    size_t copied = conn->keep(iov, left);
+    uint32_t zerocopy_copied = conn->zerocopy_copied;
+    conn->zerocopy_copied = 0;
+
+    std::lock_guard<std::mutex> stats_lk(stream->stats_mtx);
+    stream->tcp_bytes += sent + copied;
+    stream->tcp_copied += copied;
+    stream->zerocopy_frames += zerocopy;
+    stream->zerocopy_copied += zerocopy_copied;
+}
+
+size_t RtspFanoutServer::viewers(Stream* stream)
+{
+    std::lock_guard<std::mutex> lk(stream->target_mtx);
+    return stream->targets->size() + stream->tcp_targets->size() + stream->joining.size() + stream->mcast_viewers;
+}
+
+void RtspFanoutServer::dumpStats(Stream* stream)
+{
+    size_t count = viewers(stream);
+    std::lock_guard<std::mutex> lk(stream->stats_mtx);
+    ff_info("rtsp fan-out %s: %zu viewers, %" PRIu64 " frames, %" PRIu64 " packets, %" PRIu64 " datagrams in %" PRIu64
+            " sendmmsg calls, %" PRIu64 " dropped\n",
+            stream->path.c_str(), count, stream->frames, stream->packets, stream->datagrams, stream->syscalls,
+            stream->dropped);
+    ff_info("rtsp fan-out %s tcp: %" PRIu64 " bytes, %" PRIu64 " copied to backlogs, %" PRIu64 " frames skipped, %" PRIu64
+            " zerocopy frames, %" PRIu64 " zerocopy sends copied by the kernel\n",
+            stream->path.c_str(), stream->tcp_bytes, stream->tcp_copied, stream->tcp_skipped, stream->zerocopy_frames,
+            stream->zerocopy_copied);
+    ff_info("rtsp fan-out %s gop cache: %" PRIu64 " viewers started from the cache, %" PRIu64 " catch-up overflows\n",
+            stream->path.c_str(), stream->fast_starts, stream->catchup_overflows);
+    if (stream->mcast_fd >= 0)
+        ff_info("rtsp fan-out %s multicast %s:%u: %" PRIu64 " datagrams\n", stream->path.c_str(),
+                inet_ntoa(stream->mcast_addr.sin_addr), ntohs(stream->mcast_addr.sin_port), stream->mcast_datagrams);
+}
+
+/// @brief Publish the RTP destinations of the playing clients of a stream
+/// @param next_seq, last_timestamp for RTP-Info: next sequence number, timestamp of the last access unit
+void RtspFanoutServer::updateTargets(Stream* stream)
+{
+    std::lock_guard<std::mutex> lk(stream->target_mtx);
+    publishTargets(stream);
+}
+
+/// @brief Same with the target lock held
+void RtspFanoutServer::publishTargets(Stream* stream)
+{
+    auto targets = make_shared<std::vector<sockaddr_in>>();
+    auto tcp_targets = make_shared<std::vector<shared_ptr<Connection>>>();
+    stream->joining.clear();
+    stream->mcast_viewers = 0;
+    for (auto& c : clients) {
+        if (c->stream.get() != stream || !c->playing)
+            continue;
+        if (c->multicast)
+            stream->mcast_viewers++;
+        else if (c->catchup)
+            stream->joining.push_back(c->catchup);
+        else if (c->interleaved)
+            tcp_targets->push_back(c->conn);
+        else
+            targets->push_back(c->rtp_addr);
+    }
+    stream->targets = targets;
+    stream->tcp_targets = tcp_targets;
+}
+
+/// @brief Fill the catch-up queue of a client starting to play, the target lock is held
+/// @return false if there is no GOP to start from
+bool RtspFanoutServer::startCatchup(Client* client, int64_t now, uint16_t* first_seq, uint32_t* first_timestamp)
+{
+    Stream* stream = client->stream.get();
+    if (!stream->gop_valid || stream->gop_count == 0)
+        return false;
+
+    // The keyframe gets the parameter sets if it does not carry them.
+    std::vector<uint8_t> first;
+    const uint8_t* begin;
+    if (AnnexB::parameterSets(stream->gop[0].data(), stream->gop[0].size(), stream->codec, &begin) == 0) {
+        std::lock_guard<std::mutex> lk(stream->param_mtx);
+        first = stream->param_sets;
+    }
+    first.insert(first.end(), stream->gop[0].begin(), stream->gop[0].end());
+
+    // A copy of the packetizer gives the same timestamps, sequence numbers are set below.
+    RtpPacketizer packetizer = stream->packetizer;
+    RtpPacketizer::PacketSet set;
+    auto catchup = make_shared<Catchup>(stream->gop_cache_max * 2);
+    for (size_t f = 0; f < stream->gop_count; f++) {
+        const std::vector<uint8_t>& frame = f == 0 ? first : stream->gop[f];
+        int64_t due = now;
+        if (stream->gop_speed > 0)
+            due += (stream->gop_pts[f] - stream->gop_pts[0]) / stream->gop_speed;
+        set.clear();
+        packetizer.packetize(frame.data(), frame.size(), stream->gop_pts[f], set);
+        if (f == 0)
+            *first_timestamp = set.timestamp;
+        for (size_t i = 0; i < set.packets.size(); i++) {
+            const RtpPacketizer::Packet& packet = set.packets[i];
+            catchup->add(due, set.header(i), packet.header_size, packet.payload, packet.payload_size);
+        }
+    }
+    if (catchup->overflow)
+        return false;
+
+    uint16_t seq = stream->packetizer.nextSeq() - catchup->queue.size();
+    *first_seq = seq;
+    for (auto& packet : catchup->queue) {
+        packet.data[2] = seq >> 8;
+        packet.data[3] = seq;
+        seq++;
+    }
+    client->catchup = catchup;
+    return true;
+}
+
+/// @brief Send the due catch-up packets, clients that caught up join the shared packets
+/// @return true if some catch-up is still going on
+bool RtspFanoutServer::sendCatchups(int64_t now)
+{
+    bool pending = false;
+    for (auto& c : clients) {
+        if (!c->playing || !c->catchup)
+            continue;
+
+        Stream* stream = c->stream.get();
+        std::lock_guard<std::mutex> lk(stream->target_mtx);
+        Catchup* catchup = c->catchup.get();
+        while (!catchup->queue.empty() && catchup->queue.front().due <= now) {
+            std::string& data = catchup->queue.front().data;
+            if (c->interleaved) {
+                uint8_t framing[4] = {'$', c->conn->channel, (uint8_t)(data.size() >> 8), (uint8_t)data.size()};
+                std::lock_guard<std::mutex> conn_lk(c->conn->mtx);
+                iovec iov[2] = {{framing, 4}, {(void*)data.data(), data.size()}};
+                iovec* p = iov;
+                size_t count = 2;
+                if (c->conn->flush())
+                    c->conn->sendIov(p, count, 0);
+                c->conn->keep(p, count);
+            } else if (sendto(rtp_fd, data.data(), data.size(), MSG_DONTWAIT, (sockaddr*)&c->rtp_addr,
+                              sizeof(c->rtp_addr)) < 0 &&
+                       errno == EAGAIN) {
+                break;
+            }
+            catchup->bytes -= data.size();
+            catchup->queue.pop_front();
+        }
+
+        if (!catchup->queue.empty() && !catchup->overflow) {
+            pending = true;
+            continue;
+        }
+        if (catchup->overflow) {
+            // Too far behind, it goes on with the live packets after a gap.
+            std::lock_guard<std::mutex> stats_lk(stream->stats_mtx);
+            stream->catchup_overflows++;
+        } else {
+            std::lock_guard<std::mutex> conn_lk(c->conn->mtx);
+            c->conn->wait_keyframe = false;
+        }
+        c->catchup = nullptr;
+        publishTargets(stream);
+    }
+    return pending;
+}
+
+void RtspFanoutServer::controlProcess()
+{
+    std::vector<pollfd> fds;
+    std::vector<Client*> polled;
+    std::vector<shared_ptr<Stream>> polled_streams;    // held, the module may remove its stream meanwhile
+    bool catching_up = false;
+
+    while (!quit) {
+        fds.clear();
+        polled.clear();
+        polled_streams.clear();
+        fds.push_back({wake_fd, POLLIN, 0});
+        fds.push_back({listen_fd, POLLIN, 0});
+        fds.push_back({rtcp_fd, POLLIN, 0});
+        {
+            std::lock_guard<std::mutex> lk(mtx);
+            for (auto& c : clients) {
+                std::lock_guard<std::mutex> conn_lk(c->conn->mtx);
+                fds.push_back({c->conn->fd, (short)(POLLIN | (c->conn->backlog.empty() ? 0 : POLLOUT)), 0});
+                polled.push_back(c.get());
+            }
+            for (auto& it : streams) {
+                if (it.second->mcast_rtcp_fd >= 0) {
+                    fds.push_back({it.second->mcast_rtcp_fd, POLLIN, 0});
+                    polled_streams.push_back(it.second);
+                }
+            }
+        }
+
+        int ret = poll(fds.data(), fds.size(), catching_up ? RTSP_CATCHUP_POLL_MS : 500);
+        if (ret < 0 && errno != EINTR) {
+            ff_error("rtsp poll failed: %s\n", strerror(errno));
+            break;
+        }
+
+        std::lock_guard<std::mutex> lk(mtx);
+        if (ret > 0) {
+            if (fds[1].revents & POLLIN)
+                acceptClient();
+            if (fds[2].revents & POLLIN)
+                readRtcp();
+            for (size_t i = 0; i < polled.size(); i++) {
+                if (fds[i + 3].revents & POLLOUT) {
+                    std::lock_guard<std::mutex> conn_lk(polled[i]->conn->mtx);
+                    polled[i]->conn->flush();
+                }
+                if (fds[i + 3].revents & POLLERR) {
+                    // Also raised by zerocopy completions waiting in the error queue.
+                    std::lock_guard<std::mutex> conn_lk(polled[i]->conn->mtx);
+                    polled[i]->conn->reapZeroCopy();
+                }
+                if (fds[i + 3].revents & ~POLLOUT)
+                    readClient(polled[i]);
+            }
+            for (size_t i = 0; i < polled_streams.size(); i++) {
+                if (fds[i + 3 + polled.size()].revents & POLLIN)
+                    readMulticastRtcp(polled_streams[i].get());
+            }
+        }
+
+        int64_t now = steadyClockUs();
+        checkClients(now);
+        catching_up = sendCatchups(now);
+        if (now - last_report >= RTSP_REPORT_INTERVAL) {
+            sendReports(now);
+            last_report = now;
+        }
+    }
+}
+
+void RtspFanoutServer::acceptClient()
+{
+    sockaddr_in peer;
+    socklen_t len = sizeof(peer);
+    int fd = accept4(listen_fd, (sockaddr*)&peer, &len, SOCK_NONBLOCK | SOCK_CLOEXEC);
+    if (fd < 0)
+        return;
+
+    std::unique_ptr<Client> c(new Client());
+    c->conn = make_shared<Connection>(fd);
+    c->peer = peer;
+    c->interleaved = false;
+    c->multicast = false;
+    c->playing = false;
+    c->last_seen = steadyClockUs();
+    clients.push_back(std::move(c));
+}
+
+void RtspFanoutServer::readRtcp()
+{
+    uint8_t buf[1500];
+    sockaddr_in from;
+    socklen_t len = sizeof(from);
+
+    // Receiver reports only keep their client alive.
+    while (recvfrom(rtcp_fd, buf, sizeof(buf), 0, (sockaddr*)&from, &len) > 0) {
+        for (auto& c : clients) {
+            if (sameAddress(c->rtcp_addr, from))
+                c->last_seen = steadyClockUs();
+        }
+        len = sizeof(from);
+    }
+}
+
+void RtspFanoutServer::readMulticastRtcp(Stream* stream)
+{
+    uint8_t buf[1500];
+    uint32_t ssrc = htonl(stream->packetizer.getSsrc());
+    bool report = false;
+
+    // Reports of the group keep all of its viewers alive, our own looped back SRs do not count.
+    ssize_t n;
+    while ((n = recv(stream->mcast_rtcp_fd, buf, sizeof(buf), 0)) > 0) {
+        if (n >= 8 && memcmp(buf + 4, &ssrc, 4) != 0)
+            report = true;
+    }
+    if (!report)
+        return;
+    int64_t now = steadyClockUs();
+    for (auto& c : clients) {
+        if (c->stream.get() == stream && c->multicast)
+            c->last_seen = now;
+    }
+}
+
+void RtspFanoutServer::readClient(Client* client)
+{
+    char buf[4096];
+    ssize_t n = recv(client->conn->fd, buf, sizeof(buf), 0);
+    if (n == 0 || (n < 0 && errno != EAGAIN && errno != EINTR)) {
+        closeClient(client);
+        return;
+    }
+    if (n < 0)
+        return;
+
+    client->inbuf.append(buf, n);
+    client->last_seen = steadyClockUs();
+    while (true) {
+        // Interleaved RTCP from the client only keeps it alive.
+        if (!client->inbuf.empty() && client->inbuf[0] == '$') {
+            if (client->inbuf.size() < 4)
+                return;
+            size_t len = 4 + ((uint8_t)client->inbuf[2] << 8 | (uint8_t)client->inbuf[3]);
+            if (client->inbuf.size() < len)
+                return;
+            client->inbuf.erase(0, len);
+            continue;
+        }
+
+        size_t end = client->inbuf.find("\r\n\r\n");
+        if (end == std::string::npos) {
+            if (client->inbuf.size() > RTSP_MAX_REQUEST)
+                closeClient(client);
+            return;
+        }
+
+        std::string request = client->inbuf.substr(0, end + 4);
+        size_t body = atoi(RtspUtil::header(request, "Content-Length").c_str());
+        if (client->inbuf.size() < end + 4 + body)
+            return;
+        client->inbuf.erase(0, end + 4 + body);
+        if (handleRequest(client, request) < 0) {
+            closeClient(client);
+            return;
+        }
+    }
+}
+
+void RtspFanoutServer::closeClient(Client* client)
+{
+    auto it = std::find_if(clients.begin(), clients.end(), [client](const std::unique_ptr<Client>& c) { return c.get() == client; });
+    if (it == clients.end())
+        return;
+
+    shared_ptr<Stream> stream = client->stream;
+    {
+        // The fd is closed with the last reference, a send may still hold the connection.
+        std::lock_guard<std::mutex> lk(client->conn->mtx);
+        client->conn->closed = true;
+        shutdown(client->conn->fd, SHUT_RDWR);
+    }
+    clients.erase(it);
+    if (stream)
+        updateTargets(stream.get());
+}
+
+void RtspFanoutServer::checkClients(int64_t now)
+{
+    std::vector<Client*> expired;
+    std::vector<Client*> broken;
+    for (auto& c : clients) {
+        std::lock_guard<std::mutex> lk(c->conn->mtx);
+        if (c->conn->closed)
+            broken.push_back(c.get());
+        else if (now - c->last_seen > RTSP_SESSION_TIMEOUT * 1000000LL)
+            expired.push_back(c.get());
+    }
+    for (Client* c : expired) {
+        ff_info("rtsp session %s timed out\n", c->session.c_str());
+        closeClient(c);
+    }
+    for (Client* c : broken) {
+        ff_info("rtsp session %s lost its connection\n", c->session.c_str());
+        closeClient(c);
+    }
+}
+
+/// @brief RTCP sender report of every stream to its playing clients
+void RtspFanoutServer::sendReports(int64_t now)
+{
+    for (auto& it : streams) {
+        Stream* s = it.second.get();
+        uint8_t sr[32];
+        {
+            std::lock_guard<std::mutex> lk(s->stats_mtx);
+            if (s->frames == 0)
+                continue;
+            timeval tv;
+            gettimeofday(&tv, NULL);
+            uint32_t ntp_sec = tv.tv_sec + 2208988800u;
+            uint32_t ntp_frac = (uint32_t)((double)tv.tv_usec * 4294.967296);
+            uint32_t ts = s->last_timestamp + (uint32_t)((now - s->last_send_clock) * 9 / 100);
+            uint32_t ssrc = s->packetizer.getSsrc();
+            uint32_t words[6] = {ssrc, ntp_sec, ntp_frac, ts, (uint32_t)s->packets, (uint32_t)s->octets};
+            // Room for the interleaved framing in front.
+            sr[2] = 0;
+            sr[3] = 28;
+            sr[4] = 0x80;
+            sr[5] = 200;
+            sr[6] = 0;
+            sr[7] = 6;
+            for (int i = 0; i < 6; i++) {
+                uint32_t v = htonl(words[i]);
+                memcpy(sr + 8 + i * 4, &v, 4);
+            }
+        }
+        bool multicast = false;
+        for (auto& c : clients) {
+            if (c->stream != it.second || !c->playing)
+                continue;
+            if (c->multicast) {
+                multicast = true;
+            } else if (c->interleaved) {
+                sr[0] = '$';
+                sr[1] = c->conn->channel + 1;
+                c->conn->write(sr, sizeof(sr));
+            } else {
+                sendto(rtcp_fd, sr + 4, sizeof(sr) - 4, MSG_DONTWAIT, (sockaddr*)&c->rtcp_addr, sizeof(c->rtcp_addr));
+            }
+        }
+        if (multicast) {
+            sockaddr_in group = s->mcast_addr;
+            group.sin_port = htons(ntohs(group.sin_port) + 1);
+            sendto(s->mcast_fd, sr + 4, sizeof(sr) - 4, MSG_DONTWAIT, (sockaddr*)&group, sizeof(group));
+        }
+    }
+}
+
+shared_ptr<RtspFanoutServer::Stream> RtspFanoutServer::findStream(const std::string& url)
+{
+    std::string path = RtspUtil::urlPath(url);
+    // A SETUP url carries the track control after the stream path.
+    for (int i = 0; i < 2; i++) {
+        auto it = streams.find(path);
+        if (it != streams.end())
+            return it->second;
+        size_t slash = path.rfind('/');
+        if (slash == std::string::npos || slash == 0)
+            break;
+        path.resize(slash);
+    }
+    return nullptr;
+}
+
+std::string RtspFanoutServer::describe(Client* client, Stream* stream)
+{
+    sockaddr_in local;
+    socklen_t len = sizeof(local);
+    getsockname(client->conn->fd, (sockaddr*)&local, &len);
+
+    std::vector<uint8_t> params;
+    {
+        std::lock_guard<std::mutex> lk(stream->param_mtx);
+        params = stream->param_sets;
+    }
+    std::vector<AnnexB::Nal> nals;
+    AnnexB::split(params.data(), params.size(), stream->codec, nals);
+
+    std::ostringstream sdp;
+    sdp << "v=0\r\n"
+        << "o=- " << stream->packetizer.getSsrc() << " 1 IN IP4 " << inet_ntoa(local.sin_addr) << "\r\n"
+        << "s=" << stream->path << "\r\n"
+        << "t=0 0\r\n"
+        << "a=control:*\r\n";
+    // A multicast stream advertises its group, unicast clients still ask for their own ports in SETUP.
+    if (stream->mcast_fd >= 0) {
+        sdp << "m=video " << ntohs(stream->mcast_addr.sin_port) << " RTP/AVP " << (int)RtpPacketizer::PAYLOAD_TYPE << "\r\n"
+            << "c=IN IP4 " << inet_ntoa(stream->mcast_addr.sin_addr) << "/" << stream->mcast_ttl << "\r\n";
+    } else {
+        sdp << "m=video 0 RTP/AVP " << (int)RtpPacketizer::PAYLOAD_TYPE << "\r\n"
+            << "c=IN IP4 0.0.0.0\r\n";
+    }
+
+    std::string fmtp;
+    if (stream->codec == AnnexB::CODEC_H264) {
+        sdp << "a=rtpmap:" << (int)RtpPacketizer::PAYLOAD_TYPE << " H264/90000\r\n";
+        std::string sprop;
+        fmtp = "packetization-mode=1";
+        for (auto& nal : nals) {
+            if (nal.type == 7 && nal.size >= 4) {
+                char profile[16];
+                snprintf(profile, sizeof(profile), "%02X%02X%02X", nal.data[1], nal.data[2], nal.data[3]);
+                fmtp += std::string(";profile-level-id=") + profile;
+            }
+            if (nal.type == 7 || nal.type == 8)
+                sprop += (sprop.empty() ? "" : ",") + RtspUtil::base64Encode(nal.data, nal.size);
+        }
+        if (!sprop.empty())
+            fmtp += ";sprop-parameter-sets=" + sprop;
+    } else {
+        sdp << "a=rtpmap:" << (int)RtpPacketizer::PAYLOAD_TYPE << " H265/90000\r\n";
+        for (auto& nal : nals) {
+            const char* name = nal.type == 32 ? "sprop-vps" : nal.type == 33 ? "sprop-sps" : nal.type == 34 ? "sprop-pps" : nullptr;
+            if (name)
+                fmtp += (fmtp.empty() ? "" : ";") + std::string(name) + "=" + RtspUtil::base64Encode(nal.data, nal.size);
+        }
+    }
+    if (!fmtp.empty())
+        sdp << "a=fmtp:" << (int)RtpPacketizer::PAYLOAD_TYPE << " " << fmtp << "\r\n";
+    sdp << "a=control:trackID=0\r\n";
+    return sdp.str();
+}
+
+/// @return -1 to close the connection
+int RtspFanoutServer::handleRequest(Client* client, const std::string& request)
+{
+    std::istringstream first_line(request.substr(0, request.find("\r\n")));
+    std::string method, url, version;
+    first_line >> method >> url >> version;
+    if (version.compare(0, 5, "RTSP/") != 0)
+        return -1;
+
+    std::string cseq = RtspUtil::header(request, "CSeq");
+    std::string session = RtspUtil::header(request, "Session");
+    session = session.substr(0, session.find(';'));
+    std::ostringstream reply;
+    std::string body;
+    int status = 200;
+
+    if (method == "OPTIONS") {
+        reply << "Public: OPTIONS, DESCRIBE, SETUP, TEARDOWN, PLAY, GET_PARAMETER, SET_PARAMETER\r\n";
+    } else if (method == "DESCRIBE") {
+        shared_ptr<Stream> stream = findStream(url);
+        if (stream) {
+            body = describe(client, stream.get());
+            reply << "Content-Base: " << url << "/\r\nContent-Type: application/sdp\r\n";
+        } else {
+            status = 404;
+        }
+    } else if (method == "SETUP") {
+        shared_ptr<Stream> stream = findStream(url);
+        std::string transport = RtspUtil::header(request, "Transport");
+        bool interleaved = transport.find("RTP/AVP/TCP") != std::string::npos;
+        bool multicast = !interleaved && transport.find("multicast") != std::string::npos;
+        int rtp = -1, rtcp = -1;
+        if (sscanf(RtspUtil::param(transport, interleaved ? "interleaved" : "client_port").c_str(), "%d-%d", &rtp, &rtcp) == 1)
+            rtcp = rtp + 1;
+        if (interleaved && rtp < 0)
+            rtp = 0, rtcp = 1;
+
+        if (stream == nullptr) {
+            status = 404;
+        } else if ((!interleaved && !multicast && rtp <= 0) || (interleaved && rtp > 254) ||
+                   (multicast && stream->mcast_fd < 0)) {
+            status = 461;
+        } else if (!client->session.empty() && session != client->session) {
+            status = 459;
+        } else {
+            if (client->session.empty()) {
+                char id[16];
+                snprintf(id, sizeof(id), "%08lX", random());
+                client->session = id;
+            }
+            if (client->stream && client->stream != stream && client->playing) {
+                client->playing = false;
+                client->catchup = nullptr;
+                updateTargets(client->stream.get());
+            }
+            client->stream = stream;
+            client->interleaved = interleaved;
+            client->multicast = multicast;
+            char ssrc[16];
+            snprintf(ssrc, sizeof(ssrc), "%08X", stream->packetizer.getSsrc());
+            if (interleaved) {
+                std::lock_guard<std::mutex> lk(client->conn->mtx);
+                client->conn->channel = rtp;
+                if (stream->zerocopy_threshold > 0 && !client->conn->zerocopy) {
+                    int on = 1;
+                    client->conn->zerocopy = setsockopt(client->conn->fd, SOL_SOCKET, SO_ZEROCOPY, &on, sizeof(on)) == 0;
+                }
+                reply << "Transport: RTP/AVP/TCP;unicast;interleaved=" << rtp << "-" << rtp + 1 << ";ssrc=" << ssrc << "\r\n";
+            } else if (multicast) {
+                int port = ntohs(stream->mcast_addr.sin_port);
+                reply << "Transport: RTP/AVP;multicast;destination=" << inet_ntoa(stream->mcast_addr.sin_addr)
+                      << ";port=" << port << "-" << port + 1 << ";ttl=" << stream->mcast_ttl << ";ssrc=" << ssrc << "\r\n";
+            } else {
+                client->rtp_addr = client->peer;
+                client->rtp_addr.sin_port = htons(rtp);
+                client->rtcp_addr = client->peer;
+                client->rtcp_addr.sin_port = htons(rtcp);
+                reply << "Transport: RTP/AVP;unicast;client_port=" << rtp << "-" << rtcp << ";server_port=" << rtp_port
+                      << "-" << rtp_port + 1 << ";ssrc=" << ssrc << "\r\n";
+            }
+            if (client->playing)
+                updateTargets(stream.get());
+        }
+    } else if (method == "PLAY") {
+        if (client->session.empty() || session != client->session || client->stream == nullptr) {
+            status = 454;
+        } else {
+            uint16_t seq;
+            uint32_t ts;
+            bool ts_known;
+            Stream* stream = client->stream.get();
+            {
+                std::lock_guard<std::mutex> lk(stream->target_mtx);
+                ts_known = !client->playing && !client->multicast && startCatchup(client, steadyClockUs(), &seq, &ts);
+                if (ts_known) {
+                    std::lock_guard<std::mutex> stats_lk(stream->stats_mtx);
+                    stream->fast_starts++;
+                } else {
+                    // The packet at seq belongs to an access unit not encoded yet, its timestamp is not known.
+                    seq = stream->packetizer.nextSeq();
+                }
+                client->playing = true;
+                publishTargets(stream);
+            }
+            reply << "Range: npt=0.000-\r\n"
+                  << "RTP-Info: url=" << url << (url.find("trackID") == std::string::npos ? "/trackID=0" : "") << ";seq=" << seq;
+            if (ts_known)
+                reply << ";rtptime=" << ts;
+            reply << "\r\n";
+        }
+    } else if (method == "TEARDOWN") {
+        if (client->stream && client->playing) {
+            client->playing = false;
+            client->catchup = nullptr;
+            updateTargets(client->stream.get());
+        }
+        client->stream = nullptr;
+        client->session.clear();
+    } else if (method == "GET_PARAMETER" || method == "SET_PARAMETER") {
+        // keepalive
+    } else {
+        status = 501;
+    }
+
+    const char* reason = status == 200 ? "OK" : status == 404 ? "Not Found" : status == 454 ? "Session Not Found"
+                       : status == 459 ? "Aggregate Operation Not Allowed" : status == 461 ? "Unsupported Transport"
+                       : "Not Implemented";
+    std::ostringstream out;
+    out << "RTSP/1.0 " << status << " " << reason << "\r\n"
+        << "CSeq: " << cseq << "\r\n"
+        << "Server: ff_media fan-out\r\n";
+    if (!client->session.empty() && status == 200)
+        out << "Session: " << client->session << ";timeout=" << RTSP_SESSION_TIMEOUT << "\r\n";
+    out << reply.str();
+    if (!body.empty())
+        out << "Content-Length: " << body.size() << "\r\n";
+    out << "\r\n" << body;
+
+    std::string s = out.str();
+    return client->conn->write(s.data(), s.size()) ? 0 : -1;
+}
+
+ModuleRtspFanout::ModuleRtspFanout(const char* path, int port)
+    : ModuleMedia("RtspFanout"), path(path), port(port), codec(AnnexB::CODEC_H264), server(nullptr),
+      stream(nullptr), last_extra_buffer(nullptr), zerocopy_threshold(0), gop_cache_max(RTSP_GOP_CACHE_SIZE),
+      gop_cache_speed(0), mcast_port(0), mcast_ttl(1)
+{
+    buffer_count = 0;
+}
+
+ModuleRtspFanout::~ModuleRtspFanout()
+{
+    if (server && stream)
+        server->removeStream(stream);
+}
+
+int ModuleRtspFanout::init()
+{
+    shared_ptr<ModuleMedia> productor = getProductor();
+    if (productor == nullptr) {
+        ff_error("Rtsp fan-out has no productor\n");
+        return -1;
+    }
+
+    input_para = productor->getOutputImagePara();
+    media_type = productor->getMediaType();
+    if (input_para.v4l2Fmt == V4L2_PIX_FMT_H264) {
+        codec = AnnexB::CODEC_H264;
+    } else if (input_para.v4l2Fmt == V4L2_PIX_FMT_HEVC) {
+        codec = AnnexB::CODEC_H265;
+    } else {
+        ff_error("Rtsp fan-out does not support %s\n", v4l2GetFmtName(input_para.v4l2Fmt));
+        return -1;
+    }
+
+    server = RtspFanoutServer::get(port);
+    if (server == nullptr)
+        return -1;
+    stream = server->addStream(path, codec);
+    if (stream == nullptr)
+        return -1;
+    RtspFanoutServer::setZeroCopyThreshold(stream.get(), zerocopy_threshold);
+    RtspFanoutServer::setGopCache(stream.get(), gop_cache_max, gop_cache_speed);
+    if (!mcast_group.empty() && server->setMulticast(stream.get(), mcast_group, mcast_port, mcast_ttl, mcast_iface) < 0)
+        return -1;
+    return 0;
+}
+
+bool ModuleRtspFanout::ClientsIsEmpty()
+{
+    return stream == nullptr || RtspFanoutServer::viewers(stream.get()) == 0;
+}
+
+void ModuleRtspFanout::dumpStats()
+{
+    if (stream)
+        RtspFanoutServer::dumpStats(stream.get());
+}
+
+ModuleMedia::ConsumeResult ModuleRtspFanout::doConsume(shared_ptr<MediaBuffer> input_buffer, shared_ptr<MediaBuffer> output_buffer)
+{
+    (void)output_buffer;
+    if (input_buffer == nullptr || input_buffer->getActiveSize() == 0)
+        return CONSUME_SKIP;
+
+    const uint8_t* data = (const uint8_t*)input_buffer->getActiveData();
+    size_t size = input_buffer->getActiveSize();
+
+    // Parameter sets for the SDP, from the encoder or in-band on keyframes.
+    shared_ptr<MediaBuffer> extra = input_buffer->getExtraData();
+    if (extra != nullptr && extra != last_extra_buffer && extra->getActiveSize() > 0) {
+        RtspFanoutServer::setParameterSets(stream.get(), (const uint8_t*)extra->getActiveData(), extra->getActiveSize());
+        last_extra_buffer = extra;
+    } else if (last_extra_buffer == nullptr) {
+        const uint8_t* begin;
+        size_t len = AnnexB::parameterSets(data, size, codec, &begin);
+        if (len > 0)
+            RtspFanoutServer::setParameterSets(stream.get(), begin, len);
+    }
+
+    RtspFanoutServer::send(stream.get(), data, size, input_buffer->getPUstimestamp());
+    return CONSUME_SUCCESS;
+}
@@ -0,0 +1,166 @@
+#pragma once
+#include <atomic>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "module/module_media.hpp"
+#include "annexb.hpp"
+
+/*
+ * RTSP server for many viewers of the same stream.
+ *
+ * Every access unit is packetized once per stream (see RtpPacketizer) and
+ * the same packets go to all playing UDP clients through sendmmsg batches,
+ * so a viewer costs a few mmsghdr entries instead of its own
+ * packetization and syscalls. The clients of a stream share its SSRC and
+ * sequence numbers, each learns the next sequence number from RTP-Info in
+ * the PLAY reply. Sending never blocks the pipeline, packets that do not
+ * fit the socket buffer are dropped and counted.
+ *
+ * TCP interleaved clients get the same packets with writev-style sendmsg:
+ * the '$' framing and RTP headers come from small buffers, the payload is
+ * read straight from the encoder's buffer. Only what the socket does not
+ * take right away is copied, into a per connection backlog sent before
+ * anything else; a client whose backlog grows past its cap skips frames
+ * up to the next keyframe. Above a size threshold, frames can be sent with
+ * MSG_ZEROCOPY: the framed access unit is copied once for all those
+ * clients, each connection holds it until the kernel reports its send
+ * done, and the completions are collected by the control thread or the
+ * next send, so the pipeline never waits for a client. A connection with
+ * too many sends still in flight gets plain sends.
+ *
+ * A stream keeps copies of its access units since the last keyframe, up
+ * to a memory cap. A new viewer starts from that keyframe instead of
+ * waiting for the next one: its catch-up queue is the cached GOP,
+ * packetized with sequence numbers ending where the live stream goes on,
+ * followed by the live packets that arrive meanwhile. The queue goes out
+ * at once or paced at a multiple of real time, then the client joins the
+ * shared packets.
+ *
+ * A stream can also be offered on a multicast group: the SDP advertises
+ * it, and a SETUP asking for multicast gets the group instead of its own
+ * destination. The group is sent to once while anyone watches it, so
+ * multicast viewers cost nothing per viewer; RTCP goes to the group's
+ * odd port, where the receivers' reports keep all of them alive. They
+ * start at the next keyframe, the cached GOP is unicast only.
+ *
+ * One server per port runs the RTSP control connections and RTCP on its
+ * own thread; the ModuleRtspFanout instances on that port register their
+ * paths with it, like ModuleRtspServer with /live/N.
+ */
+class RtspFanoutServer
+{
+public:
+    struct Stream;
+    struct Client;
+    struct Connection;
+    struct Catchup;
+
+    static shared_ptr<RtspFanoutServer> get(int port);
+    ~RtspFanoutServer();
+
+    shared_ptr<Stream> addStream(const std::string& path, AnnexB::Codec codec);
+    void removeStream(const shared_ptr<Stream>& stream);
+
+    static void setParameterSets(Stream* stream, const uint8_t* data, size_t size);
+    // Frames of at least this size go to TCP clients with MSG_ZEROCOPY, 0 disables it.
+    static void setZeroCopyThreshold(Stream* stream, size_t bytes);
+    // GOP cache of at most max_bytes, 0 disables it; new viewers get it at speed times real time, 0 for at once.
+    static void setGopCache(Stream* stream, size_t max_bytes, int speed);
+    // RTP to group:port and RTCP to port + 1, sent from the local address iface if it is given.
+    int setMulticast(Stream* stream, const std::string& group, int port, int ttl, const std::string& iface);
+    static void send(Stream* stream, const uint8_t* data, size_t size, int64_t pts);
+    static size_t viewers(Stream* stream);
+    static void dumpStats(Stream* stream);
+
+private:
+    RtspFanoutServer(int port);
+    int start();
+    void controlProcess();
+
+    void acceptClient();
+    void readClient(Client* client);
+    void readRtcp();
+    void readMulticastRtcp(Stream* stream);
+    void closeClient(Client* client);
+    void checkClients(int64_t now);
+    void sendReports(int64_t now);
+    void updateTargets(Stream* stream);
+    void publishTargets(Stream* stream);
+    static void sendInterleaved(Stream* stream, Connection* conn);
+    static void cacheFrame(Stream* stream, const uint8_t* data, size_t size, int64_t pts);
+    bool startCatchup(Client* client, int64_t now, uint16_t* first_seq, uint32_t* first_timestamp);
+    bool sendCatchups(int64_t now);
+
+    int handleRequest(Client* client, const std::string& request);
+    shared_ptr<Stream> findStream(const std::string& url);
+    std::string describe(Client* client, Stream* stream);
+
+private:
+    int port;
+    int listen_fd;
+    int rtp_fd;
+    int rtcp_fd;
+    uint16_t rtp_port;
+    int wake_fd;
+
+    std::mutex mtx;
+    std::map<std::string, shared_ptr<Stream>> streams;
+    std::vector<std::unique_ptr<Client>> clients;
+
+    std::atomic_bool quit;
+    std::thread* thread;
+    int64_t last_report;
+};
+
+/*
+ * Pipeline sink publishing an encoded H.264/H.265 stream on a
+ * RtspFanoutServer path.
+ */
+class ModuleRtspFanout : public ModuleMedia
+{
+public:
+    ModuleRtspFanout(const char* path, int port);
+    ~ModuleRtspFanout();
+
+    void setBufferCount(uint16_t buffer_count) { (void)buffer_count; }
+    void setZeroCopyThreshold(size_t bytes) { zerocopy_threshold = bytes; }
+    void setGopCache(size_t max_bytes, int speed)
+    {
+        gop_cache_max = max_bytes;
+        gop_cache_speed = speed;
+    }
+    void setMulticast(const std::string& group, int port, int ttl = 1, const std::string& iface = "")
+    {
+        mcast_group = group;
+        mcast_port = port;
+        mcast_ttl = ttl;
+        mcast_iface = iface;
+    }
+    int init() override;
+
+    bool ClientsIsEmpty();
+    void dumpStats();
+
+protected:
+    virtual ConsumeResult doConsume(shared_ptr<MediaBuffer> input_buffer, shared_ptr<MediaBuffer> output_buffer) override;
+
+private:
+    std::string path;
+    int port;
+    AnnexB::Codec codec;
+    shared_ptr<RtspFanoutServer> server;
+    shared_ptr<RtspFanoutServer::Stream> stream;
+    shared_ptr<MediaBuffer> last_extra_buffer;
+    size_t zerocopy_threshold;
+    size_t gop_cache_max;
+    int gop_cache_speed;
+    std::string mcast_group;
+    int mcast_port;
+    int mcast_ttl;
+    std::string mcast_iface;
+};
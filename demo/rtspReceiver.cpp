@@ -0,0 +1,951 @@
+#include <arpa/inet.h>
+#include <math.h>
+#include <netdb.h>
+#include <poll.h>
+#include <sys/time.h>
+#include <unistd.h>
+#include <algorithm>
+#include <chrono>
+#include <sstream>
+
+#include "rtspReceiver.hpp"
+#include "rtspUtil.hpp"
+
+#define RTP_WINDOW 512
+#define RTP_RESYNC_PACKETS 4
+#define RTP_BATCH 64
+#define RTP_SLOT_SIZE 2048
+#define RTP_RCVBUF (4 << 20)
+#define RTP_PORT_BASE 40000
+#define RTCP_REPORT_INTERVAL 5000000
+#define RTSP_IO_TIMEOUT_SEC 5
+#define RECEIVER_DEFAULT_REORDER_DELAY 40000
+#define RECEIVER_DEFAULT_TIMEOUT 5000000
+#define RECEIVER_DEFAULT_FRAME_SIZE (2 << 20)
+#define RECEIVER_RECONNECT_MIN 500000
+#define RECEIVER_DEFAULT_RECONNECT_MAX 8000000
+
+static int64_t steadyClockUs()
+{
+    return std::chrono::duration_cast<std::chrono::microseconds>(
+               std::chrono::steady_clock::now().time_since_epoch())
+        .count();
+}
+
+static inline uint32_t rd32(const uint8_t* p)
+{
+    return (uint32_t)p[0] << 24 | p[1] << 16 | p[2] << 8 | p[3];
+}
+
+static inline void wr32(uint8_t* p, uint32_t v)
+{
+    p[0] = v >> 24;
+    p[1] = v >> 16;
+    p[2] = v >> 8;
+    p[3] = v;
+}
+
+ModuleRtspReceiver::ModuleRtspReceiver(const std::string& rtsp_url, const ImagePara& para)
+    : ModuleMedia("RtspReceiver"), port(554), codec(AnnexB::CODEC_H264), payload_type(-1), session_timeout(60),
+      rtsp_fd(-1), rtp_fd(-1), rtcp_fd(-1), server_addr(), server_rtcp(), rtp_port(-1), cseq(0), connection_lost(false),
+      reconnect_max_us(RECEIVER_DEFAULT_RECONNECT_MAX), outage_since(0), started(false), base_seq(0),
+      next_seq(0), highest_seq(0), cycles(0), bad_seq(0), bad_count(0), pending(0), lost_gap(false), gap_since(0),
+      reorder_delay_us(RECEIVER_DEFAULT_REORDER_DELAY), timeout_us(RECEIVER_DEFAULT_TIMEOUT), last_packet(0),
+      last_report(0), last_keepalive(0), frame(nullptr), frame_size(0), frame_buffer_size(RECEIVER_DEFAULT_FRAME_SIZE),
+      frame_ts(0), frame_pts(0), frame_open(false), frame_broken(false), frame_key(false), frame_params(false),
+      closed_by_marker(true), wait_keyframe(true), fu_open(false), ssrc(random()), server_ssrc(0), ts_ext(0),
+      last_ts(0), have_ts(false), last_transit(0), jitter(0), last_sr(0), last_sr_clock(0), expected_prior(0),
+      received_prior(0), packets_base(0), stats(), published()
+{
+    output_para = para;
+    media_type = BUFFER_TYPE_VIDEO;
+
+    // rtsp://[user:password@]host[:port]/path
+    std::string rest = rtsp_url.compare(0, 7, "rtsp://") == 0 ? rtsp_url.substr(7) : rtsp_url;
+    size_t slash = rest.find('/');
+    std::string authority = rest.substr(0, slash);
+    std::string path = slash == std::string::npos ? "/" : rest.substr(slash);
+    size_t at = authority.rfind('@');
+    if (at != std::string::npos) {
+        std::string credentials = authority.substr(0, at);
+        authority = authority.substr(at + 1);
+        size_t colon = credentials.find(':');
+        user = credentials.substr(0, colon);
+        if (colon != std::string::npos)
+            password = credentials.substr(colon + 1);
+    }
+    size_t colon = authority.rfind(':');
+    host = authority.substr(0, colon);
+    if (colon != std::string::npos)
+        port = atoi(authority.c_str() + colon + 1);
+    url = "rtsp://" + authority + path;
+}
+
+ModuleRtspReceiver::~ModuleRtspReceiver()
+{
+    closeSession();
+}
+
+int ModuleRtspReceiver::init()
+{
+    if (openSession() < 0) {
+        closeSession();
+        return -1;
+    }
+    output_para.v4l2Fmt = codec == AnnexB::CODEC_H264 ? V4L2_PIX_FMT_H264 : V4L2_PIX_FMT_HEVC;
+
+    int ret = initBuffer();
+    if (ret < 0) {
+        ff_error("Rtsp receiver buffer init failed\n");
+        return ret;
+    }
+
+    initialize = true;
+    return 0;
+}
+
+/// @brief Output buffers hold the frames, packets wait in the pool until they are in order
+int ModuleRtspReceiver::initBuffer()
+{
+    if (buffer_count == 0)
+        buffer_count = 8;
+
+    buffer_pool.clear();
+    buffer_ptr_queue.clear();
+    for (uint16_t i = 0; i < buffer_count; i++) {
+        shared_ptr<MediaBuffer> buffer = make_shared<MediaBuffer>(0);
+        buffer->allocBuffer(frame_buffer_size);
+        if (buffer->getData() == nullptr)
+            return -1;
+        buffer->setIndex(i);
+        buffer->setMediaBufferType(BUFFER_TYPE_VIDEO);
+        buffer_pool.push_back(buffer);
+        buffer_ptr_queue.push_back(buffer);
+    }
+
+    // A full window still leaves a batch of free slots to receive into.
+    size_t count = RTP_WINDOW + RTP_BATCH;
+    pool.assign(count * RTP_SLOT_SIZE, 0);
+    slots.assign(count, Slot());
+    free_slots.clear();
+    for (size_t i = count; i > 0; i--)
+        free_slots.push_back(i - 1);
+    window.assign(RTP_WINDOW, -1);
+    msgs.resize(RTP_BATCH);
+    iovs.resize(RTP_BATCH);
+    batch.resize(RTP_BATCH);
+    return 0;
+}
+
+int ModuleRtspReceiver::connectServer()
+{
+    addrinfo hints = {};
+    addrinfo* res = nullptr;
+    hints.ai_family = AF_INET;
+    hints.ai_socktype = SOCK_STREAM;
+    if (getaddrinfo(host.c_str(), std::to_string(port).c_str(), &hints, &res) != 0 || res == nullptr) {
+        ff_error("Failed to resolve %s\n", host.c_str());
+        return -1;
+    }
+    server_addr = *(sockaddr_in*)res->ai_addr;
+    freeaddrinfo(res);
+
+    rtsp_fd = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    timeval tv = {RTSP_IO_TIMEOUT_SEC, 0};
+    setsockopt(rtsp_fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+    setsockopt(rtsp_fd, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv));
+    if (connect(rtsp_fd, (sockaddr*)&server_addr, sizeof(server_addr)) < 0) {
+        ff_error("Failed to connect %s:%d: %s\n", host.c_str(), port, strerror(errno));
+        return -1;
+    }
+    return 0;
+}
+
+std::string ModuleRtspReceiver::authorization(const std::string& method, const std::string& uri)
+{
+    if (user.empty() || realm.empty())
+        return std::string();
+    if (nonce.empty()) {
+        std::string credentials = user + ":" + password;
+        return "Authorization: Basic " + RtspUtil::base64Encode((const uint8_t*)credentials.data(), credentials.size()) + "\r\n";
+    }
+    std::string ha1 = RtspUtil::md5Hex(user + ":" + realm + ":" + password);
+    std::string ha2 = RtspUtil::md5Hex(method + ":" + uri);
+    std::string response = RtspUtil::md5Hex(ha1 + ":" + nonce + ":" + ha2);
+    return "Authorization: Digest username=\"" + user + "\", realm=\"" + realm + "\", nonce=\"" + nonce + "\", uri=\"" +
+           uri + "\", response=\"" + response + "\"\r\n";
+}
+
+int ModuleRtspReceiver::sendRequest(const std::string& method, const std::string& uri, const std::string& headers)
+{
+    std::ostringstream out;
+    out << method << " " << uri << " RTSP/1.0\r\n"
+        << "CSeq: " << ++cseq << "\r\n"
+        << "User-Agent: ff_media\r\n"
+        << authorization(method, uri);
+    if (!session.empty())
+        out << "Session: " << session << "\r\n";
+    out << headers << "\r\n";
+
+    std::string s = out.str();
+    if (send(rtsp_fd, s.data(), s.size(), MSG_NOSIGNAL) != (ssize_t)s.size()) {
+        ff_error("Failed to send rtsp %s: %s\n", method.c_str(), strerror(errno));
+        return -1;
+    }
+    return 0;
+}
+
+/// @return the status code of the reply, -1 on error
+int ModuleRtspReceiver::request(const std::string& method, const std::string& uri, const std::string& headers, std::string* reply)
+{
+    for (int attempt = 0; attempt < 2; attempt++) {
+        if (sendRequest(method, uri, headers) < 0)
+            return -1;
+
+        std::string in;
+        size_t end;
+        while ((end = in.find("\r\n\r\n")) == std::string::npos) {
+            char buf[4096];
+            ssize_t n = recv(rtsp_fd, buf, sizeof(buf), 0);
+            if (n <= 0) {
+                ff_error("No rtsp reply to %s\n", method.c_str());
+                return -1;
+            }
+            in.append(buf, n);
+        }
+        size_t length = atoi(RtspUtil::header(in, "Content-Length").c_str());
+        while (in.size() < end + 4 + length) {
+            char buf[4096];
+            ssize_t n = recv(rtsp_fd, buf, sizeof(buf), 0);
+            if (n <= 0)
+                return -1;
+            in.append(buf, n);
+        }
+
+        int status = 0;
+        sscanf(in.c_str(), "RTSP/%*s %d", &status);
+        if (status == 401 && attempt == 0 && !user.empty()) {
+            std::string auth = RtspUtil::header(in, "WWW-Authenticate");
+            realm = RtspUtil::param(auth, "realm");
+            nonce = auth.compare(0, 6, "Digest") == 0 ? RtspUtil::param(auth, "nonce") : std::string();
+            continue;
+        }
+        if (reply)
+            *reply = in;
+        return status;
+    }
+    return 401;
+}
+
+int ModuleRtspReceiver::parseSdp(const std::string& sdp, const std::string& base)
+{
+    std::istringstream in(sdp);
+    std::string line, control;
+    bool video = false;
+    while (std::getline(in, line)) {
+        if (!line.empty() && line.back() == '\r')
+            line.pop_back();
+        if (line.compare(0, 2, "m=") == 0) {
+            // Only the first video track.
+            video = payload_type < 0 && line.compare(0, 8, "m=video ") == 0;
+            if (video) {
+                std::istringstream m(line.substr(8));
+                std::string media_port, proto;
+                m >> media_port >> proto >> payload_type;
+            }
+            continue;
+        }
+        if (!video)
+            continue;
+
+        if (line.compare(0, 10, "a=control:") == 0) {
+            control = line.substr(10);
+        } else if (line.compare(0, 9, "a=rtpmap:") == 0) {
+            if (line.find("H265/") != std::string::npos || line.find("HEVC/") != std::string::npos)
+                codec = AnnexB::CODEC_H265;
+            else if (line.find("H264/") == std::string::npos)
+                payload_type = -1;
+        } else if (line.compare(0, 7, "a=fmtp:") == 0) {
+            std::string fmtp = line.substr(line.find(' ') + 1);
+            std::vector<std::string> sets;
+            std::string sprop = RtspUtil::param(fmtp, "sprop-parameter-sets");
+            for (size_t pos = 0; !sprop.empty() && pos != std::string::npos;) {
+                size_t comma = sprop.find(',', pos);
+                sets.push_back(sprop.substr(pos, comma == std::string::npos ? comma : comma - pos));
+                pos = comma == std::string::npos ? comma : comma + 1;
+            }
+            for (const char* key : {"sprop-vps", "sprop-sps", "sprop-pps"}) {
+                std::string value = RtspUtil::param(fmtp, key);
+                if (!value.empty())
+                    sets.push_back(value);
+            }
+            param_sets.clear();
+            for (auto& set : sets) {
+                std::vector<uint8_t> nal = RtspUtil::base64Decode(set);
+                param_sets.insert(param_sets.end(), {0, 0, 0, 1});
+                param_sets.insert(param_sets.end(), nal.begin(), nal.end());
+            }
+        }
+    }
+
+    if (payload_type < 0) {
+        ff_error("No H264/H265 video in the sdp of %s\n", url.c_str());
+        return -1;
+    }
+    if (control.empty() || control == "*")
+        control_url = base;
+    else if (control.compare(0, 7, "rtsp://") == 0)
+        control_url = control;
+    else
+        control_url = base + (base.back() == '/' ? "" : "/") + control;
+    return 0;
+}
+
+int ModuleRtspReceiver::openUdp()
+{
+    sockaddr_in addr = {};
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_ANY);
+
+    // An even RTP port with RTCP on the next one, from a random start so receivers spread out.
+    uint16_t start = RTP_PORT_BASE + (random() % 10000) * 2;
+    for (int i = 0; i < 100; i++) {
+        uint16_t p = RTP_PORT_BASE + (start - RTP_PORT_BASE + i * 2) % 20000;
+        rtp_fd = socket(AF_INET, SOCK_DGRAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+        rtcp_fd = socket(AF_INET, SOCK_DGRAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+        addr.sin_port = htons(p);
+        bool ok = bind(rtp_fd, (sockaddr*)&addr, sizeof(addr)) == 0;
+        addr.sin_port = htons(p + 1);
+        ok = ok && bind(rtcp_fd, (sockaddr*)&addr, sizeof(addr)) == 0;
+        if (ok) {
+            int rcvbuf = RTP_RCVBUF;
+            setsockopt(rtp_fd, SOL_SOCKET, SO_RCVBUF, &rcvbuf, sizeof(rcvbuf));
+            return p;
+        }
+        close(rtp_fd);
+        close(rtcp_fd);
+        rtp_fd = rtcp_fd = -1;
+    }
+    ff_error("No free rtp port pair\n");
+    return -1;
+}
+
+int ModuleRtspReceiver::openSession()
+{
+    std::string reply;
+    if (connectServer() < 0)
+        return -1;
+
+    int status = request("OPTIONS", url, "", &reply);
+    status = request("DESCRIBE", url, "Accept: application/sdp\r\n", &reply);
+    if (status != 200) {
+        ff_error("Rtsp DESCRIBE %s failed: %d\n", url.c_str(), status);
+        return -1;
+    }
+    std::string base = RtspUtil::header(reply, "Content-Base");
+    if (base.empty())
+        base = RtspUtil::header(reply, "Content-Location");
+    if (base.empty())
+        base = url;
+    if (parseSdp(reply.substr(reply.find("\r\n\r\n") + 4), base) < 0)
+        return -1;
+
+    if (rtp_fd < 0 && (rtp_port = openUdp()) < 0)
+        return -1;
+    std::string transport = "Transport: RTP/AVP;unicast;client_port=" + std::to_string(rtp_port) + "-" +
+                            std::to_string(rtp_port + 1) + "\r\n";
+    status = request("SETUP", control_url, transport, &reply);
+    if (status != 200) {
+        ff_error("Rtsp SETUP %s failed: %d\n", control_url.c_str(), status);
+        return -1;
+    }
+
+    std::string value = RtspUtil::header(reply, "Session");
+    session = value.substr(0, value.find(';'));
+    std::string timeout = RtspUtil::param(value, "timeout");
+    if (!timeout.empty() && atoi(timeout.c_str()) > 0)
+        session_timeout = atoi(timeout.c_str());
+    value = RtspUtil::header(reply, "Transport");
+    int server_rtp = 0, server_rtcp_port = 0;
+    if (sscanf(RtspUtil::param(value, "server_port").c_str(), "%d-%d", &server_rtp, &server_rtcp_port) == 1)
+        server_rtcp_port = server_rtp + 1;
+    server_rtcp = server_addr;
+    server_rtcp.sin_port = htons(server_rtcp_port);
+
+    status = request("PLAY", url, "Range: npt=0.000-\r\n", &reply);
+    if (status != 200) {
+        ff_error("Rtsp PLAY %s failed: %d\n", url.c_str(), status);
+        return -1;
+    }
+
+    // Replies to keepalives are read without waiting from now on.
+    fcntl(rtsp_fd, F_SETFL, fcntl(rtsp_fd, F_GETFL) | O_NONBLOCK);
+    last_packet = last_keepalive = last_report = steadyClockUs();
+    ff_info("Rtsp receiver %s: %s, rtp port %d, session timeout %d s\n", url.c_str(),
+            codec == AnnexB::CODEC_H264 ? "H264" : "H265", rtp_port, session_timeout);
+    return 0;
+}
+
+void ModuleRtspReceiver::closeSession(bool keep_udp)
+{
+    if (rtsp_fd >= 0 && !session.empty())
+        sendRequest("TEARDOWN", url, "");
+    session.clear();
+    for (int* fd : {&rtsp_fd, &rtp_fd, &rtcp_fd}) {
+        if (keep_udp && fd != &rtsp_fd)
+            continue;
+        if (*fd >= 0)
+            close(*fd);
+        *fd = -1;
+    }
+}
+
+/// @brief Forget the packets and the frame of the old session, the next frame is a keyframe
+void ModuleRtspReceiver::resetReceiver()
+{
+    for (int& w : window) {
+        if (w >= 0)
+            free_slots.push_back(w);
+        w = -1;
+    }
+    pending = 0;
+    started = false;
+    cycles = 0;
+    bad_count = 0;
+    lost_gap = false;
+    gap_since = 0;
+    frame_open = false;
+    fu_open = false;
+    closed_by_marker = true;
+    wait_keyframe = true;
+    have_ts = false;
+    last_sr = 0;
+    expected_prior = 0;
+    received_prior = 0;
+    packets_base = stats.packets;
+
+    // Packets of the old session still queued would not fit the new numbering.
+    uint8_t buf[RTP_SLOT_SIZE];
+    for (int fd : {rtp_fd, rtcp_fd}) {
+        while (fd >= 0 && recv(fd, buf, sizeof(buf), MSG_DONTWAIT) > 0) {
+        }
+    }
+}
+
+/// @brief Open the session again until it works, waiting longer after each failure
+/// @return false if the stream has to end
+bool ModuleRtspReceiver::reconnect()
+{
+    if (reconnect_max_us <= 0)
+        return false;
+
+    AnnexB::Codec old_codec = codec;
+    std::vector<uint8_t> old_params = param_sets;
+    if (outage_since == 0)
+        outage_since = last_packet;
+    closeSession(true);
+    resetReceiver();
+
+    int64_t backoff = RECEIVER_RECONNECT_MIN;
+    for (int attempt = 1;; attempt++) {
+        if (getModuleStatus() == STATUS_STOPED)
+            return false;
+        ff_warn("Rtsp receiver %s: reconnecting, attempt %d\n", url.c_str(), attempt);
+        payload_type = -1;
+        codec = AnnexB::CODEC_H264;
+        if (openSession() == 0)
+            break;
+        closeSession(true);
+
+        int64_t until = steadyClockUs() + backoff;
+        while (steadyClockUs() < until && getModuleStatus() != STATUS_STOPED)
+            usleep(std::min<int64_t>(until - steadyClockUs(), 100000) + 1);
+        backoff = std::min(backoff * 2, reconnect_max_us);
+    }
+    connection_lost = false;
+
+    // The decoder after us was set up for the old stream.
+    if (codec != old_codec || (!old_params.empty() && !param_sets.empty() && param_sets != old_params)) {
+        ff_error("Rtsp receiver %s: the stream changed after the reconnect, it ends here\n", url.c_str());
+        return false;
+    }
+    if (param_sets.empty())
+        param_sets = old_params;
+    return true;
+}
+
+/// @brief Read what is waiting on the sockets, the RTP socket in batches
+/// @return packets received
+int ModuleRtspReceiver::receive(int64_t wait_us)
+{
+    pollfd fds[3] = {{rtp_fd, POLLIN, 0}, {rtcp_fd, POLLIN, 0}, {rtsp_fd, POLLIN, 0}};
+    int ret = poll(fds, 3, (int)std::max<int64_t>(1, (wait_us + 999) / 1000));
+    if (ret <= 0)
+        return 0;
+
+    if (fds[1].revents & POLLIN)
+        readRtcp();
+    if (fds[2].revents & POLLIN) {
+        // Keepalive replies, nothing in them is needed.
+        char buf[1024];
+        ssize_t n;
+        while ((n = recv(rtsp_fd, buf, sizeof(buf), MSG_DONTWAIT)) > 0) {
+        }
+        if (n == 0 || (n < 0 && errno != EAGAIN && errno != EINTR)) {
+            ff_warn("Rtsp receiver %s: the rtsp connection closed\n", url.c_str());
+            connection_lost = true;
+            close(rtsp_fd);
+            rtsp_fd = -1;
+        }
+    }
+    if (!(fds[0].revents & POLLIN))
+        return 0;
+
+    int received = 0;
+    int accepted = 0;
+    while (true) {
+        size_t n = std::min<size_t>(RTP_BATCH, free_slots.size());
+        for (size_t i = 0; i < n; i++) {
+            batch[i] = free_slots[free_slots.size() - 1 - i];
+            iovs[i].iov_base = pool.data() + (size_t)batch[i] * RTP_SLOT_SIZE;
+            iovs[i].iov_len = RTP_SLOT_SIZE;
+            memset(&msgs[i], 0, sizeof(msgs[i]));
+            msgs[i].msg_hdr.msg_iov = &iovs[i];
+            msgs[i].msg_hdr.msg_iovlen = 1;
+        }
+
+        int got = recvmmsg(rtp_fd, msgs.data(), n, MSG_DONTWAIT, nullptr);
+        stats.recv_calls++;
+        if (got <= 0)
+            break;
+
+        int64_t now = steadyClockUs();
+        free_slots.resize(free_slots.size() - got);
+        for (int i = 0; i < got; i++) {
+            slots[batch[i]].size = (msgs[i].msg_hdr.msg_flags & MSG_TRUNC) ? 0 : msgs[i].msg_len;
+            accepted += insert(batch[i], now);
+        }
+        received += got;
+        // A short batch means the socket is drained.
+        if ((size_t)got < n || received >= RTP_WINDOW)
+            break;
+    }
+
+    // Only packets that fit the stream count as alive, a sender looping over old numbers times out.
+    if (accepted > 0)
+        last_packet = steadyClockUs();
+    return received;
+}
+
+/// @brief Parse a received packet and put it in the reorder window
+/// @return true if the packet went into the window
+bool ModuleRtspReceiver::insert(uint16_t index, int64_t now)
+{
+    Slot& slot = slots[index];
+    const uint8_t* p = pool.data() + (size_t)index * RTP_SLOT_SIZE;
+    size_t size = slot.size;
+    size_t header = 12 + (p[0] & 0x0f) * 4;
+
+    if (size < 12 || (p[0] >> 6) != 2 || (p[1] & 0x7f) != payload_type) {
+        free_slots.push_back(index);
+        return false;
+    }
+    if ((p[0] & 0x10) && size >= header + 4)
+        header += 4 + ((p[header + 2] << 8 | p[header + 3]) * 4);
+    size_t padding = (p[0] & 0x20) ? p[size - 1] : 0;
+    if (header + padding >= size) {
+        free_slots.push_back(index);
+        return false;
+    }
+
+    slot.seq = p[2] << 8 | p[3];
+    slot.timestamp = rd32(p + 4);
+    slot.marker = p[1] & 0x80;
+    slot.offset = header;
+    slot.size = size - header - padding;
+    server_ssrc = rd32(p + 8);
+    stats.packets++;
+
+    // Interarrival jitter on the 90 kHz clock.
+    int64_t transit = now * 9 / 100 - slot.timestamp;
+    if (started) {
+        int64_t d = (int32_t)(transit - last_transit);
+        jitter += (fabs((double)d) - jitter) / 16;
+    }
+    last_transit = transit;
+
+    if (!started) {
+        started = true;
+        base_seq = next_seq = highest_seq = slot.seq;
+    }
+
+    int16_t delta = slot.seq - next_seq;
+    if (delta < 0 && delta > -RTP_WINDOW) {
+        stats.late++;
+        free_slots.push_back(index);
+        return false;
+    }
+    if (delta < 0 || delta >= RTP_WINDOW) {
+        // A stray packet is dropped; a run of them in sequence means the sender restarted
+        // its numbering, start over from there (RFC 3550 A.1).
+        if (bad_count > 0 && slot.seq == bad_seq)
+            bad_count++;
+        else
+            bad_count = 1;
+        bad_seq = slot.seq + 1;
+        if (bad_count < RTP_RESYNC_PACKETS) {
+            free_slots.push_back(index);
+            return false;
+        }
+
+        ff_warn("Rtsp receiver %s: sequence jumped by %d\n", url.c_str(), delta);
+        for (int& w : window) {
+            if (w >= 0)
+                free_slots.push_back(w);
+            w = -1;
+        }
+        if (delta > 0)
+            stats.lost += delta - pending;
+        pending = 0;
+        next_seq = slot.seq;
+        lost_gap = true;
+        gap_since = 0;
+        // The receiver report counts from the new numbering.
+        base_seq = highest_seq = slot.seq;
+        cycles = 0;
+        packets_base = stats.packets - 1;
+        expected_prior = 0;
+        received_prior = 0;
+    }
+    bad_count = 0;
+
+    int& w = window[slot.seq % RTP_WINDOW];
+    if (w >= 0) {
+        stats.duplicates++;
+        free_slots.push_back(index);
+        return false;
+    }
+    w = index;
+    pending++;
+
+    if ((int16_t)(slot.seq - highest_seq) > 0) {
+        if (slot.seq < highest_seq)
+            cycles += 1 << 16;
+        highest_seq = slot.seq;
+    } else if (slot.seq != highest_seq) {
+        stats.reordered++;
+    }
+    return true;
+}
+
+void ModuleRtspReceiver::readRtcp()
+{
+    uint8_t buf[1500];
+    ssize_t n;
+    while ((n = recv(rtcp_fd, buf, sizeof(buf), MSG_DONTWAIT)) > 0) {
+        // The middle of the NTP time of a sender report goes back in our receiver reports.
+        if (n >= 28 && buf[1] == 200) {
+            last_sr = rd32(buf + 8) << 16 | rd32(buf + 12) >> 16;
+            last_sr_clock = steadyClockUs();
+        }
+    }
+}
+
+/// @brief RTCP receiver report with a CNAME, as RFC 3550 asks for
+void ModuleRtspReceiver::sendReport(int64_t now)
+{
+    last_report = now;
+    if (!started || rtcp_fd < 0)
+        return;
+
+    uint64_t extended = cycles + highest_seq;
+    uint64_t expected = extended - base_seq + 1;
+    uint64_t received = stats.packets - packets_base;
+    int64_t lost = (int64_t)expected - (int64_t)received;
+    lost = std::max<int64_t>(std::min<int64_t>(lost, 0x7fffff), -0x800000);
+    int64_t expected_interval = expected - expected_prior;
+    int64_t lost_interval = expected_interval - (int64_t)(received - received_prior);
+    uint8_t fraction = expected_interval > 0 && lost_interval > 0 ? (lost_interval << 8) / expected_interval : 0;
+    expected_prior = expected;
+    received_prior = received;
+
+    uint8_t rr[52] = {};
+    rr[0] = 0x81;
+    rr[1] = 201;
+    rr[3] = 7;
+    wr32(rr + 4, ssrc);
+    wr32(rr + 8, server_ssrc);
+    wr32(rr + 12, (uint32_t)fraction << 24 | ((uint32_t)lost & 0xffffff));
+    wr32(rr + 16, extended);
+    wr32(rr + 20, (uint32_t)jitter);
+    wr32(rr + 24, last_sr);
+    wr32(rr + 28, last_sr ? (uint32_t)((now - last_sr_clock) * 65536 / 1000000) : 0);
+
+    uint8_t* sdes = rr + 32;
+    sdes[0] = 0x81;
+    sdes[1] = 202;
+    sdes[3] = 4;
+    wr32(sdes + 4, ssrc);
+    sdes[8] = 1;
+    sdes[9] = 8;
+    memcpy(sdes + 10, "ff_media", 8);
+    sendto(rtcp_fd, rr, sizeof(rr), MSG_DONTWAIT, (sockaddr*)&server_rtcp, sizeof(server_rtcp));
+}
+
+void ModuleRtspReceiver::keepAlive(int64_t now)
+{
+    if (rtsp_fd < 0 || now - last_keepalive < session_timeout * 1000000LL / 2)
+        return;
+    last_keepalive = now;
+    sendRequest("GET_PARAMETER", url, "");
+}
+
+bool ModuleRtspReceiver::append(const uint8_t* data, size_t size)
+{
+    if (frame_size + size > frame_buffer_size) {
+        if (!frame_broken)
+            ff_warn("Rtsp receiver %s: frame larger than %zu bytes\n", url.c_str(), frame_buffer_size);
+        return false;
+    }
+    memcpy(frame + frame_size, data, size);
+    frame_size += size;
+    return true;
+}
+
+/// @brief Start code and NAL header, with the SDP parameter sets before a keyframe that has none
+bool ModuleRtspReceiver::beginNal(const uint8_t* header, size_t header_size, uint8_t type)
+{
+    static const uint8_t start_code[4] = {0, 0, 0, 1};
+    if (AnnexB::isParameterSet(codec, type))
+        frame_params = true;
+    if (AnnexB::isKeyframe(codec, type)) {
+        if (!frame_params && !param_sets.empty() && !append(param_sets.data(), param_sets.size()))
+            return false;
+        frame_params = true;
+        frame_key = true;
+    }
+    return append(start_code, 4) && append(header, header_size);
+}
+
+bool ModuleRtspReceiver::appendNal(const uint8_t* nal, size_t size)
+{
+    size_t header = codec == AnnexB::CODEC_H264 ? 1 : 2;
+    if (size < header)
+        return false;
+    uint8_t type = codec == AnnexB::CODEC_H264 ? nal[0] & 0x1f : (nal[0] >> 1) & 0x3f;
+    return beginNal(nal, header, type) && append(nal + header, size - header);
+}
+
+/// @brief RFC 6184 / RFC 7798 payload into the frame, single NAL, aggregation and fragmentation units
+/// @return false if the packet can not be used
+bool ModuleRtspReceiver::depacketize(const uint8_t* p, size_t size)
+{
+    if (codec == AnnexB::CODEC_H264) {
+        uint8_t type = p[0] & 0x1f;
+        if (type >= 1 && type <= 23)
+            return appendNal(p, size);
+        if (type == 24) {
+            for (size_t off = 1; off + 2 <= size;) {
+                size_t n = p[off] << 8 | p[off + 1];
+                off += 2;
+                if (off + n > size || !appendNal(p + off, n))
+                    return false;
+                off += n;
+            }
+            return true;
+        }
+        if (type == 28 && size > 2) {
+            if (p[1] & 0x80) {
+                uint8_t header = (p[0] & 0xe0) | (p[1] & 0x1f);
+                fu_open = beginNal(&header, 1, header & 0x1f);
+            }
+            if (!fu_open || !append(p + 2, size - 2))
+                return false;
+            fu_open = !(p[1] & 0x40);
+            return true;
+        }
+        return false;
+    }
+
+    if (size < 3)
+        return false;
+    uint8_t type = (p[0] >> 1) & 0x3f;
+    if (type < 48)
+        return appendNal(p, size);
+    if (type == 48) {
+        for (size_t off = 2; off + 2 <= size;) {
+            size_t n = p[off] << 8 | p[off + 1];
+            off += 2;
+            if (off + n > size || !appendNal(p + off, n))
+                return false;
+            off += n;
+        }
+        return true;
+    }
+    if (type == 49 && size > 3) {
+        if (p[2] & 0x80) {
+            uint8_t header[2] = {(uint8_t)((p[0] & 0x81) | (p[2] & 0x3f) << 1), p[1]};
+            fu_open = beginNal(header, 2, p[2] & 0x3f);
+        }
+        if (!fu_open || !append(p + 3, size - 3))
+            return false;
+        fu_open = !(p[2] & 0x40);
+        return true;
+    }
+    return false;
+}
+
+/// @return true if the frame went into the buffer, false if it was dropped
+bool ModuleRtspReceiver::finishFrame(MediaBuffer* buffer)
+{
+    frame_open = false;
+    fu_open = false;
+    if (frame_size == 0)
+        return false;
+
+    if (frame_broken || (wait_keyframe && !frame_key)) {
+        stats.dropped_frames++;
+        wait_keyframe = true;
+        return false;
+    }
+    wait_keyframe = false;
+    stats.frames++;
+    if (outage_since) {
+        stats.reconnects++;
+        stats.last_gap_ms = (steadyClockUs() - outage_since) / 1000;
+        ff_info("Rtsp receiver %s: back after %u ms\n", url.c_str(), stats.last_gap_ms);
+        outage_since = 0;
+    }
+
+    buffer->setEos(false);
+    buffer->setActiveData(frame);
+    buffer->setActiveSize(frame_size);
+    buffer->setPUstimestamp(frame_pts);
+    buffer->setDUstimestamp(frame_pts);
+    return true;
+}
+
+/// @brief Depacketize the packets that are in order until a frame is complete
+/// @return true if the buffer holds a frame
+bool ModuleRtspReceiver::assemble(MediaBuffer* buffer, int64_t now)
+{
+    while (pending > 0) {
+        int index = window[next_seq % RTP_WINDOW];
+        if (index < 0) {
+            // Wait a little for a packet that may only be late.
+            if (gap_since == 0)
+                gap_since = now;
+            if (now - gap_since < reorder_delay_us && pending < RTP_WINDOW / 2)
+                return false;
+            stats.lost++;
+            next_seq++;
+            lost_gap = true;
+            continue;
+        }
+        gap_since = 0;
+
+        Slot& slot = slots[index];
+        if (lost_gap && frame_open)
+            frame_broken = true;
+        if (frame_open && slot.timestamp != frame_ts) {
+            // The marker packet went missing, the frame ends here.
+            closed_by_marker = false;
+            if (finishFrame(buffer))
+                return true;
+        }
+
+        if (!frame_open) {
+            // A loss right after a complete frame took the start of this one.
+            frame_broken = lost_gap && closed_by_marker;
+            frame_open = true;
+            frame_size = 0;
+            frame_key = false;
+            frame_params = false;
+            fu_open = false;
+            frame_ts = slot.timestamp;
+            if (have_ts)
+                ts_ext += (int32_t)(slot.timestamp - last_ts);
+            else if (outage_since)
+                ts_ext += (now - outage_since) * 9 / 100;    // a new session, time went on by the outage
+            have_ts = true;
+            last_ts = slot.timestamp;
+            frame_pts = ts_ext * 100 / 9;
+        }
+        lost_gap = false;
+
+        window[next_seq % RTP_WINDOW] = -1;
+        pending--;
+        next_seq++;
+        free_slots.push_back(index);
+        const uint8_t* payload = pool.data() + (size_t)index * RTP_SLOT_SIZE + slot.offset;
+        if (!frame_broken && !depacketize(payload, slot.size))
+            frame_broken = true;
+
+        if (slot.marker) {
+            closed_by_marker = true;
+            if (finishFrame(buffer))
+                return true;
+        }
+    }
+    gap_since = 0;
+    return false;
+}
+
+ModuleMedia::ProduceResult ModuleRtspReceiver::doProduce(shared_ptr<MediaBuffer> buffer)
+{
+    if (buffer == nullptr)
+        return PRODUCE_FAILED;
+
+    // A frame is assembled within one call, into the buffer of that call.
+    frame = (uint8_t*)buffer->getData();
+    if (frame_open) {
+        frame_open = false;
+        lost_gap = true;
+    }
+
+    ProduceResult result = PRODUCE_SUCCESS;
+    while (true) {
+        int64_t now = steadyClockUs();
+        if (assemble(buffer.get(), now))
+            break;
+
+        bool timed_out = now - last_packet > timeout_us;
+        if (timed_out && !connection_lost)
+            ff_error("Rtsp receiver %s: no packets for %" PRId64 " ms\n", url.c_str(), timeout_us / 1000);
+        if (getModuleStatus() == STATUS_STOPED || ((timed_out || connection_lost) && !reconnect())) {
+            buffer->setActiveData(nullptr);
+            buffer->setActiveSize(0);
+            buffer->setEos(true);
+            result = PRODUCE_EOS;
+            break;
+        }
+
+        keepAlive(now);
+        if (now - last_report >= RTCP_REPORT_INTERVAL)
+            sendReport(now);
+
+        int64_t wait = gap_since ? gap_since + reorder_delay_us - now : 100000;
+        receive(std::min<int64_t>(std::max<int64_t>(wait, 1000), 100000));
+    }
+
+    stats.jitter_us = (uint32_t)(jitter * 100 / 9);
+    std::lock_guard<std::mutex> lk(stats_mtx);
+    published = stats;
+    return result;
+}
+
+ModuleRtspReceiver::Stats ModuleRtspReceiver::getStats()
+{
+    std::lock_guard<std::mutex> lk(stats_mtx);
+    return published;
+}
+
+void ModuleRtspReceiver::dumpStats()
+{
+    Stats s = getStats();
+    ff_info("rtsp receiver %s: %" PRIu64 " packets in %" PRIu64 " recvmmsg calls, %" PRIu64 " lost, %" PRIu64
+            " reordered, %" PRIu64 " late, %" PRIu64 " duplicates, jitter %u us, %" PRIu64 " frames, %" PRIu64
+            " dropped, %u reconnects, last gap %u ms\n",
+            url.c_str(), s.packets, s.recv_calls, s.lost, s.reordered, s.late, s.duplicates, s.jitter_us, s.frames,
+            s.dropped_frames, s.reconnects, s.last_gap_ms);
+}
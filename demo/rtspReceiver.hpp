@@ -0,0 +1,184 @@
+#pragma once
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "module/module_media.hpp"
+#include "annexb.hpp"
+
+/*
+ * RTSP client source receiving H.264/H.265 over RTP/UDP, for recorders
+ * pulling many cameras.
+ *
+ * Packets are read with recvmmsg, up to a batch per syscall, into a fixed
+ * pool of packet slots and put in order by a sequence number window; a
+ * missing packet is waited for up to the reorder delay, then counted as
+ * lost. Packets more than a window away are dropped, unless a few of them
+ * come in sequence: then the sender restarted its numbering and the window
+ * follows it. In order packets are depacketized straight into the output buffer,
+ * which is the only copy of the payload. A frame that lost a packet is
+ * dropped and so are the frames after it until the next keyframe, so the
+ * decoder never sees a broken reference.
+ *
+ * When the camera goes away (no packets for the timeout, or the RTSP
+ * connection closes) the session is opened again in the background with
+ * exponential backoff, keeping the UDP ports and the authentication. If
+ * the codec and parameter sets are the same, the stream goes on from the
+ * next keyframe with continuous timestamps and the pipeline after it
+ * never notices; otherwise it ends, so the pipeline can be rebuilt.
+ *
+ * The stream carries no picture size, it is taken from the ImagePara.
+ */
+class ModuleRtspReceiver : public ModuleMedia
+{
+public:
+    struct Stats {
+        uint64_t packets;
+        uint64_t lost;
+        uint64_t reordered;     // arrived after a later packet, still in time
+        uint64_t late;          // arrived after it was counted as lost
+        uint64_t duplicates;
+        uint64_t frames;
+        uint64_t dropped_frames;
+        uint64_t recv_calls;
+        uint32_t jitter_us;     // RFC 3550 interarrival jitter
+        uint32_t reconnects;
+        uint32_t last_gap_ms;   // from the last packet to the first frame after a reconnect
+    };
+
+public:
+    ModuleRtspReceiver(const std::string& url, const ImagePara& para);
+    ~ModuleRtspReceiver();
+
+    void setReorderDelay(int ms) { reorder_delay_us = ms * 1000; }
+    void setFrameBufferSize(size_t bytes) { frame_buffer_size = bytes; }
+    // No packet for this long ends the stream.
+    void setTimeout(int ms) { timeout_us = (int64_t)ms * 1000; }
+    // Longest wait between reconnect attempts, 0 ends the stream at the timeout instead.
+    void setReconnect(int max_backoff_ms) { reconnect_max_us = (int64_t)max_backoff_ms * 1000; }
+
+    int init() override;
+    Stats getStats();
+    void dumpStats();
+
+protected:
+    virtual ProduceResult doProduce(shared_ptr<MediaBuffer> buffer) override;
+    virtual int initBuffer() override;
+
+private:
+    struct Slot {
+        uint16_t seq;
+        uint32_t timestamp;
+        bool marker;
+        uint16_t offset;    // payload in the slot
+        uint16_t size;
+    };
+
+    int sendRequest(const std::string& method, const std::string& url, const std::string& headers);
+    int request(const std::string& method, const std::string& url, const std::string& headers, std::string* reply);
+    std::string authorization(const std::string& method, const std::string& url);
+    int connectServer();
+    int openSession();
+    int parseSdp(const std::string& sdp, const std::string& base);
+    int openUdp();
+    void closeSession(bool keep_udp = false);
+    bool reconnect();
+    void resetReceiver();
+
+    int receive(int64_t wait_us);
+    bool insert(uint16_t slot, int64_t now);
+    void readRtcp();
+    void sendReport(int64_t now);
+    void keepAlive(int64_t now);
+
+    bool assemble(MediaBuffer* buffer, int64_t now);
+    bool depacketize(const uint8_t* payload, size_t size);
+    bool append(const uint8_t* data, size_t size);
+    bool beginNal(const uint8_t* header, size_t header_size, uint8_t type);
+    bool appendNal(const uint8_t* nal, size_t size);
+    bool finishFrame(MediaBuffer* buffer);
+
+private:
+    std::string url;        // without the credentials
+    std::string host;
+    int port;
+    std::string user;
+    std::string password;
+    std::string realm;
+    std::string nonce;
+    AnnexB::Codec codec;
+    int payload_type;
+    std::string control_url;
+    std::string session;
+    int session_timeout;
+    std::vector<uint8_t> param_sets;    // Annex-B, from the SDP
+
+    int rtsp_fd;
+    int rtp_fd;
+    int rtcp_fd;
+    sockaddr_in server_addr;
+    sockaddr_in server_rtcp;
+    int rtp_port;
+    int cseq;
+    bool connection_lost;
+    int64_t reconnect_max_us;
+    int64_t outage_since;       // last packet before a reconnect, until a frame comes again
+
+    // Packet pool, and the reorder window of slot numbers indexed by sequence number.
+    std::vector<uint8_t> pool;
+    std::vector<Slot> slots;
+    std::vector<uint16_t> free_slots;
+    std::vector<int> window;
+    std::vector<mmsghdr> msgs;
+    std::vector<iovec> iovs;
+    std::vector<uint16_t> batch;
+
+    bool started;
+    uint16_t base_seq;
+    uint16_t next_seq;
+    uint16_t highest_seq;
+    uint32_t cycles;
+    uint16_t bad_seq;           // next number of a run of packets outside the window
+    int bad_count;
+    size_t pending;
+    bool lost_gap;
+    int64_t gap_since;
+    int64_t reorder_delay_us;
+    int64_t timeout_us;
+    int64_t last_packet;
+    int64_t last_report;
+    int64_t last_keepalive;
+
+    // Frame being assembled into the output buffer.
+    uint8_t* frame;
+    size_t frame_size;
+    size_t frame_buffer_size;
+    uint32_t frame_ts;
+    int64_t frame_pts;
+    bool frame_open;
+    bool frame_broken;
+    bool frame_key;
+    bool frame_params;
+    bool closed_by_marker;
+    bool wait_keyframe;
+    bool fu_open;
+
+    uint32_t ssrc;
+    uint32_t server_ssrc;
+    int64_t ts_ext;             // unwrapped RTP timestamp of the newest frame
+    uint32_t last_ts;
+    bool have_ts;
+    int64_t last_transit;
+    double jitter;              // in RTP units
+    uint32_t last_sr;
+    int64_t last_sr_clock;
+    uint64_t expected_prior;
+    uint64_t received_prior;
+    uint64_t packets_base;      // packets before this session
+
+    Stats stats;                // owned by the module thread
+    std::mutex stats_mtx;
+    Stats published;
+};
@@ -0,0 +1,173 @@
+#include <stdio.h>
+#include <string.h>
+#include <strings.h>
+#include <sstream>
+
+#include "rtspUtil.hpp"
+
+static const char base64_table[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+
+std::string RtspUtil::header(const std::string& message, const char* name)
+{
+    std::istringstream in(message);
+    std::string line;
+    size_t len = strlen(name);
+    while (std::getline(in, line)) {
+        if (!line.empty() && line.back() == '\r')
+            line.pop_back();
+        if (line.empty())
+            break;
+        if (line.size() > len && line[len] == ':' && strncasecmp(line.c_str(), name, len) == 0) {
+            size_t begin = line.find_first_not_of(' ', len + 1);
+            return begin == std::string::npos ? std::string() : line.substr(begin);
+        }
+    }
+    return std::string();
+}
+
+std::string RtspUtil::param(const std::string& value, const char* key)
+{
+    size_t len = strlen(key);
+    for (size_t pos = 0; pos < value.size();) {
+        pos = value.find_first_not_of(" ,;", pos);
+        if (pos == std::string::npos)
+            break;
+        if (value.compare(pos, len, key) == 0 && pos + len < value.size() && value[pos + len] == '=') {
+            pos += len + 1;
+            if (value[pos] == '"')
+                return value.substr(pos + 1, value.find('"', pos + 1) - pos - 1);
+            return value.substr(pos, value.find_first_of(",;", pos) - pos);
+        }
+        // Skip this word or parameter, quoted values may contain separators.
+        size_t end = value.find_first_of("=,; ", pos);
+        if (end != std::string::npos && value[end] == '=') {
+            if (end + 1 < value.size() && value[end + 1] == '"')
+                end = value.find('"', end + 2);
+            else
+                end = value.find_first_of(",;", end);
+            if (end != std::string::npos)
+                end++;
+        }
+        pos = end;
+    }
+    return std::string();
+}
+
+std::string RtspUtil::urlPath(const std::string& url)
+{
+    size_t begin = 0;
+    if (url.compare(0, 7, "rtsp://") == 0) {
+        begin = url.find('/', 7);
+        if (begin == std::string::npos)
+            return "/";
+    }
+    size_t query = url.find('?', begin);
+    std::string path = url.substr(begin, query == std::string::npos ? std::string::npos : query - begin);
+    while (path.size() > 1 && path.back() == '/')
+        path.pop_back();
+    return path;
+}
+
+std::string RtspUtil::base64Encode(const uint8_t* data, size_t size)
+{
+    std::string out;
+    out.reserve((size + 2) / 3 * 4);
+    for (size_t i = 0; i < size; i += 3) {
+        uint32_t v = data[i] << 16;
+        if (i + 1 < size)
+            v |= data[i + 1] << 8;
+        if (i + 2 < size)
+            v |= data[i + 2];
+        out += base64_table[(v >> 18) & 0x3f];
+        out += base64_table[(v >> 12) & 0x3f];
+        out += i + 1 < size ? base64_table[(v >> 6) & 0x3f] : '=';
+        out += i + 2 < size ? base64_table[v & 0x3f] : '=';
+    }
+    return out;
+}
+
+std::vector<uint8_t> RtspUtil::base64Decode(const std::string& text)
+{
+    std::vector<uint8_t> out;
+    uint32_t v = 0;
+    int bits = 0;
+    for (char c : text) {
+        const char* p = c ? strchr(base64_table, c) : nullptr;
+        if (p == nullptr)
+            continue;
+        v = (v << 6) | (p - base64_table);
+        bits += 6;
+        if (bits >= 8) {
+            bits -= 8;
+            out.push_back(v >> bits);
+        }
+    }
+    return out;
+}
+
+std::string RtspUtil::md5Hex(const std::string& text)
+{
+    static const uint32_t k[64] = {
+        0xd76aa478, 0xe8c7b756, 0x242070db, 0xc1bdceee, 0xf57c0faf, 0x4787c62a, 0xa8304613, 0xfd469501,
+        0x698098d8, 0x8b44f7af, 0xffff5bb1, 0x895cd7be, 0x6b901122, 0xfd987193, 0xa679438e, 0x49b40821,
+        0xf61e2562, 0xc040b340, 0x265e5a51, 0xe9b6c7aa, 0xd62f105d, 0x02441453, 0xd8a1e681, 0xe7d3fbc8,
+        0x21e1cde6, 0xc33707d6, 0xf4d50d87, 0x455a14ed, 0xa9e3e905, 0xfcefa3f8, 0x676f02d9, 0x8d2a4c8a,
+        0xfffa3942, 0x8771f681, 0x6d9d6122, 0xfde5380c, 0xa4beea44, 0x4bdecfa9, 0xf6bb4b60, 0xbebfbc70,
+        0x289b7ec6, 0xeaa127fa, 0xd4ef3085, 0x04881d05, 0xd9d4d039, 0xe6db99e5, 0x1fa27cf8, 0xc4ac5665,
+        0xf4292244, 0x432aff97, 0xab9423a7, 0xfc93a039, 0x655b59c3, 0x8f0ccc92, 0xffeff47d, 0x85845dd1,
+        0x6fa87e4f, 0xfe2ce6e0, 0xa3014314, 0x4e0811a1, 0xf7537e82, 0xbd3af235, 0x2ad7d2bb, 0xeb86d391,
+    };
+    static const uint8_t r[16] = {7, 12, 17, 22, 5, 9, 14, 20, 4, 11, 16, 23, 6, 10, 15, 21};
+
+    std::vector<uint8_t> msg(text.begin(), text.end());
+    uint64_t bits = (uint64_t)text.size() * 8;
+    msg.push_back(0x80);
+    while (msg.size() % 64 != 56)
+        msg.push_back(0);
+    for (int i = 0; i < 8; i++)
+        msg.push_back(bits >> (i * 8));
+
+    uint32_t h[4] = {0x67452301, 0xefcdab89, 0x98badcfe, 0x10325476};
+    for (size_t off = 0; off < msg.size(); off += 64) {
+        uint32_t w[16];
+        for (int i = 0; i < 16; i++)
+            w[i] = msg[off + i * 4] | msg[off + i * 4 + 1] << 8 | msg[off + i * 4 + 2] << 16 | (uint32_t)msg[off + i * 4 + 3] << 24;
+
+        uint32_t a = h[0], b = h[1], c = h[2], d = h[3];
+        for (int i = 0; i < 64; i++) {
+            uint32_t f;
+            int g;
+            if (i < 16) {
+                f = (b & c) | (~b & d);
+                g = i;
+            } else if (i < 32) {
+                f = (d & b) | (~d & c);
+                g = (5 * i + 1) % 16;
+            } else if (i < 48) {
+                f = b ^ c ^ d;
+                g = (3 * i + 5) % 16;
+            } else {
+                f = c ^ (b | ~d);
+                g = (7 * i) % 16;
+            }
+            uint32_t rot = r[(i / 16) * 4 + i % 4];
+            f += a + k[i] + w[g];
+            a = d;
+            d = c;
+            c = b;
+            b += (f << rot) | (f >> (32 - rot));
+        }
+        h[0] += a;
+        h[1] += b;
+        h[2] += c;
+        h[3] += d;
+    }
+
+    std::string out;
+    char hex[3];
+    for (int i = 0; i < 16; i++) {
+        snprintf(hex, sizeof(hex), "%02x", (h[i / 4] >> ((i % 4) * 8)) & 0xff);
+        out += hex;
+    }
+    return out;
+}
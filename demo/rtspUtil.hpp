@@ -0,0 +1,25 @@
+#pragma once
+#include <stdint.h>
+#include <stddef.h>
+#include <string>
+#include <vector>
+
+/*
+ * Text helpers shared by the user-side RTSP server and client: header
+ * lookup, base64 for sprop parameter sets and Basic authentication, and
+ * MD5 for Digest authentication (RFC 2069 style, as cameras use it).
+ */
+class RtspUtil
+{
+public:
+    // Value of a header of a request or reply, empty if it is missing.
+    static std::string header(const std::string& message, const char* name);
+    // Value of a key="value" or key=value parameter inside a header value.
+    static std::string param(const std::string& value, const char* key);
+    // Path of a rtsp:// URL, without host, query and trailing slash.
+    static std::string urlPath(const std::string& url);
+
+    static std::string base64Encode(const uint8_t* data, size_t size);
+    static std::vector<uint8_t> base64Decode(const std::string& text);
+    static std::string md5Hex(const std::string& text);
+};
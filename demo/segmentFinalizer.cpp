@@ -0,0 +1,113 @@
+#include <chrono>
+#include <inttypes.h>
+#include <algorithm>
+
+#include "base/ff_log.h"
+#include "segmentFinalizer.hpp"
+
+static int64_t steadyClockUs()
+{
+    return std::chrono::duration_cast<std::chrono::microseconds>(
+               std::chrono::steady_clock::now().time_since_epoch())
+        .count();
+}
+
+SegmentFinalizer::SegmentFinalizer(size_t max_pending)
+    : max_pending(max_pending > 0 ? max_pending : 1), finished_callback(nullptr), busy(false), quit(false),
+      thread(nullptr), finished(0), rejected(0), max_close_us(0)
+{
+    thread = new std::thread(&SegmentFinalizer::finalizerProcess, this);
+}
+
+SegmentFinalizer::~SegmentFinalizer()
+{
+    {
+        std::lock_guard<std::mutex> lk(mtx);
+        quit = true;
+        cond.notify_one();
+    }
+    thread->join();
+    delete thread;
+    thread = nullptr;
+}
+
+bool SegmentFinalizer::hasRoom()
+{
+    std::lock_guard<std::mutex> lk(mtx);
+    return jobs.size() < max_pending;
+}
+
+bool SegmentFinalizer::tryPush(const std::string& path, CloseFunction close)
+{
+    std::lock_guard<std::mutex> lk(mtx);
+    if (jobs.size() >= max_pending) {
+        rejected++;
+        return false;
+    }
+    jobs.push_back({path, std::move(close)});
+    cond.notify_one();
+    return true;
+}
+
+void SegmentFinalizer::push(const std::string& path, CloseFunction close)
+{
+    std::unique_lock<std::mutex> lk(mtx);
+    if (jobs.size() >= max_pending)
+        rejected++;
+    done_cond.wait(lk, [this] { return jobs.size() < max_pending; });
+    jobs.push_back({path, std::move(close)});
+    cond.notify_one();
+}
+
+void SegmentFinalizer::flush()
+{
+    std::unique_lock<std::mutex> lk(mtx);
+    done_cond.wait(lk, [this] { return jobs.empty() && !busy; });
+}
+
+size_t SegmentFinalizer::pending()
+{
+    std::lock_guard<std::mutex> lk(mtx);
+    return jobs.size() + busy;
+}
+
+void SegmentFinalizer::finalizerProcess()
+{
+    std::unique_lock<std::mutex> lk(mtx);
+    while (true) {
+        if (jobs.empty()) {
+            // Everything queued before quit is still closed.
+            if (quit)
+                break;
+            cond.wait(lk);
+            continue;
+        }
+
+        // Moved out, so the closure holds the only reference to what it closes.
+        Job job = std::move(jobs.front());
+        jobs.pop_front();
+        busy = true;
+        lk.unlock();
+
+        int64_t start = steadyClockUs();
+        job.close();
+        job.close = nullptr;
+        uint64_t elapsed = steadyClockUs() - start;
+        ff_info("Finalized %s in %" PRIu64 " us\n", job.path.c_str(), elapsed);
+        if (finished_callback)
+            finished_callback(job.path);
+
+        lk.lock();
+        busy = false;
+        finished++;
+        max_close_us = std::max(max_close_us, elapsed);
+        done_cond.notify_all();
+    }
+}
+
+void SegmentFinalizer::dumpStats(const char* name)
+{
+    std::lock_guard<std::mutex> lk(mtx);
+    ff_info("%s finalizer: %" PRIu64 " files closed, longest %" PRIu64 " us, %" PRIu64 " closes found it full\n",
+            name, finished, max_close_us, rejected);
+}
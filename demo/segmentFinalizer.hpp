@@ -0,0 +1,67 @@
+#pragma once
+#include <stdint.h>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <thread>
+
+/*
+ * Background thread closing finished recording files.
+ *
+ * Closing a file can take long, a regular MP4 writes its whole index and a
+ * fragmented one drains its write-behind queue, so writers hand the close
+ * over here and continue in the next file at once. At most max_pending
+ * closes wait at a time, a writer finding no room keeps writing its old
+ * file instead of piling up open ones. The finished callback runs on this
+ * thread after the file is closed, so it only ever sees complete files.
+ */
+class SegmentFinalizer
+{
+public:
+    using CloseFunction = std::function<void()>;
+    using FinishedCallback = std::function<void(const std::string& path)>;
+
+public:
+    SegmentFinalizer(size_t max_pending = 2);
+    // Closes everything still pending.
+    ~SegmentFinalizer();
+
+    void setFinishedCallback(FinishedCallback callback) { finished_callback = callback; }
+
+    bool hasRoom();
+    // Queue the close of path, false without room.
+    bool tryPush(const std::string& path, CloseFunction close);
+    // Queue the close of path, waits for room.
+    void push(const std::string& path, CloseFunction close);
+    // Wait until every queued close is done.
+    void flush();
+
+    size_t pending();
+    void dumpStats(const char* name);
+
+private:
+    struct Job {
+        std::string path;
+        CloseFunction close;
+    };
+
+    void finalizerProcess();
+
+private:
+    size_t max_pending;
+    FinishedCallback finished_callback;
+
+    std::mutex mtx;
+    std::condition_variable cond;
+    std::condition_variable done_cond;
+    std::deque<Job> jobs;
+    bool busy;
+    bool quit;
+    std::thread* thread;
+
+    uint64_t finished;
+    uint64_t rejected;
+    uint64_t max_close_us;
+};
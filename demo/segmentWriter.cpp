@@ -0,0 +1,399 @@
+#include <chrono>
+#include <algorithm>
+
+#include "segmentWriter.hpp"
+
+#define SEGMENT_RETRY_MIN_MS 500
+#define SEGMENT_RETRY_MAX_MS 30000
+
+// Expose the consume entry points so a segment can be fed without being a pipeline stage.
+class SegmentVideoFile : public ModuleFileWriter
+{
+public:
+    using ModuleFileWriter::ModuleFileWriter;
+    using ModuleFileWriter::doConsume;
+};
+
+class SegmentAudioFile : public ModuleFileWriterExtend
+{
+public:
+    using ModuleFileWriterExtend::ModuleFileWriterExtend;
+    using ModuleFileWriterExtend::doConsume;
+};
+
+struct ModuleSegmentWriter::Segment {
+    std::string path;
+    shared_ptr<SegmentVideoFile> video;
+    shared_ptr<SegmentAudioFile> audio;
+    shared_ptr<Fmp4Muxer> fmp4;
+    int audio_writers = 0;      // audio packets being written, under seg_mtx
+};
+
+ModuleSegmentWriter::ModuleSegmentWriter(NameGenerator generator)
+    : ModuleMedia("SegmentWriter"), name_generator(generator), closed_callback(nullptr),
+      max_duration(0), max_size(0), fragment_duration(-1), prealloc_size(0), max_pending_close(2), annexb(false), codec(AnnexB::CODEC_H264), video_codec(MEDIA_CODEC_UNKNOWN),
+      last_extra_buffer(nullptr), audio_enabled(false), audio_channels(0), audio_bits(0),
+      audio_sample_rate(0), audio_codec(MEDIA_CODEC_UNKNOWN), current(nullptr),
+      segment_start_pts(-1), segment_bytes(0), rotate_pending(false), rotate_requested(false),
+      segment_count(0), open_requested(false), next(nullptr), worker_quit(false), worker(nullptr),
+      finalizer(nullptr)
+{
+    buffer_count = 0;
+}
+
+ModuleSegmentWriter::~ModuleSegmentWriter()
+{
+    if (worker) {
+        {
+            std::lock_guard<std::mutex> lk(task_mtx);
+            worker_quit = true;
+            task_cond.notify_one();
+        }
+        worker->join();
+        delete worker;
+        worker = nullptr;
+    }
+
+    if (finalizer) {
+        for (auto seg : {next, current}) {
+            if (seg)
+                finalizer->push(seg->path, [this, seg]() mutable { closeSegment(std::move(seg)); });
+        }
+        next = current = nullptr;
+        // Waits for every pending close.
+        delete finalizer;
+        finalizer = nullptr;
+    }
+}
+
+/// @brief Switch to a new file at the next keyframe
+void ModuleSegmentWriter::requestRotate()
+{
+    rotate_requested = true;
+}
+
+void ModuleSegmentWriter::setVideoExtraData(const uint8_t* extra_data, unsigned extra_size)
+{
+    std::lock_guard<std::mutex> lk(extra_mtx);
+    video_extra.assign(extra_data, extra_data + extra_size);
+}
+
+void ModuleSegmentWriter::setAudioParameter(int channel_count, int bit_per_sample, int sample_rate, media_codec_t type)
+{
+    audio_enabled = true;
+    audio_channels = channel_count;
+    audio_bits = bit_per_sample;
+    audio_sample_rate = sample_rate;
+    audio_codec = type;
+}
+
+void ModuleSegmentWriter::setAudioExtraData(const uint8_t* extra_data, unsigned extra_size)
+{
+    std::lock_guard<std::mutex> lk(extra_mtx);
+    audio_extra.assign(extra_data, extra_data + extra_size);
+}
+
+int ModuleSegmentWriter::init()
+{
+    shared_ptr<ModuleMedia> productor = getProductor();
+    if (productor == nullptr || name_generator == nullptr) {
+        ff_error("Segment writer has no productor or file name generator\n");
+        return -1;
+    }
+
+    input_para = productor->getOutputImagePara();
+    media_type = productor->getMediaType();
+    switch (input_para.v4l2Fmt) {
+        case V4L2_PIX_FMT_H264:
+            annexb = true;
+            codec = AnnexB::CODEC_H264;
+            video_codec = MEDIA_CODEC_VIDEO_H264;
+            break;
+        case V4L2_PIX_FMT_HEVC:
+            annexb = true;
+            codec = AnnexB::CODEC_H265;
+            video_codec = MEDIA_CODEC_VIDEO_H265;
+            break;
+        case V4L2_PIX_FMT_MJPEG:
+            // every frame is a keyframe
+            video_codec = MEDIA_CODEC_VIDEO_MJPEG;
+            break;
+        default:
+            ff_error("Segment writer does not support %s\n", v4l2GetFmtName(input_para.v4l2Fmt));
+            return -1;
+    }
+
+    current = openSegment();
+    if (current == nullptr)
+        return -1;
+
+    finalizer = new SegmentFinalizer(max_pending_close);
+    finalizer->setFinishedCallback([this](const std::string& path) {
+        if (closed_callback)
+            closed_callback(path);
+    });
+    worker = new std::thread(&ModuleSegmentWriter::workerProcess, this);
+    return 0;
+}
+
+std::string ModuleSegmentWriter::getCurrentPath()
+{
+    std::lock_guard<std::mutex> lk(seg_mtx);
+    return current ? current->path : std::string();
+}
+
+/// @brief Create the next segment file with the cached stream parameters
+shared_ptr<ModuleSegmentWriter::Segment> ModuleSegmentWriter::openSegment()
+{
+    shared_ptr<Segment> seg = make_shared<Segment>();
+    seg->path = name_generator();
+
+    if (fragment_duration >= 0) {
+        if (!annexb) {
+            ff_error("Fragmented segments need H.264 or H.265\n");
+            return nullptr;
+        }
+        seg->fmp4 = make_shared<Fmp4Muxer>(seg->path);
+        seg->fmp4->setVideoTrack(codec, input_para.width, input_para.height);
+        seg->fmp4->setFragmentDuration(fragment_duration);
+        seg->fmp4->setPreallocateSize(prealloc_size);
+        {
+            std::lock_guard<std::mutex> lk(extra_mtx);
+            if (!video_extra.empty())
+                seg->fmp4->setVideoExtraData(video_extra.data(), video_extra.size());
+            if (audio_enabled) {
+                seg->fmp4->setAudioTrack(audio_channels, audio_sample_rate);
+                if (!audio_extra.empty())
+                    seg->fmp4->setAudioExtraData(audio_extra.data(), audio_extra.size());
+            }
+        }
+        if (seg->fmp4->open() < 0)
+            return nullptr;
+        segment_count++;
+        return seg;
+    }
+
+    // The segment is not attached to the pipeline, so it gets the stream parameters explicitly.
+    seg->video = make_shared<SegmentVideoFile>(input_para, seg->path);
+    seg->video->setVideoParameter(input_para.width, input_para.height, video_codec);
+    {
+        std::lock_guard<std::mutex> lk(extra_mtx);
+        if (!video_extra.empty())
+            seg->video->setVideoExtraData(video_extra.data(), video_extra.size());
+    }
+    if (seg->video->init() < 0) {
+        ff_error("Failed to open segment %s\n", seg->path.c_str());
+        return nullptr;
+    }
+
+    if (audio_enabled) {
+        seg->audio = make_shared<SegmentAudioFile>(seg->video, std::string());
+        seg->audio->setAudioParameter(audio_channels, audio_bits, audio_sample_rate, audio_codec);
+        {
+            std::lock_guard<std::mutex> lk(extra_mtx);
+            if (!audio_extra.empty())
+                seg->audio->setAudioExtraData(audio_extra.data(), audio_extra.size());
+        }
+        if (seg->audio->init() < 0) {
+            ff_warn("Failed to add audio to segment %s\n", seg->path.c_str());
+            seg->audio = nullptr;
+        }
+    }
+
+    segment_count++;
+    return seg;
+}
+
+void ModuleSegmentWriter::closeSegment(shared_ptr<Segment> segment)
+{
+    // The segment is no longer current, only an audio packet already in flight can still use it.
+    {
+        std::unique_lock<std::mutex> lk(seg_mtx);
+        seg_cond.wait(lk, [&segment]() { return segment->audio_writers == 0; });
+    }
+
+    std::string path = segment->path;
+    // The writers flush and close the file when they are released.
+    segment->audio = nullptr;
+    segment->video = nullptr;
+    if (segment->fmp4) {
+        segment->fmp4->close();
+        segment->fmp4->dumpStats();
+        segment->fmp4 = nullptr;
+    }
+    segment = nullptr;
+}
+
+void ModuleSegmentWriter::workerProcess()
+{
+    int retry_ms = SEGMENT_RETRY_MIN_MS;
+    std::unique_lock<std::mutex> lk(task_mtx);
+    while (!worker_quit) {
+        if (open_requested && next == nullptr) {
+            lk.unlock();
+            shared_ptr<Segment> seg = openSegment();
+            lk.lock();
+            if (seg) {
+                next = seg;
+                open_requested = false;
+                retry_ms = SEGMENT_RETRY_MIN_MS;
+                continue;
+            }
+
+            // The rotation stays pending and the current file keeps growing until a retry succeeds.
+            ff_error("Failed to open the next segment, retrying in %d ms\n", retry_ms);
+            task_cond.wait_for(lk, std::chrono::milliseconds(retry_ms), [this]() { return worker_quit; });
+            retry_ms = std::min(retry_ms * 2, SEGMENT_RETRY_MAX_MS);
+            continue;
+        }
+
+        task_cond.wait(lk);
+    }
+}
+
+bool ModuleSegmentWriter::isKeyframe(shared_ptr<MediaBuffer> buffer)
+{
+    if (!annexb)
+        return true;
+    AnnexB::FrameInfo info = AnnexB::parseFrame((const uint8_t*)buffer->getActiveData(), buffer->getActiveSize(), codec);
+    return info.type == AnnexB::FRAME_KEY;
+}
+
+void ModuleSegmentWriter::cacheExtraData(shared_ptr<MediaBuffer> buffer)
+{
+    shared_ptr<MediaBuffer> extra = buffer->getExtraData();
+    if (extra == nullptr || extra == last_extra_buffer || extra->getActiveSize() == 0)
+        return;
+
+    const uint8_t* data = (const uint8_t*)extra->getActiveData();
+    std::lock_guard<std::mutex> lk(extra_mtx);
+    video_extra.assign(data, data + extra->getActiveSize());
+    last_extra_buffer = extra;
+}
+
+ModuleMedia::ConsumeResult ModuleSegmentWriter::doConsume(shared_ptr<MediaBuffer> input_buffer, shared_ptr<MediaBuffer> output_buffer)
+{
+    shared_ptr<Segment> seg;
+
+    if (input_buffer == nullptr)
+        return CONSUME_SKIP;
+
+    int64_t pts = input_buffer->getPUstimestamp();
+    cacheExtraData(input_buffer);
+
+    if (rotate_pending && isKeyframe(input_buffer)) {
+        shared_ptr<Segment> ready;
+        {
+            std::lock_guard<std::mutex> lk(task_mtx);
+            if (finalizer->hasRoom()) {
+                ready = next;
+                next = nullptr;
+            }
+        }
+
+        // Keep writing the old file until the new one is open and the finalizer has room,
+        // nothing is dropped meanwhile.
+        if (ready) {
+            shared_ptr<Segment> old;
+            {
+                std::lock_guard<std::mutex> lk(seg_mtx);
+                old = current;
+                current = ready;
+            }
+            finalizer->push(old->path, [this, old]() mutable { closeSegment(std::move(old)); });
+            rotate_pending = false;
+            segment_start_pts = -1;
+            segment_bytes = 0;
+        }
+    }
+
+    {
+        std::lock_guard<std::mutex> lk(seg_mtx);
+        seg = current;
+    }
+
+    ConsumeResult ret = CONSUME_SUCCESS;
+    if (seg->fmp4)
+        seg->fmp4->writeVideo((const uint8_t*)input_buffer->getActiveData(), input_buffer->getActiveSize(), pts);
+    else
+        ret = seg->video->doConsume(input_buffer, output_buffer);
+
+    if (segment_start_pts < 0)
+        segment_start_pts = pts;
+    segment_bytes += input_buffer->getActiveSize();
+
+    if (!rotate_pending) {
+        bool rotate = rotate_requested.exchange(false);
+        rotate |= max_duration > 0 && pts - segment_start_pts >= max_duration;
+        rotate |= max_size > 0 && segment_bytes >= max_size;
+        if (rotate) {
+            rotate_pending = true;
+            std::lock_guard<std::mutex> lk(task_mtx);
+            open_requested = true;
+            task_cond.notify_one();
+        }
+    }
+
+    return ret;
+}
+
+ModuleMedia::ConsumeResult ModuleSegmentWriter::consumeAudio(shared_ptr<MediaBuffer> buffer)
+{
+    shared_ptr<Segment> seg;
+    {
+        std::lock_guard<std::mutex> lk(seg_mtx);
+        seg = current;
+        if (seg == nullptr)
+            return CONSUME_SKIP;
+        seg->audio_writers++;
+    }
+
+    ConsumeResult ret = CONSUME_SUCCESS;
+    if (seg->fmp4)
+        seg->fmp4->writeAudio((const uint8_t*)buffer->getActiveData(), buffer->getActiveSize(), buffer->getPUstimestamp());
+    else if (seg->audio)
+        ret = seg->audio->doConsume(buffer, nullptr);
+    else
+        ret = CONSUME_SKIP;
+
+    std::lock_guard<std::mutex> lk(seg_mtx);
+    if (--seg->audio_writers == 0)
+        seg_cond.notify_all();
+    return ret;
+}
+
+ModuleSegmentWriterExtend::ModuleSegmentWriterExtend(shared_ptr<ModuleSegmentWriter> writer)
+    : ModuleMedia("SegmentWriterExtend"), writer(writer)
+{
+    buffer_count = 0;
+}
+
+ModuleSegmentWriterExtend::~ModuleSegmentWriterExtend()
+{
+}
+
+int ModuleSegmentWriterExtend::init()
+{
+    shared_ptr<ModuleMedia> productor = getProductor();
+    if (writer == nullptr || productor == nullptr) {
+        ff_error("Segment writer extend has no writer or productor\n");
+        return -1;
+    }
+
+    if (!writer->audio_enabled) {
+        ff_error("Segment writer audio parameter is not set\n");
+        return -1;
+    }
+
+    input_para = productor->getOutputImagePara();
+    media_type = productor->getMediaType();
+    return 0;
+}
+
+ModuleMedia::ConsumeResult ModuleSegmentWriterExtend::doConsume(shared_ptr<MediaBuffer> input_buffer, shared_ptr<MediaBuffer> output_buffer)
+{
+    (void)output_buffer;
+    if (input_buffer == nullptr)
+        return CONSUME_SKIP;
+    return writer->consumeAudio(input_buffer);
+}
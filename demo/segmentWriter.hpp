@@ -0,0 +1,136 @@
+#pragma once
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <string>
+#include <vector>
+#include <functional>
+
+#include "module/vo/module_fileWriter.hpp"
+#include "annexb.hpp"
+#include "fmp4Muxer.hpp"
+#include "segmentFinalizer.hpp"
+
+/*
+ * Recording sink that rotates its output files on its own.
+ *
+ * When the current segment reaches the max duration or size, or a rotation
+ * is requested, a worker thread opens the next file with the cached video
+ * and audio extra data. The switch happens on the first keyframe after that,
+ * inside the consume call, so the encoder keeps running and every packet
+ * lands in exactly one segment. The old file goes to a SegmentFinalizer,
+ * which closes it off the pipeline thread while the next file is already
+ * written; when max_pending_close files are still closing, the switch
+ * waits for the next keyframe after that. When the next file can not be
+ * opened, the worker retries with a growing delay and the current file
+ * goes on meanwhile. Audio is fed through ModuleSegmentWriterExtend.
+ */
+class ModuleSegmentWriter : public ModuleMedia
+{
+    friend class ModuleSegmentWriterExtend;
+
+public:
+    using NameGenerator = std::function<std::string()>;
+    using SegmentCallback = std::function<void(const std::string& path)>;
+
+public:
+    ModuleSegmentWriter(NameGenerator generator);
+    ~ModuleSegmentWriter();
+
+    void setMaxDuration(int64_t duration_us) { max_duration = duration_us; }
+    void setMaxSize(uint64_t bytes) { max_size = bytes; }
+    // Write fragmented MP4 segments, see Fmp4Muxer. Negative keeps regular MP4.
+    void setFragmentDuration(int64_t duration_us) { fragment_duration = duration_us; }
+    // Preallocation step of fragmented segments, e.g. the expected segment size.
+    void setPreallocateSize(uint64_t bytes) { prealloc_size = bytes; }
+    // Segments closing in the background at most, see SegmentFinalizer.
+    void setMaxPendingClose(size_t count) { max_pending_close = count; }
+    void requestRotate();
+
+    // Called from the finalizer thread once a segment file is closed.
+    void setSegmentClosedCallback(SegmentCallback callback) { closed_callback = callback; }
+
+    void setVideoExtraData(const uint8_t* extra_data, unsigned extra_size);
+    void setAudioParameter(int channel_count, int bit_per_sample, int sample_rate, media_codec_t type);
+    void setAudioExtraData(const uint8_t* extra_data, unsigned extra_size);
+
+    void setBufferCount(uint16_t buffer_count) { (void)buffer_count; }
+    int init() override;
+
+    std::string getCurrentPath();
+    uint64_t getSegmentCount() const { return segment_count; }
+
+protected:
+    virtual ConsumeResult doConsume(shared_ptr<MediaBuffer> input_buffer, shared_ptr<MediaBuffer> output_buffer) override;
+
+private:
+    struct Segment;
+
+    shared_ptr<Segment> openSegment();
+    void closeSegment(shared_ptr<Segment> segment);
+    ConsumeResult consumeAudio(shared_ptr<MediaBuffer> buffer);
+    bool isKeyframe(shared_ptr<MediaBuffer> buffer);
+    void cacheExtraData(shared_ptr<MediaBuffer> buffer);
+    void workerProcess();
+
+private:
+    NameGenerator name_generator;
+    SegmentCallback closed_callback;
+    int64_t max_duration;
+    uint64_t max_size;
+    int64_t fragment_duration;
+    uint64_t prealloc_size;
+    size_t max_pending_close;
+
+    bool annexb;
+    AnnexB::Codec codec;
+    media_codec_t video_codec;
+
+    std::mutex extra_mtx;
+    std::vector<uint8_t> video_extra;
+    std::vector<uint8_t> audio_extra;
+    shared_ptr<MediaBuffer> last_extra_buffer;
+    bool audio_enabled;
+    int audio_channels;
+    int audio_bits;
+    int audio_sample_rate;
+    media_codec_t audio_codec;
+
+    // current is switched under seg_mtx, read by the video and audio threads
+    std::mutex seg_mtx;
+    std::condition_variable seg_cond;   // an old segment's audio writers are done
+    shared_ptr<Segment> current;
+    int64_t segment_start_pts;
+    uint64_t segment_bytes;
+    bool rotate_pending;
+    std::atomic_bool rotate_requested;
+    std::atomic<uint64_t> segment_count;
+
+    std::mutex task_mtx;
+    std::condition_variable task_cond;
+    bool open_requested;
+    shared_ptr<Segment> next;
+    bool worker_quit;
+    std::thread* worker;
+    SegmentFinalizer* finalizer;
+};
+
+/*
+ * Audio input of a ModuleSegmentWriter, follows its segment switches.
+ */
+class ModuleSegmentWriterExtend : public ModuleMedia
+{
+public:
+    ModuleSegmentWriterExtend(shared_ptr<ModuleSegmentWriter> writer);
+    ~ModuleSegmentWriterExtend();
+
+    void setBufferCount(uint16_t buffer_count) { (void)buffer_count; }
+    int init() override;
+
+protected:
+    virtual ConsumeResult doConsume(shared_ptr<MediaBuffer> input_buffer, shared_ptr<MediaBuffer> output_buffer) override;
+
+private:
+    shared_ptr<ModuleSegmentWriter> writer;
+};
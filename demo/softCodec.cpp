@@ -0,0 +1,520 @@
+extern "C" {
+#include <libavcodec/avcodec.h>
+#include <libavutil/imgutils.h>
+#include <libavutil/opt.h>
+#include <libswscale/swscale.h>
+}
+
+#include "softCodec.hpp"
+#include "annexb.hpp"
+
+static AVCodecID v4l2ToCodecId(uint32_t fmt)
+{
+    switch (fmt) {
+        case V4L2_PIX_FMT_H264:
+            return AV_CODEC_ID_H264;
+        case V4L2_PIX_FMT_HEVC:
+            return AV_CODEC_ID_HEVC;
+        case V4L2_PIX_FMT_MJPEG:
+            return AV_CODEC_ID_MJPEG;
+        default:
+            return AV_CODEC_ID_NONE;
+    }
+}
+
+static AVPixelFormat v4l2ToPixFmt(uint32_t fmt)
+{
+    switch (fmt) {
+        case V4L2_PIX_FMT_NV12:
+            return AV_PIX_FMT_NV12;
+        case V4L2_PIX_FMT_NV21:
+            return AV_PIX_FMT_NV21;
+        case V4L2_PIX_FMT_NV16:
+            return AV_PIX_FMT_NV16;
+        case V4L2_PIX_FMT_YUV420:
+            return AV_PIX_FMT_YUV420P;
+        case V4L2_PIX_FMT_YUYV:
+            return AV_PIX_FMT_YUYV422;
+        case V4L2_PIX_FMT_UYVY:
+            return AV_PIX_FMT_UYVY422;
+        case V4L2_PIX_FMT_RGB24:
+            return AV_PIX_FMT_RGB24;
+        case V4L2_PIX_FMT_BGR24:
+            return AV_PIX_FMT_BGR24;
+        case V4L2_PIX_FMT_BGR32:
+            return AV_PIX_FMT_BGRA;
+        case V4L2_PIX_FMT_ABGR32:
+            return AV_PIX_FMT_BGRA;
+        case V4L2_PIX_FMT_ARGB32:
+            return AV_PIX_FMT_ARGB;
+        default:
+            return AV_PIX_FMT_NONE;
+    }
+}
+
+/// @brief Point the planes of a frame at a VideoBuffer laid out with hstride x vstride
+static int fillPlanes(uint8_t* data[4], int linesize[4], AVPixelFormat fmt, uint8_t* base, const ImagePara& para)
+{
+    int ret = av_image_fill_linesizes(linesize, fmt, para.hstride);
+    if (ret < 0)
+        return ret;
+    return av_image_fill_pointers(data, fmt, para.vstride, base, linesize);
+}
+
+ModuleSoftDec::ModuleSoftDec()
+    : ModuleSoftDec(ImagePara())
+{
+}
+
+ModuleSoftDec::ModuleSoftDec(const ImagePara& para)
+    : ModuleMedia("SoftDec"), ctx(nullptr), frame(nullptr), pkt(nullptr), sws(nullptr),
+      buffer_type(VideoBuffer::DRM_BUFFER_CACHEABLE), draining(false)
+{
+    input_para = para;
+    media_type = BUFFER_TYPE_VIDEO;
+}
+
+ModuleSoftDec::~ModuleSoftDec()
+{
+    release();
+}
+
+void ModuleSoftDec::release()
+{
+    if (sws)
+        sws_freeContext(sws);
+    if (pkt)
+        av_packet_free(&pkt);
+    if (frame)
+        av_frame_free(&frame);
+    if (ctx)
+        avcodec_free_context(&ctx);
+    sws = nullptr;
+}
+
+int ModuleSoftDec::init()
+{
+    shared_ptr<ModuleMedia> productor = getProductor();
+    if (input_para.width == 0 && productor)
+        input_para = productor->getOutputImagePara();
+
+    AVCodecID id = v4l2ToCodecId(input_para.v4l2Fmt);
+    if (id == AV_CODEC_ID_NONE || input_para.width == 0 || input_para.height == 0) {
+        ff_error("Soft decoder does not support input %dx%d %s\n", input_para.width, input_para.height,
+                 v4l2GetFmtName(input_para.v4l2Fmt));
+        return -1;
+    }
+
+    const AVCodec* codec = avcodec_find_decoder(id);
+    if (codec == nullptr) {
+        ff_error("libavcodec has no %s decoder\n", avcodec_get_name(id));
+        return -1;
+    }
+
+    ctx = avcodec_alloc_context3(codec);
+    frame = av_frame_alloc();
+    pkt = av_packet_alloc();
+    if (ctx == nullptr || frame == nullptr || pkt == nullptr) {
+        ff_error("Failed to alloc soft decoder context\n");
+        return -1;
+    }
+
+    ctx->thread_count = 0;
+    ctx->flags |= AV_CODEC_FLAG_LOW_DELAY;
+    ctx->pkt_timebase = {1, 1000000};
+    if (avcodec_open2(ctx, codec, nullptr) < 0) {
+        ff_error("Failed to open the %s decoder\n", codec->name);
+        return -1;
+    }
+
+    // Same layout as the mpp decoder output.
+    output_para = ImagePara(input_para.width, input_para.height, ALIGN(input_para.width, 16),
+                            ALIGN(input_para.height, 16), V4L2_PIX_FMT_NV12);
+
+    int ret = initBuffer();
+    if (ret < 0) {
+        ff_error("Soft decoder buffer init failed\n");
+        return ret;
+    }
+    return 0;
+}
+
+int ModuleSoftDec::initBuffer()
+{
+    return ModuleMedia::initBuffer(buffer_type);
+}
+
+int ModuleSoftDec::receiveFrame(shared_ptr<VideoBuffer> buffer)
+{
+    int ret = avcodec_receive_frame(ctx, frame);
+    if (ret < 0)
+        return ret;
+
+    if ((uint32_t)frame->width > output_para.hstride || (uint32_t)frame->height > output_para.vstride) {
+        // The stream grew, the buffers follow one by one as they come back.
+        ff_info("Soft decoder output changed to %dx%d\n", frame->width, frame->height);
+        output_para = ImagePara(frame->width, frame->height, ALIGN(frame->width, 16), ALIGN(frame->height, 16),
+                                V4L2_PIX_FMT_NV12);
+    }
+    if (buffer->getSize() < (size_t)output_para.hstride * output_para.vstride * 3 / 2) {
+        buffer->resetBuffer();
+        buffer->allocBuffer(output_para);
+    }
+
+    sws = sws_getCachedContext(sws, frame->width, frame->height, (AVPixelFormat)frame->format,
+                               frame->width, frame->height, AV_PIX_FMT_NV12, SWS_BILINEAR,
+                               nullptr, nullptr, nullptr);
+    if (sws == nullptr) {
+        av_frame_unref(frame);
+        return AVERROR(EINVAL);
+    }
+
+    ImagePara para(frame->width, frame->height, output_para.hstride, output_para.vstride, V4L2_PIX_FMT_NV12);
+    uint8_t* dst[4];
+    int dst_linesize[4];
+    fillPlanes(dst, dst_linesize, AV_PIX_FMT_NV12, (uint8_t*)buffer->getData(), para);
+    sws_scale(sws, frame->data, frame->linesize, 0, frame->height, dst, dst_linesize);
+
+    buffer->setImagePara(para);
+    buffer->setActiveData(buffer->getData());
+    buffer->setActiveSize(para.hstride * para.vstride * 3 / 2);
+    buffer->setPUstimestamp(frame->best_effort_timestamp);
+    buffer->setDUstimestamp(frame->best_effort_timestamp);
+    if (buffer->getBufferType() == VideoBuffer::DRM_BUFFER_CACHEABLE)
+        buffer->flushDrmBuf();
+
+    av_frame_unref(frame);
+    return 0;
+}
+
+ModuleMedia::ConsumeResult ModuleSoftDec::doConsume(shared_ptr<MediaBuffer> input_buffer, shared_ptr<MediaBuffer> output_buffer)
+{
+    if (input_buffer == nullptr || output_buffer == nullptr)
+        return CONSUME_SKIP;
+
+    shared_ptr<VideoBuffer> out = static_pointer_cast<VideoBuffer>(output_buffer);
+
+    // A frame left over from an earlier packet goes out first, the packet is sent on the repeat.
+    if (receiveFrame(out) == 0)
+        return CONSUME_NEED_REPEAT;
+
+    if (input_buffer->getEos()) {
+        if (!draining) {
+            avcodec_send_packet(ctx, nullptr);
+            draining = true;
+        }
+        return receiveFrame(out) == 0 ? CONSUME_NEED_REPEAT : CONSUME_EOS;
+    }
+
+    if (draining) {
+        // The source restarted after eos, e.g. a looped file.
+        avcodec_flush_buffers(ctx);
+        draining = false;
+    }
+
+    pkt->data = (uint8_t*)input_buffer->getActiveData();
+    pkt->size = input_buffer->getActiveSize();
+    pkt->pts = input_buffer->getPUstimestamp();
+    pkt->dts = AV_NOPTS_VALUE;
+    int ret = avcodec_send_packet(ctx, pkt);
+    if (ret == AVERROR(EAGAIN)) {
+        // The decoder is full, take a frame out and send the same packet again on the repeat.
+        if (receiveFrame(out) == 0)
+            return CONSUME_NEED_REPEAT;
+        ff_warn("Soft decoder dropped a %d bytes packet\n", pkt->size);
+        return CONSUME_SKIP;
+    }
+    if (ret < 0) {
+        ff_warn("Soft decoder dropped a %d bytes packet\n", pkt->size);
+        return CONSUME_SKIP;
+    }
+
+    if (receiveFrame(out) == 0)
+        return CONSUME_SUCCESS;
+    return CONSUME_SKIP;
+}
+
+ModuleSoftEnc::ModuleSoftEnc(EncodeType type, int fps, int gop, int bps)
+    : ModuleMedia("SoftEnc"), encode_type(type), fps(fps), gop(gop), bps(bps), duration(0), frame_count(0),
+      reopening(false), ctx(nullptr), frame(nullptr), src_frame(nullptr), pkt(nullptr), sws(nullptr),
+      extra_data(nullptr)
+{
+    media_type = BUFFER_TYPE_VIDEO;
+}
+
+ModuleSoftEnc::~ModuleSoftEnc()
+{
+    release();
+}
+
+void ModuleSoftEnc::release()
+{
+    if (sws)
+        sws_freeContext(sws);
+    if (pkt)
+        av_packet_free(&pkt);
+    if (src_frame)
+        av_frame_free(&src_frame);
+    if (frame)
+        av_frame_free(&frame);
+    if (ctx)
+        avcodec_free_context(&ctx);
+    sws = nullptr;
+}
+
+int ModuleSoftEnc::init()
+{
+    shared_ptr<ModuleMedia> productor = getProductor();
+    if (productor)
+        input_para = productor->getOutputImagePara();
+
+    int ret = open();
+    if (ret < 0)
+        return ret;
+
+    ret = initBuffer();
+    if (ret < 0) {
+        ff_error("Soft encoder buffer init failed\n");
+        return ret;
+    }
+    return 0;
+}
+
+/// @brief (Re)open the encoder for input_para
+int ModuleSoftEnc::open()
+{
+    AVCodecID id;
+    uint32_t out_fmt;
+
+    release();
+
+    AVPixelFormat in_fmt = v4l2ToPixFmt(input_para.v4l2Fmt);
+    if (in_fmt == AV_PIX_FMT_NONE || input_para.width == 0 || input_para.height == 0) {
+        ff_error("Soft encoder does not support input %dx%d %s\n", input_para.width, input_para.height,
+                 v4l2GetFmtName(input_para.v4l2Fmt));
+        return -1;
+    }
+
+    switch (encode_type) {
+        case ENCODE_TYPE_H264:
+            id = AV_CODEC_ID_H264;
+            out_fmt = V4L2_PIX_FMT_H264;
+            break;
+        case ENCODE_TYPE_H265:
+            id = AV_CODEC_ID_HEVC;
+            out_fmt = V4L2_PIX_FMT_HEVC;
+            break;
+        case ENCODE_TYPE_MJPEG:
+            id = AV_CODEC_ID_MJPEG;
+            out_fmt = V4L2_PIX_FMT_MJPEG;
+            break;
+        default:
+            ff_error("Soft encoder does not support encode type %d\n", encode_type);
+            return -1;
+    }
+
+    const AVCodec* codec = avcodec_find_encoder(id);
+    if (codec == nullptr) {
+        ff_error("libavcodec has no %s encoder\n", avcodec_get_name(id));
+        return -1;
+    }
+
+    ctx = avcodec_alloc_context3(codec);
+    frame = av_frame_alloc();
+    src_frame = av_frame_alloc();
+    pkt = av_packet_alloc();
+    if (ctx == nullptr || frame == nullptr || src_frame == nullptr || pkt == nullptr) {
+        ff_error("Failed to alloc soft encoder context\n");
+        return -1;
+    }
+
+    // Encode the input format directly when the encoder takes it.
+    AVPixelFormat enc_fmt = AV_PIX_FMT_NONE;
+    for (const AVPixelFormat* p = codec->pix_fmts; p && *p != AV_PIX_FMT_NONE; p++) {
+        if (enc_fmt == AV_PIX_FMT_NONE)
+            enc_fmt = *p;
+        if (*p == in_fmt) {
+            enc_fmt = in_fmt;
+            break;
+        }
+    }
+    if (enc_fmt == AV_PIX_FMT_NONE)
+        enc_fmt = AV_PIX_FMT_YUV420P;
+
+    ctx->width = input_para.width;
+    ctx->height = input_para.height;
+    ctx->pix_fmt = enc_fmt;
+    ctx->time_base = {1, 1000000};
+    ctx->framerate = {fps, 1};
+    ctx->gop_size = gop;
+    ctx->max_b_frames = 0;
+    ctx->bit_rate = (int64_t)bps * 1000;
+    ctx->thread_count = 0;
+    if (id == AV_CODEC_ID_MJPEG)
+        ctx->color_range = AVCOL_RANGE_JPEG;
+    av_opt_set(ctx->priv_data, "preset", "veryfast", 0);
+    av_opt_set(ctx->priv_data, "tune", "zerolatency", 0);
+
+    if (avcodec_open2(ctx, codec, nullptr) < 0) {
+        ff_error("Failed to open the %s encoder\n", codec->name);
+        return -1;
+    }
+
+    if (enc_fmt != in_fmt) {
+        frame->format = enc_fmt;
+        frame->width = ctx->width;
+        frame->height = ctx->height;
+        if (av_frame_get_buffer(frame, 0) < 0) {
+            ff_error("Failed to alloc soft encoder frame\n");
+            return -1;
+        }
+        sws = sws_getContext(ctx->width, ctx->height, in_fmt, ctx->width, ctx->height, enc_fmt,
+                             SWS_BILINEAR, nullptr, nullptr, nullptr);
+        if (sws == nullptr) {
+            ff_error("Failed to create the soft encoder converter\n");
+            return -1;
+        }
+    }
+
+    output_para = ImagePara(input_para.width, input_para.height, input_para.width, input_para.height, out_fmt);
+    // New parameter sets come with the first keyframe.
+    extra_data = nullptr;
+    return 0;
+}
+
+int ModuleSoftEnc::initBuffer()
+{
+    // Worst case for a badly compressible frame, like the mpp encoder output.
+    setBufferSize((size_t)input_para.width * input_para.height * 2);
+    return ModuleMedia::initBuffer(VideoBuffer::MALLOC_BUFFER);
+}
+
+/// @brief Keep the parameter sets of the first keyframe as the stream's extra data
+void ModuleSoftEnc::updateExtraData()
+{
+    const uint8_t* begin = nullptr;
+
+    if (encode_type == ENCODE_TYPE_MJPEG || extra_data != nullptr)
+        return;
+
+    AnnexB::Codec codec = encode_type == ENCODE_TYPE_H264 ? AnnexB::CODEC_H264 : AnnexB::CODEC_H265;
+    size_t size = AnnexB::parameterSets(pkt->data, pkt->size, codec, &begin);
+    if (size == 0)
+        return;
+
+    extra_data = make_shared<VideoBuffer>(VideoBuffer::MALLOC_BUFFER);
+    extra_data->allocBuffer(size);
+    memcpy(extra_data->getData(), begin, size);
+    extra_data->setActiveData(extra_data->getData());
+    extra_data->setActiveSize(size);
+    extra_data->setImagePara(output_para);
+}
+
+int ModuleSoftEnc::receivePacket(shared_ptr<VideoBuffer> buffer)
+{
+    int ret = avcodec_receive_packet(ctx, pkt);
+    if (ret < 0)
+        return ret;
+
+    if ((size_t)pkt->size > buffer->getSize()) {
+        buffer->resetBuffer();
+        buffer->allocBuffer(std::max((size_t)pkt->size, (size_t)input_para.width * input_para.height * 2));
+    }
+
+    if (pkt->flags & AV_PKT_FLAG_KEY)
+        updateExtraData();
+
+    memcpy(buffer->getData(), pkt->data, pkt->size);
+    buffer->setActiveData(buffer->getData());
+    buffer->setActiveSize(pkt->size);
+    buffer->setImagePara(output_para);
+    buffer->setPUstimestamp(pkt->pts);
+    buffer->setDUstimestamp(pkt->pts);
+    buffer->setExtraData(extra_data);
+    av_packet_unref(pkt);
+    return 0;
+}
+
+int ModuleSoftEnc::fillFrame(shared_ptr<VideoBuffer> buffer)
+{
+    ImagePara para = buffer->getImagePara();
+    AVPixelFormat fmt = v4l2ToPixFmt(para.v4l2Fmt);
+
+    if (buffer->getBufferType() == VideoBuffer::DRM_BUFFER_CACHEABLE)
+        buffer->invalidateDrmBuf();
+
+    src_frame->format = fmt;
+    src_frame->width = para.width;
+    src_frame->height = para.height;
+    if (fillPlanes(src_frame->data, src_frame->linesize, fmt, (uint8_t*)buffer->getData(), para) < 0)
+        return -1;
+
+    AVFrame* f = src_frame;
+    if (sws != nullptr) {
+        if (av_frame_make_writable(frame) < 0)
+            return -1;
+        sws_scale(sws, src_frame->data, src_frame->linesize, 0, para.height, frame->data, frame->linesize);
+        f = frame;
+    }
+
+    f->pts = duration > 0 ? frame_count * duration : buffer->getPUstimestamp();
+    int ret = avcodec_send_frame(ctx, f);
+    if (ret == 0)
+        frame_count++;
+    return ret;
+}
+
+ModuleMedia::ConsumeResult ModuleSoftEnc::doConsume(shared_ptr<MediaBuffer> input_buffer, shared_ptr<MediaBuffer> output_buffer)
+{
+    // ctx is gone if reopening at a new size failed.
+    if (input_buffer == nullptr || output_buffer == nullptr || ctx == nullptr)
+        return CONSUME_SKIP;
+
+    shared_ptr<VideoBuffer> out = static_pointer_cast<VideoBuffer>(output_buffer);
+
+    if (receivePacket(out) == 0)
+        return CONSUME_NEED_REPEAT;
+
+    if (input_buffer->getEos()) {
+        avcodec_send_frame(ctx, nullptr);
+        return receivePacket(out) == 0 ? CONSUME_NEED_REPEAT : CONSUME_EOS;
+    }
+
+    if (input_buffer->getMediaBufferType() != BUFFER_TYPE_VIDEO)
+        return CONSUME_SKIP;
+
+    shared_ptr<VideoBuffer> in = static_pointer_cast<VideoBuffer>(input_buffer);
+    ImagePara para = in->getImagePara();
+    if (para.width != (uint32_t)ctx->width || para.height != (uint32_t)ctx->height ||
+        para.v4l2Fmt != input_para.v4l2Fmt) {
+        // Drain the packets of the old size, one per repeat, then reopen before sending this frame.
+        if (!reopening) {
+            avcodec_send_frame(ctx, nullptr);
+            reopening = true;
+            if (receivePacket(out) == 0)
+                return CONSUME_NEED_REPEAT;
+        }
+        reopening = false;
+        ff_info("Soft encoder input changed to %dx%d\n", para.width, para.height);
+        input_para = para;
+        if (open() < 0)
+            return CONSUME_FAILED;
+    }
+
+    int ret = fillFrame(in);
+    if (ret == AVERROR(EAGAIN)) {
+        // The encoder is full, take a packet out and send the same frame again on the repeat.
+        if (receivePacket(out) == 0)
+            return CONSUME_NEED_REPEAT;
+        ff_warn("Soft encoder failed to take a frame\n");
+        return CONSUME_SKIP;
+    }
+    if (ret < 0) {
+        ff_warn("Soft encoder failed to take a frame\n");
+        return CONSUME_SKIP;
+    }
+
+    if (receivePacket(out) == 0)
+        return CONSUME_SUCCESS;
+    return CONSUME_SKIP;
+}
@@ -0,0 +1,86 @@
+#pragma once
+#include "module/module_media.hpp"
+#include "base/ff_type.hpp"
+
+struct AVCodecContext;
+struct AVFrame;
+struct AVPacket;
+struct SwsContext;
+
+/*
+ * libavcodec reference decoder with the ModuleMppDec contract: H.264, H.265
+ * or MJPEG buffers in, NV12 VideoBuffers with 16 aligned strides and the
+ * packet pts out. A stream growing past the output buffers reallocates
+ * each one as it is reused. Built only with -DSOFT_CODEC=ON.
+ */
+class ModuleSoftDec : public ModuleMedia
+{
+public:
+    ModuleSoftDec();
+    ModuleSoftDec(const ImagePara& input_para);
+    ~ModuleSoftDec();
+
+    // DRM buffers keep the output usable by rga, drm and mpp; malloc runs anywhere.
+    void setOutputBufferType(VideoBuffer::BUFFER_TYPE type) { buffer_type = type; }
+    int init() override;
+
+protected:
+    virtual ConsumeResult doConsume(shared_ptr<MediaBuffer> input_buffer, shared_ptr<MediaBuffer> output_buffer) override;
+    virtual int initBuffer() override;
+
+private:
+    int receiveFrame(shared_ptr<VideoBuffer> buffer);
+    void release();
+
+private:
+    AVCodecContext* ctx;
+    AVFrame* frame;
+    AVPacket* pkt;
+    SwsContext* sws;
+    VideoBuffer::BUFFER_TYPE buffer_type;
+    bool draining;
+};
+
+/*
+ * libavcodec reference encoder with the ModuleMppEnc contract: raw
+ * VideoBuffers in, one encoded buffer per frame out with the pts kept and
+ * the parameter sets attached as extra data. No B frames, so pts == dts.
+ * A change of the input size reopens the encoder with the frame that
+ * brought it, new parameter sets follow with its keyframe.
+ */
+class ModuleSoftEnc : public ModuleMedia
+{
+public:
+    ModuleSoftEnc(EncodeType type, int fps = 30, int gop = 60, int bps = 2048);
+    ~ModuleSoftEnc();
+
+    void setDuration(int64_t _duration) { duration = _duration; }
+    int init() override;
+
+protected:
+    virtual ConsumeResult doConsume(shared_ptr<MediaBuffer> input_buffer, shared_ptr<MediaBuffer> output_buffer) override;
+    virtual int initBuffer() override;
+
+private:
+    int open();
+    int receivePacket(shared_ptr<VideoBuffer> buffer);
+    int fillFrame(shared_ptr<VideoBuffer> buffer);
+    void updateExtraData();
+    void release();
+
+private:
+    EncodeType encode_type;
+    int fps;
+    int gop;
+    int bps;
+    int64_t duration;
+    int64_t frame_count;
+    bool reopening;             // draining the encoder before a size change
+
+    AVCodecContext* ctx;
+    AVFrame* frame;
+    AVFrame* src_frame;
+    AVPacket* pkt;
+    SwsContext* sws;
+    shared_ptr<VideoBuffer> extra_data;
+};
@@ -0,0 +1,170 @@
+#include "temporalLayer.hpp"
+
+#define TEMPORAL_MEASURE_WINDOW 1000000
+
+ModuleTemporalFilter::ModuleTemporalFilter(uint8_t max_temporal_id)
+    : ModuleMedia("TemporalFilter"), wanted_tid(max_temporal_id), target_fps(0),
+      selected_tid(max_temporal_id), annexb(false), codec(AnnexB::CODEC_H264),
+      passed(0), dropped(0)
+{
+    buffer_count = 0;
+    reset();
+}
+
+ModuleTemporalFilter::~ModuleTemporalFilter()
+{
+}
+
+void ModuleTemporalFilter::reset()
+{
+    window_start = -1;
+    for (int i = 0; i < TEMPORAL_LAYER_MAX; i++) {
+        window_frames[i] = 0;
+        layer_fps[i] = 0;
+    }
+    layer_count = 0;
+    warned = false;
+}
+
+void ModuleTemporalFilter::setMaxTemporalId(uint8_t temporal_id)
+{
+    target_fps = 0;
+    wanted_tid = std::min<uint8_t>(temporal_id, TEMPORAL_LAYER_MAX - 1);
+}
+
+/// @brief Follow the lowest set of layers whose frame rate reaches fps
+/// @param fps 0 forwards every layer
+void ModuleTemporalFilter::setTargetFps(int fps)
+{
+    target_fps = fps;
+    if (fps <= 0)
+        wanted_tid = TEMPORAL_LAYER_MAX - 1;
+}
+
+int ModuleTemporalFilter::init()
+{
+    shared_ptr<ModuleMedia> productor = getProductor();
+    if (productor == nullptr) {
+        ff_error("Temporal filter has no productor\n");
+        return -1;
+    }
+
+    input_para = productor->getOutputImagePara();
+    output_para = input_para;
+    media_type = productor->getMediaType();
+
+    switch (input_para.v4l2Fmt) {
+        case V4L2_PIX_FMT_H264:
+            annexb = true;
+            codec = AnnexB::CODEC_H264;
+            break;
+        case V4L2_PIX_FMT_HEVC:
+            annexb = true;
+            codec = AnnexB::CODEC_H265;
+            break;
+        case V4L2_PIX_FMT_MJPEG:
+            // no layers, everything passes
+            annexb = false;
+            break;
+        default:
+            ff_error("Temporal filter does not support %s\n", v4l2GetFmtName(input_para.v4l2Fmt));
+            return -1;
+    }
+    return 0;
+}
+
+/// @brief Count frames per layer over a window of pts
+void ModuleTemporalFilter::measure(uint8_t temporal_id, int64_t pts)
+{
+    if (window_start < 0 || pts < window_start) {
+        window_start = pts;
+        for (int i = 0; i < TEMPORAL_LAYER_MAX; i++)
+            window_frames[i] = 0;
+    }
+
+    window_frames[temporal_id]++;
+    if (pts - window_start < TEMPORAL_MEASURE_WINDOW)
+        return;
+
+    double span = (pts - window_start) / 1000000.0;
+    layer_count = 0;
+    for (int i = 0; i < TEMPORAL_LAYER_MAX; i++) {
+        layer_fps[i] = window_frames[i] / span;
+        if (window_frames[i])
+            layer_count = i + 1;
+        window_frames[i] = 0;
+    }
+    window_start = pts;
+
+    if (target_fps > 0)
+        wanted_tid = chooseTemporalId();
+}
+
+uint8_t ModuleTemporalFilter::chooseTemporalId()
+{
+    double fps = 0;
+    int target = target_fps;
+
+    for (uint8_t i = 0; i < layer_count; i++) {
+        fps += layer_fps[i];
+        // 5% slack for pts jitter
+        if (fps >= target * 0.95)
+            return i;
+    }
+
+    if (layer_count <= 1 && !warned && fps > target * 1.05) {
+        ff_warn("Stream has no temporal layers, forwarding %.1f fps instead of %d\n", fps, target);
+        warned = true;
+    }
+    return layer_count ? layer_count - 1 : TEMPORAL_LAYER_MAX - 1;
+}
+
+ModuleMedia::ConsumeResult ModuleTemporalFilter::doConsume(shared_ptr<MediaBuffer> input_buffer, shared_ptr<MediaBuffer> output_buffer)
+{
+    (void)output_buffer;
+    if (input_buffer == nullptr)
+        return CONSUME_SKIP;
+
+    if (!annexb || input_buffer->getEos()) {
+        passed++;
+        return CONSUME_BYPASS;
+    }
+
+    AnnexB::FrameInfo info = AnnexB::parseFrame((const uint8_t*)input_buffer->getActiveData(),
+                                                input_buffer->getActiveSize(), codec);
+    if (info.vcl_count == 0) {
+        passed++;
+        return CONSUME_BYPASS;
+    }
+
+    uint8_t tid = std::min<uint8_t>(info.temporal_id, TEMPORAL_LAYER_MAX - 1);
+    measure(tid, input_buffer->getPUstimestamp());
+
+    uint8_t wanted = wanted_tid;
+    if (wanted < selected_tid) {
+        selected_tid = wanted;
+    } else if (wanted > selected_tid) {
+        // Higher layers may reference pictures that were dropped, rejoin where that can not happen.
+        if (info.type == AnnexB::FRAME_KEY)
+            selected_tid = wanted;
+        else if (info.layer_switch && tid > selected_tid)
+            selected_tid = std::min(wanted, tid);
+    }
+
+    if (tid > selected_tid) {
+        dropped++;
+        return CONSUME_SKIP;
+    }
+
+    passed++;
+    return CONSUME_BYPASS;
+}
+
+void ModuleTemporalFilter::dumpStats()
+{
+    uint64_t total = passed + dropped;
+    ff_info("temporal filter: TemporalId <= %u, passed %" PRIu64 ", dropped %" PRIu64 " (%.1f%%)\n",
+            selected_tid, passed, dropped, total ? dropped * 100.0 / total : 0.0);
+    for (uint8_t i = 0; i < layer_count; i++)
+        ff_info("    layer %u: %.1f fps\n", i, layer_fps[i]);
+}
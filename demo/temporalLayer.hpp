@@ -0,0 +1,65 @@
+#pragma once
+#include <atomic>
+
+#include "module/module_media.hpp"
+#include "annexb.hpp"
+
+#define TEMPORAL_LAYER_MAX 8
+
+/*
+ * Per sink temporal layer selection on an encoded stream.
+ *
+ * One encoder producing a temporally layered stream (e.g. 120/60/30 fps
+ * layers) feeds several sinks, each through its own filter. A filter passes
+ * the buffers of the layers up to its selected TemporalId straight through
+ * and drops the rest, which leaves a decodable stream at a lower frame rate:
+ *   setMaxTemporalId  fixed layer selection
+ *   setTargetFps      lowest layer set reaching the fps, measured from pts
+ * Dropping layers is possible at any frame; adding one back waits for a
+ * keyframe or a H.265 TSA/STSA picture. Buffers without slices always pass.
+ */
+class ModuleTemporalFilter : public ModuleMedia
+{
+public:
+    ModuleTemporalFilter(uint8_t max_temporal_id = TEMPORAL_LAYER_MAX - 1);
+    ~ModuleTemporalFilter();
+
+    void setMaxTemporalId(uint8_t temporal_id);
+    void setTargetFps(int fps);
+    uint8_t getSelectedTemporalId() const { return selected_tid; }
+
+    // Forwarded NAL units are the encoder's buffers; a pool here would only copy them.
+    void setBufferCount(uint16_t buffer_count) { (void)buffer_count; }
+    int init() override;
+
+    uint64_t getPassedCount() const { return passed; }
+    uint64_t getDroppedCount() const { return dropped; }
+    void dumpStats();
+
+public:
+    virtual ConsumeResult doConsume(shared_ptr<MediaBuffer> input_buffer, shared_ptr<MediaBuffer> output_buffer) override;
+
+protected:
+    void reset() override;
+
+private:
+    void measure(uint8_t temporal_id, int64_t pts);
+    uint8_t chooseTemporalId();
+
+private:
+    std::atomic<uint8_t> wanted_tid;
+    std::atomic_int target_fps;
+    uint8_t selected_tid;
+
+    bool annexb;
+    AnnexB::Codec codec;
+
+    int64_t window_start;
+    uint64_t window_frames[TEMPORAL_LAYER_MAX];
+    double layer_fps[TEMPORAL_LAYER_MAX];
+    uint8_t layer_count;
+    bool warned;
+
+    uint64_t passed;
+    uint64_t dropped;
+};
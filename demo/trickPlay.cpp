@@ -0,0 +1,251 @@
+#include <chrono>
+#include <inttypes.h>
+
+#include "trickPlay.hpp"
+
+#define TRICK_DEFAULT_RATE 8
+
+static int64_t steadyClockUs()
+{
+    return std::chrono::duration_cast<std::chrono::microseconds>(
+               std::chrono::steady_clock::now().time_since_epoch())
+        .count();
+}
+
+ModuleTrickPlay::ModuleTrickPlay(shared_ptr<ModuleFileReader> reader, const std::string& path)
+    : ModuleMedia("TrickPlay"), reader(reader), path(path), annexb(false), codec(AnnexB::CODEC_H264),
+      speed(1), trick_rate(TRICK_DEFAULT_RATE), cursor(0), pending(-1), awaiting_seek(false),
+      drop_until_key(false), have_offset(false), time_offset(0), last_pts(0), trick_pts(0),
+      next_issue(0), quit(false), control(nullptr), seeks(0), passed(0), dropped(0)
+{
+    buffer_count = 0;
+}
+
+ModuleTrickPlay::~ModuleTrickPlay()
+{
+    if (control) {
+        {
+            std::lock_guard<std::mutex> lk(mtx);
+            quit = true;
+            cond.notify_one();
+        }
+        control->join();
+        delete control;
+        control = nullptr;
+    }
+}
+
+int ModuleTrickPlay::init()
+{
+    shared_ptr<ModuleMedia> productor = getProductor();
+    if (productor == nullptr || reader == nullptr) {
+        ff_error("Trick play has no productor or file reader\n");
+        return -1;
+    }
+
+    input_para = productor->getOutputImagePara();
+    output_para = input_para;
+    media_type = productor->getMediaType();
+
+    switch (input_para.v4l2Fmt) {
+        case V4L2_PIX_FMT_H264:
+            annexb = true;
+            codec = AnnexB::CODEC_H264;
+            break;
+        case V4L2_PIX_FMT_HEVC:
+            annexb = true;
+            codec = AnnexB::CODEC_H265;
+            break;
+        default:
+            annexb = false;
+            break;
+    }
+
+    // Without an index seeking still works, through the reader's own seek.
+    int64_t start = steadyClockUs();
+    if (index.load(path) < 0 || index.empty())
+        ff_warn("No keyframe index for %s, trick play disabled\n", path.c_str());
+    else
+        ff_info("Keyframe index of %s: %zu keyframes in %" PRId64 " us\n", path.c_str(), index.size(),
+                steadyClockUs() - start);
+
+    control = new std::thread(&ModuleTrickPlay::controlProcess, this);
+    return 0;
+}
+
+/// @brief Index entry of the frames passing now
+size_t ModuleTrickPlay::currentEntry()
+{
+    if (speed != 1 || !have_offset)
+        return cursor;
+    return index.lookup(last_pts - time_offset);
+}
+
+/// @brief Next keyframe to show in trick mode, always at least one keyframe away
+size_t ModuleTrickPlay::nextEntry(size_t entry)
+{
+    int64_t target = index.at(entry).time_us + (int64_t)speed * 1000000 / trick_rate;
+    size_t next = index.lookup(target);
+
+    if (speed > 0 && next <= entry)
+        next = entry + 1;
+    else if (speed < 0 && next >= entry)
+        next = entry > 0 ? entry - 1 : 0;
+    return std::min(next, index.size() - 1);
+}
+
+void ModuleTrickPlay::requestSeek(size_t entry)
+{
+    pending = entry;
+    awaiting_seek = true;
+    cond.notify_one();
+}
+
+int64_t ModuleTrickPlay::seek(int64_t ms)
+{
+    if (index.empty()) {
+        int ret = reader->setFileReaderSeek(ms);
+        std::lock_guard<std::mutex> lk(mtx);
+        drop_until_key = true;
+        have_offset = false;
+        seeks++;
+        return ret < 0 ? -1 : ms;
+    }
+
+    std::lock_guard<std::mutex> lk(mtx);
+    size_t entry = index.lookup(ms * 1000);
+    requestSeek(entry);
+    return index.at(entry).time_us / 1000;
+}
+
+int64_t ModuleTrickPlay::stepKeyframe(int n)
+{
+    if (index.empty())
+        return -1;
+
+    std::lock_guard<std::mutex> lk(mtx);
+    int64_t entry = (int64_t)currentEntry() + n;
+    entry = std::max<int64_t>(0, std::min<int64_t>(entry, index.size() - 1));
+    requestSeek(entry);
+    return index.at(entry).time_us / 1000;
+}
+
+int ModuleTrickPlay::setSpeed(int _speed)
+{
+    if (_speed == 0)
+        return -1;
+    if (_speed != 1 && index.empty()) {
+        ff_warn("Trick play needs a keyframe index\n");
+        return -1;
+    }
+
+    std::lock_guard<std::mutex> lk(mtx);
+    if (_speed == speed)
+        return 0;
+
+    size_t entry = currentEntry();
+    speed = _speed;
+    // Trick play starts from the next step, normal play resumes at the current keyframe.
+    requestSeek(speed == 1 ? entry : nextEntry(entry));
+    ff_info("Trick play speed %d\n", speed);
+    return 0;
+}
+
+int64_t ModuleTrickPlay::getPosition()
+{
+    std::lock_guard<std::mutex> lk(mtx);
+    if (speed != 1 && !index.empty())
+        return index.at(cursor).time_us / 1000;
+    return have_offset ? (last_pts - time_offset) / 1000 : -1;
+}
+
+void ModuleTrickPlay::controlProcess()
+{
+    std::unique_lock<std::mutex> lk(mtx);
+    while (!quit) {
+        if (pending < 0) {
+            cond.wait(lk);
+            continue;
+        }
+
+        // Keyframes are paced here, the reader delivers them as fast as it can seek.
+        int64_t wait = speed != 1 ? next_issue - steadyClockUs() : 0;
+        if (wait > 0) {
+            cond.wait_for(lk, std::chrono::microseconds(wait));
+            continue;
+        }
+
+        size_t entry = pending;
+        pending = -1;
+        lk.unlock();
+        int ret = reader->setFileReaderSeek(index.at(entry).time_us / 1000);
+        lk.lock();
+        if (ret < 0)
+            ff_warn("Failed to seek to %" PRId64 " ms\n", index.at(entry).time_us / 1000);
+
+        // A newer request made meanwhile is issued on the next round.
+        if (pending < 0)
+            awaiting_seek = false;
+        cursor = entry;
+        drop_until_key = true;
+        have_offset = false;
+        next_issue = steadyClockUs() + 1000000 / trick_rate;
+        seeks++;
+    }
+}
+
+ModuleMedia::ConsumeResult ModuleTrickPlay::doConsume(shared_ptr<MediaBuffer> input_buffer, shared_ptr<MediaBuffer> output_buffer)
+{
+    (void)output_buffer;
+    if (input_buffer == nullptr)
+        return CONSUME_SKIP;
+    if (input_buffer->getEos())
+        return CONSUME_BYPASS;
+
+    bool key = true;
+    if (annexb) {
+        AnnexB::FrameInfo info = AnnexB::parseFrame((const uint8_t*)input_buffer->getActiveData(),
+                                                    input_buffer->getActiveSize(), codec);
+        if (info.vcl_count == 0)
+            return CONSUME_BYPASS;
+        key = info.type == AnnexB::FRAME_KEY;
+    }
+
+    int64_t pts = input_buffer->getPUstimestamp();
+    std::lock_guard<std::mutex> lk(mtx);
+    if (awaiting_seek || (drop_until_key && !key) || (speed != 1 && !key)) {
+        dropped++;
+        return CONSUME_SKIP;
+    }
+
+    if (key && !have_offset && !index.empty()) {
+        // The first keyframe after a seek is the one sought to.
+        time_offset = pts - index.at(cursor).time_us;
+        have_offset = true;
+    }
+    drop_until_key = false;
+    last_pts = pts;
+    passed++;
+
+    if (speed == 1)
+        return CONSUME_BYPASS;
+
+    size_t next = nextEntry(cursor);
+    if (next == cursor) {
+        // Either end of the file, continue with normal play.
+        speed = 1;
+        ff_info("Trick play reached the %s, normal play\n", cursor == 0 ? "start" : "end");
+    } else {
+        requestSeek(next);
+    }
+
+    trick_pts = std::max(trick_pts + 1000000 / trick_rate, pts);
+    input_buffer->setPUstimestamp(trick_pts);
+    return CONSUME_BYPASS;
+}
+
+void ModuleTrickPlay::dumpStats()
+{
+    ff_info("trick play: %zu keyframes indexed, %" PRIu64 " seeks, passed %" PRIu64 ", dropped %" PRIu64 "\n",
+            index.size(), seeks, passed, dropped);
+}
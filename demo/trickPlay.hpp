@@ -0,0 +1,82 @@
+#pragma once
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+
+#include "module/module_media.hpp"
+#include "module/vi/module_fileReader.hpp"
+#include "annexb.hpp"
+#include "keyframeIndex.hpp"
+
+/*
+ * Keyframe accurate seeking and trick play for ModuleFileReader.
+ *
+ * The module sits between the file reader and the decoder like
+ * ModuleFrameSkip. A KeyframeIndex of the file turns a seek into a binary
+ * search for the preceding keyframe, the reader is then sought exactly to
+ * it and everything before the next keyframe is dropped, so the decoder
+ * never starts on a broken GOP.
+ *
+ * With a speed other than 1 only keyframes pass: after each one the next
+ * keyframe speed / trick_rate seconds away (backwards for a negative
+ * speed) is sought to from a control thread, paced at trick_rate frames
+ * per second. Timestamps are rewritten to keep increasing in trick mode.
+ * Reaching either end of the file returns to normal play.
+ */
+class ModuleTrickPlay : public ModuleMedia
+{
+public:
+    ModuleTrickPlay(shared_ptr<ModuleFileReader> reader, const std::string& path);
+    ~ModuleTrickPlay();
+
+    // Seek to the keyframe at or before ms, returns its time in ms or -1.
+    int64_t seek(int64_t ms);
+    // Move by n keyframes from the current position.
+    int64_t stepKeyframe(int n);
+    // 1 is normal play, > 1 fast forward and < 0 reverse, both keyframe only.
+    int setSpeed(int speed);
+    int getSpeed() const { return speed; }
+    void setTrickRate(int fps) { trick_rate = fps > 0 ? fps : 1; }
+    int64_t getPosition();
+    const KeyframeIndex& getIndex() const { return index; }
+
+    void setBufferCount(uint16_t buffer_count) { (void)buffer_count; }
+    int init() override;
+    void dumpStats();
+
+public:
+    virtual ConsumeResult doConsume(shared_ptr<MediaBuffer> input_buffer, shared_ptr<MediaBuffer> output_buffer) override;
+
+private:
+    void requestSeek(size_t entry);
+    size_t currentEntry();
+    size_t nextEntry(size_t entry);
+    void controlProcess();
+
+private:
+    shared_ptr<ModuleFileReader> reader;
+    std::string path;
+    KeyframeIndex index;
+    bool annexb;
+    AnnexB::Codec codec;
+
+    std::mutex mtx;
+    std::condition_variable cond;
+    int speed;
+    int trick_rate;
+    size_t cursor;              // index entry of the last keyframe sought to
+    int64_t pending;            // entry to seek to, -1 for none
+    bool awaiting_seek;         // drop until the pending seek was issued
+    bool drop_until_key;
+    bool have_offset;
+    int64_t time_offset;        // pts - index time
+    int64_t last_pts;
+    int64_t trick_pts;
+    int64_t next_issue;
+    bool quit;
+    std::thread* control;
+
+    uint64_t seeks;
+    uint64_t passed;
+    uint64_t dropped;
+};
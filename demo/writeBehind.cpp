@@ -0,0 +1,251 @@
+#include <algorithm>
+#include <chrono>
+#include <errno.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "writeBehind.hpp"
+#include "base/ff_log.h"
+
+#define WRITE_BEHIND_ALIGN 4096
+
+static int64_t steadyClockUs()
+{
+    return std::chrono::duration_cast<std::chrono::microseconds>(
+               std::chrono::steady_clock::now().time_since_epoch())
+        .count();
+}
+
+struct WriteBehindFile::Block {
+    uint8_t* data;
+
+    Block(size_t size) : data(nullptr)
+    {
+        if (posix_memalign((void**)&data, WRITE_BEHIND_ALIGN, size))
+            data = nullptr;
+    }
+    ~Block() { free(data); }
+};
+
+WriteBehindFile::WriteBehindFile(size_t block_size, size_t max_queue_bytes)
+    : block_size(block_size), max_queue(max_queue_bytes / block_size), prealloc_step(0), prealloc_end(0),
+      fd(-1), offset(0), current(nullptr), current_offset(0), current_fill(0),
+      quit(false), worker(nullptr), error(false), open_time(0), close_time(0)
+{
+    if (max_queue == 0)
+        max_queue = 1;
+    memset(&stats, 0, sizeof(stats));
+}
+
+WriteBehindFile::~WriteBehindFile()
+{
+    close();
+}
+
+int WriteBehindFile::open(const std::string& _path)
+{
+    if (fd >= 0)
+        close();
+
+    fd = ::open(_path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd < 0) {
+        ff_error("Failed to open %s: %s\n", _path.c_str(), strerror(errno));
+        return -1;
+    }
+
+    path = _path;
+    offset = 0;
+    prealloc_end = 0;
+    current_offset = 0;
+    current_fill = 0;
+    error = false;
+    quit = false;
+    memset(&stats, 0, sizeof(stats));
+    open_time = steadyClockUs();
+    newBlock();
+    if (current == nullptr) {
+        ::close(fd);
+        fd = -1;
+        return -1;
+    }
+
+    worker = new std::thread(&WriteBehindFile::ioProcess, this);
+    return 0;
+}
+
+void WriteBehindFile::newBlock()
+{
+    current = std::make_shared<Block>(block_size);
+    if (current->data == nullptr) {
+        ff_error("Failed to allocate write block\n");
+        current = nullptr;
+    }
+    current_offset = offset;
+    current_fill = 0;
+}
+
+void WriteBehindFile::enqueue(const Job& job)
+{
+    std::unique_lock<std::mutex> lk(mtx);
+    if (jobs.size() >= max_queue) {
+        // Back pressure only when the disk is far behind, memory is bounded by max_queue.
+        stats.stalls++;
+        space_cond.wait(lk, [this] { return jobs.size() < max_queue || quit; });
+    }
+    jobs.push_back(job);
+    stats.queue_depth = jobs.size();
+    if (stats.queue_depth > stats.max_queue_depth)
+        stats.max_queue_depth = stats.queue_depth;
+    cond.notify_one();
+}
+
+int WriteBehindFile::write(const void* data, size_t size)
+{
+    const uint8_t* p = (const uint8_t*)data;
+
+    if (fd < 0 || current == nullptr || error)
+        return -1;
+
+    while (size > 0) {
+        size_t n = std::min(size, block_size - current_fill);
+        memcpy(current->data + current_fill, p, n);
+        current_fill += n;
+        offset += n;
+        p += n;
+        size -= n;
+
+        if (current_fill == block_size) {
+            enqueue({current, current_offset, block_size, false});
+            newBlock();
+            if (current == nullptr)
+                return -1;
+        }
+    }
+    return 0;
+}
+
+/// @brief Queue what has been written so far
+/// @param sync also fdatasync once it is written
+void WriteBehindFile::flush(bool sync)
+{
+    if (fd < 0 || current == nullptr)
+        return;
+    // The I/O thread only reads the bytes before current_fill, later writes append behind them.
+    if (current_fill > 0 || sync)
+        enqueue({current, current_offset, current_fill, sync});
+}
+
+int WriteBehindFile::close()
+{
+    if (fd < 0)
+        return 0;
+
+    if (current && current_fill > 0)
+        enqueue({current, current_offset, current_fill, false});
+    current = nullptr;
+
+    {
+        std::lock_guard<std::mutex> lk(mtx);
+        quit = true;
+        cond.notify_one();
+    }
+    if (worker) {
+        worker->join();
+        delete worker;
+        worker = nullptr;
+    }
+
+    // Give back the preallocated tail.
+    if (prealloc_end > offset && ftruncate(fd, offset) < 0)
+        ff_warn("Failed to truncate %s: %s\n", path.c_str(), strerror(errno));
+    ::close(fd);
+    fd = -1;
+    close_time = steadyClockUs();
+    return error ? -1 : 0;
+}
+
+void WriteBehindFile::preallocate(uint64_t end)
+{
+    if (prealloc_step == 0 || end <= prealloc_end)
+        return;
+
+    uint64_t target = prealloc_end;
+    while (target < end)
+        target += prealloc_step;
+    // KEEP_SIZE leaves the file size at the written data, so a crash never shows zeros at the end.
+    if (fallocate(fd, FALLOC_FL_KEEP_SIZE, prealloc_end, target - prealloc_end) < 0) {
+        ff_warn("fallocate %s failed: %s, preallocation disabled\n", path.c_str(), strerror(errno));
+        prealloc_step = 0;
+        return;
+    }
+    prealloc_end = target;
+}
+
+void WriteBehindFile::ioProcess()
+{
+    std::unique_lock<std::mutex> lk(mtx);
+    while (true) {
+        if (jobs.empty()) {
+            if (quit)
+                break;
+            cond.wait(lk);
+            continue;
+        }
+
+        Job job = jobs.front();
+        jobs.pop_front();
+        stats.queue_depth = jobs.size();
+        space_cond.notify_one();
+        lk.unlock();
+
+        int64_t start = steadyClockUs();
+        preallocate(job.offset + job.length);
+
+        size_t done = 0;
+        while (done < job.length && !error) {
+            ssize_t ret = pwrite(fd, job.block->data + done, job.length - done, job.offset + done);
+            if (ret < 0) {
+                if (errno == EINTR)
+                    continue;
+                ff_error("Failed to write %s: %s\n", path.c_str(), strerror(errno));
+                error = true;
+                break;
+            }
+            done += ret;
+        }
+        if (job.sync && !error)
+            fdatasync(fd);
+        uint64_t latency = steadyClockUs() - start;
+
+        lk.lock();
+        // A partial block is written again once full, count the file growth only.
+        uint64_t end = job.offset + done;
+        if (end > stats.bytes)
+            stats.bytes = end;
+        stats.writes++;
+        stats.total_latency_us += latency;
+        if (latency > stats.max_latency_us)
+            stats.max_latency_us = latency;
+    }
+}
+
+WriteBehindFile::Stats WriteBehindFile::getStats()
+{
+    std::lock_guard<std::mutex> lk(mtx);
+    Stats s = stats;
+    int64_t elapsed = (fd >= 0 ? steadyClockUs() : close_time) - open_time;
+    s.bytes_per_second = elapsed > 0 ? s.bytes * 1000000.0 / elapsed : 0;
+    return s;
+}
+
+void WriteBehindFile::dumpStats(const char* name)
+{
+    Stats s = getStats();
+    ff_info("%s: %" PRIu64 " bytes, %.2f MB/s, %" PRIu64 " writes, latency avg %" PRIu64 " us max %" PRIu64
+            " us, queue max %u, stalls %u\n",
+            name, s.bytes, s.bytes_per_second / 1000000.0, s.writes, s.writes ? s.total_latency_us / s.writes : 0,
+            s.max_latency_us, s.max_queue_depth, s.stalls);
+}
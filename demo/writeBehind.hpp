@@ -0,0 +1,91 @@
+#pragma once
+#include <stdint.h>
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+
+/*
+ * Append-only file written from its own I/O thread.
+ *
+ * write() only copies into the current block, full blocks go to the I/O
+ * thread as single aligned pwrite calls, so a slow disk never stalls the
+ * caller unless the queue exceeds its limit. flush() queues the partial
+ * block (and an optional fdatasync) without waiting for it. The file is
+ * preallocated with fallocate in large steps to keep it contiguous, the
+ * unused tail is released at close.
+ */
+class WriteBehindFile
+{
+public:
+    struct Stats {
+        uint64_t bytes;             // written to the file
+        uint64_t writes;
+        uint64_t max_latency_us;    // of one pwrite/fdatasync
+        uint64_t total_latency_us;
+        uint32_t queue_depth;       // blocks waiting now
+        uint32_t max_queue_depth;
+        uint32_t stalls;            // write() calls that waited for the queue
+        double bytes_per_second;
+    };
+
+public:
+    WriteBehindFile(size_t block_size = 1 << 20, size_t max_queue_bytes = 64 << 20);
+    ~WriteBehindFile();
+
+    // Grow the file by this much at a time, 0 disables preallocation.
+    void setPreallocateSize(uint64_t bytes) { prealloc_step = bytes; }
+
+    int open(const std::string& path);
+    int write(const void* data, size_t size);
+    void flush(bool sync);
+    int close();
+
+    bool isOpen() const { return fd >= 0; }
+    uint64_t size() const { return offset; }
+    bool failed() const { return error; }
+    Stats getStats();
+    void dumpStats(const char* name);
+
+private:
+    struct Block;
+    struct Job {
+        std::shared_ptr<Block> block;
+        uint64_t offset;
+        size_t length;
+        bool sync;
+    };
+
+    void enqueue(const Job& job);
+    void newBlock();
+    void ioProcess();
+    void preallocate(uint64_t end);
+
+private:
+    size_t block_size;
+    size_t max_queue;
+    uint64_t prealloc_step;
+    uint64_t prealloc_end;
+
+    int fd;
+    std::string path;
+    uint64_t offset;            // bytes accepted by write()
+    std::shared_ptr<Block> current;
+    uint64_t current_offset;    // file offset of the current block
+    size_t current_fill;
+
+    std::mutex mtx;
+    std::condition_variable cond;
+    std::condition_variable space_cond;
+    std::deque<Job> jobs;
+    bool quit;
+    std::thread* worker;
+    std::atomic_bool error;
+
+    Stats stats;
+    int64_t open_time;
+    int64_t close_time;
+};